@@ -0,0 +1,184 @@
+#include "engine.h"
+#include "ArenaFuncs.h"
+#include <imgui.h>
+#include <mutex>
+
+#ifdef _WIN32
+#define VC_EXTRALEAN
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <Windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
+namespace Arena
+{
+    static std::mutex   ArenaListMutex;
+    static MemoryArena* FirstArena = NULL;
+
+    static u8* ReserveAddressSpace(u64 size)
+    {
+#ifdef _WIN32
+        return (u8*)VirtualAlloc(NULL, size, MEM_RESERVE, PAGE_NOACCESS);
+#else
+        void* memory = mmap(NULL, size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        return memory == MAP_FAILED ? NULL : (u8*)memory;
+#endif
+    }
+
+    static bool CommitPages(u8* address, u64 size)
+    {
+#ifdef _WIN32
+        return VirtualAlloc(address, size, MEM_COMMIT, PAGE_READWRITE) != NULL;
+#else
+        return mprotect(address, size, PROT_READ | PROT_WRITE) == 0;
+#endif
+    }
+
+    static void ReleaseAddressSpace(u8* address, u64 size)
+    {
+#ifdef _WIN32
+        VirtualFree(address, 0, MEM_RELEASE);
+#else
+        munmap(address, size);
+#endif
+    }
+
+    // Commits up to end, rounded to the granularity, without going past the reserved range
+    static bool Grow(MemoryArena& arena, u64 end)
+    {
+        if (end > arena.reserved)
+            return false;
+
+        const u64 committed = arena.committed;
+        u64 newCommitted = (end + ARENA_COMMIT_GRANULARITY - 1) & ~(u64)(ARENA_COMMIT_GRANULARITY - 1);
+        newCommitted = newCommitted < arena.reserved ? newCommitted : arena.reserved;
+
+        if (!CommitPages(arena.base + committed, newCommitted - committed))
+            return false;
+
+        arena.committed = newCommitted;
+        return true;
+    }
+
+    bool Create(MemoryArena& arena, const char* name, u64 reserveSize)
+    {
+        arena.name = name;
+        arena.reserved = (reserveSize + ARENA_COMMIT_GRANULARITY - 1) & ~(u64)(ARENA_COMMIT_GRANULARITY - 1);
+        arena.head = 0;
+        arena.committed = 0;
+        arena.highWater = 0;
+
+        arena.base = ReserveAddressSpace(arena.reserved);
+        if (!arena.base)
+        {
+            ELOG("Could not reserve %llu MB for the %s arena", (unsigned long long)(arena.reserved / MB(1)), name);
+            arena.reserved = 0;
+            return false;
+        }
+
+        std::lock_guard<std::mutex> lock(ArenaListMutex);
+        arena.next = FirstArena;
+        FirstArena = &arena;
+        return true;
+    }
+
+    void Release(MemoryArena& arena)
+    {
+        if (!arena.base)
+            return;
+
+        {
+            std::lock_guard<std::mutex> lock(ArenaListMutex);
+            MemoryArena** link = &FirstArena;
+            while (*link && *link != &arena)
+                link = &(*link)->next;
+            if (*link)
+                *link = arena.next;
+        }
+
+        ReleaseAddressSpace(arena.base, arena.reserved);
+        arena.base = NULL;
+        arena.reserved = 0;
+        arena.head = 0;
+        arena.committed = 0;
+    }
+
+    void* Push(MemoryArena& arena, u64 size, u64 alignment)
+    {
+        ASSERT(alignment && !(alignment & (alignment - 1)), "The alignment must be a power of 2");
+
+        // The base is page aligned, so aligning the offset aligns the address
+        const u64 start = (arena.head + alignment - 1) & ~(alignment - 1);
+        const u64 end = start + size;
+
+        if (end > arena.committed && !Grow(arena, end))
+        {
+            ELOG("The %s arena is out of memory: %llu bytes requested, %llu of %llu MB used", arena.name,
+                (unsigned long long)size, (unsigned long long)(arena.head / MB(1)), (unsigned long long)(arena.reserved / MB(1)));
+            return NULL;
+        }
+
+        arena.head = end;
+        if (end > arena.highWater.load(std::memory_order_relaxed))
+            arena.highWater.store(end, std::memory_order_relaxed);
+
+        return arena.base + start;
+    }
+
+    bool HasRoom(const MemoryArena& arena, u64 size, u64 alignment)
+    {
+        const u64 start = (arena.head + alignment - 1) & ~(alignment - 1);
+        return start <= arena.reserved && size <= arena.reserved - start;
+    }
+
+    void* PushCopy(MemoryArena& arena, const void* data, u64 size, u64 alignment)
+    {
+        void* memory = Push(arena, size, alignment);
+        if (memory)
+            memcpy(memory, data, size);
+        return memory;
+    }
+
+    void Reset(MemoryArena& arena)
+    {
+        arena.head = 0;
+    }
+
+    // Owns the scratch arena of a thread, so it is released with the thread
+    struct ThreadScratch
+    {
+        MemoryArena arena = {};
+        char        name[32];
+
+        ThreadScratch()
+        {
+            static std::atomic<u32> threadCount(0);
+            snprintf(name, sizeof(name), "Scratch %u", threadCount++);
+            Create(arena, name, ARENA_SCRATCH_RESERVE);
+        }
+
+        ~ThreadScratch()
+        {
+            Release(arena);
+        }
+    };
+
+    MemoryArena& GetScratch()
+    {
+        static thread_local ThreadScratch scratch;
+        return scratch.arena;
+    }
+
+    void DrawGui()
+    {
+        std::lock_guard<std::mutex> lock(ArenaListMutex);
+
+        for (MemoryArena* arena = FirstArena; arena; arena = arena->next)
+        {
+            ImGui::Text("%-12s committed %8.2f MB  high water %8.2f MB  reserved %6llu MB", arena->name,
+                arena->committed / (f64)MB(1), arena->highWater / (f64)MB(1), (unsigned long long)(arena->reserved / MB(1)));
+        }
+    }
+}
@@ -0,0 +1,91 @@
+#ifndef ARENA_FUNC
+#define ARENA_FUNC
+
+#include "Globals.h"
+#include <atomic>
+#include <vector>
+
+#define ARENA_DEFAULT_ALIGNMENT 16
+#define ARENA_COMMIT_GRANULARITY KB(64) // Pages are committed in chunks of this size as the head grows
+#define ARENA_SCRATCH_RESERVE MB(256)   // Address space of each per-thread scratch arena
+
+// Linear allocator over a range of reserved address space. Memory is committed on demand and kept
+// committed after a reset, so a steady frame never calls into the OS. Not thread safe: an arena
+// belongs to one thread at a time, worker threads use their own scratch arena.
+struct MemoryArena
+{
+    const char* name;
+    u8*         base;
+    u64         reserved;
+    u64         head;
+
+    // Read by the Gui from the main thread while the owner allocates
+    std::atomic<u64> committed;
+    std::atomic<u64> highWater;
+
+    MemoryArena* next; // In the list of live arenas
+};
+
+// Restores the head of the arena when it goes out of scope, releasing every push made in between
+struct ArenaScope
+{
+    MemoryArena& arena;
+    u64          head;
+
+    ArenaScope(MemoryArena& arena) : arena(arena), head(arena.head) {}
+    ~ArenaScope() { arena.head = head; }
+};
+
+namespace Arena
+{
+    // Reserves reserveSize bytes of address space without committing any of it
+    bool Create(MemoryArena& arena, const char* name, u64 reserveSize);
+
+    void Release(MemoryArena& arena);
+
+    // Returns NULL, and logs, when the reserved range is exhausted
+    void* Push(MemoryArena& arena, u64 size, u64 alignment = ARENA_DEFAULT_ALIGNMENT);
+
+    void* PushCopy(MemoryArena& arena, const void* data, u64 size, u64 alignment = 1);
+
+    // Whether a push of size bytes fits in the reserved range, for callers that fall back to the heap
+    bool HasRoom(const MemoryArena& arena, u64 size, u64 alignment = ARENA_DEFAULT_ALIGNMENT);
+
+    template <typename T>
+    T* PushArray(MemoryArena& arena, u64 count)
+    {
+        return (T*)Push(arena, count * sizeof(T), alignof(T) > ARENA_DEFAULT_ALIGNMENT ? alignof(T) : ARENA_DEFAULT_ALIGNMENT);
+    }
+
+    template <typename T>
+    T* PushStruct(MemoryArena& arena)
+    {
+        return PushArray<T>(arena, 1);
+    }
+
+    // Pushes the array when it fits in the arena, else returns heapFallback sized for it, so a
+    // large request is not bound by the reserved range
+    template <typename T>
+    T* PushArrayOrHeap(MemoryArena& arena, u64 count, std::vector<T>& heapFallback)
+    {
+        const u64 alignment = alignof(T) > ARENA_DEFAULT_ALIGNMENT ? alignof(T) : ARENA_DEFAULT_ALIGNMENT;
+        if (HasRoom(arena, count * sizeof(T), alignment))
+            if (T* array = PushArray<T>(arena, count))
+                return array;
+
+        heapFallback.resize(count);
+        return heapFallback.data();
+    }
+
+    // Frees everything at once, the committed pages stay for the next use
+    void Reset(MemoryArena& arena);
+
+    // Scratch arena of the calling thread, created on first use and released when the thread exits.
+    // Allocate from it inside an ArenaScope so it returns to empty.
+    MemoryArena& GetScratch();
+
+    // Committed size and high water mark of every live arena
+    void DrawGui();
+}
+
+#endif // !ARENA_FUNC
@@ -0,0 +1,226 @@
+#include "engine.h"
+#include "BloomFuncs.h"
+#include <imgui.h>
+
+#define BLOOM_COMPUTE_TILE 128 // Keep in sync with TILE_SIZE in BLUR.glsl
+
+namespace Bloom
+{
+    // Pairs of neighbouring discrete taps are merged into one bilinear fetch placed between them,
+    // weighted so the hardware filter reproduces both, which halves the fragment blur fetches
+    static void UpdateKernel(BloomState& bloom)
+    {
+        f32 sum = 0.0f;
+        for (u32 i = 0; i <= BLOOM_KERNEL_RADIUS; ++i)
+        {
+            bloom.kernel[i] = expf(-(f32)(i * i) / (2.0f * bloom.sigma * bloom.sigma));
+            sum += i == 0 ? bloom.kernel[i] : 2.0f * bloom.kernel[i];
+        }
+
+        for (u32 i = 0; i <= BLOOM_KERNEL_RADIUS; ++i)
+            bloom.kernel[i] /= sum;
+
+        bloom.linearOffsets[0] = 0.0f;
+        bloom.linearWeights[0] = bloom.kernel[0];
+        for (u32 i = 1; i < BLOOM_LINEAR_TAPS; ++i)
+        {
+            const u32 first = 2 * i - 1;
+            const u32 second = 2 * i;
+            const f32 weight = bloom.kernel[first] + bloom.kernel[second];
+            bloom.linearWeights[i] = weight;
+            bloom.linearOffsets[i] = (first * bloom.kernel[first] + second * bloom.kernel[second]) / weight;
+        }
+
+        bloom.kernelSigma = bloom.sigma;
+    }
+
+    static void DrawScreenQuad(App* app)
+    {
+        GLState::BindVertexArray(app, app->vao);
+        glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_SHORT, 0);
+        GLState::BindVertexArray(app, 0);
+    }
+
+    static void ExecuteBrightPass(App* app, FrameGraphState& graph, const FrameGraphPass& pass)
+    {
+        const Program& blitBrightestProgram = app->programs[app->blitBrightestPixelsShader];
+        GLState::UseProgram(app, blitBrightestProgram.handle);
+        glUniform1f(app->bloom.brightThresholdLocation, app->bloom.threshold);
+
+        GLState::BindTexture(app, 0, GL_TEXTURE_2D, FrameGraph::GetTexture(graph, pass.reads[0]));
+
+        DrawScreenQuad(app);
+        GLState::UseProgram(app, 0);
+
+        // Box-filtered downsample of the bright pixels into the rest of the chain
+        GLState::ActiveTexture(app, 0);
+        GLState::BindTexture(app, 0, GL_TEXTURE_2D, FrameGraph::GetTexture(graph, pass.colorWrites[0]));
+        glGenerateMipmap(GL_TEXTURE_2D);
+        GLState::BindTexture(app, 0, GL_TEXTURE_2D, 0);
+    }
+
+    static void BlurFragment(App* app, FrameGraphState& graph, GLuint bright, GLuint blurH, ivec2 size)
+    {
+        BloomState& bloom = app->bloom;
+
+        const Program& blurProgram = app->programs[app->blurShader];
+        GLState::UseProgram(app, blurProgram.handle);
+        glUniform1fv(bloom.blurOffsetsLocation, BLOOM_LINEAR_TAPS, bloom.linearOffsets);
+        glUniform1fv(bloom.blurWeightsLocation, BLOOM_LINEAR_TAPS, bloom.linearWeights);
+
+        for (u32 lod = 0; lod < BLOOM_MIP_LEVELS; ++lod)
+        {
+            const ivec2 lodSize = glm::max(ivec2(size.x >> lod, size.y >> lod), ivec2(1, 1));
+            glUniform1i(bloom.blurInputLodLocation, lod);
+
+            // Horizontal, bright -> blurH
+            FrameGraph::BindFrameBuffer(app, graph, RenderTargetPool::GetFrameBuffer(app, &blurH, 1, 0, lod), lodSize);
+            glUniform2f(bloom.blurDirectionLocation, 1.0f, 0.0f);
+            GLState::BindTexture(app, 0, GL_TEXTURE_2D, bright);
+            DrawScreenQuad(app);
+
+            // Vertical, blurH -> bright
+            FrameGraph::BindFrameBuffer(app, graph, RenderTargetPool::GetFrameBuffer(app, &bright, 1, 0, lod), lodSize);
+            glUniform2f(bloom.blurDirectionLocation, 0.0f, 1.0f);
+            GLState::BindTexture(app, 0, GL_TEXTURE_2D, blurH);
+            DrawScreenQuad(app);
+        }
+
+        GLState::BindTexture(app, 0, GL_TEXTURE_2D, 0);
+        GLState::UseProgram(app, 0);
+    }
+
+    static void BlurCompute(App* app, GLuint bright, GLuint blurH, ivec2 size)
+    {
+        BloomState& bloom = app->bloom;
+
+        const Program& blurProgram = app->programs[app->blurComputeShader];
+        GLState::UseProgram(app, blurProgram.handle);
+        glUniform1fv(bloom.blurComputeKernelLocation, BLOOM_KERNEL_RADIUS + 1, bloom.kernel);
+
+        for (u32 lod = 0; lod < BLOOM_MIP_LEVELS; ++lod)
+        {
+            const ivec2 lodSize = glm::max(ivec2(size.x >> lod, size.y >> lod), ivec2(1, 1));
+            glUniform1i(bloom.blurComputeInputLodLocation, lod);
+
+            // One work group per tile of a row, then of a column
+            glUniform2i(bloom.blurComputeDirectionLocation, 1, 0);
+            GLState::BindTexture(app, 0, GL_TEXTURE_2D, bright);
+            glBindImageTexture(0, blurH, lod, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA16F);
+            glDispatchCompute((lodSize.x + BLOOM_COMPUTE_TILE - 1) / BLOOM_COMPUTE_TILE, lodSize.y, 1);
+            glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+
+            glUniform2i(bloom.blurComputeDirectionLocation, 0, 1);
+            GLState::BindTexture(app, 0, GL_TEXTURE_2D, blurH);
+            glBindImageTexture(0, bright, lod, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA16F);
+            glDispatchCompute((lodSize.y + BLOOM_COMPUTE_TILE - 1) / BLOOM_COMPUTE_TILE, lodSize.x, 1);
+            glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+        }
+
+        glBindImageTexture(0, 0, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA16F);
+        GLState::BindTexture(app, 0, GL_TEXTURE_2D, 0);
+        GLState::UseProgram(app, 0);
+    }
+
+    static void ExecuteBlurPass(App* app, FrameGraphState& graph, const FrameGraphPass& pass)
+    {
+        if (app->bloom.kernelSigma != app->bloom.sigma)
+            UpdateKernel(app->bloom);
+
+        const FrameGraphResource brightResource = pass.reads[0];
+        const GLuint bright = FrameGraph::GetTexture(graph, brightResource);
+        const GLuint blurH = FrameGraph::GetTexture(graph, pass.reads[1]);
+        const ivec2 size = graph.resources[brightResource].desc.size;
+
+        if (app->bloom.useCompute)
+            BlurCompute(app, bright, blurH, size);
+        else
+            BlurFragment(app, graph, bright, blurH, size);
+    }
+
+    static void ExecuteCompositePass(App* app, FrameGraphState& graph, const FrameGraphPass& pass)
+    {
+        const Program& bloomProgram = app->programs[app->bloomShader];
+        GLState::UseProgram(app, bloomProgram.handle);
+        glUniform1i(app->bloom.compositeMaxLodLocation, BLOOM_MIP_LEVELS);
+        glUniform1f(app->bloom.compositeIntensityLocation, app->bloom.intensity);
+
+        GLState::BindTexture(app, 0, GL_TEXTURE_2D, FrameGraph::GetTexture(graph, pass.reads[0]));
+        GLState::BindTexture(app, 1, GL_TEXTURE_2D, FrameGraph::GetTexture(graph, pass.reads[1]));
+
+        DrawScreenQuad(app);
+        GLState::UseProgram(app, 0);
+    }
+
+    void Init(App* app)
+    {
+        BloomState& bloom = app->bloom;
+        bloom.threshold = 1.0f;
+        bloom.intensity = 1.0f;
+        bloom.sigma = 4.0f;
+        UpdateKernel(bloom);
+    }
+
+    void ConfigurePrograms(App* app)
+    {
+        BloomState& bloom = app->bloom;
+
+        const Program& blitBrightestProgram = app->programs[app->blitBrightestPixelsShader];
+        SetProgramSampler(blitBrightestProgram, "uTexture", 0);
+        bloom.brightThresholdLocation = GetUniformLocation(blitBrightestProgram, "threshold");
+
+        const Program& blurProgram = app->programs[app->blurShader];
+        SetProgramSampler(blurProgram, "colorMap", 0);
+        bloom.blurDirectionLocation = GetUniformLocation(blurProgram, "direction");
+        bloom.blurInputLodLocation = GetUniformLocation(blurProgram, "inputLod");
+        bloom.blurOffsetsLocation = GetUniformLocation(blurProgram, "uOffsets[0]");
+        bloom.blurWeightsLocation = GetUniformLocation(blurProgram, "uWeights[0]");
+
+        const Program& blurComputeProgram = app->programs[app->blurComputeShader];
+        SetProgramSampler(blurComputeProgram, "colorMap", 0);
+        bloom.blurComputeDirectionLocation = GetUniformLocation(blurComputeProgram, "uDirection");
+        bloom.blurComputeInputLodLocation = GetUniformLocation(blurComputeProgram, "inputLod");
+        bloom.blurComputeKernelLocation = GetUniformLocation(blurComputeProgram, "uKernel[0]");
+
+        const Program& bloomProgram = app->programs[app->bloomShader];
+        SetProgramSampler(bloomProgram, "uScene", 0);
+        SetProgramSampler(bloomProgram, "colorMap", 1);
+        bloom.compositeMaxLodLocation = GetUniformLocation(bloomProgram, "maxLod");
+        bloom.compositeIntensityLocation = GetUniformLocation(bloomProgram, "uIntensity");
+    }
+
+    void AddPasses(App* app, FrameGraphState& graph, FrameGraphResource sceneColor, FrameGraphResource output)
+    {
+        // Half resolution mip chains, one level per blur step
+        const RenderTargetDesc desc = RenderTargetPool::DisplayTarget(app, GL_RGBA16F, 2, BLOOM_MIP_LEVELS);
+        const FrameGraphResource bright = FrameGraph::CreateTarget(graph, "Bloom bright", desc);
+        const FrameGraphResource blurH = FrameGraph::CreateTarget(graph, "Bloom horizontal", desc);
+
+        const u32 brightPass = FrameGraph::AddPass(graph, "Bloom bright pass", ExecuteBrightPass);
+        FrameGraph::Read(graph, brightPass, sceneColor);
+        FrameGraph::WriteColor(graph, brightPass, bright);
+
+        // Ping-pongs between both chains one level at a time, so it binds its own framebuffers
+        const u32 blurPass = FrameGraph::AddPass(graph, "Bloom blur", ExecuteBlurPass);
+        FrameGraph::Read(graph, blurPass, bright);
+        FrameGraph::Read(graph, blurPass, blurH);
+        FrameGraph::WriteColor(graph, blurPass, bright);
+        FrameGraph::WriteColor(graph, blurPass, blurH);
+        FrameGraph::SetManualTargets(graph, blurPass);
+
+        const u32 compositePass = FrameGraph::AddPass(graph, "Bloom composite", ExecuteCompositePass);
+        FrameGraph::Read(graph, compositePass, sceneColor);
+        FrameGraph::Read(graph, compositePass, bright);
+        FrameGraph::WriteColor(graph, compositePass, output);
+        FrameGraph::SetClear(graph, compositePass, GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT, vec4(0.0f, 0.0f, 0.0f, 1.0f));
+    }
+
+    void DrawGui(App* app)
+    {
+        BloomState& bloom = app->bloom;
+        ImGui::Checkbox("Compute blur", &bloom.useCompute);
+        ImGui::SliderFloat("Threshold", &bloom.threshold, 0.0f, 4.0f);
+        ImGui::SliderFloat("Intensity", &bloom.intensity, 0.0f, 4.0f);
+        ImGui::SliderFloat("Blur sigma", &bloom.sigma, 1.0f, 6.0f);
+    }
+}
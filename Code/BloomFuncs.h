@@ -0,0 +1,52 @@
+#ifndef BLOOM_FUNC
+#define BLOOM_FUNC
+
+#include "Globals.h"
+#include "FrameGraphFuncs.h"
+
+struct App;
+
+#define BLOOM_MIP_LEVELS 5        // Half resolution down to 1/32
+#define BLOOM_KERNEL_RADIUS 12    // Discrete Gaussian taps on each side of the center, keep in sync with BLUR.glsl
+#define BLOOM_LINEAR_TAPS (BLOOM_KERNEL_RADIUS / 2 + 1) // Center plus one bilinear fetch per pair of discrete taps
+
+struct BloomState
+{
+    bool useCompute; // Separable blur in compute with shared-memory tiles instead of fragment passes
+    f32  threshold;
+    f32  intensity;
+    f32  sigma;
+
+    // Gaussian weights, recomputed when sigma changes
+    f32 kernelSigma;
+    f32 kernel[BLOOM_KERNEL_RADIUS + 1];      // Discrete, for the compute blur
+    f32 linearOffsets[BLOOM_LINEAR_TAPS];     // In texels, for the fragment blur
+    f32 linearWeights[BLOOM_LINEAR_TAPS];
+
+    // Cached uniform locations
+    GLint brightThresholdLocation;
+    GLint blurDirectionLocation;
+    GLint blurInputLodLocation;
+    GLint blurOffsetsLocation;
+    GLint blurWeightsLocation;
+    GLint blurComputeDirectionLocation;
+    GLint blurComputeInputLodLocation;
+    GLint blurComputeKernelLocation;
+    GLint compositeMaxLodLocation;
+    GLint compositeIntensityLocation;
+};
+
+namespace Bloom
+{
+    void Init(App* app);
+
+    // Sampler units and uniform locations, call after the bloom programs are loaded or reloaded
+    void ConfigurePrograms(App* app);
+
+    // Bright pass into a half resolution mip chain, blur of every level and additive composite of sceneColor into output
+    void AddPasses(App* app, FrameGraphState& graph, FrameGraphResource sceneColor, FrameGraphResource output);
+
+    void DrawGui(App* app);
+}
+
+#endif // !BLOOM_FUNC
@@ -57,4 +57,137 @@ namespace BufferManager
         memcpy((u8*)buffer.data + buffer.head, data, size);
         buffer.head += size;
     }
+
+    typedef void (APIENTRYP BufferStorageProc)(GLenum target, GLsizeiptr size, const void* data, GLbitfield flags);
+    static BufferStorageProc BufferStorage = NULL;
+
+    bool LoadBufferStorage()
+    {
+        if (glfwExtensionSupported("GL_ARB_buffer_storage"))
+            BufferStorage = (BufferStorageProc)glfwGetProcAddress("glBufferStorage");
+
+        return BufferStorage != NULL;
+    }
+
+    static Buffer CreateRingPage(const RingBuffer& ring, u32 frameSize)
+    {
+        Buffer page = {};
+        page.size = frameSize * RING_BUFFER_FRAME_COUNT;
+        page.type = ring.type;
+
+        glGenBuffers(1, &page.handle);
+        glBindBuffer(page.type, page.handle);
+        if (ring.isPersistent)
+        {
+            const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+            BufferStorage(page.type, page.size, NULL, flags);
+            page.data = (u8*)glMapBufferRange(page.type, 0, page.size, flags);
+        }
+        else
+        {
+            glBufferData(page.type, page.size, NULL, GL_STREAM_DRAW);
+        }
+        glBindBuffer(page.type, 0);
+
+        return page;
+    }
+
+    static void OpenRingRegion(const RingBuffer& ring, Buffer& page)
+    {
+        page.head = ring.frameIndex * (page.size / RING_BUFFER_FRAME_COUNT);
+
+        if (!ring.isPersistent)
+        {
+            // The fences already guarantee the GPU is done with this region, so skip the implicit sync
+            glBindBuffer(page.type, page.handle);
+            page.data = (u8*)glMapBufferRange(page.type, 0, page.size, GL_MAP_WRITE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+            glBindBuffer(page.type, 0);
+        }
+    }
+
+    RingBuffer CreateRingBuffer(u32 frameSize, GLenum type)
+    {
+        RingBuffer ring = {};
+        ring.type = type;
+        ring.frameSize = frameSize;
+        ring.isPersistent = BufferStorage != NULL;
+        ring.pages.push_back(CreateRingPage(ring, frameSize));
+
+        return ring;
+    }
+
+    void BeginRingFrame(RingBuffer& ring)
+    {
+        ASSERT(!ring.isFrameOpen, "The previous ring frame was not fenced");
+
+        ring.frameIndex = (ring.frameIndex + 1) % RING_BUFFER_FRAME_COUNT;
+
+        GLsync& fence = ring.fences[ring.frameIndex];
+        if (fence)
+        {
+            while (glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000) == GL_TIMEOUT_EXPIRED);
+            glDeleteSync(fence);
+            fence = 0;
+        }
+
+        ring.pageIndex = 0;
+        OpenRingRegion(ring, ring.pages[0]);
+        ring.isFrameOpen = true;
+    }
+
+    Buffer& ReserveRingBlock(RingBuffer& ring, u32 size, u32 alignment)
+    {
+        ASSERT(ring.isFrameOpen, "BeginRingFrame must be called first");
+
+        Buffer& page = ring.pages[ring.pageIndex];
+        const u32 regionEnd = (ring.frameIndex + 1) * (page.size / RING_BUFFER_FRAME_COUNT);
+        if (Align(page.head, alignment) + size <= regionEnd)
+            return page;
+
+        // Chain the next page big enough for the block, appending one when there is none. Smaller pages in
+        // between are left unused this frame, so no page is moved under a reference returned earlier.
+        const u32 requiredFrameSize = size + alignment;
+        do
+        {
+            ring.pageIndex++;
+        } while (ring.pageIndex < ring.pages.size() && (u32)ring.pages[ring.pageIndex].size / RING_BUFFER_FRAME_COUNT < requiredFrameSize);
+
+        if (ring.pageIndex == ring.pages.size())
+        {
+            const u32 frameSize = ring.frameSize > requiredFrameSize ? ring.frameSize : requiredFrameSize;
+            ring.pages.push_back(CreateRingPage(ring, frameSize));
+        }
+
+        Buffer& nextPage = ring.pages[ring.pageIndex];
+        OpenRingRegion(ring, nextPage);
+        return nextPage;
+    }
+
+    void EndRingWrites(RingBuffer& ring)
+    {
+        if (ring.isPersistent)
+            return;
+
+        for (u32 i = 0; i <= ring.pageIndex; ++i)
+        {
+            // Pages skipped for being too small were not mapped
+            Buffer& page = ring.pages[i];
+            if (!page.data)
+                continue;
+
+            glBindBuffer(page.type, page.handle);
+            glUnmapBuffer(page.type);
+            glBindBuffer(page.type, 0);
+            page.data = NULL;
+        }
+    }
+
+    void FenceRingFrame(RingBuffer& ring)
+    {
+        if (!ring.isFrameOpen)
+            return;
+
+        ring.fences[ring.frameIndex] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        ring.isFrameOpen = false;
+    }
 }
@@ -11,13 +11,23 @@ namespace BufferManager
 
     #define PushData(buffer, data, size) BufferManager::PushAlignedData(buffer, data, size, 1)
     #define PushUInt(buffer, value) { u32 v = value; BufferManager::PushAlignedData(buffer, &v, sizeof(v), 4); } 
+    #define PushFloat(buffer, value) { f32 v = value; BufferManager::PushAlignedData(buffer, &v, sizeof(v), 4); }
     #define PushVec3(buffer, value) BufferManager::PushAlignedData(buffer, value_ptr(value), sizeof(value), sizeof(vec4))
     #define PushVec4(buffer, value) BufferManager::PushAlignedData(buffer, value_ptr(value), sizeof(value), sizeof(vec4))
+    #define PushUVec4(buffer, value) BufferManager::PushAlignedData(buffer, value_ptr(value), sizeof(value), sizeof(vec4))
     #define PushMat3(buffer, value) BufferManager::PushAlignedData(buffer, value_ptr(value), sizeof(value), sizeof(vec4))
     #define PushMat4(buffer, value) BufferManager::PushAlignedData(buffer, value_ptr(value), sizeof(value), sizeof(vec4))
 
     #define BINDING(b) b
 
+    // ARB_buffer_storage (core in 4.4) is not part of the generated 4.3 loader
+    #ifndef GL_MAP_PERSISTENT_BIT
+    #define GL_MAP_PERSISTENT_BIT 0x0040
+    #endif
+    #ifndef GL_MAP_COHERENT_BIT
+    #define GL_MAP_COHERENT_BIT 0x0080
+    #endif
+
     bool IsPowerOf2(u32 value);
 
     u32 Align(u32 value, u32 alignment);
@@ -34,6 +44,24 @@ namespace BufferManager
 
     void PushAlignedData(Buffer& buffer, const void* data, u32 size, u32 alignment);
 
+    // Loads glBufferStorage if the driver exposes it. Without it ring buffers fall back to unsynchronized mapping.
+    bool LoadBufferStorage();
+
+    RingBuffer CreateRingBuffer(u32 frameSize, GLenum type);
+
+    // Moves to the next frame region, waiting for the GPU only if it still reads it
+    void BeginRingFrame(RingBuffer& ring);
+
+    // Returns the page to push into, with room for size bytes after aligning the head. Chains the next page on overflow.
+    // The reference stays valid after later reservations, pages never move.
+    Buffer& ReserveRingBlock(RingBuffer& ring, u32 size, u32 alignment);
+
+    // Call once the frame data is written and before drawing with it
+    void EndRingWrites(RingBuffer& ring);
+
+    // Call after the last draw that reads the frame data
+    void FenceRingFrame(RingBuffer& ring);
+
 }
 
 #endif // !BUFFER_MANAGER_FUNC
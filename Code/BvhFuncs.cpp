@@ -0,0 +1,408 @@
+#include "BvhFuncs.h"
+#include <float.h>
+
+namespace Bvh
+{
+    struct BvhBin
+    {
+        vec3 aabbMin;
+        vec3 aabbMax;
+        u32  count;
+    };
+
+    static f32 SurfaceArea(const vec3& aabbMin, const vec3& aabbMax)
+    {
+        if (aabbMin.x > aabbMax.x)
+            return 0.0f;
+
+        const vec3 e = aabbMax - aabbMin;
+        return 2.0f * (e.x * e.y + e.y * e.z + e.z * e.x);
+    }
+
+    static bool IsLeaf(const BvhNode& node)
+    {
+        return node.leftChild == BVH_NO_CHILD;
+    }
+
+    static void ComputeNodeBounds(BvhTree& bvh, u32 nodeIdx)
+    {
+        BvhNode& node = bvh.nodes[nodeIdx];
+        if (!IsLeaf(node))
+        {
+            const BvhNode& left = bvh.nodes[node.leftChild];
+            const BvhNode& right = bvh.nodes[node.leftChild + 1];
+            node.aabbMin = glm::min(left.aabbMin, right.aabbMin);
+            node.aabbMax = glm::max(left.aabbMax, right.aabbMax);
+            return;
+        }
+
+        node.aabbMin = vec3(FLT_MAX);
+        node.aabbMax = vec3(-FLT_MAX);
+        for (u32 i = node.firstItem; i < node.firstItem + node.itemCount; ++i)
+        {
+            const u32 item = bvh.itemIndices[i];
+            node.aabbMin = glm::min(node.aabbMin, bvh.itemMin[item]);
+            node.aabbMax = glm::max(node.aabbMax, bvh.itemMax[item]);
+        }
+    }
+
+    static void MakeLeaf(BvhTree& bvh, u32 nodeIdx)
+    {
+        const BvhNode& node = bvh.nodes[nodeIdx];
+        for (u32 i = node.firstItem; i < node.firstItem + node.itemCount; ++i)
+            bvh.itemLeaf[bvh.itemIndices[i]] = nodeIdx;
+    }
+
+    static u32 BinIndex(f32 centroid, f32 centroidMin, f32 scale)
+    {
+        const u32 bin = (u32)((centroid - centroidMin) * scale);
+        return bin < BVH_BIN_COUNT - 1 ? bin : BVH_BIN_COUNT - 1;
+    }
+
+    // Returns the number of items moved to the left child, 0 if the node should stay a leaf
+    static u32 PartitionNode(BvhTree& bvh, const std::vector<vec3>& centroids, u32 nodeIdx)
+    {
+        const BvhNode& node = bvh.nodes[nodeIdx];
+        const u32 first = node.firstItem;
+        const u32 count = node.itemCount;
+        if (count <= 2)
+            return 0;
+
+        vec3 centroidMin = vec3(FLT_MAX);
+        vec3 centroidMax = vec3(-FLT_MAX);
+        for (u32 i = first; i < first + count; ++i)
+        {
+            centroidMin = glm::min(centroidMin, centroids[bvh.itemIndices[i]]);
+            centroidMax = glm::max(centroidMax, centroids[bvh.itemIndices[i]]);
+        }
+
+        // Evaluate the SAH at every bin boundary of every axis
+        f32 bestCost = FLT_MAX;
+        i32 bestAxis = -1;
+        u32 bestSplit = 0;
+
+        for (i32 axis = 0; axis < 3; ++axis)
+        {
+            const f32 extent = centroidMax[axis] - centroidMin[axis];
+            if (extent <= 0.0f)
+                continue;
+
+            BvhBin bins[BVH_BIN_COUNT];
+            for (BvhBin& bin : bins)
+                bin = { vec3(FLT_MAX), vec3(-FLT_MAX), 0 };
+
+            const f32 scale = BVH_BIN_COUNT / extent;
+            for (u32 i = first; i < first + count; ++i)
+            {
+                const u32 item = bvh.itemIndices[i];
+                BvhBin& bin = bins[BinIndex(centroids[item][axis], centroidMin[axis], scale)];
+                bin.aabbMin = glm::min(bin.aabbMin, bvh.itemMin[item]);
+                bin.aabbMax = glm::max(bin.aabbMax, bvh.itemMax[item]);
+                bin.count++;
+            }
+
+            f32 leftArea[BVH_BIN_COUNT - 1];
+            u32 leftCount[BVH_BIN_COUNT - 1];
+            vec3 sweepMin = vec3(FLT_MAX);
+            vec3 sweepMax = vec3(-FLT_MAX);
+            u32 sweepCount = 0;
+            for (u32 b = 0; b < BVH_BIN_COUNT - 1; ++b)
+            {
+                sweepMin = glm::min(sweepMin, bins[b].aabbMin);
+                sweepMax = glm::max(sweepMax, bins[b].aabbMax);
+                sweepCount += bins[b].count;
+                leftArea[b] = SurfaceArea(sweepMin, sweepMax);
+                leftCount[b] = sweepCount;
+            }
+
+            sweepMin = vec3(FLT_MAX);
+            sweepMax = vec3(-FLT_MAX);
+            sweepCount = 0;
+            for (u32 b = BVH_BIN_COUNT - 1; b > 0; --b)
+            {
+                sweepMin = glm::min(sweepMin, bins[b].aabbMin);
+                sweepMax = glm::max(sweepMax, bins[b].aabbMax);
+                sweepCount += bins[b].count;
+
+                const f32 cost = leftCount[b - 1] * leftArea[b - 1] + sweepCount * SurfaceArea(sweepMin, sweepMax);
+                if (leftCount[b - 1] > 0 && sweepCount > 0 && cost < bestCost)
+                {
+                    bestCost = cost;
+                    bestAxis = axis;
+                    bestSplit = b;
+                }
+            }
+        }
+
+        const f32 leafCost = count * SurfaceArea(node.aabbMin, node.aabbMax);
+        if (bestAxis < 0 || bestCost >= leafCost)
+        {
+            if (count <= BVH_MAX_LEAF_ITEMS)
+                return 0;
+
+            // Coincident centroids or no profitable split: halve the range so leaves stay small
+            return count / 2;
+        }
+
+        const f32 scale = BVH_BIN_COUNT / (centroidMax[bestAxis] - centroidMin[bestAxis]);
+        u32 i = first;
+        u32 j = first + count;
+        while (i < j)
+        {
+            if (BinIndex(centroids[bvh.itemIndices[i]][bestAxis], centroidMin[bestAxis], scale) < bestSplit)
+                ++i;
+            else
+                std::swap(bvh.itemIndices[i], bvh.itemIndices[--j]);
+        }
+
+        return i - first;
+    }
+
+    void Build(BvhTree& bvh, const vec3* itemMin, const vec3* itemMax, u32 itemCount)
+    {
+        bvh.itemMin.assign(itemMin, itemMin + itemCount);
+        bvh.itemMax.assign(itemMax, itemMax + itemCount);
+        bvh.itemIndices.resize(itemCount);
+        bvh.itemLeaf.assign(itemCount, 0);
+        for (u32 i = 0; i < itemCount; ++i)
+            bvh.itemIndices[i] = i;
+
+        std::vector<vec3> centroids(itemCount);
+        for (u32 i = 0; i < itemCount; ++i)
+            centroids[i] = (itemMin[i] + itemMax[i]) * 0.5f;
+
+        // A binary tree with n leaves has at most 2n - 1 nodes
+        bvh.nodes.clear();
+        bvh.nodes.reserve(itemCount > 0 ? itemCount * 2 - 1 : 1);
+
+        BvhNode root = {};
+        root.itemCount = itemCount;
+        root.parent = UINT32_MAX;
+        bvh.nodes.push_back(root);
+
+        std::vector<u32> stack;
+        stack.push_back(0);
+        while (!stack.empty())
+        {
+            const u32 nodeIdx = stack.back();
+            stack.pop_back();
+
+            ComputeNodeBounds(bvh, nodeIdx);
+
+            const u32 leftCount = PartitionNode(bvh, centroids, nodeIdx);
+            if (leftCount == 0)
+            {
+                MakeLeaf(bvh, nodeIdx);
+                continue;
+            }
+
+            const u32 leftChild = bvh.nodes.size();
+            BvhNode left = {};
+            left.firstItem = bvh.nodes[nodeIdx].firstItem;
+            left.itemCount = leftCount;
+            left.parent = nodeIdx;
+
+            BvhNode right = {};
+            right.firstItem = left.firstItem + leftCount;
+            right.itemCount = bvh.nodes[nodeIdx].itemCount - leftCount;
+            right.parent = nodeIdx;
+
+            bvh.nodes.push_back(left);
+            bvh.nodes.push_back(right);
+            bvh.nodes[nodeIdx].leftChild = leftChild;
+
+            stack.push_back(leftChild);
+            stack.push_back(leftChild + 1);
+        }
+
+        bvh.buildCost = ComputeCost(bvh);
+        bvh.refitCount = 0;
+    }
+
+    void RefitItem(BvhTree& bvh, u32 item, const vec3& itemMin, const vec3& itemMax)
+    {
+        bvh.itemMin[item] = itemMin;
+        bvh.itemMax[item] = itemMax;
+        bvh.refitCount++;
+
+        // Walk up until a node's bounds stop changing
+        for (u32 nodeIdx = bvh.itemLeaf[item]; nodeIdx != UINT32_MAX; nodeIdx = bvh.nodes[nodeIdx].parent)
+        {
+            const vec3 oldMin = bvh.nodes[nodeIdx].aabbMin;
+            const vec3 oldMax = bvh.nodes[nodeIdx].aabbMax;
+            ComputeNodeBounds(bvh, nodeIdx);
+            if (bvh.nodes[nodeIdx].aabbMin == oldMin && bvh.nodes[nodeIdx].aabbMax == oldMax)
+                break;
+        }
+    }
+
+    f32 ComputeCost(const BvhTree& bvh)
+    {
+        if (bvh.nodes.empty())
+            return 0.0f;
+
+        const f32 rootArea = SurfaceArea(bvh.nodes[0].aabbMin, bvh.nodes[0].aabbMax);
+        if (rootArea <= 0.0f)
+            return 0.0f;
+
+        f32 cost = 0.0f;
+        for (const BvhNode& node : bvh.nodes)
+        {
+            const f32 area = SurfaceArea(node.aabbMin, node.aabbMax);
+            cost += IsLeaf(node) ? area * node.itemCount : area;
+        }
+
+        return cost / rootArea;
+    }
+
+    bool NeedsRebuild(BvhTree& bvh)
+    {
+        if (bvh.refitCount < bvh.itemIndices.size() / 8 + 1)
+            return false;
+
+        bvh.refitCount = 0;
+        return ComputeCost(bvh) > bvh.buildCost * BVH_REBUILD_COST_RATIO;
+    }
+
+    struct FrustumQueryEntry
+    {
+        u32 nodeIdx;
+        u32 planeMask; // Planes the node straddles, the others fully contain it
+    };
+
+    // Returns false if the box is outside a plane of the mask, and clears the planes that fully contain it
+    static bool ClassifyAABB(const vec3& aabbMin, const vec3& aabbMax, const vec4* planes, u32 planeCount, u32& planeMask)
+    {
+        const vec3 center = (aabbMin + aabbMax) * 0.5f;
+        const vec3 extent = (aabbMax - aabbMin) * 0.5f;
+
+        for (u32 p = 0; p < planeCount; ++p)
+        {
+            if ((planeMask & (1u << p)) == 0)
+                continue;
+
+            const vec3 normal = vec3(planes[p]);
+            const f32 distance = glm::dot(normal, center) + planes[p].w;
+            const f32 radius = glm::dot(glm::abs(normal), extent);
+            if (distance + radius < 0.0f)
+                return false;
+            if (distance - radius >= 0.0f)
+                planeMask &= ~(1u << p);
+        }
+
+        return true;
+    }
+
+    void QueryFrustum(const BvhTree& bvh, const vec4* planes, u32 planeCount, std::vector<u32>& outItems)
+    {
+        if (bvh.nodes.empty() || bvh.nodes[0].itemCount == 0)
+            return;
+
+        std::vector<FrustumQueryEntry> stack;
+        stack.push_back({ 0, (1u << planeCount) - 1 });
+
+        while (!stack.empty())
+        {
+            FrustumQueryEntry entry = stack.back();
+            stack.pop_back();
+
+            const BvhNode& node = bvh.nodes[entry.nodeIdx];
+            if (!ClassifyAABB(node.aabbMin, node.aabbMax, planes, planeCount, entry.planeMask))
+                continue;
+
+            // Fully inside: the whole subtree is visible
+            if (entry.planeMask == 0)
+            {
+                outItems.insert(outItems.end(), bvh.itemIndices.begin() + node.firstItem, bvh.itemIndices.begin() + node.firstItem + node.itemCount);
+                continue;
+            }
+
+            if (IsLeaf(node))
+            {
+                for (u32 i = node.firstItem; i < node.firstItem + node.itemCount; ++i)
+                {
+                    const u32 item = bvh.itemIndices[i];
+                    u32 itemMask = entry.planeMask;
+                    if (ClassifyAABB(bvh.itemMin[item], bvh.itemMax[item], planes, planeCount, itemMask))
+                        outItems.push_back(item);
+                }
+                continue;
+            }
+
+            stack.push_back({ node.leftChild, entry.planeMask });
+            stack.push_back({ node.leftChild + 1, entry.planeMask });
+        }
+    }
+
+    // Entry distance of the ray in the box, FLT_MAX if it misses or enters past maxDistance
+    static f32 IntersectAABB(const vec3& aabbMin, const vec3& aabbMax, const vec3& origin, const vec3& invDirection, f32 maxDistance)
+    {
+        const vec3 t0 = (aabbMin - origin) * invDirection;
+        const vec3 t1 = (aabbMax - origin) * invDirection;
+        const vec3 tNear = glm::min(t0, t1);
+        const vec3 tFar = glm::max(t0, t1);
+
+        const f32 entry = glm::max(glm::max(tNear.x, tNear.y), glm::max(tNear.z, 0.0f));
+        const f32 exit = glm::min(glm::min(tFar.x, tFar.y), tFar.z);
+
+        return (entry <= exit && entry < maxDistance) ? entry : FLT_MAX;
+    }
+
+    u32 RayCast(const BvhTree& bvh, const vec3& origin, const vec3& direction, f32* outDistance)
+    {
+        u32 closestItem = UINT32_MAX;
+        f32 closestDistance = FLT_MAX;
+
+        if (bvh.nodes.empty() || bvh.nodes[0].itemCount == 0)
+            return closestItem;
+
+        const vec3 invDirection = 1.0f / direction;
+
+        std::vector<u32> stack;
+        if (IntersectAABB(bvh.nodes[0].aabbMin, bvh.nodes[0].aabbMax, origin, invDirection, closestDistance) != FLT_MAX)
+            stack.push_back(0);
+
+        while (!stack.empty())
+        {
+            const BvhNode& node = bvh.nodes[stack.back()];
+            stack.pop_back();
+
+            if (IsLeaf(node))
+            {
+                for (u32 i = node.firstItem; i < node.firstItem + node.itemCount; ++i)
+                {
+                    const u32 item = bvh.itemIndices[i];
+                    const f32 distance = IntersectAABB(bvh.itemMin[item], bvh.itemMax[item], origin, invDirection, closestDistance);
+                    if (distance < closestDistance)
+                    {
+                        closestDistance = distance;
+                        closestItem = item;
+                    }
+                }
+                continue;
+            }
+
+            // Visit the nearest child first so farther subtrees get rejected by closestDistance
+            const BvhNode& left = bvh.nodes[node.leftChild];
+            const BvhNode& right = bvh.nodes[node.leftChild + 1];
+            const f32 leftDistance = IntersectAABB(left.aabbMin, left.aabbMax, origin, invDirection, closestDistance);
+            const f32 rightDistance = IntersectAABB(right.aabbMin, right.aabbMax, origin, invDirection, closestDistance);
+
+            const bool leftFirst = leftDistance <= rightDistance;
+            const f32 nearDistance = leftFirst ? leftDistance : rightDistance;
+            const f32 farDistance = leftFirst ? rightDistance : leftDistance;
+            const u32 nearChild = leftFirst ? node.leftChild : node.leftChild + 1;
+            const u32 farChild = leftFirst ? node.leftChild + 1 : node.leftChild;
+
+            if (farDistance != FLT_MAX)
+                stack.push_back(farChild);
+            if (nearDistance != FLT_MAX)
+                stack.push_back(nearChild);
+        }
+
+        if (outDistance)
+            *outDistance = closestDistance;
+
+        return closestItem;
+    }
+}
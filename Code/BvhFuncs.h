@@ -0,0 +1,57 @@
+#ifndef BVH_FUNC
+#define BVH_FUNC
+
+#include "Globals.h"
+
+#define BVH_BIN_COUNT 16
+#define BVH_MAX_LEAF_ITEMS 8
+#define BVH_NO_CHILD 0 // The root is never a child, so index 0 marks a leaf
+#define BVH_REBUILD_COST_RATIO 1.5f
+
+// Every node covers the contiguous range [firstItem, firstItem + itemCount) of Bvh::itemIndices,
+// internal nodes included, so a subtree fully inside a query is appended without visiting it
+struct BvhNode
+{
+    vec3 aabbMin;
+    u32  firstItem;
+    vec3 aabbMax;
+    u32  itemCount;
+    u32  leftChild;   // The right child is always leftChild + 1
+    u32  parent;
+};
+
+struct BvhTree
+{
+    std::vector<BvhNode> nodes;
+    std::vector<u32>     itemIndices; // Item ids ordered by leaf
+    std::vector<u32>     itemLeaf;    // Leaf node of every item id
+    std::vector<vec3>    itemMin;
+    std::vector<vec3>    itemMax;
+
+    f32 buildCost;    // SAH cost right after the last build
+    u32 refitCount;   // Items refitted since the cost was last checked
+};
+
+namespace Bvh
+{
+    // Binned SAH build over the item bounds
+    void Build(BvhTree& bvh, const vec3* itemMin, const vec3* itemMax, u32 itemCount);
+
+    // Updates the bounds of a moved item and refits its ancestors
+    void RefitItem(BvhTree& bvh, u32 item, const vec3& itemMin, const vec3& itemMax);
+
+    // SAH cost of the tree relative to its root area. Refits make it grow compared to buildCost.
+    f32 ComputeCost(const BvhTree& bvh);
+
+    // True when the refits degraded the tree enough to be worth a rebuild.
+    // The O(n) cost evaluation only runs once enough items were refitted.
+    bool NeedsRebuild(BvhTree& bvh);
+
+    // Appends the ids of the items whose bounds are not fully outside any of the planes
+    void QueryFrustum(const BvhTree& bvh, const vec4* planes, u32 planeCount, std::vector<u32>& outItems);
+
+    // Closest item whose bounds are hit by the ray, UINT32_MAX if none
+    u32 RayCast(const BvhTree& bvh, const vec3& origin, const vec3& direction, f32* outDistance = nullptr);
+}
+
+#endif // !BVH_FUNC
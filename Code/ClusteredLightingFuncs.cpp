@@ -0,0 +1,107 @@
+#include "engine.h"
+#include "ClusteredLightingFuncs.h"
+
+namespace ClusteredLighting
+{
+    void Init(App* app)
+    {
+        ClusteredLightingState& state = app->clusteredLighting;
+
+        glGenBuffers(1, &state.lightsBuffer);
+        glGenBuffers(1, &state.gridBuffer);
+        glGenBuffers(1, &state.lightIndexBuffer);
+        glGenBuffers(1, &state.indexCounterBuffer);
+
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, state.gridBuffer);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, CLUSTER_COUNT * 2 * sizeof(u32), NULL, GL_DYNAMIC_COPY);
+
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, state.lightIndexBuffer);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, CLUSTER_MAX_LIGHT_INDICES * sizeof(u32), NULL, GL_DYNAMIC_COPY);
+
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, state.indexCounterBuffer);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(u32), NULL, GL_DYNAMIC_COPY);
+
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    }
+
+    void UpdateLights(App* app)
+    {
+        ClusteredLightingState& state = app->clusteredLighting;
+
+        // Directional lights first, so the compute pass only walks the point lights
+        state.lightParams.clear();
+        for (const Light& light : app->lights)
+            if (light.type == LightType_Directional)
+                state.lightParams.push_back({ vec4(light.position, 0.0f), vec4(light.color, (f32)light.type), vec4(light.direction, 0.0f) });
+
+        state.directionalLightCount = state.lightParams.size();
+
+        for (const Light& light : app->lights)
+            if (light.type != LightType_Directional)
+                state.lightParams.push_back({ vec4(light.position, light.radius), vec4(light.color, (f32)light.type), vec4(light.direction, 0.0f) });
+
+        const u32 lightCount = state.lightParams.size();
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, state.lightsBuffer);
+        if (lightCount > state.lightsCapacity)
+        {
+            state.lightsCapacity = lightCount * 2;
+            glBufferData(GL_SHADER_STORAGE_BUFFER, state.lightsCapacity * sizeof(ClusterLightParams), NULL, GL_DYNAMIC_DRAW);
+        }
+        if (lightCount > 0)
+            glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, lightCount * sizeof(ClusterLightParams), state.lightParams.data());
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+        // Slices are exponential in view depth: slice = log(z) * scale - bias
+        const Camera& camera = app->camera;
+        const f32 depthLog = logf(camera.zfar / camera.znear);
+        const f32 sliceScale = CLUSTER_SLICES / depthLog;
+        const f32 sliceBias = CLUSTER_SLICES * logf(camera.znear) / depthLog;
+
+        Buffer& paramsBuffer = BufferManager::ReserveRingBlock(app->uniformRing, 2 * sizeof(glm::mat4) + 4 * sizeof(vec4), app->uniformBlockAligment);
+        BufferManager::AlignHead(paramsBuffer, app->uniformBlockAligment);
+        state.paramsBuffer = paramsBuffer.handle;
+        state.paramsOffset = paramsBuffer.head;
+
+        PushMat4(paramsBuffer, camera.viewMatrix);
+        PushMat4(paramsBuffer, glm::inverse(camera.projectionMatrix));
+        PushUVec4(paramsBuffer, uvec4(CLUSTER_TILES_X, CLUSTER_TILES_Y, CLUSTER_SLICES, 0));
+        PushUVec4(paramsBuffer, uvec4(state.directionalLightCount, lightCount, CLUSTER_MAX_LIGHT_INDICES, 0));
+        PushVec4(paramsBuffer, vec4(camera.znear, camera.zfar, sliceScale, sliceBias));
+        PushVec4(paramsBuffer, vec4(app->displaySize.x, app->displaySize.y, 0.0f, 0.0f));
+
+        state.paramsSize = paramsBuffer.head - state.paramsOffset;
+    }
+
+    void CullLights(App* app)
+    {
+        ClusteredLightingState& state = app->clusteredLighting;
+
+        const u32 zero = 0;
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, state.indexCounterBuffer);
+        glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, &zero);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+        GLState::UseProgram(app, app->programs[app->clusterLightsShader].handle);
+        GLState::BindBufferRange(app, GL_UNIFORM_BUFFER, BINDING(CLUSTER_PARAMS_BINDING), state.paramsBuffer, state.paramsOffset, state.paramsSize);
+        GLState::BindBufferBase(app, GL_SHADER_STORAGE_BUFFER, CLUSTER_LIGHTS_BINDING, state.lightsBuffer);
+        GLState::BindBufferBase(app, GL_SHADER_STORAGE_BUFFER, CLUSTER_GRID_BINDING, state.gridBuffer);
+        GLState::BindBufferBase(app, GL_SHADER_STORAGE_BUFFER, CLUSTER_LIGHT_INDICES_BINDING, state.lightIndexBuffer);
+        GLState::BindBufferBase(app, GL_SHADER_STORAGE_BUFFER, CLUSTER_INDEX_COUNTER_BINDING, state.indexCounterBuffer);
+
+        // One work group per cluster
+        glDispatchCompute(CLUSTER_TILES_X, CLUSTER_TILES_Y, CLUSTER_SLICES);
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+        GLState::UseProgram(app, 0);
+    }
+
+    void BindForShading(App* app)
+    {
+        ClusteredLightingState& state = app->clusteredLighting;
+
+        GLState::BindBufferRange(app, GL_UNIFORM_BUFFER, BINDING(CLUSTER_PARAMS_BINDING), state.paramsBuffer, state.paramsOffset, state.paramsSize);
+        GLState::BindBufferBase(app, GL_SHADER_STORAGE_BUFFER, CLUSTER_LIGHTS_BINDING, state.lightsBuffer);
+        GLState::BindBufferBase(app, GL_SHADER_STORAGE_BUFFER, CLUSTER_GRID_BINDING, state.gridBuffer);
+        GLState::BindBufferBase(app, GL_SHADER_STORAGE_BUFFER, CLUSTER_LIGHT_INDICES_BINDING, state.lightIndexBuffer);
+    }
+}
@@ -0,0 +1,67 @@
+#ifndef CLUSTERED_LIGHTING_FUNC
+#define CLUSTERED_LIGHTING_FUNC
+
+#include "Globals.h"
+
+struct App;
+
+// Cluster grid: screen tiles x exponential depth slices
+#define CLUSTER_TILES_X 16
+#define CLUSTER_TILES_Y 9
+#define CLUSTER_SLICES 24
+#define CLUSTER_COUNT (CLUSTER_TILES_X * CLUSTER_TILES_Y * CLUSTER_SLICES)
+#define CLUSTER_AVERAGE_LIGHTS 64 // Sizes the shared light index list
+#define CLUSTER_MAX_LIGHT_INDICES (CLUSTER_COUNT * CLUSTER_AVERAGE_LIGHTS)
+
+// Lights the GlobalParams block of the non-clustered shaders can hold
+#define GLOBAL_PARAMS_MAX_LIGHTS 16
+
+// Bindings shared by CLUSTER_LIGHTS.glsl and the *_CLUSTERED resolve shaders
+#define CLUSTER_PARAMS_BINDING 3       // Uniform block
+#define CLUSTER_LIGHTS_BINDING 3       // Storage blocks
+#define CLUSTER_GRID_BINDING 4
+#define CLUSTER_LIGHT_INDICES_BINDING 5
+#define CLUSTER_INDEX_COUNTER_BINDING 6
+
+// std430 mirror of ClusterLight in the shaders
+struct ClusterLightParams
+{
+    vec4 positionRadius;
+    vec4 colorType;
+    vec4 direction;
+};
+
+struct ClusteredLightingState
+{
+    bool   isEnabled;
+    GLuint lightsBuffer;
+    GLuint gridBuffer;        // (offset, count) into the light index list per cluster
+    GLuint lightIndexBuffer;
+    GLuint indexCounterBuffer;
+    u32    lightsCapacity;
+    u32    directionalLightCount; // Directional lights go first in the lights buffer and are never binned
+
+    // ClusterParams block of the frame, in the uniform ring
+    GLuint paramsBuffer;
+    u32    paramsOffset;
+    u32    paramsSize;
+
+    std::vector<ClusterLightParams> lightParams;
+};
+
+namespace ClusteredLighting
+{
+    void Init(App* app);
+
+    // Uploads the lights and writes the frame's ClusterParams block.
+    // Call from UpdateEntityBuffer, between BeginRingFrame and EndRingWrites.
+    void UpdateLights(App* app);
+
+    // Dispatches the compute pass that bins the point lights into the clusters
+    void CullLights(App* app);
+
+    // Binds the cluster buffers for a *_CLUSTERED resolve shader
+    void BindForShading(App* app);
+}
+
+#endif // !CLUSTERED_LIGHTING_FUNC
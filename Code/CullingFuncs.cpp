@@ -0,0 +1,388 @@
+#include "engine.h"
+#include "CullingFuncs.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define CULLING_SSE 1
+#include <immintrin.h>
+#endif
+
+namespace Culling
+{
+    void ExtractFrustumPlanes(const glm::mat4& viewProjection, vec4 planes[FrustumPlane_Count])
+    {
+        // glm is column major: row i of the matrix is (m[0][i], m[1][i], m[2][i], m[3][i])
+        const glm::mat4& m = viewProjection;
+        const vec4 row0 = vec4(m[0][0], m[1][0], m[2][0], m[3][0]);
+        const vec4 row1 = vec4(m[0][1], m[1][1], m[2][1], m[3][1]);
+        const vec4 row2 = vec4(m[0][2], m[1][2], m[2][2], m[3][2]);
+        const vec4 row3 = vec4(m[0][3], m[1][3], m[2][3], m[3][3]);
+
+        planes[FrustumPlane_Left] = row3 + row0;
+        planes[FrustumPlane_Right] = row3 - row0;
+        planes[FrustumPlane_Bottom] = row3 + row1;
+        planes[FrustumPlane_Top] = row3 - row1;
+        planes[FrustumPlane_Near] = row3 + row2;
+        planes[FrustumPlane_Far] = row3 - row2;
+
+        for (u32 i = 0; i < FrustumPlane_Count; ++i)
+            planes[i] /= glm::length(vec3(planes[i]));
+    }
+
+    void TransformAABB(const glm::mat4& transform, const vec3& localMin, const vec3& localMax, vec3& outCenter, vec3& outExtent)
+    {
+        const vec3 localCenter = (localMin + localMax) * 0.5f;
+        const vec3 localExtent = (localMax - localMin) * 0.5f;
+
+        // Arvo: the new extent is the local extent projected on the absolute rotation/scale axes
+        const glm::mat3 basis = glm::mat3(transform);
+        const glm::mat3 absBasis = glm::mat3(glm::abs(basis[0]), glm::abs(basis[1]), glm::abs(basis[2]));
+
+        outCenter = vec3(transform * vec4(localCenter, 1.0f));
+        outExtent = absBasis * localExtent;
+    }
+
+    static void ComputeEntityBounds(App* app, u32 entityIdx)
+    {
+        EntityBoundsSoA& bounds = app->culling.bounds;
+        const Entity& entity = app->entities[entityIdx];
+        const Mesh& mesh = app->meshes[app->models[entity.modelIndex].meshIdx];
+
+        vec3 center, extent;
+        TransformAABB(entity.worldMatrix, mesh.aabbMin, mesh.aabbMax, center, extent);
+
+        bounds.centerX[entityIdx] = center.x;
+        bounds.centerY[entityIdx] = center.y;
+        bounds.centerZ[entityIdx] = center.z;
+        bounds.extentX[entityIdx] = extent.x;
+        bounds.extentY[entityIdx] = extent.y;
+        bounds.extentZ[entityIdx] = extent.z;
+    }
+
+    static void ComputeEntityBoundsBatch(void* data, u32 begin, u32 end)
+    {
+        App* app = (App*)data;
+        for (u32 i = begin; i < end; ++i)
+            ComputeEntityBounds(app, i);
+    }
+
+    static void ResizeBounds(EntityBoundsSoA& bounds, u32 count)
+    {
+        bounds.centerX.resize(count);
+        bounds.centerY.resize(count);
+        bounds.centerZ.resize(count);
+        bounds.extentX.resize(count);
+        bounds.extentY.resize(count);
+        bounds.extentZ.resize(count);
+    }
+
+    static void GetBoundsMinMax(const EntityBoundsSoA& bounds, u32 i, vec3& outMin, vec3& outMax)
+    {
+        const vec3 center = vec3(bounds.centerX[i], bounds.centerY[i], bounds.centerZ[i]);
+        const vec3 extent = vec3(bounds.extentX[i], bounds.extentY[i], bounds.extentZ[i]);
+        outMin = center - extent;
+        outMax = center + extent;
+    }
+
+    static void BuildBvh(const EntityBoundsSoA& bounds, BvhTree& bvh)
+    {
+        const u32 count = bounds.centerX.size();
+        std::vector<vec3> itemMin(count);
+        std::vector<vec3> itemMax(count);
+        for (u32 i = 0; i < count; ++i)
+            GetBoundsMinMax(bounds, i, itemMin[i], itemMax[i]);
+
+        Bvh::Build(bvh, itemMin.data(), itemMax.data(), count);
+    }
+
+    static bool IsBvhBuilt(const CullingState& culling)
+    {
+        return !culling.bvh.nodes.empty() && culling.bvh.itemIndices.size() == culling.bounds.centerX.size();
+    }
+
+    void UpdateEntityBounds(App* app)
+    {
+        CullingState& culling = app->culling;
+        const u32 entityCount = app->entities.size();
+
+        // Entities were added or removed: recompute everything and drop the stale tree
+        if (culling.bounds.centerX.size() != entityCount)
+        {
+            ResizeBounds(culling.bounds, entityCount);
+            JobSystem::ParallelFor(app, ComputeEntityBoundsBatch, app, entityCount, CULLING_BATCH_SIZE);
+
+            culling.bvh.nodes.clear();
+            culling.movedEntities.clear();
+            return;
+        }
+
+        const bool isBvhBuilt = IsBvhBuilt(culling);
+        for (u32 entityIdx : culling.movedEntities)
+        {
+            ComputeEntityBounds(app, entityIdx);
+            if (isBvhBuilt)
+            {
+                vec3 aabbMin, aabbMax;
+                GetBoundsMinMax(culling.bounds, entityIdx, aabbMin, aabbMax);
+                Bvh::RefitItem(culling.bvh, entityIdx, aabbMin, aabbMax);
+            }
+        }
+        culling.movedEntities.clear();
+
+        if (isBvhBuilt && Bvh::NeedsRebuild(culling.bvh))
+            BuildBvh(culling.bounds, culling.bvh);
+    }
+
+    void MarkEntityMoved(App* app, u32 entityIdx)
+    {
+        app->culling.movedEntities.push_back(entityIdx);
+    }
+
+    static void EnsureBvh(App* app)
+    {
+        UpdateEntityBounds(app);
+        if (!IsBvhBuilt(app->culling))
+            BuildBvh(app->culling.bounds, app->culling.bvh);
+    }
+
+    static bool IsAABBVisible(const EntityBoundsSoA& bounds, u32 i, const vec4 planes[FrustumPlane_Count])
+    {
+        for (u32 p = 0; p < FrustumPlane_Count; ++p)
+        {
+            const vec4& plane = planes[p];
+            const f32 distance = plane.x * bounds.centerX[i] + plane.y * bounds.centerY[i] + plane.z * bounds.centerZ[i] + plane.w;
+            const f32 radius = fabsf(plane.x) * bounds.extentX[i] + fabsf(plane.y) * bounds.extentY[i] + fabsf(plane.z) * bounds.extentZ[i];
+            if (distance + radius < 0.0f)
+                return false;
+        }
+        return true;
+    }
+
+    void CullBounds(const EntityBoundsSoA& bounds, const vec4 planes[FrustumPlane_Count], std::vector<u32>& visible)
+    {
+        CullBoundsRange(bounds, planes, 0, bounds.centerX.size(), visible);
+    }
+
+    void CullBoundsRange(const EntityBoundsSoA& bounds, const vec4 planes[FrustumPlane_Count], u32 begin, u32 end, std::vector<u32>& visible)
+    {
+        u32 i = begin;
+
+#if defined(__AVX__)
+        {
+            const __m256 signMask = _mm256_set1_ps(-0.0f);
+            for (; i + 8 <= end; i += 8)
+            {
+                const __m256 cx = _mm256_loadu_ps(&bounds.centerX[i]);
+                const __m256 cy = _mm256_loadu_ps(&bounds.centerY[i]);
+                const __m256 cz = _mm256_loadu_ps(&bounds.centerZ[i]);
+                const __m256 ex = _mm256_loadu_ps(&bounds.extentX[i]);
+                const __m256 ey = _mm256_loadu_ps(&bounds.extentY[i]);
+                const __m256 ez = _mm256_loadu_ps(&bounds.extentZ[i]);
+
+                __m256 outside = _mm256_setzero_ps();
+                for (u32 p = 0; p < FrustumPlane_Count; ++p)
+                {
+                    const __m256 nx = _mm256_set1_ps(planes[p].x);
+                    const __m256 ny = _mm256_set1_ps(planes[p].y);
+                    const __m256 nz = _mm256_set1_ps(planes[p].z);
+
+                    __m256 distance = _mm256_add_ps(_mm256_mul_ps(nx, cx), _mm256_set1_ps(planes[p].w));
+                    distance = _mm256_add_ps(distance, _mm256_mul_ps(ny, cy));
+                    distance = _mm256_add_ps(distance, _mm256_mul_ps(nz, cz));
+
+                    __m256 radius = _mm256_mul_ps(_mm256_andnot_ps(signMask, nx), ex);
+                    radius = _mm256_add_ps(radius, _mm256_mul_ps(_mm256_andnot_ps(signMask, ny), ey));
+                    radius = _mm256_add_ps(radius, _mm256_mul_ps(_mm256_andnot_ps(signMask, nz), ez));
+
+                    outside = _mm256_or_ps(outside, _mm256_cmp_ps(_mm256_add_ps(distance, radius), _mm256_setzero_ps(), _CMP_LT_OQ));
+                }
+
+                const u32 visibleMask = ~(u32)_mm256_movemask_ps(outside) & 0xFF;
+                for (u32 lane = 0; lane < 8; ++lane)
+                    if (visibleMask & (1u << lane))
+                        visible.push_back(i + lane);
+            }
+        }
+#endif
+
+#if defined(CULLING_SSE)
+        {
+            const __m128 signMask = _mm_set1_ps(-0.0f);
+            for (; i + 4 <= end; i += 4)
+            {
+                const __m128 cx = _mm_loadu_ps(&bounds.centerX[i]);
+                const __m128 cy = _mm_loadu_ps(&bounds.centerY[i]);
+                const __m128 cz = _mm_loadu_ps(&bounds.centerZ[i]);
+                const __m128 ex = _mm_loadu_ps(&bounds.extentX[i]);
+                const __m128 ey = _mm_loadu_ps(&bounds.extentY[i]);
+                const __m128 ez = _mm_loadu_ps(&bounds.extentZ[i]);
+
+                __m128 outside = _mm_setzero_ps();
+                for (u32 p = 0; p < FrustumPlane_Count; ++p)
+                {
+                    const __m128 nx = _mm_set1_ps(planes[p].x);
+                    const __m128 ny = _mm_set1_ps(planes[p].y);
+                    const __m128 nz = _mm_set1_ps(planes[p].z);
+
+                    __m128 distance = _mm_add_ps(_mm_mul_ps(nx, cx), _mm_set1_ps(planes[p].w));
+                    distance = _mm_add_ps(distance, _mm_mul_ps(ny, cy));
+                    distance = _mm_add_ps(distance, _mm_mul_ps(nz, cz));
+
+                    __m128 radius = _mm_mul_ps(_mm_andnot_ps(signMask, nx), ex);
+                    radius = _mm_add_ps(radius, _mm_mul_ps(_mm_andnot_ps(signMask, ny), ey));
+                    radius = _mm_add_ps(radius, _mm_mul_ps(_mm_andnot_ps(signMask, nz), ez));
+
+                    outside = _mm_or_ps(outside, _mm_cmplt_ps(_mm_add_ps(distance, radius), _mm_setzero_ps()));
+                }
+
+                const u32 visibleMask = ~(u32)_mm_movemask_ps(outside) & 0xF;
+                for (u32 lane = 0; lane < 4; ++lane)
+                    if (visibleMask & (1u << lane))
+                        visible.push_back(i + lane);
+            }
+        }
+#endif
+
+        for (; i < end; ++i)
+            if (IsAABBVisible(bounds, i, planes))
+                visible.push_back(i);
+    }
+
+    struct CullBatchJob
+    {
+        const EntityBoundsSoA* bounds;
+        const vec4*            planes;
+        std::vector<u32>*      batchVisible;
+    };
+
+    static void CullBatch(void* data, u32 begin, u32 end)
+    {
+        CullBatchJob* job = (CullBatchJob*)data;
+        std::vector<u32>& visible = job->batchVisible[begin / CULLING_BATCH_SIZE];
+        visible.clear();
+        CullBoundsRange(*job->bounds, job->planes, begin, end, visible);
+    }
+
+    void CullEntities(App* app, const Camera& camera, std::vector<u32>& visible)
+    {
+        CullingState& culling = app->culling;
+        visible.clear();
+
+        if (!culling.isEnabled)
+        {
+            for (u32 i = 0; i < app->entities.size(); ++i)
+                visible.push_back(i);
+            culling.cullTimeMs = 0.0f;
+            return;
+        }
+
+        const f64 startTime = glfwGetTime();
+
+        ExtractFrustumPlanes(camera.projectionMatrix * camera.viewMatrix, culling.planes);
+
+        if (culling.method == CullingMethod_Bvh)
+        {
+            EnsureBvh(app);
+            Bvh::QueryFrustum(culling.bvh, culling.planes, FrustumPlane_Count, visible);
+        }
+        else
+        {
+            UpdateEntityBounds(app);
+
+            // Each batch fills its own list, appended in batch order so the result matches a serial cull
+            const u32 entityCount = culling.bounds.centerX.size();
+            const u32 batchCount = (entityCount + CULLING_BATCH_SIZE - 1) / CULLING_BATCH_SIZE;
+            if (culling.batchVisible.size() < batchCount)
+                culling.batchVisible.resize(batchCount);
+
+            CullBatchJob job = { &culling.bounds, culling.planes, culling.batchVisible.data() };
+            JobSystem::ParallelFor(app, CullBatch, &job, entityCount, CULLING_BATCH_SIZE);
+
+            for (u32 batch = 0; batch < batchCount; ++batch)
+                visible.insert(visible.end(), culling.batchVisible[batch].begin(), culling.batchVisible[batch].end());
+        }
+
+        culling.cullTimeMs = (f32)((glfwGetTime() - startTime) * 1000.0);
+    }
+
+    u32 PickEntity(App* app, const Camera& camera, const vec2& screenPos, const ivec2& displaySize)
+    {
+        EnsureBvh(app);
+
+        // Unproject the cursor on the near and far planes
+        const vec2 ndc = vec2(2.0f * screenPos.x / displaySize.x - 1.0f, 1.0f - 2.0f * screenPos.y / displaySize.y);
+        const glm::mat4 inverseViewProjection = glm::inverse(camera.projectionMatrix * camera.viewMatrix);
+        const vec4 nearPoint = inverseViewProjection * vec4(ndc, -1.0f, 1.0f);
+        const vec4 farPoint = inverseViewProjection * vec4(ndc, 1.0f, 1.0f);
+
+        const vec3 origin = vec3(nearPoint) / nearPoint.w;
+        const vec3 direction = glm::normalize(vec3(farPoint) / farPoint.w - origin);
+
+        app->culling.pickedEntity = Bvh::RayCast(app->culling.bvh, origin, direction);
+        return app->culling.pickedEntity;
+    }
+
+    static f32 RandomFloat(u32& state)
+    {
+        // xorshift32, deterministic so every run benchmarks the same scene
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        return (state & 0xFFFFFF) / (f32)0x1000000;
+    }
+
+    void RunBenchmark(App* app)
+    {
+        const u32 EntityCounts[] = { 1000, 10000, 100000 };
+        const u32 Iterations = 20;
+
+        vec4 planes[FrustumPlane_Count];
+        ExtractFrustumPlanes(app->camera.projectionMatrix * app->camera.viewMatrix, planes);
+
+        for (u32 entityCount : EntityCounts)
+        {
+            // Boxes scattered around the camera with a constant density, so most of them are off-screen
+            const f32 halfSize = 10.0f * cbrtf((f32)entityCount);
+            u32 randomState = 0x9E3779B9u;
+
+            EntityBoundsSoA bounds;
+            ResizeBounds(bounds, entityCount);
+            for (u32 i = 0; i < entityCount; ++i)
+            {
+                bounds.centerX[i] = app->camera.pos.x + (RandomFloat(randomState) * 2.0f - 1.0f) * halfSize;
+                bounds.centerY[i] = app->camera.pos.y + (RandomFloat(randomState) * 2.0f - 1.0f) * halfSize;
+                bounds.centerZ[i] = app->camera.pos.z + (RandomFloat(randomState) * 2.0f - 1.0f) * halfSize;
+                bounds.extentX[i] = 0.5f + RandomFloat(randomState) * 1.5f;
+                bounds.extentY[i] = 0.5f + RandomFloat(randomState) * 1.5f;
+                bounds.extentZ[i] = 0.5f + RandomFloat(randomState) * 1.5f;
+            }
+
+            std::vector<u32> visible;
+            visible.reserve(entityCount);
+
+            f64 startTime = glfwGetTime();
+            for (u32 i = 0; i < Iterations; ++i)
+            {
+                visible.clear();
+                CullBounds(bounds, planes, visible);
+            }
+            const f64 bruteForceMs = (glfwGetTime() - startTime) * 1000.0 / Iterations;
+            const u32 bruteForceVisible = visible.size();
+
+            BvhTree bvh = {};
+            startTime = glfwGetTime();
+            BuildBvh(bounds, bvh);
+            const f64 buildMs = (glfwGetTime() - startTime) * 1000.0;
+
+            startTime = glfwGetTime();
+            for (u32 i = 0; i < Iterations; ++i)
+            {
+                visible.clear();
+                Bvh::QueryFrustum(bvh, planes, FrustumPlane_Count, visible);
+            }
+            const f64 bvhMs = (glfwGetTime() - startTime) * 1000.0 / Iterations;
+
+            ILOG("Culling benchmark, %u entities: brute force %.3f ms, BVH %.3f ms (build %.2f ms, %u nodes), %u/%u visible",
+                entityCount, bruteForceMs, bvhMs, buildMs, (u32)bvh.nodes.size(), bruteForceVisible, (u32)visible.size());
+        }
+    }
+}
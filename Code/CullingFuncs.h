@@ -0,0 +1,86 @@
+#ifndef CULLING_FUNC
+#define CULLING_FUNC
+
+#include "Globals.h"
+#include "BvhFuncs.h"
+
+struct App;
+
+#define CULLING_BATCH_SIZE 1024 // Entities per job of the brute force cull and the bounds update
+
+enum FrustumPlane
+{
+    FrustumPlane_Left,
+    FrustumPlane_Right,
+    FrustumPlane_Bottom,
+    FrustumPlane_Top,
+    FrustumPlane_Near,
+    FrustumPlane_Far,
+    FrustumPlane_Count
+};
+
+enum CullingMethod
+{
+    CullingMethod_BruteForce, // SIMD test of every entity
+    CullingMethod_Bvh,        // Hierarchical test through the entity BVH
+    CullingMethod_Count
+};
+
+// World space entity bounds in structure-of-arrays layout, so the culling kernels load 4/8 entities at once
+struct EntityBoundsSoA
+{
+    std::vector<f32> centerX;
+    std::vector<f32> centerY;
+    std::vector<f32> centerZ;
+    std::vector<f32> extentX;
+    std::vector<f32> extentY;
+    std::vector<f32> extentZ;
+};
+
+struct CullingState
+{
+    bool             isEnabled;
+    CullingMethod    method;
+    EntityBoundsSoA  bounds;
+    BvhTree          bvh;                        // Over the same world bounds, built on demand
+    std::vector<u32> movedEntities;              // Entities whose bounds need an update before the next query
+    vec4             planes[FrustumPlane_Count]; // xyz normal pointing inside, w distance
+    std::vector<u32> visibleEntities;            // Indices into app->entities, published from the render snapshot
+    std::vector<std::vector<u32>> batchVisible;  // Brute force results per job batch, merged in order
+    f32              cullTimeMs;
+    u32              pickedEntity;               // UINT32_MAX if nothing is picked
+};
+
+namespace Culling
+{
+    // Planes of the frustum of a view-projection matrix (Gribb/Hartmann), normalized
+    void ExtractFrustumPlanes(const glm::mat4& viewProjection, vec4 planes[FrustumPlane_Count]);
+
+    // World space AABB of a local AABB transformed by an affine matrix
+    void TransformAABB(const glm::mat4& transform, const vec3& localMin, const vec3& localMax, vec3& outCenter, vec3& outExtent);
+
+    // Brings the world bounds (and the BVH, when built) up to date with app->entities
+    void UpdateEntityBounds(App* app);
+
+    // Call after changing the worldMatrix of an existing entity so its bounds get refitted. Entities added to or
+    // removed from app->entities need no call, a new entity count recomputes every bound and rebuilds the BVH.
+    void MarkEntityMoved(App* app, u32 entityIdx);
+
+    // Tests the entity bounds against the planes and appends the indices of the visible ones
+    void CullBounds(const EntityBoundsSoA& bounds, const vec4 planes[FrustumPlane_Count], std::vector<u32>& visible);
+
+    // Same as CullBounds for the entities in [begin, end), safe to call from several jobs on disjoint ranges
+    void CullBoundsRange(const EntityBoundsSoA& bounds, const vec4 planes[FrustumPlane_Count], u32 begin, u32 end, std::vector<u32>& visible);
+
+    // Fills visible with the entities inside the frustum of the camera. Runs on the simulation step of the frame pipeline.
+    void CullEntities(App* app, const Camera& camera, std::vector<u32>& visible);
+
+    // Entity under a screen position (in pixels, origin top-left) seen from the camera, UINT32_MAX if none.
+    // displaySize must be the one the camera projection was built for.
+    u32 PickEntity(App* app, const Camera& camera, const vec2& screenPos, const ivec2& displaySize);
+
+    // Logs the brute force and BVH culling times over synthetic scenes of 1k, 10k and 100k entities
+    void RunBenchmark(App* app);
+}
+
+#endif // !CULLING_FUNC
@@ -0,0 +1,299 @@
+#include "engine.h"
+#include "FrameGraphFuncs.h"
+#include <imgui.h>
+
+namespace FrameGraph
+{
+    static FrameGraphResource AddResource(FrameGraphState& graph, const char* name, const RenderTargetDesc& desc, GLuint handle, bool isImported)
+    {
+        FrameGraphResourceNode resource = {};
+        resource.name = name;
+        resource.desc = desc;
+        resource.handle = handle;
+        resource.isImported = isImported;
+        resource.producer = FRAME_GRAPH_NONE;
+        resource.firstPass = FRAME_GRAPH_NONE;
+        resource.lastPass = FRAME_GRAPH_NONE;
+
+        graph.resources.push_back(resource);
+        return graph.resources.size() - 1;
+    }
+
+    static void Touch(FrameGraphState& graph, FrameGraphResource resourceIdx, u32 passIdx)
+    {
+        FrameGraphResourceNode& resource = graph.resources[resourceIdx];
+        if (resource.firstPass == FRAME_GRAPH_NONE)
+            resource.firstPass = passIdx;
+        resource.lastPass = passIdx;
+    }
+
+    // Culling a pass drops one reader from every resource it reads, which may leave their producers unused too
+    static void CullPass(FrameGraphState& graph, FrameGraphPass& pass, std::vector<FrameGraphResource>& unreferenced)
+    {
+        pass.isCulled = true;
+        graph.culledPasses++;
+
+        for (FrameGraphResource resourceIdx : pass.reads)
+        {
+            FrameGraphResourceNode& resource = graph.resources[resourceIdx];
+            if (--resource.readCount == 0 && !resource.isImported)
+                unreferenced.push_back(resourceIdx);
+        }
+    }
+
+    static void BindTargets(App* app, FrameGraphState& graph, const FrameGraphPass& pass)
+    {
+        GLuint frameBuffer = 0;
+        ivec2 viewport = app->displaySize;
+
+        const bool isBackBuffer = pass.colorWriteCount > 0 && graph.resources[pass.colorWrites[0]].isBackBuffer;
+        if (!isBackBuffer)
+        {
+            GLuint colors[RENDER_TARGET_MAX_COLORS];
+            for (u32 i = 0; i < pass.colorWriteCount; ++i)
+                colors[i] = graph.resources[pass.colorWrites[i]].handle;
+
+            const GLuint depth = pass.depthWrite != FRAME_GRAPH_NONE ? graph.resources[pass.depthWrite].handle : 0;
+            frameBuffer = RenderTargetPool::GetFrameBuffer(app, colors, pass.colorWriteCount, depth);
+
+            const FrameGraphResource sizeSource = pass.colorWriteCount > 0 ? pass.colorWrites[0] : pass.depthWrite;
+            viewport = glm::max(graph.resources[sizeSource].desc.size, ivec2(1, 1));
+        }
+
+        BindFrameBuffer(app, graph, frameBuffer, viewport);
+    }
+
+    void Reset(FrameGraphState& graph)
+    {
+        graph.passes.clear();
+        graph.resources.clear();
+    }
+
+    FrameGraphResource CreateTarget(FrameGraphState& graph, const char* name, const RenderTargetDesc& desc)
+    {
+        return AddResource(graph, name, desc, 0, false);
+    }
+
+    FrameGraphResource ImportTexture(FrameGraphState& graph, const char* name, GLuint handle, const RenderTargetDesc& desc)
+    {
+        return AddResource(graph, name, desc, handle, true);
+    }
+
+    FrameGraphResource ImportBackBuffer(App* app, FrameGraphState& graph)
+    {
+        RenderTargetDesc desc = {};
+        desc.size = app->displaySize;
+        desc.samples = 1;
+        desc.mipLevels = 1;
+
+        const FrameGraphResource resource = AddResource(graph, "Back buffer", desc, 0, true);
+        graph.resources[resource].isBackBuffer = true;
+        return resource;
+    }
+
+    u32 AddPass(FrameGraphState& graph, const char* name, FrameGraphExecuteFunc execute)
+    {
+        FrameGraphPass pass = {};
+        pass.name = name;
+        pass.execute = execute;
+        pass.depthWrite = FRAME_GRAPH_NONE;
+
+        graph.passes.push_back(pass);
+        return graph.passes.size() - 1;
+    }
+
+    void Read(FrameGraphState& graph, u32 passIdx, FrameGraphResource resource)
+    {
+        graph.passes[passIdx].reads.push_back(resource);
+    }
+
+    void WriteColor(FrameGraphState& graph, u32 passIdx, FrameGraphResource resource)
+    {
+        FrameGraphPass& pass = graph.passes[passIdx];
+        ASSERT(pass.colorWriteCount < RENDER_TARGET_MAX_COLORS, "Too many color outputs in a frame graph pass");
+
+        pass.colorWrites[pass.colorWriteCount++] = resource;
+        graph.resources[resource].producer = passIdx;
+    }
+
+    void WriteDepth(FrameGraphState& graph, u32 passIdx, FrameGraphResource resource)
+    {
+        graph.passes[passIdx].depthWrite = resource;
+        graph.resources[resource].producer = passIdx;
+    }
+
+    void SetClear(FrameGraphState& graph, u32 passIdx, GLbitfield mask, vec4 color)
+    {
+        graph.passes[passIdx].clearMask = mask;
+        graph.passes[passIdx].clearColor = color;
+    }
+
+    void SetSideEffects(FrameGraphState& graph, u32 passIdx)
+    {
+        graph.passes[passIdx].hasSideEffects = true;
+    }
+
+    void SetManualTargets(FrameGraphState& graph, u32 passIdx)
+    {
+        graph.passes[passIdx].hasManualTargets = true;
+    }
+
+    void BindFrameBuffer(App* app, FrameGraphState& graph, GLuint frameBuffer, ivec2 viewport)
+    {
+        GLState::BindFramebuffer(app, GL_FRAMEBUFFER, frameBuffer);
+
+        if (viewport != graph.boundViewport)
+        {
+            glViewport(0, 0, viewport.x, viewport.y);
+            graph.boundViewport = viewport;
+        }
+    }
+
+    void Compile(FrameGraphState& graph)
+    {
+        graph.culledPasses = 0;
+        graph.discardedTargets = 0;
+
+        for (FrameGraphPass& pass : graph.passes)
+        {
+            pass.isCulled = false;
+            pass.refCount = pass.colorWriteCount + (pass.depthWrite != FRAME_GRAPH_NONE ? 1 : 0);
+            pass.acquires.clear();
+            pass.releases.clear();
+
+            for (FrameGraphResource resourceIdx : pass.reads)
+                graph.resources[resourceIdx].readCount++;
+        }
+
+        // Passes are referenced by the resources they write, resources by the passes that read them.
+        // Walking back from the unread resources culls every pass that only feeds unused work.
+        std::vector<FrameGraphResource> unreferenced;
+        for (u32 i = 0; i < graph.resources.size(); ++i)
+            if (graph.resources[i].readCount == 0 && !graph.resources[i].isImported)
+                unreferenced.push_back(i);
+
+        for (FrameGraphPass& pass : graph.passes)
+            if (pass.refCount == 0 && !pass.hasSideEffects)
+                CullPass(graph, pass, unreferenced);
+
+        while (!unreferenced.empty())
+        {
+            const FrameGraphResource resourceIdx = unreferenced.back();
+            unreferenced.pop_back();
+
+            const u32 producerIdx = graph.resources[resourceIdx].producer;
+            if (producerIdx == FRAME_GRAPH_NONE)
+                continue;
+
+            FrameGraphPass& producer = graph.passes[producerIdx];
+            if (producer.isCulled || producer.hasSideEffects)
+                continue;
+
+            if (--producer.refCount == 0)
+                CullPass(graph, producer, unreferenced);
+        }
+
+        // Lifetimes over the surviving passes. Color outputs of a surviving pass that nobody reads are never allocated.
+        for (u32 passIdx = 0; passIdx < graph.passes.size(); ++passIdx)
+        {
+            FrameGraphPass& pass = graph.passes[passIdx];
+            if (pass.isCulled)
+                continue;
+
+            for (FrameGraphResource resourceIdx : pass.reads)
+                Touch(graph, resourceIdx, passIdx);
+
+            for (u32 i = 0; i < pass.colorWriteCount; ++i)
+            {
+                FrameGraphResourceNode& resource = graph.resources[pass.colorWrites[i]];
+                if (resource.readCount == 0 && !resource.isImported)
+                {
+                    resource.isDiscarded = true;
+                    graph.discardedTargets++;
+                    continue;
+                }
+
+                Touch(graph, pass.colorWrites[i], passIdx);
+            }
+
+            if (pass.depthWrite != FRAME_GRAPH_NONE)
+                Touch(graph, pass.depthWrite, passIdx);
+        }
+
+        for (u32 i = 0; i < graph.resources.size(); ++i)
+        {
+            const FrameGraphResourceNode& resource = graph.resources[i];
+            if (resource.isImported || resource.firstPass == FRAME_GRAPH_NONE)
+                continue;
+
+            graph.passes[resource.firstPass].acquires.push_back(i);
+            graph.passes[resource.lastPass].releases.push_back(i);
+        }
+    }
+
+    void Execute(App* app, FrameGraphState& graph)
+    {
+        // Anything outside the graph may have changed the bindings since the last frame
+        graph.boundViewport = ivec2(-1, -1);
+
+        for (FrameGraphPass& pass : graph.passes)
+        {
+            if (pass.isCulled)
+                continue;
+
+            for (FrameGraphResource resourceIdx : pass.acquires)
+            {
+                FrameGraphResourceNode& resource = graph.resources[resourceIdx];
+                resource.handle = RenderTargetPool::Acquire(app, resource.desc);
+            }
+
+            const u32 scopeIdx = Profiler::BeginScope(app, pass.name, true);
+
+            if (!pass.hasManualTargets && (pass.colorWriteCount > 0 || pass.depthWrite != FRAME_GRAPH_NONE))
+                BindTargets(app, graph, pass);
+
+            if (!pass.hasManualTargets && pass.clearMask != 0)
+            {
+                glClearColor(pass.clearColor.r, pass.clearColor.g, pass.clearColor.b, pass.clearColor.a);
+                glClear(pass.clearMask);
+            }
+
+            pass.execute(app, graph, pass);
+
+            Profiler::EndScope(app, scopeIdx);
+
+            for (FrameGraphResource resourceIdx : pass.releases)
+                RenderTargetPool::Release(app, graph.resources[resourceIdx].handle);
+        }
+
+        GLState::BindFramebuffer(app, GL_FRAMEBUFFER, 0);
+    }
+
+    GLuint GetTexture(const FrameGraphState& graph, FrameGraphResource resource)
+    {
+        return graph.resources[resource].handle;
+    }
+
+    void DrawGui(App* app)
+    {
+        const FrameGraphState& graph = app->frameGraph;
+
+        ImGui::Text("Passes: %u (%u culled)  Discarded outputs: %u",
+            (u32)graph.passes.size(), graph.culledPasses, graph.discardedTargets);
+
+        for (const FrameGraphPass& pass : graph.passes)
+            ImGui::BulletText("%s%s", pass.name, pass.isCulled ? "  (culled)" : "");
+
+        for (const FrameGraphResourceNode& resource : graph.resources)
+        {
+            if (resource.isImported)
+                ImGui::BulletText("%s  imported", resource.name);
+            else if (resource.isDiscarded)
+                ImGui::BulletText("%s  discarded", resource.name);
+            else if (resource.firstPass != FRAME_GRAPH_NONE)
+                ImGui::BulletText("%s  passes %u-%u", resource.name, resource.firstPass, resource.lastPass);
+            else
+                ImGui::BulletText("%s  unused", resource.name);
+        }
+    }
+}
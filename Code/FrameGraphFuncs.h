@@ -0,0 +1,108 @@
+#ifndef FRAME_GRAPH_FUNC
+#define FRAME_GRAPH_FUNC
+
+#include "Globals.h"
+#include "RenderTargetPoolFuncs.h"
+
+struct App;
+struct FrameGraphState;
+struct FrameGraphPass;
+
+typedef u32 FrameGraphResource; // Index into FrameGraphState::resources
+
+#define FRAME_GRAPH_NONE UINT32_MAX
+
+typedef void (*FrameGraphExecuteFunc)(App* app, FrameGraphState& graph, const FrameGraphPass& pass);
+
+struct FrameGraphResourceNode
+{
+    const char*      name;
+    RenderTargetDesc desc;
+    GLuint           handle;       // Imported handle, or the pooled target while the resource is alive
+    bool             isImported;   // Not owned by the graph (the back buffer or an external texture)
+    bool             isBackBuffer;
+    bool             isDiscarded;  // Color output nobody reads, bound as GL_NONE
+    u32              producer;     // Last pass that writes it
+    u32              readCount;    // Readers left after culling
+    u32              firstPass;
+    u32              lastPass;
+};
+
+struct FrameGraphPass
+{
+    const char*            name;
+    FrameGraphExecuteFunc  execute;
+
+    std::vector<FrameGraphResource> reads;
+    FrameGraphResource     colorWrites[RENDER_TARGET_MAX_COLORS];
+    u32                    colorWriteCount;
+    FrameGraphResource     depthWrite;
+
+    GLbitfield             clearMask;
+    vec4                   clearColor;
+    bool                   hasSideEffects; // Kept even when nothing reads its outputs, e.g. compute passes writing buffers
+    bool                   hasManualTargets; // Binds its own framebuffers (e.g. per mip level) through BindFrameBuffer
+
+    // Filled by Compile
+    bool                   isCulled;
+    u32                    refCount;
+    std::vector<FrameGraphResource> acquires; // Transient resources whose lifetime starts here
+    std::vector<FrameGraphResource> releases; // and ends here
+};
+
+struct FrameGraphState
+{
+    std::vector<FrameGraphPass>         passes;
+    std::vector<FrameGraphResourceNode> resources;
+
+    // Bound viewport, so consecutive passes on the same target skip it. The framebuffer is shadowed by GLState.
+    ivec2 boundViewport;
+
+    // Stats of the last compiled graph
+    u32 culledPasses;
+    u32 discardedTargets; // Color attachments nobody reads, left unallocated
+};
+
+namespace FrameGraph
+{
+    // Clears the passes and resources of the previous frame
+    void Reset(FrameGraphState& graph);
+
+    FrameGraphResource CreateTarget(FrameGraphState& graph, const char* name, const RenderTargetDesc& desc);
+
+    FrameGraphResource ImportTexture(FrameGraphState& graph, const char* name, GLuint handle, const RenderTargetDesc& desc);
+
+    FrameGraphResource ImportBackBuffer(App* app, FrameGraphState& graph);
+
+    u32 AddPass(FrameGraphState& graph, const char* name, FrameGraphExecuteFunc execute);
+
+    void Read(FrameGraphState& graph, u32 passIdx, FrameGraphResource resource);
+
+    void WriteColor(FrameGraphState& graph, u32 passIdx, FrameGraphResource resource);
+
+    void WriteDepth(FrameGraphState& graph, u32 passIdx, FrameGraphResource resource);
+
+    void SetClear(FrameGraphState& graph, u32 passIdx, GLbitfield mask, vec4 color);
+
+    void SetSideEffects(FrameGraphState& graph, u32 passIdx);
+
+    // The graph still tracks the pass outputs but leaves binding and clearing them to the pass
+    void SetManualTargets(FrameGraphState& graph, u32 passIdx);
+
+    // Binds a framebuffer and viewport unless they are already bound
+    void BindFrameBuffer(App* app, FrameGraphState& graph, GLuint frameBuffer, ivec2 viewport);
+
+    // Culls the passes whose outputs nobody reads and computes the lifetime of every transient resource
+    void Compile(FrameGraphState& graph);
+
+    // Runs the surviving passes in declaration order. Transient targets are taken from the pool
+    // right before their first use and returned after their last, so later passes can reuse them.
+    void Execute(App* app, FrameGraphState& graph);
+
+    // Texture of a resource, valid inside the execute callbacks of the passes that use it
+    GLuint GetTexture(const FrameGraphState& graph, FrameGraphResource resource);
+
+    void DrawGui(App* app);
+}
+
+#endif // !FRAME_GRAPH_FUNC
@@ -0,0 +1,145 @@
+#include "engine.h"
+#include "FramePipelineFuncs.h"
+#include <imgui.h>
+
+namespace FramePipeline
+{
+    static const char* ModeNames[FramePipelineMode_Count] = { "Lockstep", "Pipelined" };
+
+    static void ComputeEntityMatrices(void* data, u32 begin, u32 end)
+    {
+        App* app = (App*)data;
+        RenderSnapshot& snapshot = app->pipeline.snapshots[app->pipeline.renderSnapshot ^ 1];
+        const glm::mat4 viewProjection = snapshot.camera.projectionMatrix * snapshot.camera.viewMatrix;
+
+        for (u32 i = begin; i < end; ++i)
+        {
+            const glm::mat4& world = app->entities[snapshot.visibleEntities[i]].worldMatrix;
+            snapshot.entityMatrices[2 * i] = world;
+            snapshot.entityMatrices[2 * i + 1] = viewProjection * world;
+        }
+    }
+
+    // Moves the camera and fills the snapshot the render thread is not reading. It may run on a worker while the
+    // render thread submits, so it only writes the pipeline state, the culling structures and that snapshot.
+    static void SimulateStep(void* data, u32, u32)
+    {
+        App* app = (App*)data;
+        FramePipelineState& pipeline = app->pipeline;
+        RenderSnapshot& snapshot = pipeline.snapshots[pipeline.renderSnapshot ^ 1];
+        const f64 startTime = glfwGetTime();
+
+        Camera& camera = pipeline.camera;
+        UpdateCamera(camera, pipeline.input, pipeline.deltaTime);
+        camera.aspecRatio = (float)pipeline.displaySize.x / (float)pipeline.displaySize.y;
+        camera.fovYRad = glm::radians(60.0f);
+        camera.projectionMatrix = glm::perspective(camera.fovYRad, camera.aspecRatio, camera.znear, camera.zfar);
+        camera.viewMatrix = glm::lookAt(camera.pos, camera.pos + camera.front, camera.up);
+
+        if (pipeline.input.mouseButtons[MouseButton::LEFT] == ButtonState::BUTTON_PRESS)
+            Culling::PickEntity(app, camera, pipeline.input.mousePos, pipeline.displaySize);
+
+        // Only the entities inside the frustum get uniforms and draws
+        Culling::CullEntities(app, camera, snapshot.visibleEntities);
+
+        snapshot.camera = camera;
+        snapshot.entityMatrices.resize(2 * snapshot.visibleEntities.size());
+        JobSystem::ParallelFor(app, ComputeEntityMatrices, app, snapshot.visibleEntities.size(), FRAME_PIPELINE_MATRIX_BATCH_SIZE);
+
+        snapshot.frameIndex = ++pipeline.simulatedFrames;
+        pipeline.stepMs = (f32)((glfwGetTime() - startTime) * 1000.0);
+    }
+
+    static void Publish(App* app, u32 latencyFrames)
+    {
+        FramePipelineState& pipeline = app->pipeline;
+        pipeline.renderSnapshot ^= 1;
+        pipeline.isStepReady = false;
+        pipeline.latencyFrames = latencyFrames;
+
+        // The modules drawing the frame read the camera and the visible list from the app
+        RenderSnapshot& snapshot = pipeline.snapshots[pipeline.renderSnapshot];
+        app->camera = snapshot.camera;
+        app->culling.visibleEntities.swap(snapshot.visibleEntities);
+    }
+
+    void Init(App* app)
+    {
+        FramePipelineState& pipeline = app->pipeline;
+        pipeline.mode = FramePipelineMode_Pipelined;
+        pipeline.camera = app->camera;
+        pipeline.renderSnapshot = 0;
+        pipeline.isStepReady = false;
+        pipeline.stepCounter.pending = 0;
+        pipeline.simulatedFrames = 0;
+    }
+
+    void Update(App* app)
+    {
+        FramePipelineState& pipeline = app->pipeline;
+
+        // The step may run after the platform layer moved on to the next input state
+        const vec2 mouseLastPos = pipeline.input.mouseLastPos;
+        pipeline.input = app->input;
+        pipeline.input.mouseLastPos = mouseLastPos;
+        pipeline.displaySize = app->displaySize;
+        pipeline.deltaTime = app->deltaTime;
+
+        if (pipeline.mode == FramePipelineMode_Pipelined && pipeline.isStepReady)
+        {
+            Publish(app, 1);
+            return;
+        }
+
+        // Lockstep, or the first frame after switching to pipelined
+        SimulateStep(app, 0, 1);
+        Publish(app, 0);
+
+        // This frame's input is applied already, the step BeginStep starts must not move the camera again
+        if (pipeline.mode == FramePipelineMode_Pipelined)
+            pipeline.deltaTime = 0.0f;
+    }
+
+    void BeginStep(App* app)
+    {
+        FramePipelineState& pipeline = app->pipeline;
+        if (pipeline.mode != FramePipelineMode_Pipelined)
+            return;
+
+        pipeline.stepCounter.pending = 1;
+        JobSystem::Run(app, SimulateStep, app, 0, 1, &pipeline.stepCounter);
+    }
+
+    void EndStep(App* app)
+    {
+        FramePipelineState& pipeline = app->pipeline;
+        if (pipeline.mode != FramePipelineMode_Pipelined)
+            return;
+
+        const f64 startTime = glfwGetTime();
+        JobSystem::Wait(app, &pipeline.stepCounter);
+        pipeline.waitMs = (f32)((glfwGetTime() - startTime) * 1000.0);
+        pipeline.isStepReady = true;
+    }
+
+    const RenderSnapshot& GetRenderSnapshot(const App* app)
+    {
+        return app->pipeline.snapshots[app->pipeline.renderSnapshot];
+    }
+
+    void DrawGui(App* app)
+    {
+        FramePipelineState& pipeline = app->pipeline;
+
+        // No step is in flight while the Gui runs, so the mode can change at any frame
+        int mode = pipeline.mode;
+        if (ImGui::Combo("Frame pipeline", &mode, ModeNames, FramePipelineMode_Count))
+        {
+            pipeline.mode = (FramePipelineMode)mode;
+            pipeline.isStepReady = false;
+        }
+
+        ImGui::Text("Simulation step: %.3f ms  Render wait: %.3f ms", pipeline.stepMs, pipeline.mode == FramePipelineMode_Pipelined ? pipeline.waitMs : 0.0f);
+        ImGui::Text("Snapshot %llu, %u frame(s) of latency", (unsigned long long)GetRenderSnapshot(app).frameIndex, pipeline.latencyFrames);
+    }
+}
@@ -0,0 +1,69 @@
+#ifndef FRAME_PIPELINE_FUNC
+#define FRAME_PIPELINE_FUNC
+
+#include "Globals.h"
+#include "JobSystemFuncs.h"
+
+struct App;
+
+#define FRAME_PIPELINE_MATRIX_BATCH_SIZE 256 // Visible entities per job when the snapshot matrices are computed
+
+enum FramePipelineMode
+{
+    FramePipelineMode_Lockstep,  // Update simulates the frame that Render draws right after
+    FramePipelineMode_Pipelined, // Render simulates frame N+1 on a worker while it submits frame N
+    FramePipelineMode_Count
+};
+
+// Everything the render thread reads from the simulation of a frame. Written by one step, then left untouched
+// until the render thread moves on to the next snapshot.
+struct RenderSnapshot
+{
+    u64                    frameIndex;      // Simulation step that produced it
+    Camera                 camera;          // With the view and projection matrices of the frame
+    std::vector<u32>       visibleEntities; // Handed to app->culling.visibleEntities on publish
+    std::vector<glm::mat4> entityMatrices;  // World then WVP for each visible entity
+};
+
+struct FramePipelineState
+{
+    FramePipelineMode mode;
+
+    // Owned by the simulation step. The Gui edits the camera settings here, between two steps.
+    Camera camera;
+    Input  input;       // Latched by Update, mouseLastPos is kept across frames
+    ivec2  displaySize;
+    f32    deltaTime;
+
+    RenderSnapshot snapshots[2];
+    u32            renderSnapshot; // Index of the snapshot published to the render thread
+    bool           isStepReady;    // The other snapshot holds a finished step that was not published yet
+    JobCounter     stepCounter;
+    u64            simulatedFrames;
+
+    f32 stepMs; // Last step on its thread
+    f32 waitMs; // Time Render spent waiting for the step after submitting
+    u32 latencyFrames; // Frames between the input of the published snapshot and its display
+};
+
+namespace FramePipeline
+{
+    // Takes the initial camera from app->camera
+    void Init(App* app);
+
+    // Latches the frame inputs, then publishes the step simulated during the last Render, or runs one inline
+    void Update(App* app);
+
+    // Starts simulating the next frame on a worker. Pipelined mode only, call before submitting.
+    void BeginStep(App* app);
+
+    // Waits for the step started by BeginStep, so the next Update can publish it
+    void EndStep(App* app);
+
+    // The snapshot the render thread draws this frame
+    const RenderSnapshot& GetRenderSnapshot(const App* app);
+
+    void DrawGui(App* app);
+}
+
+#endif // !FRAME_PIPELINE_FUNC
@@ -0,0 +1,194 @@
+#include "engine.h"
+#include "GLStateFuncs.h"
+#include <imgui.h>
+
+namespace GLState
+{
+    static const char* CallNames[GLStateCall_Count] = { "glUseProgram", "glBindVertexArray", "glBindFramebuffer", "glActiveTexture", "glBindTexture", "glBindBufferRange/Base", "glVertexAttrib3f" };
+
+    // Whether the call must reach the driver, counting it either way
+    static bool Issue(GLStateCache& cache, GLStateCall call, bool isRedundant)
+    {
+        if (isRedundant && cache.isEnabled)
+        {
+            cache.elided[call]++;
+            return false;
+        }
+
+        cache.issued[call]++;
+        return true;
+    }
+
+    static GLBufferBinding* FindBufferBinding(GLStateCache& cache, GLenum target, u32 index)
+    {
+        if (index >= GL_STATE_BUFFER_BINDINGS)
+            return NULL;
+
+        switch (target)
+        {
+        case GL_UNIFORM_BUFFER:        return &cache.uniformBuffers[index];
+        case GL_SHADER_STORAGE_BUFFER: return &cache.storageBuffers[index];
+        default:                       return NULL;
+        }
+    }
+
+    static void BindBuffer(App* app, GLenum target, u32 index, GLuint buffer, GLintptr offset, GLsizeiptr size)
+    {
+        GLStateCache& cache = app->glState;
+        GLBufferBinding* binding = FindBufferBinding(cache, target, index);
+
+        const bool isRedundant = binding && binding->buffer == buffer && binding->offset == offset && binding->size == size;
+        if (!Issue(cache, GLStateCall_Buffer, isRedundant))
+            return;
+
+        if (size < 0)
+            glBindBufferBase(target, index, buffer);
+        else
+            glBindBufferRange(target, index, buffer, offset, size);
+
+        if (binding)
+        {
+            binding->buffer = buffer;
+            binding->offset = offset;
+            binding->size = size;
+        }
+    }
+
+    void Invalidate(App* app)
+    {
+        GLStateCache& cache = app->glState;
+        cache.program = GL_STATE_UNKNOWN;
+        cache.vertexArray = GL_STATE_UNKNOWN;
+        cache.drawFramebuffer = GL_STATE_UNKNOWN;
+        cache.readFramebuffer = GL_STATE_UNKNOWN;
+        cache.activeUnit = GL_STATE_UNKNOWN;
+        cache.isDequantKnown = false;
+
+        for (GLTextureBinding& texture : cache.textures)
+            texture = { GL_NONE, GL_STATE_UNKNOWN };
+
+        for (u32 i = 0; i < GL_STATE_BUFFER_BINDINGS; ++i)
+        {
+            cache.uniformBuffers[i] = { GL_STATE_UNKNOWN, 0, 0 };
+            cache.storageBuffers[i] = { GL_STATE_UNKNOWN, 0, 0 };
+        }
+    }
+
+    void BeginFrame(App* app)
+    {
+        GLStateCache& cache = app->glState;
+        memcpy(cache.lastIssued, cache.issued, sizeof(cache.issued));
+        memcpy(cache.lastElided, cache.elided, sizeof(cache.elided));
+        memset(cache.issued, 0, sizeof(cache.issued));
+        memset(cache.elided, 0, sizeof(cache.elided));
+
+        Invalidate(app);
+    }
+
+    void UseProgram(App* app, GLuint program)
+    {
+        GLStateCache& cache = app->glState;
+        if (!Issue(cache, GLStateCall_Program, cache.program == program))
+            return;
+
+        glUseProgram(program);
+        cache.program = program;
+    }
+
+    void BindVertexArray(App* app, GLuint vertexArray)
+    {
+        GLStateCache& cache = app->glState;
+        if (!Issue(cache, GLStateCall_VertexArray, cache.vertexArray == vertexArray))
+            return;
+
+        glBindVertexArray(vertexArray);
+        cache.vertexArray = vertexArray;
+    }
+
+    void BindFramebuffer(App* app, GLenum target, GLuint framebuffer)
+    {
+        GLStateCache& cache = app->glState;
+        const bool bindsDraw = target == GL_FRAMEBUFFER || target == GL_DRAW_FRAMEBUFFER;
+        const bool bindsRead = target == GL_FRAMEBUFFER || target == GL_READ_FRAMEBUFFER;
+
+        const bool isRedundant = (!bindsDraw || cache.drawFramebuffer == framebuffer) && (!bindsRead || cache.readFramebuffer == framebuffer);
+        if (!Issue(cache, GLStateCall_Framebuffer, isRedundant))
+            return;
+
+        glBindFramebuffer(target, framebuffer);
+        if (bindsDraw)
+            cache.drawFramebuffer = framebuffer;
+        if (bindsRead)
+            cache.readFramebuffer = framebuffer;
+    }
+
+    void ActiveTexture(App* app, u32 unit)
+    {
+        GLStateCache& cache = app->glState;
+        if (!Issue(cache, GLStateCall_ActiveTexture, cache.activeUnit == unit))
+            return;
+
+        glActiveTexture(GL_TEXTURE0 + unit);
+        cache.activeUnit = unit;
+    }
+
+    void BindTexture(App* app, u32 unit, GLenum target, GLuint texture)
+    {
+        GLStateCache& cache = app->glState;
+
+        // A unit holds one binding per target, only the last one is shadowed
+        GLTextureBinding* binding = unit < GL_STATE_TEXTURE_UNITS ? &cache.textures[unit] : NULL;
+        const bool isRedundant = binding && binding->target == target && binding->texture == texture;
+        if (!Issue(cache, GLStateCall_Texture, isRedundant))
+            return;
+
+        ActiveTexture(app, unit);
+        glBindTexture(target, texture);
+
+        if (binding)
+        {
+            binding->target = target;
+            binding->texture = texture;
+        }
+    }
+
+    void BindBufferRange(App* app, GLenum target, u32 index, GLuint buffer, GLintptr offset, GLsizeiptr size)
+    {
+        BindBuffer(app, target, index, buffer, offset, size);
+    }
+
+    void BindBufferBase(App* app, GLenum target, u32 index, GLuint buffer)
+    {
+        BindBuffer(app, target, index, buffer, 0, -1);
+    }
+
+    void SetPositionDequantization(App* app, vec3 scale, vec3 bias)
+    {
+        GLStateCache& cache = app->glState;
+        const bool isRedundant = cache.isDequantKnown && cache.positionScale == scale && cache.positionBias == bias;
+        if (!Issue(cache, GLStateCall_VertexAttrib, isRedundant))
+            return;
+
+        glVertexAttrib3f(VERTEX_DEQUANT_SCALE_LOCATION, scale.x, scale.y, scale.z);
+        glVertexAttrib3f(VERTEX_DEQUANT_BIAS_LOCATION, bias.x, bias.y, bias.z);
+        cache.positionScale = scale;
+        cache.positionBias = bias;
+        cache.isDequantKnown = true;
+    }
+
+    void DrawGui(App* app)
+    {
+        GLStateCache& cache = app->glState;
+        ImGui::Checkbox("Elide redundant binds", &cache.isEnabled);
+
+        u32 totalIssued = 0;
+        u32 totalElided = 0;
+        for (u32 i = 0; i < GLStateCall_Count; ++i)
+        {
+            ImGui::Text("%-24s issued %5u  elided %5u", CallNames[i], cache.lastIssued[i], cache.lastElided[i]);
+            totalIssued += cache.lastIssued[i];
+            totalElided += cache.lastElided[i];
+        }
+        ImGui::Text("%-24s issued %5u  elided %5u", "Total", totalIssued, totalElided);
+    }
+}
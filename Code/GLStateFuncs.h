@@ -0,0 +1,93 @@
+#ifndef GL_STATE_FUNC
+#define GL_STATE_FUNC
+
+#include "Globals.h"
+
+struct App;
+
+#define GL_STATE_TEXTURE_UNITS 16
+#define GL_STATE_BUFFER_BINDINGS 16 // Per indexed target, higher indices are never elided
+#define GL_STATE_UNKNOWN 0xFFFFFFFFu // Shadow value that matches no object, so the next bind is issued
+
+enum GLStateCall
+{
+    GLStateCall_Program,
+    GLStateCall_VertexArray,
+    GLStateCall_Framebuffer,
+    GLStateCall_ActiveTexture,
+    GLStateCall_Texture,
+    GLStateCall_Buffer,
+    GLStateCall_VertexAttrib,
+    GLStateCall_Count
+};
+
+struct GLTextureBinding
+{
+    GLenum target;
+    GLuint texture;
+};
+
+struct GLBufferBinding
+{
+    GLuint     buffer;
+    GLintptr   offset;
+    GLsizeiptr size; // -1 for glBindBufferBase
+};
+
+// Shadow of the bindings the renderer changes every frame. Binds matching the shadow are not sent to the driver.
+// Code binding these objects without going through GLState must call Invalidate before the next cached bind.
+struct GLStateCache
+{
+    bool isEnabled;
+
+    GLuint           program;
+    GLuint           vertexArray;
+    GLuint           drawFramebuffer;
+    GLuint           readFramebuffer;
+    u32              activeUnit;
+    GLTextureBinding textures[GL_STATE_TEXTURE_UNITS];
+    GLBufferBinding  uniformBuffers[GL_STATE_BUFFER_BINDINGS];
+    GLBufferBinding  storageBuffers[GL_STATE_BUFFER_BINDINGS];
+    vec3             positionScale; // VERTEX_DEQUANT_SCALE/BIAS_LOCATION constants
+    vec3             positionBias;
+    bool             isDequantKnown;
+
+    // Counted during the frame, shown for the previous one
+    u32 issued[GLStateCall_Count];
+    u32 elided[GLStateCall_Count];
+    u32 lastIssued[GLStateCall_Count];
+    u32 lastElided[GLStateCall_Count];
+};
+
+namespace GLState
+{
+    // Forgets every shadowed binding, so the next bind of each kind reaches the driver
+    void Invalidate(App* app);
+
+    // Publishes the counters of the last frame and invalidates, since ImGui and resource loading bind outside the cache
+    void BeginFrame(App* app);
+
+    void UseProgram(App* app, GLuint program);
+
+    void BindVertexArray(App* app, GLuint vertexArray);
+
+    // GL_FRAMEBUFFER binds both the draw and the read framebuffer
+    void BindFramebuffer(App* app, GLenum target, GLuint framebuffer);
+
+    void ActiveTexture(App* app, u32 unit);
+
+    // Selects the unit only when the binding changes, so call ActiveTexture before editing the bound texture
+    void BindTexture(App* app, u32 unit, GLenum target, GLuint texture);
+
+    // GL_UNIFORM_BUFFER or GL_SHADER_STORAGE_BUFFER
+    void BindBufferRange(App* app, GLenum target, u32 index, GLuint buffer, GLintptr offset, GLsizeiptr size);
+
+    void BindBufferBase(App* app, GLenum target, u32 index, GLuint buffer);
+
+    // Position dequantization of the submesh being drawn, constant attributes of the mesh programs
+    void SetPositionDequantization(App* app, vec3 scale, vec3 bias);
+
+    void DrawGui(App* app);
+}
+
+#endif // !GL_STATE_FUNC
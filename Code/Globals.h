@@ -6,6 +6,7 @@
 #include <glm/glm.hpp>
 #include <glm/gtx/transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
+#include <deque>
 #include <string>
 #include <vector>
 
@@ -28,6 +29,7 @@ typedef glm::vec4  vec4;
 typedef glm::ivec2 ivec2;
 typedef glm::ivec3 ivec3;
 typedef glm::ivec4 ivec4;
+typedef glm::uvec4 uvec4;
 
 enum MouseButton {
     LEFT,
@@ -59,11 +61,18 @@ struct Input {
     ButtonState keys[KEY_COUNT];
 };
 
+// Per-draw constant attributes of the mesh programs, read through glVertexAttrib rather than a buffer.
+// Positions are stored * scale + bias, which is the identity for float32 positions.
+#define VERTEX_DEQUANT_SCALE_LOCATION 6
+#define VERTEX_DEQUANT_BIAS_LOCATION  7
+
 struct VertexBufferAttribute
 {
-    u8 location;
-    u8 componentCount;
-    u8 offset;
+    u8  location;
+    u8  componentCount;
+    u8  offset;
+    u8  normalized; // Integer components read as [0, 1] or [-1, 1] floats
+    u16 type;       // GL_FLOAT, GL_HALF_FLOAT, GL_SHORT, GL_UNSIGNED_SHORT or GL_INT_2_10_10_10_REV
 };
 
 struct VertexBufferLayout
@@ -92,11 +101,20 @@ struct VAO
 struct SubMesh
 {
     VertexBufferLayout vertexBufferLayout;
-    std::vector<float> vertices;
+    std::vector<u8> vertices; // Interleaved, in the types of the layout
     std::vector<u32> indices;
     u32 vertexOffset;
     u32 indexOffset;
 
+    // Object space bounds
+    vec3 aabbMin;
+    vec3 aabbMax;
+    vec4 boundingSphere; // xyz center, w radius
+
+    // Position dequantization, fed to VERTEX_DEQUANT_SCALE/BIAS_LOCATION
+    vec3 positionScale;
+    vec3 positionBias;
+
     std::vector<VAO> vaos;
 };
 
@@ -105,6 +123,11 @@ struct Mesh
     std::vector<SubMesh>    submeshes;
     GLuint                  vertexBufferHandle;
     GLuint                  indexBufferHandle;
+
+    // Union of the submesh bounds
+    vec3                    aabbMin;
+    vec3                    aabbMax;
+    vec4                    boundingSphere;
 };
 
 struct Image
@@ -115,10 +138,33 @@ struct Image
     i32   stride;
 };
 
+enum TextureState
+{
+    TextureState_Resident,
+    TextureState_Loading,
+    TextureState_Failed
+};
+
 struct Texture
 {
-    GLuint      handle;
-    std::string filepath;
+    GLuint       handle;
+    std::string  filepath;
+    TextureState state;
+};
+
+struct ProgramUniform
+{
+    std::string name;
+    GLint       location;
+    GLenum      type;
+};
+
+struct ProgramUniformBlock
+{
+    std::string name;
+    GLuint      index;
+    GLint       binding;
+    GLint       dataSize;
 };
 
 struct Program
@@ -126,8 +172,16 @@ struct Program
     GLuint             handle;
     std::string        filepath;
     std::string        programName;
-    u64                lastWriteTimestamp; // What is this for?
+    u64                lastWriteTimestamp; // Of the source when last compiled, polled for hot reload
+    bool               isCompute;
+    u32                features;          // ShaderFeature bits, SHADER_FEATURES_GENERIC for the program without permutation defines
+    u32                genericProgramIdx; // Program a variant was derived from
     VertexShaderLayout shaderLayout;
+
+    // Reflected once at load time, so nothing queries the driver by name while rendering
+    std::vector<ProgramUniform>      uniforms;
+    std::vector<ProgramUniformBlock> uniformBlocks;
+    GLint                            inverseViewProjectionLocation; // Set every frame by the packed lighting pass, -1 if unused
 };
 
 struct Model
@@ -144,6 +198,21 @@ enum Mode
     Mode_Count
 };
 
+enum RenderPath
+{
+    RenderPath_Direct,
+    RenderPath_Indirect,
+    RenderPath_Instanced,
+    RenderPath_Count
+};
+
+enum GBufferLayout
+{
+    GBufferLayout_Full,   // Albedo RGBA8, normal/position/view direction and material targets RGBA16F
+    GBufferLayout_Packed, // Albedo RGBA8, octahedral normal RG16, metallic/roughness/AO RGBA8, position from depth
+    GBufferLayout_Count
+};
+
 struct VertexV3V2
 {
     glm::vec3 pos;
@@ -168,6 +237,9 @@ struct Material
     u32             normalsTextureIdx;
     u32             bumpTextureIdx;
     int             useTexture;
+    u32             shaderFeatures;   // ShaderFeature bits the material selects
+    u32             localParamOffset; // Range of the material in the material uniform buffer
+    u32             localParamSize;
 };
 
 struct Buffer {
@@ -178,11 +250,27 @@ struct Buffer {
     u32 head;
 };
 
+#define RING_BUFFER_FRAME_COUNT 3
+
+// Persistently mapped buffer split in RING_BUFFER_FRAME_COUNT frame regions per page.
+// Pages are chained when a frame needs more space than a region holds.
+struct RingBuffer {
+    GLenum type;
+    u32 frameSize;
+    std::deque<Buffer> pages; // Only appended to, so references to a page stay valid
+    GLsync fences[RING_BUFFER_FRAME_COUNT];
+    u32 frameIndex;
+    u32 pageIndex;
+    bool isPersistent;
+    bool isFrameOpen;
+};
+
 struct Entity {
     glm::mat4 worldMatrix;
     u32 modelIndex;
     u32 localParamOffset;
     u32 localParamSize;
+    GLuint localParamBuffer;
 };
 
 enum LightType
@@ -197,6 +285,7 @@ struct Light
     vec3 color;
     vec3 direction;
     vec3 position;
+    f32 radius; // Point lights only, distance at which their contribution reaches zero
 };
 
 struct FrameBuffer
@@ -223,6 +312,9 @@ struct Camera
     float zfar = 1000.0f;
     float fovYRad;
 
+    glm::mat4 viewMatrix;
+    glm::mat4 projectionMatrix;
+
     glm::vec4 getTopBottomLeftRight()
     {
         glm::vec4 ret;
@@ -0,0 +1,248 @@
+#include "engine.h"
+#include "IndirectRenderFuncs.h"
+#include <algorithm>
+
+namespace IndirectRenderer
+{
+    // Offset (in floats) inside an arena vertex of the attribute bound to each shader location
+    static const u32 ArenaAttributeOffsets[] = { 0, 3, 6, 8 };
+    static const u32 ArenaAttributeComponents[] = { 3, 3, 2, 4 };
+
+    static void EnsureDrawIdCapacity(IndirectRenderState& state, u32 drawCount)
+    {
+        if (drawCount <= state.drawIdCapacity)
+            return;
+
+        u32 capacity = state.drawIdCapacity > 0 ? state.drawIdCapacity * 2 : 1024;
+        capacity = capacity < drawCount ? drawCount : capacity;
+
+        std::vector<u32> drawIds(capacity);
+        for (u32 i = 0; i < capacity; ++i)
+            drawIds[i] = i;
+
+        glBindBuffer(GL_ARRAY_BUFFER, state.drawIdBuffer);
+        glBufferData(GL_ARRAY_BUFFER, capacity * sizeof(u32), drawIds.data(), GL_STATIC_DRAW);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+        state.drawIdCapacity = capacity;
+    }
+
+    void BuildArenas(App* app)
+    {
+        IndirectRenderState& state = app->indirect;
+
+        std::vector<float> vertices;
+        std::vector<u32> indices;
+
+        state.meshRanges.clear();
+        state.meshRanges.resize(app->meshes.size());
+
+        for (u32 meshIdx = 0; meshIdx < app->meshes.size(); ++meshIdx)
+        {
+            const Mesh& mesh = app->meshes[meshIdx];
+            for (const SubMesh& submesh : mesh.submeshes)
+            {
+                ArenaRange range = {};
+                range.baseVertex = vertices.size() / ARENA_VERTEX_FLOATS;
+                range.firstIndex = indices.size();
+                range.indexCount = submesh.indices.size();
+                state.meshRanges[meshIdx].push_back(range);
+
+                const u32 vertexCount = submesh.vertices.size() / submesh.vertexBufferLayout.stride;
+                const u32 arenaBase = vertices.size();
+                vertices.resize(arenaBase + vertexCount * ARENA_VERTEX_FLOATS, 0.0f);
+
+                for (const VertexBufferAttribute& attribute : submesh.vertexBufferLayout.attributes)
+                {
+                    if (attribute.location >= ARRAY_COUNT(ArenaAttributeOffsets))
+                        continue;
+
+                    // The arena stays float32 and dequantized, its draws share one identity dequantization
+                    const u32 dstOffset = ArenaAttributeOffsets[attribute.location];
+                    for (u32 v = 0; v < vertexCount; ++v)
+                    {
+                        vec4 value = ModelLoader::ReadVertexAttribute(submesh, attribute, v);
+                        if (attribute.location == 0)
+                            value = vec4(vec3(value) * submesh.positionScale + submesh.positionBias, 1.0f);
+
+                        for (u32 c = 0; c < ArenaAttributeComponents[attribute.location]; ++c)
+                            vertices[arenaBase + v * ARENA_VERTEX_FLOATS + dstOffset + c] = value[c];
+                    }
+                }
+
+                indices.insert(indices.end(), submesh.indices.begin(), submesh.indices.end());
+            }
+        }
+
+        if (state.vao == 0)
+        {
+            glGenBuffers(1, &state.vertexArena);
+            glGenBuffers(1, &state.indexArena);
+            glGenBuffers(1, &state.drawIdBuffer);
+            glGenBuffers(1, &state.materialsBuffer);
+            glGenVertexArrays(1, &state.vao);
+            glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &state.storageBlockAlignment);
+        }
+
+        glBindBuffer(GL_ARRAY_BUFFER, state.vertexArena);
+        glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(float), vertices.data(), GL_STATIC_DRAW);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+        EnsureDrawIdCapacity(state, 1);
+
+        GLState::BindVertexArray(app, state.vao);
+
+        glBindBuffer(GL_ARRAY_BUFFER, state.vertexArena);
+        for (u32 location = 0; location < ARRAY_COUNT(ArenaAttributeOffsets); ++location)
+        {
+            const u32 offset = ArenaAttributeOffsets[location] * sizeof(float);
+            glVertexAttribPointer(location, ArenaAttributeComponents[location], GL_FLOAT, GL_FALSE, ARENA_VERTEX_FLOATS * sizeof(float), (void*)(u64)offset);
+            glEnableVertexAttribArray(location);
+        }
+
+        // The draw index is fetched per instance, so each command selects its data through baseInstance
+        glBindBuffer(GL_ARRAY_BUFFER, state.drawIdBuffer);
+        glVertexAttribIPointer(ARENA_DRAW_ID_LOCATION, 1, GL_UNSIGNED_INT, sizeof(u32), (void*)0);
+        glVertexAttribDivisor(ARENA_DRAW_ID_LOCATION, 1);
+        glEnableVertexAttribArray(ARENA_DRAW_ID_LOCATION);
+
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, state.indexArena);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(u32), indices.data(), GL_STATIC_DRAW);
+
+        GLState::BindVertexArray(app, 0);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+    }
+
+    struct PendingDraw
+    {
+        GLuint textureHandle;
+        u32    entityIdx;
+        u32    submeshIdx;
+    };
+
+    void UpdateDrawBuffers(App* app)
+    {
+        IndirectRenderState& state = app->indirect;
+
+        if (state.meshRanges.size() != app->meshes.size())
+            BuildArenas(app);
+
+        // Materials are never edited once created, only new ones need an upload
+        if (state.materialCount != app->materials.size())
+        {
+            std::vector<IndirectMaterialParams> materialParams(app->materials.size());
+            for (u32 i = 0; i < app->materials.size(); ++i)
+            {
+                const Material& material = app->materials[i];
+                materialParams[i] = {};
+                materialParams[i].albedo = vec4(material.albedo, 1.0f);
+                materialParams[i].emissive = vec4(material.emissive, 1.0f);
+                materialParams[i].smoothness = material.smoothness;
+                materialParams[i].useTexture = material.useTexture;
+            }
+
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, state.materialsBuffer);
+            glBufferData(GL_SHADER_STORAGE_BUFFER, materialParams.size() * sizeof(IndirectMaterialParams), materialParams.data(), GL_STATIC_DRAW);
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+            state.materialCount = app->materials.size();
+        }
+
+        // Gather every submesh of every visible entity and order them by texture, so each texture is one batch
+        std::vector<PendingDraw> pendingDraws;
+        for (u32 entityIdx : app->culling.visibleEntities)
+        {
+            const Model& model = app->models[app->entities[entityIdx].modelIndex];
+            for (u32 submeshIdx = 0; submeshIdx < model.materialIdx.size(); ++submeshIdx)
+            {
+                const Material& material = app->materials[model.materialIdx[submeshIdx]];
+                const u32 textureIdx = material.useTexture ? material.albedoTextureIdx : app->whiteTexIdx;
+                pendingDraws.push_back({ TextureStreamer::GetResidentHandle(app, textureIdx), entityIdx, submeshIdx });
+            }
+        }
+
+        std::sort(pendingDraws.begin(), pendingDraws.end(),
+            [](const PendingDraw& a, const PendingDraw& b) { return a.textureHandle < b.textureHandle; });
+
+        const glm::mat4 viewProjection = app->camera.projectionMatrix * app->camera.viewMatrix;
+
+        state.batches.clear();
+        state.commandCount = pendingDraws.size();
+        if (pendingDraws.empty())
+            return;
+
+        // Written straight into the ring, the ranges must satisfy both the uniform and the storage alignment
+        const u32 alignment = glm::max(app->uniformBlockAligment, state.storageBlockAlignment);
+        Buffer& paramsBuffer = BufferManager::ReserveRingBlock(app->uniformRing, pendingDraws.size() * sizeof(IndirectDrawParams), alignment);
+        BufferManager::AlignHead(paramsBuffer, alignment);
+        state.drawParamsBuffer = paramsBuffer.handle;
+        state.drawParamsOffset = paramsBuffer.head;
+
+        for (u32 drawIdx = 0; drawIdx < pendingDraws.size(); ++drawIdx)
+        {
+            const PendingDraw& draw = pendingDraws[drawIdx];
+            const Entity& entity = app->entities[draw.entityIdx];
+            const Model& model = app->models[entity.modelIndex];
+
+            IndirectDrawParams params = {};
+            params.worldMatrix = entity.worldMatrix;
+            params.worldViewProjectionMatrix = viewProjection * entity.worldMatrix;
+            params.materialIdx = model.materialIdx[draw.submeshIdx];
+            PushData(paramsBuffer, &params, sizeof(params));
+
+            if (state.batches.empty() || state.batches.back().textureHandle != draw.textureHandle)
+                state.batches.push_back({ draw.textureHandle, drawIdx, 0 });
+            state.batches.back().commandCount++;
+        }
+        state.drawParamsSize = paramsBuffer.head - state.drawParamsOffset;
+
+        Buffer& commandBuffer = BufferManager::ReserveRingBlock(app->uniformRing, pendingDraws.size() * sizeof(DrawElementsIndirectCommand), sizeof(u32));
+        BufferManager::AlignHead(commandBuffer, sizeof(u32));
+        state.commandBuffer = commandBuffer.handle;
+        state.commandOffset = commandBuffer.head;
+
+        for (u32 drawIdx = 0; drawIdx < pendingDraws.size(); ++drawIdx)
+        {
+            const PendingDraw& draw = pendingDraws[drawIdx];
+            const Model& model = app->models[app->entities[draw.entityIdx].modelIndex];
+            const ArenaRange& range = state.meshRanges[model.meshIdx][draw.submeshIdx];
+
+            DrawElementsIndirectCommand command = {};
+            command.count = range.indexCount;
+            command.instanceCount = 1;
+            command.firstIndex = range.firstIndex;
+            command.baseVertex = range.baseVertex;
+            command.baseInstance = drawIdx;
+            PushData(commandBuffer, &command, sizeof(command));
+        }
+
+        EnsureDrawIdCapacity(state, state.commandCount);
+    }
+
+    void RenderGeometry(App* app)
+    {
+        IndirectRenderState& state = app->indirect;
+
+        GLState::BindBufferRange(app, GL_UNIFORM_BUFFER, BINDING(0), app->globalParamsBuffer, app->globalParamsOffset, app->globalParamsSize);
+        if (state.commandCount == 0)
+            return;
+
+        GLState::BindBufferRange(app, GL_SHADER_STORAGE_BUFFER, INDIRECT_DRAW_PARAMS_BINDING, state.drawParamsBuffer, state.drawParamsOffset, state.drawParamsSize);
+        GLState::BindBufferBase(app, GL_SHADER_STORAGE_BUFFER, INDIRECT_MATERIALS_BINDING, state.materialsBuffer);
+
+        GLState::BindVertexArray(app, state.vao);
+        GLState::SetPositionDequantization(app, vec3(1.0f), vec3(0.0f));
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, state.commandBuffer);
+
+        for (const IndirectBatch& batch : state.batches)
+        {
+            GLState::BindTexture(app, 0, GL_TEXTURE_2D, batch.textureHandle);
+            glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT,
+                (void*)(u64)(state.commandOffset + batch.firstCommand * sizeof(DrawElementsIndirectCommand)),
+                batch.commandCount, 0);
+        }
+
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+        GLState::BindVertexArray(app, 0);
+    }
+}
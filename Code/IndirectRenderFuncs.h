@@ -0,0 +1,100 @@
+#ifndef INDIRECT_RENDER_FUNC
+#define INDIRECT_RENDER_FUNC
+
+#include "Globals.h"
+
+struct App;
+
+// Every static mesh is repacked into the arena with this layout (in floats):
+// position(3) normal(3) uv(2) tangent(4, w the bitangent handedness). Missing attributes are zero filled.
+// Positions are stored dequantized, whatever the layout of the source submesh.
+#define ARENA_VERTEX_FLOATS 12
+#define ARENA_DRAW_ID_LOCATION 5
+
+// Binding points of the storage buffers read by the *_INDIRECT shaders
+#define INDIRECT_DRAW_PARAMS_BINDING 0
+#define INDIRECT_MATERIALS_BINDING 1
+
+// Layout mandated by glMultiDrawElementsIndirect
+struct DrawElementsIndirectCommand
+{
+    u32 count;
+    u32 instanceCount;
+    u32 firstIndex;
+    u32 baseVertex;
+    u32 baseInstance;
+};
+
+struct ArenaRange
+{
+    u32 baseVertex;
+    u32 firstIndex;
+    u32 indexCount;
+};
+
+// std430 mirror of DrawParams in the shaders
+struct IndirectDrawParams
+{
+    glm::mat4 worldMatrix;
+    glm::mat4 worldViewProjectionMatrix;
+    u32       materialIdx;
+    u32       padding[3];
+};
+
+// std430 mirror of MaterialParams in the shaders
+struct IndirectMaterialParams
+{
+    vec4 albedo;
+    vec4 emissive;
+    f32  smoothness;
+    i32  useTexture;
+    u32  padding[2];
+};
+
+// Consecutive commands sharing the same albedo texture, submitted with one glMultiDrawElementsIndirect
+struct IndirectBatch
+{
+    GLuint textureHandle;
+    u32    firstCommand;
+    u32    commandCount;
+};
+
+struct IndirectRenderState
+{
+    GLuint vao;
+    GLuint vertexArena;
+    GLuint indexArena;
+    GLuint drawIdBuffer;
+    GLuint materialsBuffer;
+    u32    materialCount; // Materials in materialsBuffer, they only change when a model is loaded
+    u32    drawIdCapacity;
+    GLint  storageBlockAlignment;
+
+    // This frame's draw params and commands, in the uniform ring
+    GLuint drawParamsBuffer;
+    u32    drawParamsOffset;
+    u32    drawParamsSize;
+    GLuint commandBuffer;
+    u32    commandOffset;
+    u32    commandCount;
+
+    std::vector<std::vector<ArenaRange>> meshRanges; // [meshIdx][submeshIdx]
+
+    std::vector<IndirectBatch> batches;
+};
+
+namespace IndirectRenderer
+{
+    // Packs every loaded mesh into the shared vertex/index arenas
+    void BuildArenas(App* app);
+
+    // Writes the draw commands and per-draw data of the frame in the uniform ring, so call it while the
+    // ring frame is open. The materials are uploaded again only when their count changes.
+    void UpdateDrawBuffers(App* app);
+
+    // Submits the frame draws with one glMultiDrawElementsIndirect per texture batch.
+    // The bound program must be one of the *_INDIRECT shader variants.
+    void RenderGeometry(App* app);
+}
+
+#endif // !INDIRECT_RENDER_FUNC
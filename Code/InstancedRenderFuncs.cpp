@@ -0,0 +1,104 @@
+#include "engine.h"
+#include "InstancedRenderFuncs.h"
+#include <algorithm>
+
+namespace InstancedRenderer
+{
+    void Init(App* app)
+    {
+        glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &app->instanced.storageBlockAlignment);
+    }
+
+    void UpdateInstanceBuffers(App* app)
+    {
+        InstancedRenderState& state = app->instanced;
+        state.groups.clear();
+
+        // The simulation step computed the matrices of the visible entities, in the order of the visible list
+        const RenderSnapshot& snapshot = FramePipeline::GetRenderSnapshot(app);
+        const std::vector<u32>& visibleEntities = app->culling.visibleEntities;
+
+        // Order by model so every group is a contiguous run. Positions in the visible list are sorted rather than
+        // entity indices, so each one still finds its matrices in the snapshot.
+        state.sortedVisible.resize(visibleEntities.size());
+        for (u32 i = 0; i < visibleEntities.size(); ++i)
+            state.sortedVisible[i] = i;
+        std::sort(state.sortedVisible.begin(), state.sortedVisible.end(),
+            [app, &visibleEntities](u32 a, u32 b) { return app->entities[visibleEntities[a]].modelIndex < app->entities[visibleEntities[b]].modelIndex; });
+
+        // The ring was created for uniform blocks, so the ranges must satisfy both alignments
+        const u32 alignment = glm::max(app->uniformBlockAligment, state.storageBlockAlignment);
+
+        u32 runStart = 0;
+        while (runStart < state.sortedVisible.size())
+        {
+            const u32 modelIdx = app->entities[visibleEntities[state.sortedVisible[runStart]]].modelIndex;
+            u32 runEnd = runStart + 1;
+            while (runEnd < state.sortedVisible.size() && app->entities[visibleEntities[state.sortedVisible[runEnd]]].modelIndex == modelIdx)
+                ++runEnd;
+
+            const u32 instanceCount = runEnd - runStart;
+            Buffer& instanceBuffer = BufferManager::ReserveRingBlock(app->uniformRing, instanceCount * sizeof(InstanceParams), alignment);
+            BufferManager::AlignHead(instanceBuffer, alignment);
+
+            InstanceGroup group = {};
+            group.modelIdx = modelIdx;
+            group.instanceCount = instanceCount;
+            group.instanceBuffer = instanceBuffer.handle;
+            group.instanceOffset = instanceBuffer.head;
+
+            for (u32 i = runStart; i < runEnd; ++i)
+            {
+                const u32 visibleIdx = state.sortedVisible[i];
+                PushMat4(instanceBuffer, snapshot.entityMatrices[2 * visibleIdx]);
+                PushMat4(instanceBuffer, snapshot.entityMatrices[2 * visibleIdx + 1]);
+            }
+
+            group.instanceSize = instanceBuffer.head - group.instanceOffset;
+            state.groups.push_back(group);
+
+            runStart = runEnd;
+        }
+    }
+
+    void RenderGeometry(App* app, u32 programIdx, u32 passFeatures)
+    {
+        InstancedRenderState& state = app->instanced;
+
+        GLState::BindBufferRange(app, GL_UNIFORM_BUFFER, BINDING(0), app->globalParamsBuffer, app->globalParamsOffset, app->globalParamsSize);
+
+        for (const InstanceGroup& group : state.groups)
+        {
+            GLState::BindBufferRange(app, GL_SHADER_STORAGE_BUFFER, INSTANCED_INSTANCES_BINDING, group.instanceBuffer, group.instanceOffset, group.instanceSize);
+
+            Model& model = app->models[group.modelIdx];
+            Mesh& mesh = app->meshes[model.meshIdx];
+
+            for (u32 i = 0; i < mesh.submeshes.size(); ++i)
+            {
+                SubMesh& submesh = mesh.submeshes[i];
+                Material& subMeshMaterial = app->materials[model.materialIdx[i]];
+
+                const u32 features = passFeatures | ShaderPermutation::DrawFeatures(subMeshMaterial, submesh);
+                const Program& program = app->programs[ShaderPermutation::Get(app, programIdx, features)];
+                GLState::UseProgram(app, program.handle);
+
+                GLuint vao = FindVAO(mesh, i, program);
+                GLState::BindVertexArray(app, vao);
+
+                GLState::BindTexture(app, 0, GL_TEXTURE_2D, TextureStreamer::GetResidentHandle(app, subMeshMaterial.albedoTextureIdx));
+                if (features & ShaderFeature_NormalMap)
+                {
+                    GLState::BindTexture(app, 1, GL_TEXTURE_2D, TextureStreamer::GetResidentHandle(app, subMeshMaterial.normalsTextureIdx));
+                }
+                GLState::BindBufferRange(app, GL_UNIFORM_BUFFER, BINDING(2), app->materialUniformBuffer.handle, subMeshMaterial.localParamOffset, subMeshMaterial.localParamSize);
+
+                GLState::SetPositionDequantization(app, submesh.positionScale, submesh.positionBias);
+
+                glDrawElementsInstanced(GL_TRIANGLES, submesh.indices.size(), GL_UNSIGNED_INT, (void*)(u64)submesh.indexOffset, group.instanceCount);
+            }
+        }
+
+        GLState::BindVertexArray(app, 0);
+    }
+}
@@ -0,0 +1,48 @@
+#ifndef INSTANCED_RENDER_FUNC
+#define INSTANCED_RENDER_FUNC
+
+#include "Globals.h"
+
+struct App;
+
+// Binding point of the storage buffer read by the *_INSTANCED shaders
+#define INSTANCED_INSTANCES_BINDING 2
+
+// std430 mirror of InstanceParams in the shaders
+struct InstanceParams
+{
+    glm::mat4 worldMatrix;
+    glm::mat4 worldViewProjectionMatrix;
+};
+
+// Visible entities sharing a model. Every submesh of the model is drawn once for the whole group.
+struct InstanceGroup
+{
+    u32    modelIdx;
+    u32    instanceCount;
+    GLuint instanceBuffer;
+    u32    instanceOffset;
+    u32    instanceSize;
+};
+
+struct InstancedRenderState
+{
+    GLint                      storageBlockAlignment;
+    std::vector<InstanceGroup> groups;
+    std::vector<u32>           sortedVisible; // Scratch, positions in the visible list ordered by model
+};
+
+namespace InstancedRenderer
+{
+    void Init(App* app);
+
+    // Groups the visible entities by model and writes their instance data to the uniform ring.
+    // Call from UpdateEntityBuffer, between BeginRingFrame and EndRingWrites.
+    void UpdateInstanceBuffers(App* app);
+
+    // Submits one glDrawElementsInstanced per (model, submesh) of the frame, with the permutation of
+    // programIdx matching each material. programIdx must be one of the *_INSTANCED shader variants.
+    void RenderGeometry(App* app, u32 programIdx, u32 passFeatures);
+}
+
+#endif // !INSTANCED_RENDER_FUNC
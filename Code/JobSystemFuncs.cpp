@@ -0,0 +1,333 @@
+#include "engine.h"
+#include "JobSystemFuncs.h"
+#include <imgui.h>
+
+namespace JobSystem
+{
+    // Worker slot of the calling thread. The main thread, and any thread the system did not start, use slot 0.
+    static thread_local u32 CurrentWorker = 0;
+
+    static void Push(JobSystemState& jobs, u32 workerIdx, const Job& job)
+    {
+        JobWorker& worker = jobs.workers[workerIdx];
+        std::lock_guard<std::mutex> lock(worker.mutex);
+        worker.jobs.push_back(job);
+        jobs.queuedJobs++;
+    }
+
+    // The sleep mutex is taken so a worker cannot miss the wake up between checking queuedJobs and sleeping
+    static void WakeWorkers(JobSystemState& jobs, bool wakeAll)
+    {
+        {
+            std::lock_guard<std::mutex> lock(jobs.sleepMutex);
+        }
+
+        if (wakeAll)
+            jobs.wakeUp.notify_all();
+        else
+            jobs.wakeUp.notify_one();
+    }
+
+    static bool PopJob(JobSystemState& jobs, u32 workerIdx, Job& outJob)
+    {
+        if (jobs.queuedJobs == 0)
+            return false;
+
+        JobWorker& own = jobs.workers[workerIdx];
+        {
+            std::lock_guard<std::mutex> lock(own.mutex);
+            if (!own.jobs.empty())
+            {
+                outJob = own.jobs.back();
+                own.jobs.pop_back();
+                jobs.queuedJobs--;
+                return true;
+            }
+        }
+
+        // Steal the oldest job of another worker, starting from the next one so thieves spread over the victims
+        for (u32 i = 1; i < jobs.workerCount; ++i)
+        {
+            JobWorker& victim = jobs.workers[(workerIdx + i) % jobs.workerCount];
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            if (!victim.jobs.empty())
+            {
+                outJob = victim.jobs.front();
+                victim.jobs.pop_front();
+                jobs.queuedJobs--;
+                own.stolenJobs++;
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    static bool TryRunJob(JobSystemState& jobs, u32 workerIdx)
+    {
+        Job job;
+        if (!PopJob(jobs, workerIdx, job))
+            return false;
+
+        job.func(job.data, job.begin, job.end);
+        jobs.workers[workerIdx].executedJobs++;
+        job.counter->pending.fetch_sub(1, std::memory_order_release);
+        return true;
+    }
+
+    static void WorkerLoop(JobSystemState* jobs, u32 workerIdx)
+    {
+        CurrentWorker = workerIdx;
+
+        while (jobs->isRunning)
+        {
+            if (workerIdx < jobs->activeWorkers && TryRunJob(*jobs, workerIdx))
+                continue;
+
+            std::unique_lock<std::mutex> lock(jobs->sleepMutex);
+            jobs->wakeUp.wait(lock, [jobs, workerIdx] { return !jobs->isRunning || (workerIdx < jobs->activeWorkers && jobs->queuedJobs > 0); });
+        }
+    }
+
+    void Init(App* app)
+    {
+        JobSystemState& jobs = app->jobs;
+
+        u32 workerCount = std::thread::hardware_concurrency();
+        workerCount = workerCount > 0 ? workerCount : 1;
+        workerCount = workerCount > JOB_SYSTEM_MAX_WORKERS ? JOB_SYSTEM_MAX_WORKERS : workerCount;
+
+        jobs.workerCount = workerCount;
+        jobs.activeWorkers = workerCount;
+        jobs.queuedJobs = 0;
+        jobs.isRunning = true;
+
+        for (u32 i = 1; i < workerCount; ++i)
+            jobs.threads.emplace_back(WorkerLoop, &jobs, i);
+
+        ILOG("Job system: %u workers", workerCount);
+    }
+
+    void Shutdown(App* app)
+    {
+        JobSystemState& jobs = app->jobs;
+        {
+            std::lock_guard<std::mutex> lock(jobs.sleepMutex);
+            jobs.isRunning = false;
+        }
+        jobs.wakeUp.notify_all();
+
+        for (std::thread& thread : jobs.threads)
+            thread.join();
+        jobs.threads.clear();
+
+        for (JobWorker& worker : jobs.workers)
+            worker.jobs.clear();
+        jobs.queuedJobs = 0;
+    }
+
+    void BeginFrame(App* app)
+    {
+        JobSystemState& jobs = app->jobs;
+        for (u32 i = 0; i < jobs.workerCount; ++i)
+        {
+            JobWorker& worker = jobs.workers[i];
+            worker.lastExecutedJobs = worker.executedJobs.exchange(0);
+            worker.lastStolenJobs = worker.stolenJobs.exchange(0);
+        }
+    }
+
+    void Run(App* app, JobFunc func, void* data, u32 begin, u32 end, JobCounter* counter)
+    {
+        JobSystemState& jobs = app->jobs;
+        if (!jobs.isRunning)
+        {
+            func(data, begin, end);
+            counter->pending.fetch_sub(1, std::memory_order_release);
+            return;
+        }
+
+        Push(jobs, CurrentWorker, { func, data, begin, end, counter });
+        WakeWorkers(jobs, false);
+    }
+
+    void Wait(App* app, JobCounter* counter)
+    {
+        JobSystemState& jobs = app->jobs;
+
+        // Helping instead of blocking also keeps nested waits from deadlocking the workers
+        while (counter->pending.load(std::memory_order_acquire) > 0)
+            if (!TryRunJob(jobs, CurrentWorker))
+                std::this_thread::yield();
+    }
+
+    void ParallelFor(App* app, JobFunc func, void* data, u32 count, u32 batchSize)
+    {
+        JobSystemState& jobs = app->jobs;
+        if (count == 0)
+            return;
+
+        const u32 activeWorkers = jobs.isRunning ? (u32)jobs.activeWorkers : 1;
+        if (batchSize == 0)
+        {
+            const u32 batchCount = activeWorkers * JOB_SYSTEM_BATCHES_PER_WORKER;
+            batchSize = (count + batchCount - 1) / batchCount;
+        }
+
+        // Batches keep their bounds when run inline, callers may index per-batch outputs by begin / batchSize
+        const u32 batchCount = (count + batchSize - 1) / batchSize;
+        if (batchCount == 1 || activeWorkers == 1)
+        {
+            for (u32 begin = 0; begin < count; begin += batchSize)
+                func(data, begin, begin + batchSize < count ? begin + batchSize : count);
+            return;
+        }
+
+        JobCounter counter;
+        counter.pending = batchCount;
+
+        // The caller keeps the first batch, the others wait in its deque for the workers to steal them
+        for (u32 batch = 1; batch < batchCount; ++batch)
+        {
+            const u32 begin = batch * batchSize;
+            const u32 end = begin + batchSize < count ? begin + batchSize : count;
+            Push(jobs, CurrentWorker, { func, data, begin, end, &counter });
+        }
+        WakeWorkers(jobs, true);
+
+        func(data, 0, batchSize);
+        jobs.workers[CurrentWorker].executedJobs++;
+        counter.pending.fetch_sub(1, std::memory_order_release);
+
+        Wait(app, &counter);
+    }
+
+    struct BenchmarkScene
+    {
+        std::vector<glm::mat4>        worldMatrices;
+        std::vector<glm::mat4>        wvpMatrices;
+        EntityBoundsSoA               bounds;
+        std::vector<std::vector<u32>> batchVisible;
+        glm::mat4                     viewProjection;
+        vec4                          planes[FrustumPlane_Count];
+        u32                           batchSize;
+    };
+
+    // The per-entity work of a frame: uniforms as in UpdateEntityBuffer, world bounds and the brute force cull
+    static void PrepareBenchmarkBatch(void* data, u32 begin, u32 end)
+    {
+        BenchmarkScene* scene = (BenchmarkScene*)data;
+        EntityBoundsSoA& bounds = scene->bounds;
+
+        for (u32 i = begin; i < end; ++i)
+        {
+            const glm::mat4& world = scene->worldMatrices[i];
+            scene->wvpMatrices[i] = scene->viewProjection * world;
+
+            vec3 center, extent;
+            Culling::TransformAABB(world, vec3(-1.0f), vec3(1.0f), center, extent);
+            bounds.centerX[i] = center.x;
+            bounds.centerY[i] = center.y;
+            bounds.centerZ[i] = center.z;
+            bounds.extentX[i] = extent.x;
+            bounds.extentY[i] = extent.y;
+            bounds.extentZ[i] = extent.z;
+        }
+
+        std::vector<u32>& visible = scene->batchVisible[begin / scene->batchSize];
+        visible.clear();
+        Culling::CullBoundsRange(bounds, scene->planes, begin, end, visible);
+    }
+
+    static f32 RandomFloat(u32& state)
+    {
+        // xorshift32, deterministic so every run benchmarks the same scene
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        return (state & 0xFFFFFF) / (f32)0x1000000;
+    }
+
+    void RunBenchmark(App* app)
+    {
+        JobSystemState& jobs = app->jobs;
+        const u32 EntityCount = 100000;
+        const u32 Iterations = 10;
+
+        // Boxes scattered around the camera with a constant density, as in the culling benchmark
+        BenchmarkScene scene;
+        scene.viewProjection = app->camera.projectionMatrix * app->camera.viewMatrix;
+        Culling::ExtractFrustumPlanes(scene.viewProjection, scene.planes);
+
+        const f32 halfSize = 10.0f * cbrtf((f32)EntityCount);
+        u32 randomState = 0x9E3779B9u;
+
+        scene.worldMatrices.resize(EntityCount);
+        scene.wvpMatrices.resize(EntityCount);
+        for (u32 i = 0; i < EntityCount; ++i)
+        {
+            const vec3 position = app->camera.pos + (vec3(RandomFloat(randomState), RandomFloat(randomState), RandomFloat(randomState)) * 2.0f - 1.0f) * halfSize;
+            const f32 angle = RandomFloat(randomState) * 6.2831853f;
+            const f32 scale = 0.5f + RandomFloat(randomState) * 1.5f;
+            scene.worldMatrices[i] = glm::scale(glm::rotate(glm::translate(glm::mat4(1.0f), position), angle, vec3(0.0f, 1.0f, 0.0f)), vec3(scale));
+        }
+
+        scene.bounds.centerX.resize(EntityCount);
+        scene.bounds.centerY.resize(EntityCount);
+        scene.bounds.centerZ.resize(EntityCount);
+        scene.bounds.extentX.resize(EntityCount);
+        scene.bounds.extentY.resize(EntityCount);
+        scene.bounds.extentZ.resize(EntityCount);
+
+        const u32 previousActiveWorkers = jobs.activeWorkers;
+        jobs.benchmarkMs.assign(jobs.workerCount, 0.0f);
+
+        for (u32 workerCount = 1; workerCount <= jobs.workerCount; ++workerCount)
+        {
+            jobs.activeWorkers = workerCount;
+
+            const u32 batchCount = workerCount * JOB_SYSTEM_BATCHES_PER_WORKER;
+            scene.batchSize = (EntityCount + batchCount - 1) / batchCount;
+            scene.batchVisible.resize(batchCount);
+
+            // Warm up once so the first worker count does not pay for the allocations of the visible lists
+            ParallelFor(app, PrepareBenchmarkBatch, &scene, EntityCount, scene.batchSize);
+
+            const f64 startTime = glfwGetTime();
+            for (u32 i = 0; i < Iterations; ++i)
+                ParallelFor(app, PrepareBenchmarkBatch, &scene, EntityCount, scene.batchSize);
+            const f32 elapsedMs = (f32)((glfwGetTime() - startTime) * 1000.0 / Iterations);
+
+            u32 visibleCount = 0;
+            for (const std::vector<u32>& visible : scene.batchVisible)
+                visibleCount += visible.size();
+
+            jobs.benchmarkMs[workerCount - 1] = elapsedMs;
+            ILOG("Job system benchmark, %u entities, %u workers: %.3f ms (%.2fx), %u visible",
+                EntityCount, workerCount, elapsedMs, jobs.benchmarkMs[0] / elapsedMs, visibleCount);
+        }
+
+        jobs.activeWorkers = previousActiveWorkers;
+    }
+
+    void DrawGui(App* app)
+    {
+        JobSystemState& jobs = app->jobs;
+
+        int activeWorkers = jobs.activeWorkers;
+        if (ImGui::SliderInt("Active workers", &activeWorkers, 1, jobs.workerCount))
+            jobs.activeWorkers = activeWorkers;
+
+        for (u32 i = 0; i < jobs.workerCount; ++i)
+        {
+            const JobWorker& worker = jobs.workers[i];
+            ImGui::Text("Worker %2u%s: %4u jobs, %4u stolen", i, i == 0 ? " (main)" : "", worker.lastExecutedJobs, worker.lastStolenJobs);
+        }
+
+        if (ImGui::Button("Run job system benchmark"))
+            RunBenchmark(app);
+
+        for (u32 i = 0; i < jobs.benchmarkMs.size(); ++i)
+            ImGui::Text("%2u workers: %8.3f ms  %5.2fx", i + 1, jobs.benchmarkMs[i], jobs.benchmarkMs[0] / jobs.benchmarkMs[i]);
+    }
+}
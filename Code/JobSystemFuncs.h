@@ -0,0 +1,86 @@
+#ifndef JOB_SYSTEM_FUNC
+#define JOB_SYSTEM_FUNC
+
+#include "Globals.h"
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+struct App;
+
+#define JOB_SYSTEM_MAX_WORKERS 32 // Including the main thread, which owns worker slot 0
+#define JOB_SYSTEM_BATCHES_PER_WORKER 4 // Default ParallelFor split, so a worker stalled on one batch leaves the rest to be stolen
+
+// Runs items [begin, end) of a job
+typedef void (*JobFunc)(void* data, u32 begin, u32 end);
+
+// Fence over a group of jobs, done once pending drops to zero
+struct JobCounter
+{
+    std::atomic<u32> pending;
+};
+
+struct Job
+{
+    JobFunc     func;
+    void*       data;
+    u32         begin;
+    u32         end;
+    JobCounter* counter;
+};
+
+// The owner pushes and pops at the back (newest first, its data is still in cache), thieves take from the front
+struct JobWorker
+{
+    std::mutex       mutex;
+    std::deque<Job>  jobs;
+    std::atomic<u32> executedJobs; // This frame
+    std::atomic<u32> stolenJobs;
+    u32              lastExecutedJobs;
+    u32              lastStolenJobs;
+};
+
+struct JobSystemState
+{
+    std::vector<std::thread> threads;    // Workers 1..workerCount-1
+    JobWorker                workers[JOB_SYSTEM_MAX_WORKERS];
+    u32                      workerCount;
+    std::atomic<u32>         activeWorkers; // Workers allowed to take jobs, lowered by the benchmark
+    std::atomic<u32>         queuedJobs;
+    std::atomic<bool>        isRunning;
+    std::mutex               sleepMutex;
+    std::condition_variable  wakeUp;
+
+    // Frame preparation time over the benchmark scene, indexed by active worker count - 1
+    std::vector<f32> benchmarkMs;
+};
+
+namespace JobSystem
+{
+    // Starts one worker per hardware thread, the main thread being the first one
+    void Init(App* app);
+
+    void Shutdown(App* app);
+
+    // Publishes the per-worker counters of the last frame
+    void BeginFrame(App* app);
+
+    // Queues func over [begin, end) on the calling worker. counter->pending must be raised by the caller first.
+    void Run(App* app, JobFunc func, void* data, u32 begin, u32 end, JobCounter* counter);
+
+    // Runs queued jobs, stealing them if needed, until the counter reaches zero
+    void Wait(App* app, JobCounter* counter);
+
+    // Splits [0, count) in batches of batchSize items (0 picks one from the worker count) and waits for all of them.
+    // Runs the batches inline when there is a single one or a single active worker.
+    void ParallelFor(App* app, JobFunc func, void* data, u32 count, u32 batchSize = 0);
+
+    // Times entity transforms, bounds and culling over a synthetic 100k entity scene with 1 to N workers
+    void RunBenchmark(App* app);
+
+    void DrawGui(App* app);
+}
+
+#endif // !JOB_SYSTEM_FUNC
@@ -3,14 +3,25 @@
 
 #include <stb_image.h>
 #include <stb_image_write.h>
+#include <glm/gtc/packing.hpp>
+#include <algorithm>
 
 namespace ModelLoader
 {
     Image LoadImage(const char* filename)
     {
         Image img = {};
-        stbi_set_flip_vertically_on_load(true);
-        img.pixels = stbi_load(filename, &img.size.x, &img.size.y, &img.nchannels, 0);
+        stbi_set_flip_vertically_on_load_thread(true); // Images are also decoded on worker threads
+
+        // Decoded straight from the page cache, without stdio buffering in between
+        FileView view = {};
+        if (MapFile(filename, view))
+        {
+            AdviseFileView(view, FileAccess_Sequential);
+            img.pixels = stbi_load_from_memory(view.data, (int)view.size, &img.size.x, &img.size.y, &img.nchannels, 0);
+            UnmapFile(view);
+        }
+
         if (img.pixels)
         {
             img.stride = img.size.x * img.nchannels;
@@ -27,7 +38,7 @@ namespace ModelLoader
         stbi_image_free(image.pixels);
     }
 
-    GLuint CreateTexture2DFromImage(Image image)
+    GLuint CreateTexture2DFromImage(Image image, bool generateMipmaps)
     {
         GLenum internalFormat = GL_RGB8;
         GLenum dataFormat = GL_RGB;
@@ -44,22 +55,41 @@ namespace ModelLoader
         glGenTextures(1, &texHandle);
         glBindTexture(GL_TEXTURE_2D, texHandle);
         glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, image.size.x, image.size.y, 0, dataFormat, dataType, image.pixels);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-        glGenerateMipmap(GL_TEXTURE_2D);
+        if (generateMipmaps)
+            glGenerateMipmap(GL_TEXTURE_2D);
         glBindTexture(GL_TEXTURE_2D, 0);
 
         return texHandle;
     }
 
-    u32 LoadTexture2D(App* app, const char* filepath)
+    u32 LoadTexture2D(App* app, const char* filepath, bool asyncLoad)
     {
-        for (u32 texIdx = 0; texIdx < app->textures.size(); ++texIdx)
-            if (app->textures[texIdx].filepath == filepath)
-                return texIdx;
+        const u32 pathHandle = Registry::InternPath(app->registry.paths, filepath);
+        const u64 textureKey = Registry::PathKey(pathHandle);
+
+        u32 existingTexIdx = Registry::Find(app->registry.textures, textureKey);
+        if (existingTexIdx != UINT32_MAX)
+            return existingTexIdx;
+
+        if (asyncLoad)
+        {
+            // The texture is bound to a placeholder until the streamer uploads it
+            Texture tex = {};
+            tex.filepath = filepath;
+            tex.state = TextureState_Loading;
+
+            u32 texIdx = app->textures.size();
+            app->textures.push_back(tex);
+            Registry::Insert(app->registry.textures, textureKey, texIdx);
+
+            TextureStreamer::RequestDecode(app, texIdx);
+            return texIdx;
+        }
 
         Image image = LoadImage(filepath);
 
@@ -71,6 +101,7 @@ namespace ModelLoader
 
             u32 texIdx = app->textures.size();
             app->textures.push_back(tex);
+            Registry::Insert(app->registry.textures, textureKey, texIdx);
 
             FreeImage(image);
             return texIdx;
@@ -81,37 +112,171 @@ namespace ModelLoader
         }
     }
 
-    void ProcessAssimpMesh(const aiScene* scene, aiMesh* mesh, Mesh* myMesh, u32 baseMeshMaterialIndex, std::vector<u32>& submeshMaterialIndices)
+    // Float source of an imported vertex, before it is written in the submesh layout
+    struct ImportedVertex
     {
-        std::vector<float> vertices;
-        std::vector<u32> indices;
+        vec3 position;
+        vec3 normal;
+        vec2 texCoord;
+        vec4 tangent; // w is the handedness, bitangent = cross(normal, tangent) * w
+    };
+
+    static u32 AttributeSize(const VertexBufferAttribute& attribute)
+    {
+        switch (attribute.type)
+        {
+        case GL_FLOAT:              return attribute.componentCount * 4;
+        case GL_HALF_FLOAT:
+        case GL_SHORT:
+        case GL_UNSIGNED_SHORT:     return attribute.componentCount * 2;
+        case GL_INT_2_10_10_10_REV: return 4;
+        default:                    return 0;
+        }
+    }
 
-        bool hasTexCoords = false;
-        bool hasTangentSpace = false;
+    static void AddAttribute(VertexBufferLayout& layout, u8 location, u8 componentCount, GLenum type, bool normalized)
+    {
+        const VertexBufferAttribute attribute = { location, componentCount, layout.stride, (u8)normalized, (u16)type };
+        layout.attributes.push_back(attribute);
+        layout.stride += AttributeSize(attribute);
+    }
 
-        // process vertices
-        for (unsigned int i = 0; i < mesh->mNumVertices; i++)
+    static void WriteVertexAttribute(u8* dst, const VertexBufferAttribute& attribute, vec4 value)
+    {
+        for (u32 c = 0; c < attribute.componentCount && attribute.type != GL_INT_2_10_10_10_REV; ++c)
         {
-            vertices.push_back(mesh->mVertices[i].x);
-            vertices.push_back(mesh->mVertices[i].y);
-            vertices.push_back(mesh->mVertices[i].z);
-            vertices.push_back(mesh->mNormals[i].x);
-            vertices.push_back(mesh->mNormals[i].y);
-            vertices.push_back(mesh->mNormals[i].z);
+            switch (attribute.type)
+            {
+            case GL_FLOAT:          memcpy(dst + c * 4, &value[c], 4); break;
+            case GL_HALF_FLOAT:     { const u16 h = glm::packHalf1x16(value[c]); memcpy(dst + c * 2, &h, 2); } break;
+            case GL_SHORT:          { const u16 q = glm::packSnorm1x16(value[c]); memcpy(dst + c * 2, &q, 2); } break;
+            case GL_UNSIGNED_SHORT: { const u16 q = glm::packUnorm1x16(value[c]); memcpy(dst + c * 2, &q, 2); } break;
+            }
+        }
+
+        if (attribute.type == GL_INT_2_10_10_10_REV)
+        {
+            const u32 packed = glm::packSnorm3x10_1x2(value);
+            memcpy(dst, &packed, 4);
+        }
+    }
+
+    vec4 ReadVertexAttribute(const SubMesh& submesh, const VertexBufferAttribute& attribute, u32 vertexIdx)
+    {
+        const u8* src = submesh.vertices.data() + vertexIdx * submesh.vertexBufferLayout.stride + attribute.offset;
+        vec4 value = vec4(0.0f, 0.0f, 0.0f, 1.0f);
+
+        if (attribute.type == GL_INT_2_10_10_10_REV)
+        {
+            u32 packed;
+            memcpy(&packed, src, 4);
+            return glm::unpackSnorm3x10_1x2(packed);
+        }
 
-            if (mesh->mTextureCoords[0]) // does the mesh contain texture coordinates?
+        for (u32 c = 0; c < attribute.componentCount; ++c)
+        {
+            u16 q;
+            switch (attribute.type)
             {
-                hasTexCoords = true;
-                vertices.push_back(mesh->mTextureCoords[0][i].x);
-                vertices.push_back(mesh->mTextureCoords[0][i].y);
+            case GL_FLOAT:          memcpy(&value[c], src + c * 4, 4); break;
+            case GL_HALF_FLOAT:     memcpy(&q, src + c * 2, 2); value[c] = glm::unpackHalf1x16(q); break;
+            case GL_SHORT:          memcpy(&q, src + c * 2, 2); value[c] = attribute.normalized ? glm::unpackSnorm1x16(q) : (f32)(i16)q; break;
+            case GL_UNSIGNED_SHORT: memcpy(&q, src + c * 2, 2); value[c] = attribute.normalized ? glm::unpackUnorm1x16(q) : (f32)q; break;
             }
+        }
+
+        return value;
+    }
+
+    // Float32 everywhere, or snorm16 positions within the submesh bounds, 10-10-10-2 normal and tangent
+    // and unorm16 texture coordinates (half floats when they tile outside [0, 1])
+    static void WriteSubMeshVertices(SubMesh& submesh, const ImportedVertex* imported, u32 vertexCount, bool hasTexCoords, bool hasTangentSpace, bool quantize)
+    {
+        VertexBufferLayout& layout = submesh.vertexBufferLayout;
+        layout = {};
+
+        submesh.positionScale = vec3(1.0f);
+        submesh.positionBias = vec3(0.0f);
 
-            if (mesh->mTangents != nullptr && mesh->mBitangents)
+        if (quantize)
+        {
+            vec3 aabbMin = vertexCount == 0 ? vec3(0.0f) : imported[0].position;
+            vec3 aabbMax = aabbMin;
+            bool isUnitTexCoords = true;
+            for (u32 v = 0; v < vertexCount; ++v)
             {
-                hasTangentSpace = true;
-                vertices.push_back(mesh->mTangents[i].x);
-                vertices.push_back(mesh->mTangents[i].y);
-                vertices.push_back(mesh->mTangents[i].z);
+                const ImportedVertex& vertex = imported[v];
+                aabbMin = glm::min(aabbMin, vertex.position);
+                aabbMax = glm::max(aabbMax, vertex.position);
+                isUnitTexCoords &= glm::all(glm::greaterThanEqual(vertex.texCoord, vec2(0.0f))) && glm::all(glm::lessThanEqual(vertex.texCoord, vec2(1.0f)));
+            }
+
+            submesh.positionBias = (aabbMin + aabbMax) * 0.5f;
+            submesh.positionScale = glm::max((aabbMax - aabbMin) * 0.5f, vec3(1e-6f));
+
+            AddAttribute(layout, 0, 4, GL_SHORT, true); // w pads to 8 bytes
+            AddAttribute(layout, 1, 4, GL_INT_2_10_10_10_REV, true);
+            if (hasTexCoords)
+                AddAttribute(layout, 2, 2, isUnitTexCoords ? GL_UNSIGNED_SHORT : GL_HALF_FLOAT, isUnitTexCoords);
+            if (hasTangentSpace)
+                AddAttribute(layout, 3, 4, GL_INT_2_10_10_10_REV, true);
+        }
+        else
+        {
+            AddAttribute(layout, 0, 3, GL_FLOAT, false);
+            AddAttribute(layout, 1, 3, GL_FLOAT, false);
+            if (hasTexCoords)
+                AddAttribute(layout, 2, 2, GL_FLOAT, false);
+            if (hasTangentSpace)
+                AddAttribute(layout, 3, 4, GL_FLOAT, false);
+        }
+
+        submesh.vertices.assign(vertexCount * layout.stride, 0);
+        for (u32 v = 0; v < vertexCount; ++v)
+        {
+            const ImportedVertex& vertex = imported[v];
+            u8* dst = submesh.vertices.data() + v * layout.stride;
+
+            for (const VertexBufferAttribute& attribute : layout.attributes)
+            {
+                vec4 value;
+                switch (attribute.location)
+                {
+                case 0:  value = vec4((vertex.position - submesh.positionBias) / submesh.positionScale, 0.0f); break;
+                case 1:  value = vec4(vertex.normal, 0.0f); break;
+                case 2:  value = vec4(vertex.texCoord, 0.0f, 0.0f); break;
+                default: value = vertex.tangent; break;
+                }
+                WriteVertexAttribute(dst + attribute.offset, attribute, value);
+            }
+        }
+    }
+
+    void ProcessAssimpMesh(aiMesh* mesh, SubMesh& submesh, bool quantizeVertices)
+    {
+        // The float vertices only live until they are written in the submesh layout. Meshes too large
+        // for the scratch arena use the heap, there is no size limit on imports.
+        MemoryArena& scratch = Arena::GetScratch();
+        ArenaScope scratchScope(scratch);
+        std::vector<ImportedVertex> heapVertices;
+        ImportedVertex* vertices = Arena::PushArrayOrHeap(scratch, mesh->mNumVertices, heapVertices);
+
+        std::vector<u32> indices;
+
+        bool hasTexCoords = mesh->mTextureCoords[0] != nullptr; // does the mesh contain texture coordinates?
+        bool hasTangentSpace = mesh->mTangents != nullptr && mesh->mBitangents;
+
+        // process vertices
+        for (unsigned int i = 0; i < mesh->mNumVertices; i++)
+        {
+            ImportedVertex& vertex = vertices[i];
+            vertex.position = vec3(mesh->mVertices[i].x, mesh->mVertices[i].y, mesh->mVertices[i].z);
+            vertex.normal = vec3(mesh->mNormals[i].x, mesh->mNormals[i].y, mesh->mNormals[i].z);
+            vertex.texCoord = hasTexCoords ? vec2(mesh->mTextureCoords[0][i].x, mesh->mTextureCoords[0][i].y) : vec2(0.0f);
+
+            if (hasTangentSpace)
+            {
+                const vec3 tangent = vec3(mesh->mTangents[i].x, mesh->mTangents[i].y, mesh->mTangents[i].z);
 
                 // For some reason ASSIMP gives me the bitangents flipped.
                 // Maybe it's my fault, but when I generate my own geometry
@@ -121,9 +286,11 @@ namespace ModelLoader
                 // I think that (even if the documentation says the opposite)
                 // it returns a left-handed tangent space matrix.
                 // SOLUTION: I invert the components of the bitangent here.
-                vertices.push_back(-mesh->mBitangents[i].x);
-                vertices.push_back(-mesh->mBitangents[i].y);
-                vertices.push_back(-mesh->mBitangents[i].z);
+                const vec3 bitangent = -vec3(mesh->mBitangents[i].x, mesh->mBitangents[i].y, mesh->mBitangents[i].z);
+
+                // Only the handedness is stored, the shader rebuilds the bitangent from the normal and tangent
+                const f32 handedness = glm::dot(glm::cross(vertex.normal, tangent), bitangent) < 0.0f ? -1.0f : 1.0f;
+                vertex.tangent = vec4(tangent, handedness);
             }
         }
 
@@ -137,37 +304,26 @@ namespace ModelLoader
             }
         }
 
-        // store the proper (previously proceessed) material for this mesh
-        submeshMaterialIndices.push_back(baseMeshMaterialIndex + mesh->mMaterialIndex);
+        // fill the submesh, with its vertex format
+        submesh = {};
+        WriteSubMeshVertices(submesh, vertices, mesh->mNumVertices, hasTexCoords, hasTangentSpace, quantizeVertices);
+        submesh.indices.swap(indices);
+    }
 
-        // create the vertex format
-        VertexBufferLayout vertexBufferLayout = {};
-        vertexBufferLayout.attributes.push_back(VertexBufferAttribute{ 0, 3, 0 });
-        vertexBufferLayout.attributes.push_back(VertexBufferAttribute{ 1, 3, 3 * sizeof(float) });
-        vertexBufferLayout.stride = 6 * sizeof(float);
-        if (hasTexCoords)
-        {
-            vertexBufferLayout.attributes.push_back(VertexBufferAttribute{ 2, 2, vertexBufferLayout.stride });
-            vertexBufferLayout.stride += 2 * sizeof(float);
-        }
-        if (hasTangentSpace)
+    static void ReadAssimpTexturePath(aiMaterial* material, aiTextureType type, String directory, char* outPath, u32 outPathSize)
+    {
+        outPath[0] = '\0';
+        if (material->GetTextureCount(type) > 0)
         {
-            vertexBufferLayout.attributes.push_back(VertexBufferAttribute{ 3, 3, vertexBufferLayout.stride });
-            vertexBufferLayout.stride += 3 * sizeof(float);
-
-            vertexBufferLayout.attributes.push_back(VertexBufferAttribute{ 4, 3, vertexBufferLayout.stride });
-            vertexBufferLayout.stride += 3 * sizeof(float);
+            aiString aiFilename;
+            material->GetTexture(type, 0, &aiFilename);
+            String filename = MakeString(aiFilename.C_Str());
+            String filepath = MakePath(directory, filename);
+            snprintf(outPath, outPathSize, "%s", filepath.str);
         }
-
-        // add the submesh into the mesh
-        SubMesh submesh = {};
-        submesh.vertexBufferLayout = vertexBufferLayout;
-        submesh.vertices.swap(vertices);
-        submesh.indices.swap(indices);
-        myMesh->submeshes.push_back(submesh);
     }
 
-    void ProcessAssimpMaterial(App* app, aiMaterial* material, Material& myMaterial, String directory)
+    void ReadAssimpMaterial(aiMaterial* material, MaterialDesc& desc, String directory)
     {
         aiString name;
         aiColor3D diffuseColor;
@@ -180,124 +336,198 @@ namespace ModelLoader
         material->Get(AI_MATKEY_COLOR_SPECULAR, specularColor);
         material->Get(AI_MATKEY_SHININESS, shininess);
 
-        myMaterial.name = name.C_Str();
-        myMaterial.albedo = vec3(diffuseColor.r, diffuseColor.g, diffuseColor.b);
-        myMaterial.emissive = vec3(emissiveColor.r, emissiveColor.g, emissiveColor.b);
-        myMaterial.smoothness = shininess / 256.0f;
-
-        aiString aiFilename;
+        desc = {};
+        snprintf(desc.name, sizeof(desc.name), "%s", name.C_Str());
+        desc.albedo = vec3(diffuseColor.r, diffuseColor.g, diffuseColor.b);
+        desc.emissive = vec3(emissiveColor.r, emissiveColor.g, emissiveColor.b);
+        desc.smoothness = shininess / 256.0f;
 
         if (material->GetTextureCount(aiTextureType_DIFFUSE) <= 0)
         {
-            myMaterial.useTexture = 0;
+            desc.useTexture = 0;
             return;
         }
 
-        myMaterial.useTexture = 1;
+        desc.useTexture = 1;
 
-        if (material->GetTextureCount(aiTextureType_DIFFUSE) > 0)
-        {
-            material->GetTexture(aiTextureType_DIFFUSE, 0, &aiFilename);
-            String filename = MakeString(aiFilename.C_Str());
-            String filepath = MakePath(directory, filename);
-            myMaterial.albedoTextureIdx = LoadTexture2D(app, filepath.str);
-        }
-        if (material->GetTextureCount(aiTextureType_EMISSIVE) > 0)
-        {
-            material->GetTexture(aiTextureType_EMISSIVE, 0, &aiFilename);
-            String filename = MakeString(aiFilename.C_Str());
-            String filepath = MakePath(directory, filename);
-            myMaterial.emissiveTextureIdx = LoadTexture2D(app, filepath.str);
-        }
-        if (material->GetTextureCount(aiTextureType_SPECULAR) > 0)
-        {
-            material->GetTexture(aiTextureType_SPECULAR, 0, &aiFilename);
-            String filename = MakeString(aiFilename.C_Str());
-            String filepath = MakePath(directory, filename);
-            myMaterial.specularTextureIdx = LoadTexture2D(app, filepath.str);
-        }
-        if (material->GetTextureCount(aiTextureType_NORMALS) > 0)
-        {
-            material->GetTexture(aiTextureType_NORMALS, 0, &aiFilename);
-            String filename = MakeString(aiFilename.C_Str());
-            String filepath = MakePath(directory, filename);
-            myMaterial.normalsTextureIdx = LoadTexture2D(app, filepath.str);
-        }
-        if (material->GetTextureCount(aiTextureType_HEIGHT) > 0)
+        const u32 pathSize = sizeof(desc.texturePaths[0]);
+        ReadAssimpTexturePath(material, aiTextureType_DIFFUSE, directory, desc.texturePaths[MaterialTexture_Albedo], pathSize);
+        ReadAssimpTexturePath(material, aiTextureType_EMISSIVE, directory, desc.texturePaths[MaterialTexture_Emissive], pathSize);
+        ReadAssimpTexturePath(material, aiTextureType_SPECULAR, directory, desc.texturePaths[MaterialTexture_Specular], pathSize);
+        ReadAssimpTexturePath(material, aiTextureType_NORMALS, directory, desc.texturePaths[MaterialTexture_Normals], pathSize);
+        ReadAssimpTexturePath(material, aiTextureType_HEIGHT, directory, desc.texturePaths[MaterialTexture_Bump], pathSize);
+    }
+
+    void CreateMaterial(App* app, const MaterialDesc& desc, Material& myMaterial)
+    {
+        myMaterial.name = desc.name;
+        myMaterial.albedo = desc.albedo;
+        myMaterial.emissive = desc.emissive;
+        myMaterial.smoothness = desc.smoothness;
+        myMaterial.useTexture = desc.useTexture;
+        myMaterial.shaderFeatures = ShaderPermutation::MaterialFeatures(desc.useTexture != 0, desc.texturePaths[MaterialTexture_Normals][0] != '\0');
+
+        u32* textureSlots[MaterialTexture_Count] = {
+            &myMaterial.albedoTextureIdx,
+            &myMaterial.emissiveTextureIdx,
+            &myMaterial.specularTextureIdx,
+            &myMaterial.normalsTextureIdx,
+            &myMaterial.bumpTextureIdx
+        };
+
+        for (u32 i = 0; i < MaterialTexture_Count; ++i)
         {
-            material->GetTexture(aiTextureType_HEIGHT, 0, &aiFilename);
-            String filename = MakeString(aiFilename.C_Str());
-            String filepath = MakePath(directory, filename);
-            myMaterial.bumpTextureIdx = LoadTexture2D(app, filepath.str);
+            if (desc.texturePaths[i][0] != '\0')
+                *textureSlots[i] = LoadTexture2D(app, desc.texturePaths[i]);
         }
 
         //myMaterial.createNormalFromBump();
     }
 
-    void ProcessAssimpNode(const aiScene* scene, aiNode* node, Mesh* myMesh, u32 baseMeshMaterialIndex, std::vector<u32>& submeshMaterialIndices)
+    u32 ResolveMaterial(App* app, const MaterialDesc& desc)
+    {
+        // Descriptions are zero-initialized before being filled, so their bytes are a stable content key
+        const u64 materialKey = HashBytes(&desc, sizeof(desc));
+        u32 materialIdx = Registry::Find(app->registry.materials, materialKey);
+        if (materialIdx != UINT32_MAX && memcmp(&app->materialDescs[materialIdx], &desc, sizeof(desc)) == 0)
+            return materialIdx;
+
+        // On a hash collision the new material is created but not registered, the key belongs to the other one
+        const bool isCollision = materialIdx != UINT32_MAX;
+        if (isCollision)
+            ELOG("Material key collision between %s and %s", app->materialDescs[materialIdx].name, desc.name);
+
+        materialIdx = app->materials.size();
+        app->materials.push_back(Material{});
+        app->materialDescs.push_back(desc);
+        CreateMaterial(app, desc, app->materials.back());
+        if (!isCollision)
+            Registry::Insert(app->registry.materials, materialKey, materialIdx);
+
+        return materialIdx;
+    }
+
+    void ProcessAssimpMaterial(App* app, aiMaterial* material, Material& myMaterial, String directory)
+    {
+        MaterialDesc desc;
+        ReadAssimpMaterial(material, desc, directory);
+        CreateMaterial(app, desc, myMaterial);
+    }
+
+    void ProcessAssimpNode(const aiScene* scene, aiNode* node, std::vector<aiMesh*>& meshes)
     {
-        // process all the node's meshes (if any)
+        // list all the node's meshes (if any)
         for (unsigned int i = 0; i < node->mNumMeshes; i++)
         {
-            aiMesh* mesh = scene->mMeshes[node->mMeshes[i]];
-            ProcessAssimpMesh(scene, mesh, myMesh, baseMeshMaterialIndex, submeshMaterialIndices);
+            meshes.push_back(scene->mMeshes[node->mMeshes[i]]);
         }
 
         // then do the same for each of its children
         for (unsigned int i = 0; i < node->mNumChildren; i++)
         {
-            ProcessAssimpNode(scene, node->mChildren[i], myMesh, baseMeshMaterialIndex, submeshMaterialIndices);
+            ProcessAssimpNode(scene, node->mChildren[i], meshes);
         }
     }
 
-    u32 LoadModel(App* app, const char* filename)
+    struct ImportSubMeshesJob
     {
-        const aiScene* scene = aiImportFile(filename,
-            aiProcess_Triangulate |
-            aiProcess_GenSmoothNormals |
-            aiProcess_CalcTangentSpace |
-            aiProcess_JoinIdenticalVertices |
-            aiProcess_PreTransformVertices |
-            aiProcess_ImproveCacheLocality |
-            aiProcess_OptimizeMeshes |
-            aiProcess_SortByPType);
+        aiMesh* const* meshes;
+        SubMesh*       submeshes;
+        bool           quantizeVertices;
+    };
 
-        if (!scene)
+    static void ImportSubMeshes(void* data, u32 begin, u32 end)
+    {
+        ImportSubMeshesJob* job = (ImportSubMeshesJob*)data;
+        for (u32 i = begin; i < end; ++i)
+            ProcessAssimpMesh(job->meshes[i], job->submeshes[i], job->quantizeVertices);
+    }
+
+    static void ComputeSubMeshBounds(SubMesh& submesh)
+    {
+        submesh.aabbMin = vec3(0.0f);
+        submesh.aabbMax = vec3(0.0f);
+        submesh.boundingSphere = vec4(0.0f);
+
+        const VertexBufferLayout& layout = submesh.vertexBufferLayout;
+        const VertexBufferAttribute* position = NULL;
+        for (const VertexBufferAttribute& attribute : layout.attributes)
+            if (attribute.location == 0)
+                position = &attribute;
+
+        if (!position || layout.stride == 0 || submesh.vertices.size() < layout.stride)
+            return;
+
+        // Bounds of the dequantized positions, as the vertex shader sees them
+        const u32 vertexCount = submesh.vertices.size() / layout.stride;
+        MemoryArena& scratch = Arena::GetScratch();
+        ArenaScope scratchScope(scratch);
+        std::vector<vec3> heapPositions;
+        vec3* positions = Arena::PushArrayOrHeap(scratch, vertexCount, heapPositions);
+
+        for (u32 v = 0; v < vertexCount; ++v)
+            positions[v] = vec3(ReadVertexAttribute(submesh, *position, v)) * submesh.positionScale + submesh.positionBias;
+
+        vec3 aabbMin = positions[0];
+        vec3 aabbMax = aabbMin;
+        for (u32 v = 1; v < vertexCount; ++v)
         {
-            ELOG("Error loading mesh %s: %s", filename, aiGetErrorString());
-            return UINT32_MAX;
+            aabbMin = glm::min(aabbMin, positions[v]);
+            aabbMax = glm::max(aabbMax, positions[v]);
         }
 
-        app->meshes.push_back(Mesh{});
-        Mesh& mesh = app->meshes.back();
-        u32 meshIdx = (u32)app->meshes.size() - 1u;
+        // The sphere is centered on the box, its radius reaches the farthest vertex
+        const vec3 center = (aabbMin + aabbMax) * 0.5f;
+        f32 radiusSq = 0.0f;
+        for (u32 v = 0; v < vertexCount; ++v)
+        {
+            const vec3 offset = positions[v] - center;
+            radiusSq = glm::max(radiusSq, glm::dot(offset, offset));
+        }
 
-        app->models.push_back(Model{});
-        Model& model = app->models.back();
-        model.meshIdx = meshIdx;
-        u32 modelIdx = (u32)app->models.size() - 1u;
+        submesh.aabbMin = aabbMin;
+        submesh.aabbMax = aabbMax;
+        submesh.boundingSphere = vec4(center, sqrtf(radiusSq));
+    }
 
-        String directory = GetDirectoryPart(MakeString(filename));
+    static void ComputeSubMeshBoundsBatch(void* data, u32 begin, u32 end)
+    {
+        Mesh* mesh = (Mesh*)data;
+        for (u32 i = begin; i < end; ++i)
+            ComputeSubMeshBounds(mesh->submeshes[i]);
+    }
 
-        // Create a list of materials
-        u32 baseMeshMaterialIndex = (u32)app->materials.size();
-        for (unsigned int i = 0; i < scene->mNumMaterials; ++i)
+    void ComputeMeshBounds(App* app, Mesh& mesh)
+    {
+        mesh.aabbMin = vec3(0.0f);
+        mesh.aabbMax = vec3(0.0f);
+        mesh.boundingSphere = vec4(0.0f);
+
+        // Submeshes decode their positions independently, one job each
+        JobSystem::ParallelFor(app, ComputeSubMeshBoundsBatch, &mesh, mesh.submeshes.size(), 1);
+
+        for (u32 i = 0; i < mesh.submeshes.size(); ++i)
         {
-            app->materials.push_back(Material{});
-            Material& material = app->materials.back();
-            ProcessAssimpMaterial(app, scene->mMaterials[i], material, directory);
+            const SubMesh& submesh = mesh.submeshes[i];
+            mesh.aabbMin = i == 0 ? submesh.aabbMin : glm::min(mesh.aabbMin, submesh.aabbMin);
+            mesh.aabbMax = i == 0 ? submesh.aabbMax : glm::max(mesh.aabbMax, submesh.aabbMax);
         }
 
-        ProcessAssimpNode(scene, scene->mRootNode, &mesh, baseMeshMaterialIndex, model.materialIdx);
-
-        aiReleaseImport(scene);
+        const vec3 center = (mesh.aabbMin + mesh.aabbMax) * 0.5f;
+        f32 radius = 0.0f;
+        for (const SubMesh& submesh : mesh.submeshes)
+            radius = glm::max(radius, glm::length(vec3(submesh.boundingSphere) - center) + submesh.boundingSphere.w);
+        mesh.boundingSphere = vec4(center, radius);
+    }
 
+    void UploadMeshBuffers(Mesh& mesh)
+    {
         u32 vertexBufferSize = 0;
         u32 indexBufferSize = 0;
 
         for (u32 i = 0; i < mesh.submeshes.size(); ++i)
         {
-            vertexBufferSize += mesh.submeshes[i].vertices.size() * sizeof(float);
+            vertexBufferSize += mesh.submeshes[i].vertices.size();
             indexBufferSize += mesh.submeshes[i].indices.size() * sizeof(u32);
         }
 
@@ -315,7 +545,7 @@ namespace ModelLoader
         for (u32 i = 0; i < mesh.submeshes.size(); ++i)
         {
             const void* verticesData = mesh.submeshes[i].vertices.data();
-            const u32   verticesSize = mesh.submeshes[i].vertices.size() * sizeof(float);
+            const u32   verticesSize = mesh.submeshes[i].vertices.size();
             glBufferSubData(GL_ARRAY_BUFFER, verticesOffset, verticesSize, verticesData);
             mesh.submeshes[i].vertexOffset = verticesOffset;
             verticesOffset += verticesSize;
@@ -329,7 +559,391 @@ namespace ModelLoader
 
         glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
         glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+
+    static u64 ImportFlagsHash(bool quantizeVertices)
+    {
+        const u32 importFlags = MODEL_IMPORT_FLAGS;
+        return HashBytes(&quantizeVertices, sizeof(quantizeVertices), HashBytes(&importFlags, sizeof(importFlags)));
+    }
+
+    // Assimp reads the source files, and the files they reference, through read-only mappings
+    struct MappedAssimpFile
+    {
+        FileView view;
+        u64      cursor;
+    };
+
+    static size_t MappedFileRead(aiFile* file, char* buffer, size_t size, size_t count)
+    {
+        MappedAssimpFile* mapped = (MappedAssimpFile*)file->UserData;
+        if (size == 0)
+            return 0;
+
+        const u64 available = (mapped->view.size - mapped->cursor) / size;
+        const size_t readCount = count < available ? count : (size_t)available;
+        memcpy(buffer, mapped->view.data + mapped->cursor, readCount * size);
+        mapped->cursor += readCount * size;
+        return readCount;
+    }
+
+    static size_t MappedFileWrite(aiFile*, const char*, size_t, size_t)
+    {
+        return 0;
+    }
+
+    static size_t MappedFileTell(aiFile* file)
+    {
+        return (size_t)((MappedAssimpFile*)file->UserData)->cursor;
+    }
+
+    static size_t MappedFileSize(aiFile* file)
+    {
+        return (size_t)((MappedAssimpFile*)file->UserData)->view.size;
+    }
+
+    static void MappedFileFlush(aiFile*)
+    {
+    }
+
+    static aiReturn MappedFileSeek(aiFile* file, size_t offset, aiOrigin origin)
+    {
+        MappedAssimpFile* mapped = (MappedAssimpFile*)file->UserData;
+        const u64 size = mapped->view.size;
+
+        // Same rules as Assimp's memory streams: the offset of aiOrigin_END counts back from the end
+        u64 cursor = 0;
+        switch (origin)
+        {
+        case aiOrigin_SET: cursor = offset; break;
+        case aiOrigin_CUR: cursor = mapped->cursor + offset; break;
+        case aiOrigin_END: cursor = offset <= size ? size - offset : size + 1; break;
+        default: return aiReturn_FAILURE;
+        }
+
+        if (cursor > size)
+            return aiReturn_FAILURE;
+
+        mapped->cursor = cursor;
+        return aiReturn_SUCCESS;
+    }
+
+    // UserData of the aiFileIO, when set, lists every file the importer opened
+    static aiFile* MappedFileOpen(aiFileIO* fileIO, const char* filename, const char* mode)
+    {
+        if (strchr(mode, 'w') || strchr(mode, 'a'))
+            return NULL;
+
+        if (fileIO->UserData)
+        {
+            std::vector<std::string>& openedFiles = *(std::vector<std::string>*)fileIO->UserData;
+            if (std::find(openedFiles.begin(), openedFiles.end(), filename) == openedFiles.end())
+                openedFiles.push_back(filename);
+        }
+
+        MappedAssimpFile* mapped = new MappedAssimpFile{};
+        if (!MapFile(filename, mapped->view))
+        {
+            delete mapped;
+            return NULL;
+        }
+
+        AdviseFileView(mapped->view, FileAccess_Sequential);
+
+        aiFile* file = new aiFile{};
+        file->ReadProc = MappedFileRead;
+        file->WriteProc = MappedFileWrite;
+        file->TellProc = MappedFileTell;
+        file->FileSizeProc = MappedFileSize;
+        file->SeekProc = MappedFileSeek;
+        file->FlushProc = MappedFileFlush;
+        file->UserData = (aiUserData)mapped;
+        return file;
+    }
+
+    static void MappedFileClose(aiFileIO*, aiFile* file)
+    {
+        MappedAssimpFile* mapped = (MappedAssimpFile*)file->UserData;
+        UnmapFile(mapped->view);
+        delete mapped;
+        delete file;
+    }
+
+    static u64 DependencyTimestampHash(const MeshCacheDependency* dependencies, u32 dependencyCount)
+    {
+        u64 hash = HashBytes(&dependencyCount, sizeof(dependencyCount));
+        for (u32 i = 0; i < dependencyCount; ++i)
+        {
+            const u64 timestamp = GetFileLastWriteTimestamp(dependencies[i].path);
+            hash = HashBytes(&timestamp, sizeof(timestamp), hash);
+        }
+        return hash;
+    }
+
+    // Every offset and index of the records must stay inside the file, a corrupt cache is reimported
+    static bool IsValidCacheSubMesh(const MeshCacheHeader& header, const MeshCacheSubMesh& cached)
+    {
+        return cached.attributeCount <= MESH_CACHE_MAX_ATTRIBUTES &&
+            cached.stride > 0 && cached.stride <= UINT8_MAX && cached.vertexSize % cached.stride == 0 &&
+            (u64)cached.vertexOffset + cached.vertexSize <= header.vertexDataSize &&
+            cached.indexOffset % sizeof(u32) == 0 &&
+            (u64)cached.indexOffset + (u64)cached.indexCount * sizeof(u32) <= header.indexDataSize &&
+            cached.materialIdx < header.materialCount;
+    }
+
+    u32 LoadModelFromCache(App* app, const char* filename, const char* cachePath)
+    {
+        // The cache is read in place: the GPU buffers are filled directly from the mapping
+        FileView view = {};
+        if (!MapFile(cachePath, view))
+            return UINT32_MAX;
+
+        AdviseFileView(view, FileAccess_Sequential);
+        const u8* fileData = view.data;
+        const u64 fileSize = view.size;
+
+        MeshCacheHeader header = {};
+        if (fileSize >= sizeof(header))
+            memcpy(&header, fileData, sizeof(header));
+
+        const u64 expectedSize = sizeof(MeshCacheHeader) +
+            (u64)header.dependencyCount * sizeof(MeshCacheDependency) +
+            (u64)header.materialCount * sizeof(MaterialDesc) +
+            (u64)header.submeshCount * sizeof(MeshCacheSubMesh) +
+            header.vertexDataSize + header.indexDataSize;
+
+        if (header.magic != MESH_CACHE_MAGIC ||
+            header.version != MESH_CACHE_VERSION ||
+            header.sourceTimestamp != GetFileLastWriteTimestamp(filename) ||
+            header.importFlagsHash != ImportFlagsHash(app->quantizeVertices) ||
+            expectedSize != fileSize)
+        {
+            ILOG("Mesh cache %s is stale or invalid, reimporting %s", cachePath, filename);
+            UnmapFile(view);
+            return UINT32_MAX;
+        }
+
+        const MeshCacheDependency* dependencies = (const MeshCacheDependency*)(fileData + sizeof(MeshCacheHeader));
+        const MaterialDesc* materialDescs = (const MaterialDesc*)(dependencies + header.dependencyCount);
+        const MeshCacheSubMesh* cachedSubmeshes = (const MeshCacheSubMesh*)(materialDescs + header.materialCount);
+        const u8* vertexData = (const u8*)(cachedSubmeshes + header.submeshCount);
+        const u8* indexData = vertexData + header.vertexDataSize;
+
+        bool isValid = DependencyTimestampHash(dependencies, header.dependencyCount) == header.dependencyTimestampHash;
+        for (u32 i = 0; i < header.dependencyCount && isValid; ++i)
+            isValid = memchr(dependencies[i].path, '\0', MESH_CACHE_MAX_PATH) != NULL;
+        for (u32 i = 0; i < header.submeshCount && isValid; ++i)
+            isValid = IsValidCacheSubMesh(header, cachedSubmeshes[i]);
+
+        if (!isValid)
+        {
+            ILOG("Mesh cache %s is stale or invalid, reimporting %s", cachePath, filename);
+            UnmapFile(view);
+            return UINT32_MAX;
+        }
+
+        app->meshes.push_back(Mesh{});
+        Mesh& mesh = app->meshes.back();
+        u32 meshIdx = (u32)app->meshes.size() - 1u;
+
+        app->models.push_back(Model{});
+        Model& model = app->models.back();
+        model.meshIdx = meshIdx;
+        u32 modelIdx = (u32)app->models.size() - 1u;
+
+        std::vector<u32> materialIndices(header.materialCount);
+        for (u32 i = 0; i < header.materialCount; ++i)
+            materialIndices[i] = ResolveMaterial(app, materialDescs[i]);
+
+        for (u32 i = 0; i < header.submeshCount; ++i)
+        {
+            const MeshCacheSubMesh& cached = cachedSubmeshes[i];
+
+            SubMesh submesh = {};
+            submesh.vertexBufferLayout.attributes.assign(cached.attributes, cached.attributes + cached.attributeCount);
+            submesh.vertexBufferLayout.stride = (u8)cached.stride;
+            submesh.vertices.assign(vertexData + cached.vertexOffset, vertexData + cached.vertexOffset + cached.vertexSize);
+            submesh.positionScale = cached.positionScale;
+            submesh.positionBias = cached.positionBias;
+            submesh.indices.assign((const u32*)(indexData + cached.indexOffset), (const u32*)(indexData + cached.indexOffset) + cached.indexCount);
+            submesh.vertexOffset = cached.vertexOffset;
+            submesh.indexOffset = cached.indexOffset;
+            mesh.submeshes.push_back(submesh);
+
+            model.materialIdx.push_back(materialIndices[cached.materialIdx]);
+        }
+
+        ComputeMeshBounds(app, mesh);
+
+        // The cached blobs already have the final GPU layout, upload them in one go
+        glGenBuffers(1, &mesh.vertexBufferHandle);
+        glBindBuffer(GL_ARRAY_BUFFER, mesh.vertexBufferHandle);
+        glBufferData(GL_ARRAY_BUFFER, header.vertexDataSize, vertexData, GL_STATIC_DRAW);
+
+        glGenBuffers(1, &mesh.indexBufferHandle);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.indexBufferHandle);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, header.indexDataSize, indexData, GL_STATIC_DRAW);
+
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+        UnmapFile(view);
+
+        return modelIdx;
+    }
+
+    void WriteModelCache(App* app, const char* filename, const char* cachePath, u32 modelIdx, const std::vector<MaterialDesc>& materialDescs, const std::vector<u32>& submeshMaterialSlots, const std::vector<std::string>& dependencies)
+    {
+        const Model& model = app->models[modelIdx];
+
+        std::vector<MeshCacheDependency> cachedDependencies(dependencies.size());
+        for (u32 i = 0; i < dependencies.size(); ++i)
+        {
+            if (dependencies[i].size() >= MESH_CACHE_MAX_PATH)
+            {
+                ELOG("Mesh cache not written for %s: the path of %s is too long", filename, dependencies[i].c_str());
+                return;
+            }
+
+            cachedDependencies[i] = {};
+            memcpy(cachedDependencies[i].path, dependencies[i].c_str(), dependencies[i].size());
+        }
+        const Mesh& mesh = app->meshes[model.meshIdx];
+
+        MeshCacheHeader header = {};
+        header.magic = MESH_CACHE_MAGIC;
+        header.version = MESH_CACHE_VERSION;
+        header.sourceTimestamp = GetFileLastWriteTimestamp(filename);
+        header.importFlagsHash = ImportFlagsHash(app->quantizeVertices);
+        header.materialCount = materialDescs.size();
+        header.submeshCount = mesh.submeshes.size();
+        header.dependencyCount = cachedDependencies.size();
+        header.dependencyTimestampHash = DependencyTimestampHash(cachedDependencies.data(), cachedDependencies.size());
+
+        std::vector<MeshCacheSubMesh> cachedSubmeshes(mesh.submeshes.size());
+        for (u32 i = 0; i < mesh.submeshes.size(); ++i)
+        {
+            const SubMesh& submesh = mesh.submeshes[i];
+            const std::vector<VertexBufferAttribute>& attributes = submesh.vertexBufferLayout.attributes;
+            if (attributes.size() > MESH_CACHE_MAX_ATTRIBUTES)
+            {
+                ELOG("Mesh cache not written for %s: too many vertex attributes", filename);
+                return;
+            }
+
+            MeshCacheSubMesh& cached = cachedSubmeshes[i];
+            cached = {};
+            memcpy(cached.attributes, attributes.data(), attributes.size() * sizeof(VertexBufferAttribute));
+            cached.attributeCount = attributes.size();
+            cached.stride = submesh.vertexBufferLayout.stride;
+            cached.vertexSize = submesh.vertices.size();
+            cached.positionScale = submesh.positionScale;
+            cached.positionBias = submesh.positionBias;
+            cached.indexCount = submesh.indices.size();
+            cached.vertexOffset = submesh.vertexOffset;
+            cached.indexOffset = submesh.indexOffset;
+            cached.materialIdx = submeshMaterialSlots[i];
+
+            header.vertexDataSize += submesh.vertices.size();
+            header.indexDataSize += submesh.indices.size() * sizeof(u32);
+        }
+
+        FILE* file = fopen(cachePath, "wb");
+        if (!file)
+        {
+            ELOG("Could not write mesh cache %s", cachePath);
+            return;
+        }
+
+        fwrite(&header, sizeof(header), 1, file);
+        fwrite(cachedDependencies.data(), sizeof(MeshCacheDependency), cachedDependencies.size(), file);
+        fwrite(materialDescs.data(), sizeof(MaterialDesc), materialDescs.size(), file);
+        fwrite(cachedSubmeshes.data(), sizeof(MeshCacheSubMesh), cachedSubmeshes.size(), file);
+        for (const SubMesh& submesh : mesh.submeshes)
+            fwrite(submesh.vertices.data(), 1, submesh.vertices.size(), file);
+        for (const SubMesh& submesh : mesh.submeshes)
+            fwrite(submesh.indices.data(), sizeof(u32), submesh.indices.size(), file);
+
+        fclose(file);
+    }
+
+    u32 LoadModel(App* app, const char* filename)
+    {
+        // A model loaded twice shares its mesh buffers, materials and textures
+        const u64 modelKey = Registry::PathKey(Registry::InternPath(app->registry.paths, filename));
+        u32 existingModelIdx = Registry::Find(app->registry.models, modelKey);
+        if (existingModelIdx != UINT32_MAX)
+            return existingModelIdx;
+
+        char cachePath[512];
+        snprintf(cachePath, sizeof(cachePath), "%s%s", filename, MESH_CACHE_EXTENSION);
+
+        u32 cachedModelIdx = LoadModelFromCache(app, filename, cachePath);
+        if (cachedModelIdx != UINT32_MAX)
+        {
+            Registry::Insert(app->registry.models, modelKey, cachedModelIdx);
+            return cachedModelIdx;
+        }
+
+        // The files opened besides the source, such as the material library, invalidate the cache too
+        std::vector<std::string> openedFiles;
+        aiFileIO fileIO = {};
+        fileIO.OpenProc = MappedFileOpen;
+        fileIO.CloseProc = MappedFileClose;
+        fileIO.UserData = (aiUserData)&openedFiles;
+        const aiScene* scene = aiImportFileEx(filename, MODEL_IMPORT_FLAGS, &fileIO);
+        openedFiles.erase(std::remove(openedFiles.begin(), openedFiles.end(), filename), openedFiles.end());
+
+        if (!scene)
+        {
+            ELOG("Error loading mesh %s: %s", filename, aiGetErrorString());
+            return UINT32_MAX;
+        }
+
+        app->meshes.push_back(Mesh{});
+        Mesh& mesh = app->meshes.back();
+        u32 meshIdx = (u32)app->meshes.size() - 1u;
+
+        app->models.push_back(Model{});
+        Model& model = app->models.back();
+        model.meshIdx = meshIdx;
+        u32 modelIdx = (u32)app->models.size() - 1u;
+
+        String directory = GetDirectoryPart(MakeString(filename));
+
+        // Create a list of materials, reusing the ones other models already created
+        std::vector<MaterialDesc> materialDescs(scene->mNumMaterials);
+        std::vector<u32> materialIndices(scene->mNumMaterials);
+        for (unsigned int i = 0; i < scene->mNumMaterials; ++i)
+        {
+            ReadAssimpMaterial(scene->mMaterials[i], materialDescs[i], directory);
+            materialIndices[i] = ResolveMaterial(app, materialDescs[i]);
+        }
+
+        // Submeshes first reference the scene materials, then they are remapped to the app ones
+        std::vector<aiMesh*> sceneMeshes;
+        ProcessAssimpNode(scene, scene->mRootNode, sceneMeshes);
+        std::vector<u32> submeshMaterialSlots;
+        for (aiMesh* sceneMesh : sceneMeshes)
+        {
+            submeshMaterialSlots.push_back(sceneMesh->mMaterialIndex);
+            model.materialIdx.push_back(materialIndices[sceneMesh->mMaterialIndex]);
+        }
+
+        // Every submesh converts its vertices on its own, one job each
+        mesh.submeshes.resize(sceneMeshes.size());
+        ImportSubMeshesJob job = { sceneMeshes.data(), mesh.submeshes.data(), app->quantizeVertices };
+        JobSystem::ParallelFor(app, ImportSubMeshes, &job, sceneMeshes.size(), 1);
+
+        aiReleaseImport(scene);
+
+        ComputeMeshBounds(app, mesh);
+        UploadMeshBuffers(mesh);
+
+        WriteModelCache(app, filename, cachePath, modelIdx, materialDescs, submeshMaterialSlots, openedFiles);
+
+        Registry::Insert(app->registry.models, modelKey, modelIdx);
 
         return modelIdx;
     }
-}
\ No newline at end of file
+}
@@ -2,28 +2,127 @@
 #define MODEL_LOADING_FUNC
 
 #include <assimp/cimport.h>
+#include <assimp/cfileio.h>
 #include <assimp/scene.h>
 #include <assimp/postprocess.h>
 #include "Globals.h"
 #include <vector>
+#include <string>
 
 struct App;
 
+// Post-process steps applied to every imported model. Any change here invalidates the mesh caches.
+#define MODEL_IMPORT_FLAGS (aiProcess_Triangulate | \
+                            aiProcess_GenSmoothNormals | \
+                            aiProcess_CalcTangentSpace | \
+                            aiProcess_JoinIdenticalVertices | \
+                            aiProcess_PreTransformVertices | \
+                            aiProcess_ImproveCacheLocality | \
+                            aiProcess_OptimizeMeshes | \
+                            aiProcess_SortByPType)
+
+#define MESH_CACHE_EXTENSION ".meshcache"
+#define MESH_CACHE_MAGIC 0x48534D45 // "EMSH"
+#define MESH_CACHE_VERSION 3
+#define MESH_CACHE_MAX_ATTRIBUTES 8
+#define MESH_CACHE_MAX_PATH 256
+
+enum MaterialTextureSlot
+{
+    MaterialTexture_Albedo,
+    MaterialTexture_Emissive,
+    MaterialTexture_Specular,
+    MaterialTexture_Normals,
+    MaterialTexture_Bump,
+    MaterialTexture_Count
+};
+
+// Plain description of a material as read from the source file, before its textures are loaded.
+// It is also the on-disk material record of the mesh cache, so it must stay trivially copyable.
+struct MaterialDesc
+{
+    char name[64];
+    vec3 albedo;
+    vec3 emissive;
+    f32  smoothness;
+    i32  useTexture;
+    char texturePaths[MaterialTexture_Count][256];
+};
+
+// Mesh cache file layout:
+// MeshCacheHeader | MeshCacheDependency[dependencyCount] | MaterialDesc[materialCount] | MeshCacheSubMesh[submeshCount] | vertex data | index data
+struct MeshCacheHeader
+{
+    u32 magic;
+    u32 version;
+    u64 sourceTimestamp;
+    u64 importFlagsHash;
+    u32 materialCount;
+    u32 submeshCount;
+    u32 vertexDataSize;
+    u32 indexDataSize;
+    u32 dependencyCount;
+    u32 padding;
+    u64 dependencyTimestampHash; // Of the last write timestamps of the dependencies, in order
+};
+
+// Another file the importer read for the model, e.g. its material library
+struct MeshCacheDependency
+{
+    char path[MESH_CACHE_MAX_PATH];
+};
+
+struct MeshCacheSubMesh
+{
+    VertexBufferAttribute attributes[MESH_CACHE_MAX_ATTRIBUTES];
+    u32 attributeCount;
+    u32 stride;
+    u32 vertexSize; // in bytes
+    u32 indexCount;
+    u32 vertexOffset;
+    u32 indexOffset;
+    u32 materialIdx; // index into the material records of the cache file
+    vec3 positionScale;
+    vec3 positionBias;
+};
+
 namespace ModelLoader
 {
     Image LoadImage(const char* filename);
 
     void FreeImage(Image image);
 
-    GLuint CreateTexture2DFromImage(Image image);
+    // Without generateMipmaps only the base level is specified, the caller runs glGenerateMipmap before the texture is sampled
+    GLuint CreateTexture2DFromImage(Image image, bool generateMipmaps = true);
+
+    u32 LoadTexture2D(App* app, const char* filepath, bool asyncLoad = true);
+
+    // Writes the vertices in the compact layout when quantizeVertices is set, float32 otherwise.
+    // Touches nothing but the submesh, so several meshes can be processed by concurrent jobs.
+    void ProcessAssimpMesh(aiMesh* mesh, SubMesh& submesh, bool quantizeVertices);
+
+    // One attribute of a vertex converted to floats the way the vertex fetch does, before any dequantization
+    vec4 ReadVertexAttribute(const SubMesh& submesh, const VertexBufferAttribute& attribute, u32 vertexIdx);
 
-    u32 LoadTexture2D(App* app, const char* filepath);
+    void ReadAssimpMaterial(aiMaterial* material, MaterialDesc& desc, String directory);
 
-    void ProcessAssimpMesh(const aiScene* scene, aiMesh* mesh, Mesh* myMesh, u32 baseMeshMaterialIndex, std::vector<u32>& submeshMaterialIndices);
+    void CreateMaterial(App* app, const MaterialDesc& desc, Material& myMaterial);
+
+    // Returns the index of a material with this exact description, creating it if needed
+    u32 ResolveMaterial(App* app, const MaterialDesc& desc);
 
     void ProcessAssimpMaterial(App* app, aiMaterial* material, Material& myMaterial, String directory);
 
-    void ProcessAssimpNode(const aiScene* scene, aiNode* node, Mesh* myMesh, u32 baseMeshMaterialIndex, std::vector<u32>& submeshMaterialIndices);
+    // Lists the meshes of the node hierarchy in submesh order
+    void ProcessAssimpNode(const aiScene* scene, aiNode* node, std::vector<aiMesh*>& meshes);
+
+    void ComputeMeshBounds(App* app, Mesh& mesh);
+
+    void UploadMeshBuffers(Mesh& mesh);
+
+    u32 LoadModelFromCache(App* app, const char* filename, const char* cachePath);
+
+    void WriteModelCache(App* app, const char* filename, const char* cachePath, u32 modelIdx, const std::vector<MaterialDesc>& materialDescs, const std::vector<u32>& submeshMaterialSlots, const std::vector<std::string>& dependencies);
 
     u32 LoadModel(App* app, const char* filename);
 }
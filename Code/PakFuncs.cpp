@@ -0,0 +1,579 @@
+#include "engine.h"
+#include "PakFuncs.h"
+#include <imgui.h>
+#include <algorithm>
+
+#ifdef _WIN32
+#define VC_EXTRALEAN
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <Windows.h>
+#else
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#endif
+
+namespace Pak
+{
+    static PakArchive MountedPak;
+
+    static const char* CodecNames[PakCodec_Count] = { "None", "LZ4" };
+
+    // Never packed: the archives themselves, program binaries only valid for the driver that wrote them,
+    // and mesh caches, which are rewritten next to the sources when they go stale
+    static const char* SkippedExtensions[] = { PAK_EXTENSION, PROGRAM_CACHE_EXTENSION, MESH_CACHE_EXTENSION, ".exe", ".dll", ".pdb" };
+
+    // LZ4 block format: sequences of a token, literals, a 16-bit offset and a match length.
+    // The last match starts 12 bytes before the end at the latest and the last 5 bytes are literals.
+#define LZ4_MIN_MATCH 4
+#define LZ4_LAST_LITERALS 5
+#define LZ4_MATCH_FIND_LIMIT 12
+#define LZ4_MAX_OFFSET 65535
+#define LZ4_HASH_BITS 16
+
+    static u32 Read32(const u8* bytes)
+    {
+        u32 value;
+        memcpy(&value, bytes, sizeof(value));
+        return value;
+    }
+
+    static bool WriteLength(u8* dst, u64 capacity, u64& op, u64 length)
+    {
+        for (; length >= 255; length -= 255)
+        {
+            if (op >= capacity) return false;
+            dst[op++] = 255;
+        }
+        if (op >= capacity) return false;
+        dst[op++] = (u8)length;
+        return true;
+    }
+
+    static bool WriteSequence(u8* dst, u64 capacity, u64& op, const u8* literals, u64 literalCount, u32 offset, u64 matchLength)
+    {
+        if (op >= capacity) return false;
+        u8& token = dst[op++];
+        token = (u8)((literalCount < 15 ? literalCount : 15) << 4);
+        if (literalCount >= 15 && !WriteLength(dst, capacity, op, literalCount - 15))
+            return false;
+
+        if (op + literalCount > capacity) return false;
+        memcpy(dst + op, literals, literalCount);
+        op += literalCount;
+
+        // The last sequence has no match
+        if (matchLength == 0)
+            return true;
+
+        if (op + 2 > capacity) return false;
+        dst[op++] = (u8)(offset & 0xff);
+        dst[op++] = (u8)(offset >> 8);
+
+        const u64 matchCode = matchLength - LZ4_MIN_MATCH;
+        token |= (u8)(matchCode < 15 ? matchCode : 15);
+        return matchCode < 15 || WriteLength(dst, capacity, op, matchCode - 15);
+    }
+
+    // Greedy single probe compressor. Returns 0 when the output does not fit in capacity.
+    static u64 Lz4Compress(const u8* src, u64 srcSize, u8* dst, u64 capacity)
+    {
+        std::vector<u32> table(1u << LZ4_HASH_BITS, UINT32_MAX);
+        u64 op = 0;
+        u64 anchor = 0;
+        u64 ip = 0;
+
+        while (srcSize >= LZ4_MATCH_FIND_LIMIT && ip + LZ4_MATCH_FIND_LIMIT <= srcSize)
+        {
+            const u32 sequence = Read32(src + ip);
+            const u32 hash = (sequence * 2654435761u) >> (32 - LZ4_HASH_BITS);
+            const u32 candidate = table[hash];
+            table[hash] = (u32)ip;
+
+            if (candidate == UINT32_MAX || ip - candidate > LZ4_MAX_OFFSET || Read32(src + candidate) != sequence)
+            {
+                ip++;
+                continue;
+            }
+
+            u64 matchLength = LZ4_MIN_MATCH;
+            const u64 matchLimit = srcSize - LZ4_LAST_LITERALS;
+            while (ip + matchLength < matchLimit && src[candidate + matchLength] == src[ip + matchLength])
+                matchLength++;
+
+            if (!WriteSequence(dst, capacity, op, src + anchor, ip - anchor, (u32)(ip - candidate), matchLength))
+                return 0;
+
+            ip += matchLength;
+            anchor = ip;
+        }
+
+        if (!WriteSequence(dst, capacity, op, src + anchor, srcSize - anchor, 0, 0))
+            return 0;
+
+        return op;
+    }
+
+    // Fails on any malformed input instead of reading or writing out of bounds
+    static bool Lz4Decompress(const u8* src, u64 srcSize, u8* dst, u64 dstSize)
+    {
+        u64 ip = 0;
+        u64 op = 0;
+
+        while (ip < srcSize)
+        {
+            const u8 token = src[ip++];
+
+            u64 literalCount = token >> 4;
+            if (literalCount == 15)
+            {
+                u8 byte;
+                do
+                {
+                    if (ip >= srcSize) return false;
+                    byte = src[ip++];
+                    literalCount += byte;
+                } while (byte == 255);
+            }
+
+            if (literalCount > srcSize - ip || literalCount > dstSize - op)
+                return false;
+            memcpy(dst + op, src + ip, literalCount);
+            ip += literalCount;
+            op += literalCount;
+
+            if (ip == srcSize)
+                break;
+
+            if (srcSize - ip < 2)
+                return false;
+            const u64 offset = src[ip] | ((u64)src[ip + 1] << 8);
+            ip += 2;
+            if (offset == 0 || offset > op)
+                return false;
+
+            u64 matchLength = token & 15;
+            if (matchLength == 15)
+            {
+                u8 byte;
+                do
+                {
+                    if (ip >= srcSize) return false;
+                    byte = src[ip++];
+                    matchLength += byte;
+                } while (byte == 255);
+            }
+            matchLength += LZ4_MIN_MATCH;
+
+            if (matchLength > dstSize - op)
+                return false;
+
+            // The match may overlap the bytes it produces
+            const u8* match = dst + op - offset;
+            for (u64 i = 0; i < matchLength; ++i)
+                dst[op + i] = match[i];
+            op += matchLength;
+        }
+
+        return op == dstSize;
+    }
+
+    // Paths relative to the working directory with '/' separators and no "." or ".." parts, as the
+    // packer stores them. Returns false for absolute paths and paths leaving the working directory.
+    static bool NormalizePath(const char* filepath, char* normalized, u32 capacity)
+    {
+        if (filepath[0] == '/' || filepath[0] == '\\' || strchr(filepath, ':'))
+            return false;
+
+        u32 length = 0;
+        const char* part = filepath;
+        while (*part)
+        {
+            const char* partEnd = part;
+            while (*partEnd && *partEnd != '/' && *partEnd != '\\')
+                partEnd++;
+            const u32 partLength = (u32)(partEnd - part);
+
+            if (partLength == 2 && part[0] == '.' && part[1] == '.')
+            {
+                if (length == 0)
+                    return false;
+                while (length > 0 && normalized[length - 1] != '/')
+                    length--;
+                if (length > 0)
+                    length--;
+            }
+            else if (partLength > 0 && !(partLength == 1 && part[0] == '.'))
+            {
+                if (length + partLength + 2 > capacity)
+                    return false;
+                if (length > 0)
+                    normalized[length++] = '/';
+                memcpy(normalized + length, part, partLength);
+                length += partLength;
+            }
+
+            part = *partEnd ? partEnd + 1 : partEnd;
+        }
+
+        normalized[length] = '\0';
+        return length > 0;
+    }
+
+    static const PakEntry* FindEntry(const char* filepath)
+    {
+        if (!MountedPak.header)
+            return NULL;
+
+        char path[PAK_MAX_PATH];
+        if (!NormalizePath(filepath, path, sizeof(path)))
+            return NULL;
+
+        // The TOC is sorted by path
+        u32 first = 0;
+        u32 last = MountedPak.header->entryCount;
+        while (first < last)
+        {
+            const u32 middle = first + (last - first) / 2;
+            const PakEntry& entry = MountedPak.entries[middle];
+            const int order = strcmp(path, MountedPak.paths + entry.pathOffset);
+            if (order == 0)
+                return &entry;
+            if (order < 0)
+                last = middle;
+            else
+                first = middle + 1;
+        }
+
+        return NULL;
+    }
+
+    // When overrides are allowed, a loose file written after the archive was packed wins over its entry, so
+    // edited shaders hot reload and rewritten files are read. Otherwise only the TOC is read.
+    static const PakEntry* FindCurrentEntry(const char* filepath)
+    {
+        const PakEntry* entry = FindEntry(filepath);
+        if (entry && MountedPak.allowLooseOverrides && GetLooseFileLastWriteTimestamp(filepath) > entry->timestamp)
+            return NULL;
+
+        return entry;
+    }
+
+    static bool IsSkipped(const std::string& path)
+    {
+        for (const char* extension : SkippedExtensions)
+        {
+            const size_t extensionLength = strlen(extension);
+            if (path.size() >= extensionLength && path.compare(path.size() - extensionLength, extensionLength, extension) == 0)
+                return true;
+        }
+        return false;
+    }
+
+    // Lists the files under directory, with paths relative to root
+    static void ListFiles(const std::string& root, const std::string& directory, std::vector<std::string>& files)
+    {
+        const std::string searchPath = directory.empty() ? root : root + "/" + directory;
+
+#ifdef _WIN32
+        WIN32_FIND_DATAA findData;
+        HANDLE find = FindFirstFileA((searchPath + "/*").c_str(), &findData);
+        if (find == INVALID_HANDLE_VALUE)
+            return;
+
+        do
+        {
+            const char* name = findData.cFileName;
+            if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0)
+                continue;
+
+            const std::string path = directory.empty() ? name : directory + "/" + name;
+            if (findData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+                ListFiles(root, path, files);
+            else if (!IsSkipped(path))
+                files.push_back(path);
+        } while (FindNextFileA(find, &findData));
+
+        FindClose(find);
+#else
+        DIR* dir = opendir(searchPath.c_str());
+        if (!dir)
+            return;
+
+        while (dirent* dirEntry = readdir(dir))
+        {
+            const char* name = dirEntry->d_name;
+            if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0)
+                continue;
+
+            const std::string path = directory.empty() ? name : directory + "/" + name;
+            struct stat fileStat;
+            if (stat((root + "/" + path).c_str(), &fileStat) != 0)
+                continue;
+
+            if (S_ISDIR(fileStat.st_mode))
+                ListFiles(root, path, files);
+            else if (S_ISREG(fileStat.st_mode) && !IsSkipped(path))
+                files.push_back(path);
+        }
+
+        closedir(dir);
+#endif
+    }
+
+    static bool WritePadding(FILE* file, u64 offset, u64 alignedOffset)
+    {
+        static const u8 Zeros[1024] = {};
+        while (offset < alignedOffset)
+        {
+            const u64 count = alignedOffset - offset < sizeof(Zeros) ? alignedOffset - offset : sizeof(Zeros);
+            if (fwrite(Zeros, 1, count, file) != count)
+                return false;
+            offset += count;
+        }
+        return true;
+    }
+
+    bool Build(const char* rootDirectory, const char* pakPath, bool compress)
+    {
+        std::vector<std::string> files;
+        ListFiles(rootDirectory, "", files);
+        std::sort(files.begin(), files.end());
+
+        PakHeader header = {};
+        header.magic = PAK_MAGIC;
+        header.version = PAK_VERSION;
+        header.entryCount = files.size();
+
+        std::vector<PakEntry> entries(files.size());
+        std::string pathData;
+        for (u32 i = 0; i < files.size(); ++i)
+        {
+            entries[i] = {};
+            entries[i].pathOffset = pathData.size();
+            entries[i].pathLength = files[i].size();
+            pathData.append(files[i].c_str(), files[i].size() + 1);
+        }
+        header.pathDataSize = pathData.size();
+
+        FILE* file = fopen(pakPath, "wb");
+        if (!file)
+        {
+            ELOG("Could not write asset archive %s", pakPath);
+            return false;
+        }
+
+        // The TOC goes first but is written last, once the entry offsets and sizes are known
+        const u64 tocSize = sizeof(PakHeader) + entries.size() * sizeof(PakEntry) + pathData.size();
+        bool success = WritePadding(file, 0, tocSize);
+        u64 offset = tocSize;
+
+        u64 totalSize = 0;
+        u64 totalStoredSize = 0;
+        std::vector<u8> compressed;
+        for (u32 i = 0; i < files.size() && success; ++i)
+        {
+            const std::string sourcePath = std::string(rootDirectory) + "/" + files[i];
+            FileView view = {};
+            if (!MapFile(sourcePath.c_str(), view))
+            {
+                ELOG("Could not read %s, the asset archive %s is incomplete", sourcePath.c_str(), pakPath);
+                success = false;
+                break;
+            }
+
+            PakEntry& entry = entries[i];
+            entry.size = view.size;
+            entry.timestamp = GetFileLastWriteTimestamp(sourcePath.c_str());
+            entry.codec = PakCodec_None;
+            entry.storedSize = view.size;
+            const u8* storedData = view.data;
+
+            // Only worth decompressing at load when it saves a good part of the reads
+            if (compress && view.size > 0)
+            {
+                compressed.resize(view.size);
+                const u64 compressedSize = Lz4Compress(view.data, view.size, compressed.data(), view.size - view.size / 8);
+                if (compressedSize > 0)
+                {
+                    entry.codec = PakCodec_LZ4;
+                    entry.storedSize = compressedSize;
+                    storedData = compressed.data();
+                }
+            }
+
+            const u64 alignedOffset = (offset + PAK_ENTRY_ALIGNMENT - 1) & ~(u64)(PAK_ENTRY_ALIGNMENT - 1);
+            success = WritePadding(file, offset, alignedOffset) &&
+                fwrite(storedData, 1, entry.storedSize, file) == entry.storedSize;
+            entry.dataOffset = alignedOffset;
+            offset = alignedOffset + entry.storedSize;
+
+            totalSize += entry.size;
+            totalStoredSize += entry.storedSize;
+            UnmapFile(view);
+        }
+
+        success = success &&
+            fseek(file, 0, SEEK_SET) == 0 &&
+            fwrite(&header, sizeof(header), 1, file) == 1 &&
+            fwrite(entries.data(), sizeof(PakEntry), entries.size(), file) == entries.size() &&
+            fwrite(pathData.data(), 1, pathData.size(), file) == pathData.size();
+
+        success = fclose(file) == 0 && success;
+        if (!success)
+        {
+            ELOG("Could not write asset archive %s", pakPath);
+            remove(pakPath);
+            return false;
+        }
+
+        ILOG("Packed %u files into %s: %.2f MB stored for %.2f MB of data, archive %.2f MB", header.entryCount, pakPath,
+            totalStoredSize / (f64)MB(1), totalSize / (f64)MB(1), offset / (f64)MB(1));
+        return true;
+    }
+
+    bool Mount(const char* pakPath, bool allowLooseOverrides)
+    {
+        Unmount();
+
+        FileView view = {};
+        if (!MapFile(pakPath, view))
+            return false;
+
+        PakHeader header = {};
+        if (view.size >= sizeof(header))
+            memcpy(&header, view.data, sizeof(header));
+
+        const u64 tocSize = sizeof(PakHeader) + (u64)header.entryCount * sizeof(PakEntry) + header.pathDataSize;
+        if (header.magic != PAK_MAGIC || header.version != PAK_VERSION || tocSize > view.size)
+        {
+            ELOG("Asset archive %s is invalid, reading loose files", pakPath);
+            UnmapFile(view);
+            return false;
+        }
+
+        // Every entry must lie inside the archive, so lookups need no checks later
+        const PakEntry* entries = (const PakEntry*)(view.data + sizeof(PakHeader));
+        const char* paths = (const char*)(entries + header.entryCount);
+        for (u32 i = 0; i < header.entryCount; ++i)
+        {
+            const PakEntry& entry = entries[i];
+            if (entry.pathOffset + (u64)entry.pathLength >= header.pathDataSize ||
+                paths[entry.pathOffset + entry.pathLength] != '\0' ||
+                entry.codec >= PakCodec_Count ||
+                entry.dataOffset > view.size || entry.storedSize > view.size - entry.dataOffset ||
+                (entry.codec == PakCodec_None && entry.storedSize != entry.size))
+            {
+                ELOG("Asset archive %s is invalid, reading loose files", pakPath);
+                UnmapFile(view);
+                return false;
+            }
+        }
+
+        // The TOC is read in place, the entries are brought in as they are opened
+        AdviseFileView(view, FileAccess_Random);
+        AdviseFileView(view, FileAccess_WillNeed, 0, tocSize);
+
+        MountedPak.path = pakPath;
+        MountedPak.view = view;
+        MountedPak.entries = entries;
+        MountedPak.paths = paths;
+        MountedPak.allowLooseOverrides = allowLooseOverrides;
+        MountedPak.openedEntries = 0;
+        MountedPak.readBytes = 0;
+        MountedPak.decompressedBytes = 0;
+        MountedPak.header = (const PakHeader*)view.data;
+
+        ILOG("Mounted asset archive %s with %u files%s", pakPath, header.entryCount, allowLooseOverrides ? ", newer loose files override it" : "");
+        return true;
+    }
+
+    void Unmount()
+    {
+        if (!MountedPak.header)
+            return;
+
+        MountedPak.header = NULL;
+        MountedPak.entries = NULL;
+        MountedPak.paths = NULL;
+        UnmapFile(MountedPak.view);
+        MountedPak.path.clear();
+    }
+
+    bool MapEntry(const char* filepath, FileView& view)
+    {
+        const PakEntry* entry = FindCurrentEntry(filepath);
+        if (!entry)
+            return false;
+
+        MountedPak.openedEntries++;
+        MountedPak.readBytes += entry->storedSize;
+
+        if (entry->codec == PakCodec_None)
+        {
+            // Read ahead of the whole entry while the caller starts on its first bytes
+            AdviseFileView(MountedPak.view, FileAccess_WillNeed, entry->dataOffset, entry->storedSize);
+            view.data = entry->size > 0 ? MountedPak.view.data + entry->dataOffset : NULL;
+            view.size = entry->size;
+            view.source = FileViewSource_Archive;
+            return true;
+        }
+
+        AdviseFileView(MountedPak.view, FileAccess_Sequential, entry->dataOffset, entry->storedSize);
+        u8* data = (u8*)malloc(entry->size);
+        if (!data || !Lz4Decompress(MountedPak.view.data + entry->dataOffset, entry->storedSize, data, entry->size))
+        {
+            ELOG("Could not decompress %s from the asset archive %s", filepath, MountedPak.path.c_str());
+            free(data);
+            return false;
+        }
+
+        MountedPak.decompressedBytes += entry->size;
+        view.data = data;
+        view.size = entry->size;
+        view.source = FileViewSource_Decompressed;
+        return true;
+    }
+
+    bool GetEntryTimestamp(const char* filepath, u64& timestamp)
+    {
+        const PakEntry* entry = FindCurrentEntry(filepath);
+        if (!entry)
+            return false;
+
+        timestamp = entry->timestamp;
+        return true;
+    }
+
+    bool PrefetchEntry(const char* filepath)
+    {
+        const PakEntry* entry = FindCurrentEntry(filepath);
+        if (!entry)
+            return false;
+
+        AdviseFileView(MountedPak.view, FileAccess_WillNeed, entry->dataOffset, entry->storedSize);
+        return true;
+    }
+
+    void DrawGui()
+    {
+        if (!MountedPak.header)
+        {
+            ImGui::Text("No archive mounted, assets are read from loose files");
+            ImGui::Text("Run the engine with --pack [archive] [--compress] to build %s", PAK_DEFAULT_PATH);
+            return;
+        }
+
+        u32 codecCounts[PakCodec_Count] = {};
+        for (u32 i = 0; i < MountedPak.header->entryCount; ++i)
+            codecCounts[MountedPak.entries[i].codec]++;
+
+        ImGui::Text("%s: %u files, %.2f MB", MountedPak.path.c_str(), MountedPak.header->entryCount, MountedPak.view.size / (f64)MB(1));
+        for (u32 codec = 0; codec < PakCodec_Count; ++codec)
+            ImGui::Text("  %-5s %u files", CodecNames[codec], codecCounts[codec]);
+        ImGui::Text("Newer loose files %s", MountedPak.allowLooseOverrides ? "override their entries" : "are ignored");
+        ImGui::Text("Opened %u entries, read %.2f MB, decompressed %.2f MB", MountedPak.openedEntries.load(),
+            MountedPak.readBytes / (f64)MB(1), MountedPak.decompressedBytes / (f64)MB(1));
+    }
+}
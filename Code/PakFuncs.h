@@ -0,0 +1,89 @@
+#ifndef PAK_FUNC
+#define PAK_FUNC
+
+#include "Globals.h"
+#include "platform.h"
+#include <atomic>
+#include <string>
+
+#define PAK_DEFAULT_PATH "Assets.pak"   // Mounted at startup when it exists next to the loose files
+#define PAK_EXTENSION ".pak"
+#define PAK_MAGIC 0x314B4150            // "PAK1"
+#define PAK_VERSION 1
+#define PAK_ENTRY_ALIGNMENT KB(64)      // Entries start on a boundary the mapping and madvise can use as is
+#define PAK_MAX_PATH 512
+
+// Debug builds let a loose file newer than its entry override it, so edited assets hot reload over a mounted
+// archive. That costs a stat per lookup, so release builds only read the TOC unless run with --loose-overrides.
+#ifdef _DEBUG
+#define PAK_DEFAULT_LOOSE_OVERRIDES true
+#else
+#define PAK_DEFAULT_LOOSE_OVERRIDES false
+#endif
+
+enum PakCodec
+{
+    PakCodec_None, // Stored as is, read in place from the mapping
+    PakCodec_LZ4,  // LZ4 block format, decompressed into its own buffer when opened
+    PakCodec_Count
+};
+
+// File layout: header, the TOC sorted by path, the path strings, then the entries
+struct PakHeader
+{
+    u32 magic;
+    u32 version;
+    u32 entryCount;
+    u32 pathDataSize;
+};
+
+struct PakEntry
+{
+    u32 pathOffset;  // In the path strings, relative to the working directory with '/' separators
+    u32 pathLength;
+    u32 codec;
+    u32 padding;
+    u64 dataOffset;  // From the start of the archive, PAK_ENTRY_ALIGNMENT aligned
+    u64 storedSize;
+    u64 size;        // Once decompressed
+    u64 timestamp;   // Last write time of the packed file, as GetFileLastWriteTimestamp returns it
+};
+
+// The mounted archive is read only, so loader threads look entries up without locking
+struct PakArchive
+{
+    std::string      path;
+    FileView         view;
+    const PakHeader* header;
+    const PakEntry*  entries;
+    const char*      paths;
+    bool             allowLooseOverrides;
+
+    std::atomic<u32> openedEntries;
+    std::atomic<u64> readBytes;
+    std::atomic<u64> decompressedBytes;
+};
+
+namespace Pak
+{
+    // Offline packer: packs every file under rootDirectory into pakPath, but the archives and the
+    // program and mesh caches. With compress, an entry is stored with LZ4 when it saves at
+    // least an eighth of its size. Reads the loose files, call it before mounting an archive.
+    bool Build(const char* rootDirectory, const char* pakPath, bool compress);
+
+    // From then on MapFile, ReadTextFile, PrefetchFile and GetFileLastWriteTimestamp look in the archive
+    // before the loose files. With allowLooseOverrides a loose file newer than its entry is read instead.
+    // Call before any thread loads assets.
+    bool Mount(const char* pakPath, bool allowLooseOverrides = PAK_DEFAULT_LOOSE_OVERRIDES);
+
+    void Unmount();
+
+    // Used by the platform layer. Return false when no archive is mounted or it lacks the file.
+    bool MapEntry(const char* filepath, FileView& view);
+    bool GetEntryTimestamp(const char* filepath, u64& timestamp);
+    bool PrefetchEntry(const char* filepath);
+
+    void DrawGui();
+}
+
+#endif // !PAK_FUNC
@@ -0,0 +1,231 @@
+#include "engine.h"
+#include "ProfilerFuncs.h"
+#include <imgui.h>
+#include <float.h>
+#include <stdio.h>
+#include <string.h>
+
+namespace Profiler
+{
+    static f64 NowMs()
+    {
+        return glfwGetTime() * 1000.0;
+    }
+
+    static ProfileTimeline& FindTimeline(ProfilerState& profiler, const ProfileScopeRecord& scope)
+    {
+        for (ProfileTimeline& timeline : profiler.timelines)
+            if (timeline.name == scope.name || strcmp(timeline.name, scope.name) == 0)
+                return timeline;
+
+        ProfileTimeline timeline = {};
+        timeline.name = scope.name;
+        timeline.depth = scope.depth;
+        timeline.hasGpu = scope.hasGpu;
+        profiler.timelines.push_back(timeline);
+        return profiler.timelines.back();
+    }
+
+    static void WriteTrace(ProfilerState& profiler)
+    {
+        FILE* file = fopen(PROFILER_TRACE_FILE, "wb");
+        if (!file)
+        {
+            ELOG("Could not write profiler trace %s", PROFILER_TRACE_FILE);
+            profiler.traceEvents.clear();
+            return;
+        }
+
+        fprintf(file, "{\"traceEvents\":[\n");
+        fprintf(file, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":1,\"args\":{\"name\":\"CPU\"}},\n");
+        fprintf(file, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":2,\"args\":{\"name\":\"GPU\"}}");
+        for (const ProfileTraceEvent& event : profiler.traceEvents)
+        {
+            fprintf(file, ",\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":%d}",
+                event.name, event.isGpu ? "gpu" : "cpu", event.beginUs, event.durationUs, event.isGpu ? 2 : 1);
+        }
+        fprintf(file, "\n]}\n");
+        fclose(file);
+
+        ILOG("Profiler trace written to %s (%u events)", PROFILER_TRACE_FILE, (u32)profiler.traceEvents.size());
+        profiler.traceEvents.clear();
+    }
+
+    // Moves the timings of a frame that left flight into the histograms and the trace
+    static void ResolveFrame(ProfilerState& profiler, ProfileFrame& frame)
+    {
+        frame.isPending = false;
+
+        // Never wait for the GPU: a frame whose last query is still in flight keeps only its CPU timings
+        bool isGpuAvailable = true;
+        for (i32 i = (i32)frame.scopeCount - 1; i >= 0; --i)
+        {
+            if (!frame.scopes[i].hasGpu)
+                continue;
+
+            GLint isAvailable = GL_FALSE;
+            glGetQueryObjectiv(frame.queries[i * 2 + 1], GL_QUERY_RESULT_AVAILABLE, &isAvailable);
+            isGpuAvailable = isAvailable == GL_TRUE;
+            break;
+        }
+
+        const u32 historyIdx = profiler.historyHead;
+        profiler.historyHead = (profiler.historyHead + 1) % PROFILER_HISTORY;
+
+        for (ProfileTimeline& timeline : profiler.timelines)
+        {
+            timeline.cpuMs[historyIdx] = 0.0f;
+            timeline.gpuMs[historyIdx] = 0.0f;
+        }
+
+        const bool isCapturing = profiler.traceFramesLeft > 0;
+
+        for (u32 i = 0; i < frame.scopeCount; ++i)
+        {
+            const ProfileScopeRecord& scope = frame.scopes[i];
+            ProfileTimeline& timeline = FindTimeline(profiler, scope);
+
+            const f64 cpuMs = scope.cpuEndMs - scope.cpuBeginMs;
+            timeline.cpuMs[historyIdx] += (f32)cpuMs;
+
+            if (isCapturing)
+                profiler.traceEvents.push_back({ scope.name, scope.cpuBeginMs * 1000.0, cpuMs * 1000.0, false });
+
+            if (!scope.hasGpu || !isGpuAvailable)
+                continue;
+
+            GLuint64 gpuBeginNs = 0;
+            GLuint64 gpuEndNs = 0;
+            glGetQueryObjectui64v(frame.queries[i * 2], GL_QUERY_RESULT, &gpuBeginNs);
+            glGetQueryObjectui64v(frame.queries[i * 2 + 1], GL_QUERY_RESULT, &gpuEndNs);
+
+            const f64 gpuMs = (f64)(gpuEndNs - gpuBeginNs) / 1000000.0;
+            timeline.gpuMs[historyIdx] += (f32)gpuMs;
+
+            if (isCapturing)
+            {
+                const f64 gpuBeginUs = frame.cpuReferenceMs * 1000.0 + (f64)((GLint64)gpuBeginNs - frame.gpuReferenceNs) / 1000.0;
+                profiler.traceEvents.push_back({ scope.name, gpuBeginUs, gpuMs * 1000.0, true });
+            }
+        }
+
+        if (isCapturing && --profiler.traceFramesLeft == 0)
+            WriteTrace(profiler);
+    }
+
+    void Init(App* app)
+    {
+        ProfilerState& profiler = app->profiler;
+        for (ProfileFrame& frame : profiler.frames)
+        {
+            glGenQueries(ARRAY_COUNT(frame.queries), frame.queries);
+            frame.scopeCount = 0;
+            frame.isPending = false;
+        }
+    }
+
+    void Shutdown(App* app)
+    {
+        for (ProfileFrame& frame : app->profiler.frames)
+            glDeleteQueries(ARRAY_COUNT(frame.queries), frame.queries);
+    }
+
+    void BeginFrame(App* app)
+    {
+        ProfilerState& profiler = app->profiler;
+        profiler.frameIndex = (profiler.frameIndex + 1) % PROFILER_FRAME_LATENCY;
+        profiler.openDepth = 0;
+
+        ProfileFrame& frame = profiler.frames[profiler.frameIndex];
+        if (frame.isPending)
+            ResolveFrame(profiler, frame);
+
+        frame.scopeCount = 0;
+        frame.isPending = true;
+        frame.cpuReferenceMs = NowMs();
+        glGetInteger64v(GL_TIMESTAMP, &frame.gpuReferenceNs);
+    }
+
+    u32 BeginScope(App* app, const char* name, bool isGpu)
+    {
+        ProfilerState& profiler = app->profiler;
+        ProfileFrame& frame = profiler.frames[profiler.frameIndex];
+        if (frame.scopeCount == PROFILER_MAX_SCOPES)
+            return UINT32_MAX;
+
+        // Timestamps instead of GL_TIME_ELAPSED, since elapsed queries cannot nest
+        const u32 scopeIdx = frame.scopeCount++;
+        if (isGpu)
+            glQueryCounter(frame.queries[scopeIdx * 2], GL_TIMESTAMP);
+
+        ProfileScopeRecord& scope = frame.scopes[scopeIdx];
+        scope.name = name;
+        scope.depth = profiler.openDepth++;
+        scope.hasGpu = isGpu;
+        scope.cpuBeginMs = NowMs();
+        scope.cpuEndMs = scope.cpuBeginMs;
+
+        return scopeIdx;
+    }
+
+    void EndScope(App* app, u32 scopeIdx)
+    {
+        if (scopeIdx == UINT32_MAX)
+            return;
+
+        ProfilerState& profiler = app->profiler;
+        ProfileFrame& frame = profiler.frames[profiler.frameIndex];
+
+        ProfileScopeRecord& scope = frame.scopes[scopeIdx];
+        scope.cpuEndMs = NowMs();
+        if (scope.hasGpu)
+            glQueryCounter(frame.queries[scopeIdx * 2 + 1], GL_TIMESTAMP);
+
+        profiler.openDepth--;
+    }
+
+    void CaptureTrace(App* app, u32 frameCount)
+    {
+        app->profiler.traceEvents.clear();
+        app->profiler.traceFramesLeft = frameCount;
+    }
+
+    void DrawGui(App* app)
+    {
+        ProfilerState& profiler = app->profiler;
+
+        // The latest resolved frame is the entry before the head
+        const u32 latestIdx = (profiler.historyHead + PROFILER_HISTORY - 1) % PROFILER_HISTORY;
+
+        for (const ProfileTimeline& timeline : profiler.timelines)
+        {
+            ImGui::PushID(timeline.name);
+            ImGui::Indent(timeline.depth * 10.0f + 1.0f);
+
+            if (timeline.hasGpu)
+            {
+                ImGui::Text("%s  CPU %.3f ms  GPU %.3f ms", timeline.name, timeline.cpuMs[latestIdx], timeline.gpuMs[latestIdx]);
+                ImGui::PlotHistogram("##gpu", timeline.gpuMs, PROFILER_HISTORY, profiler.historyHead, "GPU", 0.0f, FLT_MAX, ImVec2(0, 40));
+            }
+            else
+            {
+                ImGui::Text("%s  CPU %.3f ms", timeline.name, timeline.cpuMs[latestIdx]);
+                ImGui::PlotHistogram("##cpu", timeline.cpuMs, PROFILER_HISTORY, profiler.historyHead, "CPU", 0.0f, FLT_MAX, ImVec2(0, 40));
+            }
+
+            ImGui::Unindent(timeline.depth * 10.0f + 1.0f);
+            ImGui::PopID();
+        }
+
+        if (ImGui::TreeNode("GL state cache"))
+        {
+            GLState::DrawGui(app);
+            ImGui::TreePop();
+        }
+
+        if (profiler.traceFramesLeft > 0)
+            ImGui::Text("Capturing trace... %u frames left", profiler.traceFramesLeft);
+        else if (ImGui::Button("Capture Chrome trace (120 frames)"))
+            CaptureTrace(app, 120);
+    }
+}
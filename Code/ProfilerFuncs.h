@@ -0,0 +1,99 @@
+#ifndef PROFILER_FUNC
+#define PROFILER_FUNC
+
+#include "Globals.h"
+
+struct App;
+
+#define PROFILER_MAX_SCOPES 64      // Per frame
+#define PROFILER_FRAME_LATENCY 3    // Frames in flight before the GPU timestamps of a frame are read back
+#define PROFILER_HISTORY 128        // Frames kept for the histograms
+#define PROFILER_TRACE_FILE "profile_trace.json"
+
+struct ProfileScopeRecord
+{
+    const char* name;
+    u32         depth;
+    f64         cpuBeginMs;
+    f64         cpuEndMs;
+    bool        hasGpu;
+};
+
+// One slot per frame in flight, each owning the timestamp queries of its scopes
+struct ProfileFrame
+{
+    ProfileScopeRecord scopes[PROFILER_MAX_SCOPES];
+    GLuint             queries[PROFILER_MAX_SCOPES * 2]; // Begin and end timestamp of every scope
+    u32                scopeCount;
+    f64                cpuReferenceMs; // CPU and GPU clocks sampled together, to place GPU scopes on the trace
+    GLint64            gpuReferenceNs;
+    bool               isPending;
+};
+
+// Rolling per-name timings, several scopes with the same name in a frame add up
+struct ProfileTimeline
+{
+    const char* name;
+    u32         depth;
+    bool        hasGpu;
+    f32         cpuMs[PROFILER_HISTORY];
+    f32         gpuMs[PROFILER_HISTORY];
+};
+
+struct ProfileTraceEvent
+{
+    const char* name;
+    f64         beginUs;
+    f64         durationUs;
+    bool        isGpu;
+};
+
+struct ProfilerState
+{
+    ProfileFrame frames[PROFILER_FRAME_LATENCY];
+    u32          frameIndex;
+    u32          openDepth;
+
+    std::vector<ProfileTimeline> timelines;
+    u32                          historyHead;  // Next history entry to write
+
+    std::vector<ProfileTraceEvent> traceEvents;
+    u32                            traceFramesLeft; // Frames still to capture, 0 when not capturing
+};
+
+namespace Profiler
+{
+    void Init(App* app);
+
+    void Shutdown(App* app);
+
+    // Reads back the frame that left flight and opens a new one. Call once per frame before any scope.
+    void BeginFrame(App* app);
+
+    // GPU scopes also record CPU time. Returns UINT32_MAX when the frame ran out of scopes.
+    u32 BeginScope(App* app, const char* name, bool isGpu);
+
+    void EndScope(App* app, u32 scopeIdx);
+
+    // Records the next frames and writes them as a Chrome trace (chrome://tracing, Perfetto)
+    void CaptureTrace(App* app, u32 frameCount);
+
+    void DrawGui(App* app);
+}
+
+// RAII marker, use through PROFILE_SCOPE/PROFILE_GPU_SCOPE
+struct ProfileScope
+{
+    ProfileScope(App* app, const char* name, bool isGpu) : app(app), scopeIdx(Profiler::BeginScope(app, name, isGpu)) {}
+    ~ProfileScope() { Profiler::EndScope(app, scopeIdx); }
+
+    App* app;
+    u32  scopeIdx;
+};
+
+#define PROFILE_CONCAT_INNER(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_INNER(a, b)
+#define PROFILE_SCOPE(app, name) ProfileScope PROFILE_CONCAT(profileScope, __LINE__)(app, name, false)
+#define PROFILE_GPU_SCOPE(app, name) ProfileScope PROFILE_CONCAT(profileScope, __LINE__)(app, name, true)
+
+#endif // !PROFILER_FUNC
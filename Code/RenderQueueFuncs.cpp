@@ -0,0 +1,219 @@
+#include "engine.h"
+#include "RenderQueueFuncs.h"
+#include <imgui.h>
+
+namespace RenderQueue
+{
+    static const char* OrderNames[RenderQueueOrder_Count] = { "Submission", "State", "Front to back" };
+
+    static u64 Field(u32 value, u32 bits)
+    {
+        return (u64)glm::min(value, (1u << bits) - 1);
+    }
+
+    // View depth of the submesh bounds quantized linearly between the camera planes
+    static u32 QuantizedDepth(App* app, const Entity& entity, const SubMesh& submesh)
+    {
+        const Camera& camera = app->camera;
+        const vec4 center = camera.viewMatrix * entity.worldMatrix * vec4(vec3(submesh.boundingSphere), 1.0f);
+        const f32 depth = glm::clamp((-center.z - camera.znear) / (camera.zfar - camera.znear), 0.0f, 1.0f);
+        return (u32)(depth * (f32)((1u << RENDER_QUEUE_DEPTH_BITS) - 1));
+    }
+
+    static u64 MakeKey(App* app, RenderQueueOrder order, const RenderQueueItem& item)
+    {
+        const Entity& entity = app->entities[item.entityIdx];
+        const Model& model = app->models[entity.modelIndex];
+        const SubMesh& submesh = app->meshes[model.meshIdx].submeshes[item.submeshIdx];
+
+        const u64 program = Field(item.programIdx, RENDER_QUEUE_PROGRAM_BITS);
+        const u64 geometry = Field((model.meshIdx << RENDER_QUEUE_SUBMESH_BITS) | glm::min(item.submeshIdx, (1u << RENDER_QUEUE_SUBMESH_BITS) - 1), RENDER_QUEUE_GEOMETRY_BITS);
+        const u64 material = Field(item.materialIdx, RENDER_QUEUE_MATERIAL_BITS);
+        const u64 depth = QuantizedDepth(app, entity, submesh);
+
+        const u64 state = (program << (RENDER_QUEUE_GEOMETRY_BITS + RENDER_QUEUE_MATERIAL_BITS))
+                        | (geometry << RENDER_QUEUE_MATERIAL_BITS)
+                        | material;
+
+        if (order == RenderQueueOrder_FrontToBack)
+            return (depth << (RENDER_QUEUE_PROGRAM_BITS + RENDER_QUEUE_GEOMETRY_BITS + RENDER_QUEUE_MATERIAL_BITS)) | state;
+
+        return (state << RENDER_QUEUE_DEPTH_BITS) | depth;
+    }
+
+    void Build(App* app, u32 programIdx, u32 passFeatures)
+    {
+        RenderQueueState& queue = app->renderQueue;
+        queue.items.clear();
+
+        for (u32 entityIdx : app->culling.visibleEntities)
+        {
+            const Model& model = app->models[app->entities[entityIdx].modelIndex];
+            const Mesh& mesh = app->meshes[model.meshIdx];
+
+            for (u32 i = 0; i < mesh.submeshes.size(); ++i)
+            {
+                const u32 materialIdx = model.materialIdx[i];
+
+                // The variant of the material, so the shader does not branch on its textures per pixel
+                RenderQueueItem item;
+                item.entityIdx = entityIdx;
+                item.submeshIdx = i;
+                item.materialIdx = materialIdx;
+                item.features = passFeatures | ShaderPermutation::DrawFeatures(app->materials[materialIdx], mesh.submeshes[i]);
+                item.programIdx = ShaderPermutation::Get(app, programIdx, item.features);
+                queue.items.push_back(item);
+            }
+        }
+    }
+
+    void Sort(App* app)
+    {
+        RenderQueueState& queue = app->renderQueue;
+        queue.entries.resize(queue.items.size());
+
+        for (u32 i = 0; i < queue.items.size(); ++i)
+        {
+            queue.entries[i].key = queue.order == RenderQueueOrder_Submission ? 0 : MakeKey(app, queue.order, queue.items[i]);
+            queue.entries[i].itemIdx = i;
+        }
+
+        queue.sortPasses = queue.order == RenderQueueOrder_Submission ? 0 : RadixSort(queue.entries, queue.scratch);
+    }
+
+    u32 RadixSort(std::vector<RenderQueueSortEntry>& entries, std::vector<RenderQueueSortEntry>& scratch)
+    {
+        const u32 passCount = sizeof(u64) * 8 / RENDER_QUEUE_RADIX_BITS;
+        const u32 count = entries.size();
+        if (count < 2)
+            return 0;
+
+        // Every digit histogram in one read of the keys
+        u32 histograms[passCount][RENDER_QUEUE_RADIX_BUCKETS] = {};
+        for (const RenderQueueSortEntry& entry : entries)
+            for (u32 pass = 0; pass < passCount; ++pass)
+                histograms[pass][(entry.key >> (pass * RENDER_QUEUE_RADIX_BITS)) & (RENDER_QUEUE_RADIX_BUCKETS - 1)]++;
+
+        scratch.resize(count);
+        u32 sortedPasses = 0;
+
+        for (u32 pass = 0; pass < passCount; ++pass)
+        {
+            u32* histogram = histograms[pass];
+            const u32 shift = pass * RENDER_QUEUE_RADIX_BITS;
+
+            // All keys share this digit, the pass would copy them in the same order
+            if (histogram[(entries[0].key >> shift) & (RENDER_QUEUE_RADIX_BUCKETS - 1)] == count)
+                continue;
+
+            u32 offset = 0;
+            for (u32 bucket = 0; bucket < RENDER_QUEUE_RADIX_BUCKETS; ++bucket)
+            {
+                const u32 bucketCount = histogram[bucket];
+                histogram[bucket] = offset;
+                offset += bucketCount;
+            }
+
+            for (const RenderQueueSortEntry& entry : entries)
+                scratch[histogram[(entry.key >> shift) & (RENDER_QUEUE_RADIX_BUCKETS - 1)]++] = entry;
+
+            entries.swap(scratch);
+            sortedPasses++;
+        }
+
+        return sortedPasses;
+    }
+
+    void Submit(App* app)
+    {
+        RenderQueueState& queue = app->renderQueue;
+        queue.drawCount = 0;
+        queue.programBinds = 0;
+        queue.vaoBinds = 0;
+        queue.textureBinds = 0;
+        queue.bufferBinds = 0;
+
+        GLuint boundProgram = 0;
+        GLuint boundVao = 0;
+        GLuint boundTextures[2] = { 0, 0 };
+        u32 boundEntity = UINT32_MAX;
+        u32 boundMaterial = UINT32_MAX;
+
+        for (const RenderQueueSortEntry& entry : queue.entries)
+        {
+            const RenderQueueItem& item = queue.items[entry.itemIdx];
+            const Entity& entity = app->entities[item.entityIdx];
+            Mesh& mesh = app->meshes[app->models[entity.modelIndex].meshIdx];
+            const SubMesh& submesh = mesh.submeshes[item.submeshIdx];
+            const Material& material = app->materials[item.materialIdx];
+            const Program& program = app->programs[item.programIdx];
+
+            if (program.handle != boundProgram)
+            {
+                GLState::UseProgram(app, program.handle);
+                boundProgram = program.handle;
+                queue.programBinds++;
+            }
+
+            if (item.entityIdx != boundEntity)
+            {
+                GLState::BindBufferRange(app, GL_UNIFORM_BUFFER, BINDING(1), entity.localParamBuffer, entity.localParamOffset, entity.localParamSize);
+                boundEntity = item.entityIdx;
+                queue.bufferBinds++;
+            }
+
+            // The VAO depends on the program attributes, so it is looked up after the program switch
+            const GLuint vao = FindVAO(mesh, item.submeshIdx, program);
+            if (vao != boundVao)
+            {
+                GLState::BindVertexArray(app, vao);
+                boundVao = vao;
+                queue.vaoBinds++;
+            }
+
+            const GLuint albedo = TextureStreamer::GetResidentHandle(app, material.albedoTextureIdx);
+            if (albedo != boundTextures[0])
+            {
+                GLState::BindTexture(app, 0, GL_TEXTURE_2D, albedo);
+                boundTextures[0] = albedo;
+                queue.textureBinds++;
+            }
+
+            if (item.features & ShaderFeature_NormalMap)
+            {
+                const GLuint normals = TextureStreamer::GetResidentHandle(app, material.normalsTextureIdx);
+                if (normals != boundTextures[1])
+                {
+                    GLState::BindTexture(app, 1, GL_TEXTURE_2D, normals);
+                    boundTextures[1] = normals;
+                    queue.textureBinds++;
+                }
+            }
+
+            if (item.materialIdx != boundMaterial)
+            {
+                GLState::BindBufferRange(app, GL_UNIFORM_BUFFER, BINDING(2), app->materialUniformBuffer.handle, material.localParamOffset, material.localParamSize);
+                boundMaterial = item.materialIdx;
+                queue.bufferBinds++;
+            }
+
+            GLState::SetPositionDequantization(app, submesh.positionScale, submesh.positionBias);
+
+            glDrawElements(GL_TRIANGLES, submesh.indices.size(), GL_UNSIGNED_INT, (void*)(u64)submesh.indexOffset);
+            queue.drawCount++;
+        }
+    }
+
+    void DrawGui(App* app)
+    {
+        RenderQueueState& queue = app->renderQueue;
+
+        int order = queue.order;
+        if (ImGui::Combo("Draw order", &order, OrderNames, RenderQueueOrder_Count))
+            queue.order = (RenderQueueOrder)order;
+
+        ImGui::Text("Draws: %u  Radix passes: %u", queue.drawCount, queue.sortPasses);
+        ImGui::Text("Binds - programs: %u  VAOs: %u  textures: %u  buffers: %u",
+            queue.programBinds, queue.vaoBinds, queue.textureBinds, queue.bufferBinds);
+    }
+}
@@ -0,0 +1,75 @@
+#ifndef RENDER_QUEUE_FUNC
+#define RENDER_QUEUE_FUNC
+
+#include "Globals.h"
+
+struct App;
+
+// Sort key fields, from the most significant down. Every frame graph pass builds and sorts its own queue,
+// so the pass is already the outermost order and has no bits of its own.
+#define RENDER_QUEUE_PROGRAM_BITS  8
+#define RENDER_QUEUE_GEOMETRY_BITS 16 // Mesh and submesh, i.e. the VAO once the program is known
+#define RENDER_QUEUE_MATERIAL_BITS 16
+#define RENDER_QUEUE_DEPTH_BITS    24 // View depth between the camera planes
+#define RENDER_QUEUE_SUBMESH_BITS  6  // Of the geometry bits
+
+#define RENDER_QUEUE_RADIX_BITS 8
+#define RENDER_QUEUE_RADIX_BUCKETS (1 << RENDER_QUEUE_RADIX_BITS)
+
+enum RenderQueueOrder
+{
+    RenderQueueOrder_Submission,  // Visible entities in insertion order, unsorted
+    RenderQueueOrder_State,       // Program, geometry, material, then front to back
+    RenderQueueOrder_FrontToBack, // Depth first for early-Z, state within equal depths
+    RenderQueueOrder_Count
+};
+
+struct RenderQueueItem
+{
+    u32 entityIdx;
+    u32 submeshIdx;
+    u32 programIdx; // Permutation chosen when the draw was queued
+    u32 materialIdx;
+    u32 features;
+};
+
+struct RenderQueueSortEntry
+{
+    u64 key;
+    u32 itemIdx;
+};
+
+struct RenderQueueState
+{
+    RenderQueueOrder                  order;
+    std::vector<RenderQueueItem>      items;
+    std::vector<RenderQueueSortEntry> entries;
+    std::vector<RenderQueueSortEntry> scratch; // Radix sort ping-pong
+
+    // Stats of the last submitted queue
+    u32 drawCount;
+    u32 programBinds;
+    u32 vaoBinds;
+    u32 textureBinds;
+    u32 bufferBinds;
+    u32 sortPasses; // Radix passes that moved keys, passes over a digit all keys share are skipped
+};
+
+namespace RenderQueue
+{
+    // One item per submesh of every visible entity, drawn with the permutation of programIdx matching its material
+    void Build(App* app, u32 programIdx, u32 passFeatures);
+
+    // Orders the items by their 64-bit keys
+    void Sort(App* app);
+
+    // Draws the items in sorted order, binding only the state that differs from the previous draw
+    void Submit(App* app);
+
+    // LSD radix sort on the keys, 8 bits per pass. Returns the passes that reordered anything.
+    u32 RadixSort(std::vector<RenderQueueSortEntry>& entries, std::vector<RenderQueueSortEntry>& scratch);
+
+    void DrawGui(App* app);
+}
+
+#endif // !RENDER_QUEUE_FUNC
@@ -0,0 +1,314 @@
+#include "engine.h"
+#include "RenderTargetPoolFuncs.h"
+#include <imgui.h>
+#include <string.h>
+
+namespace RenderTargetPool
+{
+    struct FormatInfo
+    {
+        GLenum format;
+        GLenum dataType;
+        u32    bytesPerPixel;
+    };
+
+    static FormatInfo GetFormatInfo(GLenum internalFormat)
+    {
+        switch (internalFormat)
+        {
+        case GL_RGBA8:              return { GL_RGBA, GL_UNSIGNED_BYTE, 4 };
+        case GL_RGBA16F:            return { GL_RGBA, GL_FLOAT, 8 };
+        case GL_RGBA32F:            return { GL_RGBA, GL_FLOAT, 16 };
+        case GL_RG16:               return { GL_RG, GL_UNSIGNED_SHORT, 4 };
+        case GL_RG16F:              return { GL_RG, GL_FLOAT, 4 };
+        case GL_R11F_G11F_B10F:     return { GL_RGB, GL_FLOAT, 4 };
+        case GL_R8:                 return { GL_RED, GL_UNSIGNED_BYTE, 1 };
+        case GL_R32F:               return { GL_RED, GL_FLOAT, 4 };
+        case GL_DEPTH_COMPONENT24:  return { GL_DEPTH_COMPONENT, GL_UNSIGNED_INT, 4 };
+        case GL_DEPTH_COMPONENT32F: return { GL_DEPTH_COMPONENT, GL_FLOAT, 4 };
+        case GL_DEPTH24_STENCIL8:   return { GL_DEPTH_STENCIL, GL_UNSIGNED_INT_24_8, 4 };
+        default:
+            ELOG("Render target format 0x%x is not supported by the pool, allocating it as RGBA8", internalFormat);
+            return { GL_RGBA, GL_UNSIGNED_BYTE, 4 };
+        }
+    }
+
+    static bool IsSameDesc(const RenderTargetDesc& a, const RenderTargetDesc& b)
+    {
+        return a.internalFormat == b.internalFormat && a.size == b.size && a.samples == b.samples && a.mipLevels == b.mipLevels;
+    }
+
+    static u64 ComputeBytes(const RenderTargetDesc& desc)
+    {
+        const u64 bytesPerPixel = GetFormatInfo(desc.internalFormat).bytesPerPixel;
+
+        u64 bytes = 0;
+        for (u32 level = 0; level < desc.mipLevels; ++level)
+            bytes += (u64)glm::max(desc.size.x >> level, 1) * (u64)glm::max(desc.size.y >> level, 1) * bytesPerPixel;
+
+        return bytes * desc.samples;
+    }
+
+    static void AllocateStorage(App* app, RenderTarget& target)
+    {
+        RenderTargetPoolState& pool = app->renderTargets;
+        const RenderTargetDesc& desc = target.desc;
+
+        // Allocation can happen mid-frame, when a pass acquires its targets
+        GLState::ActiveTexture(app, 0);
+
+        if (desc.samples > 1)
+        {
+            GLState::BindTexture(app, 0, GL_TEXTURE_2D_MULTISAMPLE, target.handle);
+            glTexImage2DMultisample(GL_TEXTURE_2D_MULTISAMPLE, desc.samples, desc.internalFormat, desc.size.x, desc.size.y, GL_TRUE);
+            GLState::BindTexture(app, 0, GL_TEXTURE_2D_MULTISAMPLE, 0);
+        }
+        else
+        {
+            const FormatInfo info = GetFormatInfo(desc.internalFormat);
+
+            GLState::BindTexture(app, 0, GL_TEXTURE_2D, target.handle);
+            for (u32 level = 0; level < desc.mipLevels; ++level)
+                glTexImage2D(GL_TEXTURE_2D, level, desc.internalFormat, glm::max(desc.size.x >> level, 1), glm::max(desc.size.y >> level, 1), 0, info.format, info.dataType, NULL);
+
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, desc.mipLevels > 1 ? GL_LINEAR_MIPMAP_LINEAR : GL_NEAREST);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, desc.mipLevels > 1 ? GL_LINEAR : GL_NEAREST);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, desc.mipLevels - 1);
+            GLState::BindTexture(app, 0, GL_TEXTURE_2D, 0);
+        }
+
+        pool.allocatedBytes += ComputeBytes(desc);
+    }
+
+    static bool UsesTarget(const PooledFrameBuffer& frameBuffer, GLuint handle)
+    {
+        if (frameBuffer.depth == handle)
+            return true;
+
+        for (u32 i = 0; i < frameBuffer.colorCount; ++i)
+            if (frameBuffer.colors[i] == handle)
+                return true;
+
+        return false;
+    }
+
+    static void DeleteFrameBuffersUsing(RenderTargetPoolState& pool, GLuint handle)
+    {
+        for (u32 i = 0; i < pool.frameBuffers.size();)
+        {
+            if (UsesTarget(pool.frameBuffers[i], handle))
+            {
+                glDeleteFramebuffers(1, &pool.frameBuffers[i].handle);
+                pool.frameBuffers[i] = pool.frameBuffers.back();
+                pool.frameBuffers.pop_back();
+            }
+            else
+                ++i;
+        }
+    }
+
+    RenderTargetDesc DisplayTarget(App* app, GLenum internalFormat, u32 divisor, u32 mipLevels)
+    {
+        RenderTargetDesc desc = {};
+        desc.internalFormat = internalFormat;
+        desc.size = ivec2(app->displaySize.x / (i32)divisor, app->displaySize.y / (i32)divisor);
+        desc.samples = 1;
+        desc.mipLevels = mipLevels;
+        return desc;
+    }
+
+    void BeginFrame(App* app)
+    {
+        RenderTargetPoolState& pool = app->renderTargets;
+        pool.frameIndex++;
+
+        for (u32 i = 0; i < pool.targets.size();)
+        {
+            RenderTarget& target = pool.targets[i];
+            if (target.isAcquired || pool.frameIndex - target.lastUsedFrame <= RENDER_TARGET_EVICT_FRAMES)
+            {
+                ++i;
+                continue;
+            }
+
+            DeleteFrameBuffersUsing(pool, target.handle);
+            glDeleteTextures(1, &target.handle);
+            pool.allocatedBytes -= ComputeBytes(target.desc);
+
+            pool.targets[i] = pool.targets.back();
+            pool.targets.pop_back();
+        }
+
+        for (u32 i = 0; i < pool.frameBuffers.size();)
+        {
+            if (pool.frameIndex - pool.frameBuffers[i].lastUsedFrame > RENDER_TARGET_EVICT_FRAMES)
+            {
+                glDeleteFramebuffers(1, &pool.frameBuffers[i].handle);
+                pool.frameBuffers[i] = pool.frameBuffers.back();
+                pool.frameBuffers.pop_back();
+            }
+            else
+                ++i;
+        }
+    }
+
+    void Shutdown(App* app)
+    {
+        RenderTargetPoolState& pool = app->renderTargets;
+
+        for (PooledFrameBuffer& frameBuffer : pool.frameBuffers)
+            glDeleteFramebuffers(1, &frameBuffer.handle);
+
+        for (RenderTarget& target : pool.targets)
+            glDeleteTextures(1, &target.handle);
+
+        pool.frameBuffers.clear();
+        pool.targets.clear();
+        pool.allocatedBytes = 0;
+    }
+
+    GLuint Acquire(App* app, const RenderTargetDesc& requestedDesc)
+    {
+        RenderTargetPoolState& pool = app->renderTargets;
+
+        // A minimized window reports a 0x0 framebuffer
+        RenderTargetDesc desc = requestedDesc;
+        desc.size = glm::max(desc.size, ivec2(1, 1));
+        desc.samples = glm::max(desc.samples, 1u);
+        desc.mipLevels = glm::max(desc.mipLevels, 1u);
+
+        // Exact match first. Otherwise the storage of a free target of the same kind released in an earlier
+        // frame (e.g. one sized for the window before a resize) is respecified in place. The driver orphans
+        // the old storage, so a drag-resize keeps one set of targets instead of one per frame.
+        u32 staleIdx = UINT32_MAX;
+        for (u32 i = 0; i < pool.targets.size(); ++i)
+        {
+            RenderTarget& target = pool.targets[i];
+            if (target.isAcquired)
+                continue;
+
+            if (IsSameDesc(target.desc, desc))
+            {
+                target.isAcquired = true;
+                target.lastUsedFrame = pool.frameIndex;
+                return target.handle;
+            }
+
+            const bool isSameKind = target.desc.internalFormat == desc.internalFormat && target.desc.samples == desc.samples && target.desc.mipLevels == desc.mipLevels;
+            if (staleIdx == UINT32_MAX && isSameKind && pool.frameIndex - target.lastUsedFrame >= 1)
+                staleIdx = i;
+        }
+
+        if (staleIdx != UINT32_MAX)
+        {
+            RenderTarget& target = pool.targets[staleIdx];
+            pool.allocatedBytes -= ComputeBytes(target.desc);
+            target.desc = desc;
+            target.isAcquired = true;
+            target.lastUsedFrame = pool.frameIndex;
+            AllocateStorage(app, target);
+            pool.reallocations++;
+            return target.handle;
+        }
+
+        RenderTarget target = {};
+        target.desc = desc;
+        target.isAcquired = true;
+        target.lastUsedFrame = pool.frameIndex;
+        glGenTextures(1, &target.handle);
+        AllocateStorage(app, target);
+
+        pool.targets.push_back(target);
+        return target.handle;
+    }
+
+    void Release(App* app, GLuint handle)
+    {
+        for (RenderTarget& target : app->renderTargets.targets)
+        {
+            if (target.handle == handle)
+            {
+                target.isAcquired = false;
+                return;
+            }
+        }
+
+        ELOG("Released texture %u is not a pooled render target", handle);
+    }
+
+    GLuint GetFrameBuffer(App* app, const GLuint* colors, u32 colorCount, GLuint depth, u32 level)
+    {
+        RenderTargetPoolState& pool = app->renderTargets;
+        ASSERT(colorCount <= RENDER_TARGET_MAX_COLORS, "Too many color attachments");
+
+        for (PooledFrameBuffer& frameBuffer : pool.frameBuffers)
+        {
+            if (frameBuffer.colorCount != colorCount || frameBuffer.depth != depth || frameBuffer.level != level)
+                continue;
+            if (memcmp(frameBuffer.colors, colors, colorCount * sizeof(GLuint)) != 0)
+                continue;
+
+            frameBuffer.lastUsedFrame = pool.frameIndex;
+            return frameBuffer.handle;
+        }
+
+        PooledFrameBuffer frameBuffer = {};
+        frameBuffer.colorCount = colorCount;
+        frameBuffer.depth = depth;
+        frameBuffer.level = level;
+        frameBuffer.lastUsedFrame = pool.frameIndex;
+        memcpy(frameBuffer.colors, colors, colorCount * sizeof(GLuint));
+
+        glGenFramebuffers(1, &frameBuffer.handle);
+        GLState::BindFramebuffer(app, GL_FRAMEBUFFER, frameBuffer.handle);
+
+        GLenum drawBuffers[RENDER_TARGET_MAX_COLORS];
+        for (u32 i = 0; i < colorCount; ++i)
+        {
+            // A 0 handle leaves the slot empty, so a shader output can be dropped without moving the others
+            glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + i, colors[i], level);
+            drawBuffers[i] = colors[i] != 0 ? GL_COLOR_ATTACHMENT0 + i : GL_NONE;
+        }
+
+        if (depth != 0)
+        {
+            GLenum depthAttachment = GL_DEPTH_ATTACHMENT;
+            for (const RenderTarget& target : pool.targets)
+                if (target.handle == depth && target.desc.internalFormat == GL_DEPTH24_STENCIL8)
+                    depthAttachment = GL_DEPTH_STENCIL_ATTACHMENT;
+
+            glFramebufferTexture(GL_FRAMEBUFFER, depthAttachment, depth, level);
+        }
+
+        if (colorCount > 0)
+            glDrawBuffers(colorCount, drawBuffers);
+        else
+            glDrawBuffer(GL_NONE);
+
+        GLenum framebufferStatus = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+        if (framebufferStatus != GL_FRAMEBUFFER_COMPLETE)
+            ELOG("Pooled framebuffer is incomplete (status 0x%x)", framebufferStatus);
+
+        GLState::BindFramebuffer(app, GL_FRAMEBUFFER, 0);
+
+        pool.frameBuffers.push_back(frameBuffer);
+        return frameBuffer.handle;
+    }
+
+    void DrawGui(App* app)
+    {
+        RenderTargetPoolState& pool = app->renderTargets;
+
+        ImGui::Text("Targets: %u  Framebuffers: %u  Memory: %.1f MB", (u32)pool.targets.size(), (u32)pool.frameBuffers.size(), pool.allocatedBytes / (1024.0 * 1024.0));
+        ImGui::Text("In-place reallocations: %u", pool.reallocations);
+
+        for (const RenderTarget& target : pool.targets)
+        {
+            ImGui::BulletText("#%u  0x%x  %dx%d  x%u samples  %u mips%s", target.handle, target.desc.internalFormat,
+                target.desc.size.x, target.desc.size.y, target.desc.samples, target.desc.mipLevels, target.isAcquired ? "  (held)" : "");
+        }
+    }
+}
@@ -0,0 +1,70 @@
+#ifndef RENDER_TARGET_POOL_FUNC
+#define RENDER_TARGET_POOL_FUNC
+
+#include "Globals.h"
+
+struct App;
+
+#define RENDER_TARGET_EVICT_FRAMES 4  // Frames a target may stay unused before its memory is freed
+#define RENDER_TARGET_MAX_COLORS 8
+
+struct RenderTargetDesc
+{
+    GLenum internalFormat;
+    ivec2  size;
+    u32    samples;   // 1 for a regular 2D texture
+    u32    mipLevels; // 1 for no mip chain
+};
+
+struct RenderTarget
+{
+    RenderTargetDesc desc;
+    GLuint           handle;
+    u32              lastUsedFrame;
+    bool             isAcquired;
+};
+
+// Framebuffer objects are cached by attachment set, so passes that get the same targets back skip the rebuild
+struct PooledFrameBuffer
+{
+    GLuint handle;
+    GLuint colors[RENDER_TARGET_MAX_COLORS];
+    u32    colorCount;
+    GLuint depth;
+    u32    level;
+    u32    lastUsedFrame;
+};
+
+struct RenderTargetPoolState
+{
+    std::vector<RenderTarget>      targets;
+    std::vector<PooledFrameBuffer> frameBuffers;
+    u32                            frameIndex;
+    u64                            allocatedBytes;
+    u32                            reallocations; // Storage respecified in place, e.g. after a resize
+};
+
+namespace RenderTargetPool
+{
+    // Target the size of the display divided by divisor
+    RenderTargetDesc DisplayTarget(App* app, GLenum internalFormat, u32 divisor = 1, u32 mipLevels = 1);
+
+    // Advances the frame and frees the targets and framebuffers that went unused for RENDER_TARGET_EVICT_FRAMES
+    void BeginFrame(App* app);
+
+    void Shutdown(App* app);
+
+    // Returns a texture matching desc that no other pass holds. A target released earlier in the frame
+    // is handed out again, so passes whose lifetimes do not overlap share its memory.
+    GLuint Acquire(App* app, const RenderTargetDesc& desc);
+
+    // Call once the pass that last reads the target has been recorded
+    void Release(App* app, GLuint handle);
+
+    // Framebuffer with the given attachments at a mip level, depth may be 0
+    GLuint GetFrameBuffer(App* app, const GLuint* colors, u32 colorCount, GLuint depth, u32 level = 0);
+
+    void DrawGui(App* app);
+}
+
+#endif // !RENDER_TARGET_POOL_FUNC
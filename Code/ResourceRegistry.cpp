@@ -0,0 +1,106 @@
+#include "ResourceRegistry.h"
+#include "platform.h"
+#include <string.h>
+
+namespace Registry
+{
+    static u64 NonZeroKey(u64 key)
+    {
+        return key == HASH_TABLE_EMPTY_KEY ? 1 : key;
+    }
+
+    static u32 SlotMask(const HashTable& table)
+    {
+        return (u32)table.keys.size() - 1;
+    }
+
+    static void Grow(HashTable& table)
+    {
+        std::vector<u64> oldKeys;
+        std::vector<u32> oldValues;
+        oldKeys.swap(table.keys);
+        oldValues.swap(table.values);
+
+        const u32 capacity = oldKeys.empty() ? HASH_TABLE_INITIAL_CAPACITY : (u32)oldKeys.size() * 2;
+        table.keys.assign(capacity, HASH_TABLE_EMPTY_KEY);
+        table.values.assign(capacity, UINT32_MAX);
+        table.count = 0;
+
+        for (u32 i = 0; i < oldKeys.size(); ++i)
+            if (oldKeys[i] != HASH_TABLE_EMPTY_KEY)
+                Insert(table, oldKeys[i], oldValues[i]);
+    }
+
+    u32 Find(const HashTable& table, u64 key)
+    {
+        if (table.keys.empty())
+            return UINT32_MAX;
+
+        key = NonZeroKey(key);
+        const u32 mask = SlotMask(table);
+        for (u32 slot = (u32)key & mask; table.keys[slot] != HASH_TABLE_EMPTY_KEY; slot = (slot + 1) & mask)
+        {
+            if (table.keys[slot] == key)
+                return table.values[slot];
+        }
+
+        return UINT32_MAX;
+    }
+
+    void Insert(HashTable& table, u64 key, u32 value)
+    {
+        // Keep the load factor under 70% so probe sequences stay short
+        if ((table.count + 1) * 10 > table.keys.size() * 7)
+            Grow(table);
+
+        key = NonZeroKey(key);
+        const u32 mask = SlotMask(table);
+        u32 slot = (u32)key & mask;
+        while (table.keys[slot] != HASH_TABLE_EMPTY_KEY && table.keys[slot] != key)
+            slot = (slot + 1) & mask;
+
+        if (table.keys[slot] == HASH_TABLE_EMPTY_KEY)
+            table.count++;
+
+        table.keys[slot] = key;
+        table.values[slot] = value;
+    }
+
+    u32 InternPath(PathInterner& interner, const char* path)
+    {
+        std::string normalized = path;
+        for (char& c : normalized)
+            if (c == '\\')
+                c = '/';
+
+        const u64 key = HashBytes(normalized.data(), normalized.size());
+        u32 pathHandle = Find(interner.lookup, key);
+        if (pathHandle != UINT32_MAX)
+        {
+            // 64-bit hashes of distinct paths are not expected to collide
+            ASSERT(interner.paths[pathHandle] == normalized, "Path hash collision");
+            return pathHandle;
+        }
+
+        pathHandle = interner.paths.size();
+        interner.paths.push_back(normalized);
+        Insert(interner.lookup, key, pathHandle);
+        return pathHandle;
+    }
+
+    const char* GetPath(const PathInterner& interner, u32 pathHandle)
+    {
+        return interner.paths[pathHandle].c_str();
+    }
+
+    u64 PathKey(u32 pathHandle)
+    {
+        return (u64)pathHandle + 1;
+    }
+
+    u64 ProgramKey(u32 pathHandle, const char* programName, u32 features)
+    {
+        const u64 nameKey = HashBytes(programName, strlen(programName), HashBytes(&pathHandle, sizeof(pathHandle)));
+        return HashBytes(&features, sizeof(features), nameKey);
+    }
+}
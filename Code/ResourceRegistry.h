@@ -0,0 +1,50 @@
+#ifndef RESOURCE_REGISTRY
+#define RESOURCE_REGISTRY
+
+#include "Globals.h"
+
+#define HASH_TABLE_EMPTY_KEY 0
+#define HASH_TABLE_INITIAL_CAPACITY 64
+
+// Open-addressing (linear probing) table mapping non-zero 64-bit keys to u32 values
+struct HashTable
+{
+    std::vector<u64> keys;
+    std::vector<u32> values;
+    u32              count;
+};
+
+// Paths are interned once and afterwards referred to by a small handle
+struct PathInterner
+{
+    HashTable                lookup;
+    std::vector<std::string> paths;
+};
+
+struct ResourceRegistry
+{
+    PathInterner paths;
+    HashTable    textures;  // path handle -> index in app->textures
+    HashTable    materials; // material content hash -> index in app->materials
+    HashTable    models;    // path handle -> index in app->models (the model owns its mesh)
+    HashTable    programs;  // (path handle, program name, features) -> index in app->programs
+};
+
+namespace Registry
+{
+    u32 Find(const HashTable& table, u64 key);
+
+    void Insert(HashTable& table, u64 key, u32 value);
+
+    // Returns the handle of the normalized path, interning it if it was not seen before
+    u32 InternPath(PathInterner& interner, const char* path);
+
+    const char* GetPath(const PathInterner& interner, u32 pathHandle);
+
+    u64 PathKey(u32 pathHandle);
+
+    // features is the permutation of the program, SHADER_FEATURES_GENERIC for the plain one
+    u64 ProgramKey(u32 pathHandle, const char* programName, u32 features);
+}
+
+#endif // !RESOURCE_REGISTRY
@@ -0,0 +1,517 @@
+#include "engine.h"
+#include "ShaderCompilerFuncs.h"
+#include <imgui.h>
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+#ifndef GL_COMPLETION_STATUS_KHR
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+#endif
+
+namespace ShaderCompiler
+{
+    typedef void (APIENTRYP MaxShaderCompilerThreadsProc)(GLuint count);
+    static MaxShaderCompilerThreadsProc MaxShaderCompilerThreads = NULL;
+
+    static u64 SourceHash(const Program& program, String source)
+    {
+        u64 hash = HashBytes(source.str, source.len);
+        hash = HashBytes(program.programName.c_str(), program.programName.size(), hash);
+        hash = HashBytes(&program.features, sizeof(program.features), hash);
+        return HashBytes(&program.isCompute, sizeof(program.isCompute), hash);
+    }
+
+    static u64 DriverHash()
+    {
+        const GLenum names[] = { GL_VENDOR, GL_RENDERER, GL_VERSION };
+
+        u64 hash = HashBytes(NULL, 0);
+        for (GLenum name : names)
+        {
+            const char* value = (const char*)glGetString(name);
+            if (value)
+                hash = HashBytes(value, strlen(value), hash);
+        }
+        return hash;
+    }
+
+    // Only submits the work, the status is read in FinishCompile so the driver can compile in the background
+    static GLuint CompileStage(GLenum type, const char* stageDefine, const char* programName, const char* featureDefines, String source)
+    {
+        const char versionString[] = "#version 430\n";
+        char shaderNameDefine[128];
+        snprintf(shaderNameDefine, sizeof(shaderNameDefine), "#define %s\n", programName);
+
+        const GLchar* shaderSource[] = {
+            versionString,
+            shaderNameDefine,
+            stageDefine,
+            featureDefines,
+            source.str
+        };
+        const GLint shaderLengths[] = {
+            (GLint)strlen(versionString),
+            (GLint)strlen(shaderNameDefine),
+            (GLint)strlen(stageDefine),
+            (GLint)strlen(featureDefines),
+            (GLint)source.len
+        };
+
+        GLuint shader = glCreateShader(type);
+        glShaderSource(shader, ARRAY_COUNT(shaderSource), shaderSource, shaderLengths);
+        glCompileShader(shader);
+        return shader;
+    }
+
+    static PendingProgram BeginCompile(const ShaderCompilerState& compiler, u32 programIdx, const Program& program, String source, u64 sourceHash)
+    {
+        PendingProgram pending = {};
+        pending.programIdx = programIdx;
+        pending.sourceHash = sourceHash;
+
+        const char* name = program.programName.c_str();
+        char defines[SHADER_FEATURE_DEFINES_SIZE];
+        ShaderPermutation::BuildDefines(program.features, defines, sizeof(defines));
+
+        if (program.isCompute)
+        {
+            pending.shaders[pending.shaderCount++] = CompileStage(GL_COMPUTE_SHADER, "#define COMPUTE\n", name, defines, source);
+        }
+        else
+        {
+            pending.shaders[pending.shaderCount++] = CompileStage(GL_VERTEX_SHADER, "#define VERTEX\n", name, defines, source);
+            pending.shaders[pending.shaderCount++] = CompileStage(GL_FRAGMENT_SHADER, "#define FRAGMENT\n", name, defines, source);
+        }
+
+        pending.handle = glCreateProgram();
+        for (u32 i = 0; i < pending.shaderCount; ++i)
+            glAttachShader(pending.handle, pending.shaders[i]);
+
+        if (compiler.hasProgramBinary)
+            glProgramParameteri(pending.handle, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+
+        glLinkProgram(pending.handle);
+        return pending;
+    }
+
+    static bool IsCompileDone(const ShaderCompilerState& compiler, const PendingProgram& pending)
+    {
+        if (!compiler.hasParallelCompile)
+            return true;
+
+        GLint isDone = GL_FALSE;
+        glGetProgramiv(pending.handle, GL_COMPLETION_STATUS_KHR, &isDone);
+        return isDone == GL_TRUE;
+    }
+
+    static void ReleaseShaders(PendingProgram& pending)
+    {
+        for (u32 i = 0; i < pending.shaderCount; ++i)
+        {
+            glDetachShader(pending.handle, pending.shaders[i]);
+            glDeleteShader(pending.shaders[i]);
+        }
+        pending.shaderCount = 0;
+    }
+
+    static void Discard(PendingProgram& pending)
+    {
+        ReleaseShaders(pending);
+        glDeleteProgram(pending.handle);
+    }
+
+    // Blocks until the driver is done with the program if it is not yet
+    static bool FinishCompile(PendingProgram& pending, const char* programName, bool isCompute)
+    {
+        GLchar  infoLogBuffer[1024] = {};
+        GLsizei infoLogBufferSize = sizeof(infoLogBuffer);
+        GLsizei infoLogSize;
+        GLint   success;
+
+        for (u32 i = 0; i < pending.shaderCount; ++i)
+        {
+            glGetShaderiv(pending.shaders[i], GL_COMPILE_STATUS, &success);
+            if (!success)
+            {
+                const char* stageName = isCompute ? "compute" : i == 0 ? "vertex" : "fragment";
+                glGetShaderInfoLog(pending.shaders[i], infoLogBufferSize, &infoLogSize, infoLogBuffer);
+                ELOG("glCompileShader() failed with %s shader %s\nReported message:\n%s\n", stageName, programName, infoLogBuffer);
+            }
+        }
+
+        glGetProgramiv(pending.handle, GL_LINK_STATUS, &success);
+        if (!success)
+        {
+            glGetProgramInfoLog(pending.handle, infoLogBufferSize, &infoLogSize, infoLogBuffer);
+            ELOG("glLinkProgram() failed with program %s\nReported message:\n%s\n", programName, infoLogBuffer);
+        }
+
+        ReleaseShaders(pending);
+        return success == GL_TRUE;
+    }
+
+    static void GetCachePath(const Program& program, char* cachePath, u32 cachePathSize)
+    {
+        if (program.features == SHADER_FEATURES_GENERIC)
+            snprintf(cachePath, cachePathSize, "%s.%s%s", program.filepath.c_str(), program.programName.c_str(), PROGRAM_CACHE_EXTENSION);
+        else
+            snprintf(cachePath, cachePathSize, "%s.%s.%x%s", program.filepath.c_str(), program.programName.c_str(), program.features, PROGRAM_CACHE_EXTENSION);
+    }
+
+    static GLuint LoadFromCache(const ShaderCompilerState& compiler, const Program& program, u64 sourceHash)
+    {
+        char cachePath[512];
+        GetCachePath(program, cachePath, sizeof(cachePath));
+
+        FileView view = {};
+        if (!MapFile(cachePath, view))
+            return 0;
+
+        ProgramCacheHeader header = {};
+        const bool hasHeader = view.size >= sizeof(header);
+        if (hasHeader)
+            memcpy(&header, view.data, sizeof(header));
+
+        if (!hasHeader ||
+            header.magic != PROGRAM_CACHE_MAGIC ||
+            header.version != PROGRAM_CACHE_VERSION ||
+            header.sourceHash != sourceHash ||
+            header.driverHash != compiler.driverHash)
+        {
+            ILOG("Program cache %s is stale or invalid, compiling %s", cachePath, program.programName.c_str());
+            UnmapFile(view);
+            return 0;
+        }
+
+        if (view.size - sizeof(header) < header.binarySize)
+        {
+            UnmapFile(view);
+            return 0;
+        }
+
+        // The driver may still reject a binary it wrote, e.g. after an update that kept the version string
+        GLuint handle = glCreateProgram();
+        glProgramBinary(handle, header.binaryFormat, view.data + sizeof(header), header.binarySize);
+        UnmapFile(view);
+
+        GLint success = GL_FALSE;
+        glGetProgramiv(handle, GL_LINK_STATUS, &success);
+        if (!success)
+        {
+            ILOG("Program cache %s was rejected by the driver, compiling %s", cachePath, program.programName.c_str());
+            glDeleteProgram(handle);
+            return 0;
+        }
+
+        return handle;
+    }
+
+    static void WriteCache(const ShaderCompilerState& compiler, const Program& program, GLuint handle, u64 sourceHash)
+    {
+        GLint binaryLength = 0;
+        glGetProgramiv(handle, GL_PROGRAM_BINARY_LENGTH, &binaryLength);
+        if (binaryLength <= 0)
+            return;
+
+        std::vector<u8> binary(binaryLength);
+        GLenum binaryFormat = 0;
+        GLsizei writtenLength = 0;
+        glGetProgramBinary(handle, binaryLength, &writtenLength, &binaryFormat, binary.data());
+
+        ProgramCacheHeader header = {};
+        header.magic = PROGRAM_CACHE_MAGIC;
+        header.version = PROGRAM_CACHE_VERSION;
+        header.sourceHash = sourceHash;
+        header.driverHash = compiler.driverHash;
+        header.binaryFormat = binaryFormat;
+        header.binarySize = writtenLength;
+
+        char cachePath[512];
+        GetCachePath(program, cachePath, sizeof(cachePath));
+
+        FILE* file = fopen(cachePath, "wb");
+        if (!file)
+        {
+            ELOG("Could not write program cache %s", cachePath);
+            return;
+        }
+
+        fwrite(&header, sizeof(header), 1, file);
+        fwrite(binary.data(), 1, writtenLength, file);
+        fclose(file);
+    }
+
+    // Vertex array objects are built per program, the ones of a replaced program are never found again
+    static void ReleaseProgramVAOs(App* app, GLuint programHandle)
+    {
+        for (Mesh& mesh : app->meshes)
+        {
+            for (SubMesh& submesh : mesh.submeshes)
+            {
+                for (u32 i = 0; i < submesh.vaos.size();)
+                {
+                    if (submesh.vaos[i].programHandle == programHandle)
+                    {
+                        glDeleteVertexArrays(1, &submesh.vaos[i].handle);
+                        submesh.vaos.erase(submesh.vaos.begin() + i);
+                    }
+                    else
+                    {
+                        ++i;
+                    }
+                }
+            }
+        }
+    }
+
+    static std::string GetDirectory(const std::string& filepath)
+    {
+        const size_t separator = filepath.find_last_of("/\\");
+        return separator != std::string::npos ? filepath.substr(0, separator) : std::string();
+    }
+
+    static void Watch(App* app, const std::string& filepath)
+    {
+#ifdef __linux__
+        ShaderCompilerState& compiler = app->shaderCompiler;
+        if (compiler.watchFile == -1)
+            return;
+
+        const std::string directory = GetDirectory(filepath);
+        for (const ShaderWatch& watch : compiler.watches)
+            if (watch.directory == directory)
+                return;
+
+        // Editors often save by renaming a temporary file over the original
+        const int descriptor = inotify_add_watch(compiler.watchFile, directory.empty() ? "." : directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO);
+        if (descriptor == -1)
+        {
+            ELOG("inotify_add_watch() failed for %s, its shaders will not reload", directory.c_str());
+            return;
+        }
+
+        compiler.watches.push_back(ShaderWatch{ descriptor, directory });
+#endif
+    }
+
+    // Starts compiling the new source, the program keeps its current handle until Complete swaps it
+    static void QueueReload(App* app, u32 programIdx)
+    {
+        ShaderCompilerState& compiler = app->shaderCompiler;
+        Program& program = app->programs[programIdx];
+        program.lastWriteTimestamp = GetFileLastWriteTimestamp(program.filepath.c_str());
+
+        String source = ReadTextFile(program.filepath.c_str());
+        if (!source.str)
+            return;
+
+        // A newer save supersedes a reload still in flight
+        for (u32 i = 0; i < compiler.pending.size(); ++i)
+        {
+            if (compiler.pending[i].programIdx == programIdx)
+            {
+                Discard(compiler.pending[i]);
+                compiler.pending.erase(compiler.pending.begin() + i);
+                break;
+            }
+        }
+
+        ILOG("Reloading program %s from %s", program.programName.c_str(), program.filepath.c_str());
+
+        PendingProgram pending = BeginCompile(compiler, programIdx, program, source, SourceHash(program, source));
+        pending.isReload = true;
+        compiler.pending.push_back(pending);
+    }
+
+    // Returns whether the program got a new handle
+    static bool Complete(App* app, PendingProgram& pending)
+    {
+        ShaderCompilerState& compiler = app->shaderCompiler;
+        Program& program = app->programs[pending.programIdx];
+
+        const bool isLinked = FinishCompile(pending, program.programName.c_str(), program.isCompute);
+        if (!isLinked && pending.isReload)
+        {
+            ELOG("Keeping the previous version of program %s", program.programName.c_str());
+            glDeleteProgram(pending.handle);
+            compiler.failedReloads++;
+            return false;
+        }
+
+        if (isLinked && compiler.hasProgramBinary)
+            WriteCache(compiler, program, pending.handle, pending.sourceHash);
+
+        if (pending.isReload)
+        {
+            ReleaseProgramVAOs(app, program.handle);
+            glDeleteProgram(program.handle);
+            compiler.reloads++;
+        }
+
+        program.handle = pending.handle;
+        ReflectProgram(program);
+        return true;
+    }
+
+    void Init(App* app)
+    {
+        ShaderCompilerState& compiler = app->shaderCompiler;
+        compiler.watchFile = -1;
+
+        if (glfwExtensionSupported("GL_KHR_parallel_shader_compile"))
+            MaxShaderCompilerThreads = (MaxShaderCompilerThreadsProc)glfwGetProcAddress("glMaxShaderCompilerThreadsKHR");
+        else if (glfwExtensionSupported("GL_ARB_parallel_shader_compile"))
+            MaxShaderCompilerThreads = (MaxShaderCompilerThreadsProc)glfwGetProcAddress("glMaxShaderCompilerThreadsARB");
+
+        // Let the driver pick the thread count
+        compiler.hasParallelCompile = MaxShaderCompilerThreads != NULL;
+        if (compiler.hasParallelCompile)
+            MaxShaderCompilerThreads(0xFFFFFFFF);
+
+        GLint binaryFormatCount = 0;
+        glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &binaryFormatCount);
+        compiler.hasProgramBinary = binaryFormatCount > 0;
+        compiler.driverHash = DriverHash();
+
+#ifdef __linux__
+        compiler.watchFile = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (compiler.watchFile == -1)
+            ELOG("inotify_init1() failed, polling shader timestamps instead");
+#endif
+    }
+
+    void Shutdown(App* app)
+    {
+        ShaderCompilerState& compiler = app->shaderCompiler;
+        for (PendingProgram& pending : compiler.pending)
+            Discard(pending);
+        compiler.pending.clear();
+
+#ifdef __linux__
+        if (compiler.watchFile != -1)
+            close(compiler.watchFile);
+#endif
+        compiler.watchFile = -1;
+        compiler.watches.clear();
+    }
+
+    void Load(App* app, u32 programIdx, String source)
+    {
+        ShaderCompilerState& compiler = app->shaderCompiler;
+        Program& program = app->programs[programIdx];
+        Watch(app, program.filepath);
+
+        const u64 sourceHash = SourceHash(program, source);
+        if (compiler.hasProgramBinary)
+        {
+            GLuint handle = LoadFromCache(compiler, program, sourceHash);
+            if (handle != 0)
+            {
+                program.handle = handle;
+                ReflectProgram(program);
+                compiler.cacheHits++;
+                return;
+            }
+
+            compiler.cacheMisses++;
+        }
+
+        compiler.pending.push_back(BeginCompile(compiler, programIdx, program, source, sourceHash));
+    }
+
+    bool FinishPending(App* app, bool wait)
+    {
+        ShaderCompilerState& compiler = app->shaderCompiler;
+
+        bool hasLinked = false;
+        for (u32 i = 0; i < compiler.pending.size();)
+        {
+            PendingProgram& pending = compiler.pending[i];
+            if (!wait && !IsCompileDone(compiler, pending))
+            {
+                ++i;
+                continue;
+            }
+
+            hasLinked |= Complete(app, pending);
+            compiler.pending.erase(compiler.pending.begin() + i);
+        }
+
+        return hasLinked;
+    }
+
+    void Update(App* app)
+    {
+        ShaderCompilerState& compiler = app->shaderCompiler;
+
+#ifdef __linux__
+        if (compiler.watchFile != -1)
+        {
+            alignas(inotify_event) char buffer[4096];
+            ssize_t length;
+            while ((length = read(compiler.watchFile, buffer, sizeof(buffer))) > 0)
+            {
+                for (char* cursor = buffer; cursor < buffer + length;)
+                {
+                    const inotify_event* event = (const inotify_event*)cursor;
+                    cursor += sizeof(inotify_event) + event->len;
+                    if (event->len == 0)
+                        continue;
+
+                    for (const ShaderWatch& watch : compiler.watches)
+                    {
+                        if (watch.descriptor != event->wd)
+                            continue;
+
+                        const std::string filepath = watch.directory.empty() ? event->name : watch.directory + "/" + event->name;
+                        for (u32 i = 0; i < app->programs.size(); ++i)
+                            if (app->programs[i].filepath == filepath)
+                                QueueReload(app, i);
+                    }
+                }
+            }
+        }
+        else
+#endif
+        {
+            compiler.pollTimer += app->deltaTime;
+            if (compiler.pollTimer >= SHADER_RELOAD_POLL_SECONDS)
+            {
+                compiler.pollTimer = 0.0f;
+                for (u32 i = 0; i < app->programs.size(); ++i)
+                {
+                    const Program& program = app->programs[i];
+                    if (GetFileLastWriteTimestamp(program.filepath.c_str()) != program.lastWriteTimestamp)
+                        QueueReload(app, i);
+                }
+            }
+        }
+
+        // New handles lost their sampler units and may have moved their uniforms
+        if (FinishPending(app, false))
+            ConfigurePrograms(app);
+    }
+
+    void ReloadAll(App* app)
+    {
+        for (u32 i = 0; i < app->programs.size(); ++i)
+            QueueReload(app, i);
+    }
+
+    void DrawGui(App* app)
+    {
+        const ShaderCompilerState& compiler = app->shaderCompiler;
+
+        ImGui::Text("Parallel compile: %s  Program binaries: %s",
+            compiler.hasParallelCompile ? "yes" : "no", compiler.hasProgramBinary ? "yes" : "no");
+        ImGui::Text("Watching: %s", compiler.watchFile != -1 ? "inotify" : "timestamp polling");
+        ImGui::Text("Binary cache: %u hit(s), %u miss(es)", compiler.cacheHits, compiler.cacheMisses);
+        ImGui::Text("Reloads: %u (%u failed)  Compiling: %u", compiler.reloads, compiler.failedReloads, (u32)compiler.pending.size());
+
+        if (ImGui::Button("Reload all shaders"))
+            ReloadAll(app);
+    }
+}
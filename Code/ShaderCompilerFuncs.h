@@ -0,0 +1,85 @@
+#ifndef SHADER_COMPILER_FUNC
+#define SHADER_COMPILER_FUNC
+
+#include "Globals.h"
+
+struct App;
+
+#define PROGRAM_CACHE_EXTENSION ".progbin"
+#define PROGRAM_CACHE_MAGIC 0x47525045 // "EPRG"
+#define PROGRAM_CACHE_VERSION 1
+#define SHADER_RELOAD_POLL_SECONDS 0.5f // Timestamp polling period where no file watcher is available
+
+// Binary written by glGetProgramBinary, valid only for the same source and the same driver
+struct ProgramCacheHeader
+{
+    u32 magic;
+    u32 version;
+    u64 sourceHash;
+    u64 driverHash;
+    u32 binaryFormat;
+    u32 binarySize;
+};
+
+// A program whose shaders are compiling and linking, on the driver threads when parallel compile is available
+struct PendingProgram
+{
+    u32    programIdx;
+    GLuint handle;
+    GLuint shaders[2];
+    u32    shaderCount;
+    u64    sourceHash;
+    bool   isReload; // Replaces a program already in use, which keeps rendering until this one links
+};
+
+struct ShaderWatch
+{
+    int         descriptor;
+    std::string directory;
+};
+
+struct ShaderCompilerState
+{
+    bool hasParallelCompile; // GL_KHR_parallel_shader_compile or its ARB twin
+    bool hasProgramBinary;   // At least one program binary format
+    u64  driverHash;         // Vendor, renderer and version strings
+
+    std::vector<PendingProgram> pending;
+
+    // inotify on Linux, timestamp polling elsewhere
+    int                      watchFile;
+    std::vector<ShaderWatch> watches;
+    f32                      pollTimer;
+
+    // Stats
+    u32 cacheHits;
+    u32 cacheMisses;
+    u32 reloads;
+    u32 failedReloads;
+};
+
+namespace ShaderCompiler
+{
+    // Call before loading any program
+    void Init(App* app);
+
+    void Shutdown(App* app);
+
+    // Gives the program a handle from the binary cache, or starts compiling it from source.
+    // A program being compiled is ready after FinishPending.
+    void Load(App* app, u32 programIdx, String source);
+
+    // Completes the compiles in flight. Without wait, only the ones the driver already finished.
+    // Returns whether any program got a new handle, which then needs ConfigurePrograms.
+    bool FinishPending(App* app, bool wait);
+
+    // Starts recompiling the programs whose source changed, and swaps in the ones that finished
+    void Update(App* app);
+
+    // Recompiles every program, e.g. after editing a shader on a platform without a watcher
+    void ReloadAll(App* app);
+
+    void DrawGui(App* app);
+}
+
+#endif // !SHADER_COMPILER_FUNC
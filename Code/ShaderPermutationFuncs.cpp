@@ -0,0 +1,163 @@
+#include "engine.h"
+#include "ShaderPermutationFuncs.h"
+#include <imgui.h>
+
+namespace ShaderPermutation
+{
+    struct FeatureDefine
+    {
+        u32         feature;
+        const char* define;
+    };
+
+    static const FeatureDefine FeatureDefines[] = {
+        { ShaderFeature_AlbedoTexture, "HAS_ALBEDO_TEX" },
+        { ShaderFeature_NormalMap,     "HAS_NORMAL_MAP" },
+        { ShaderFeature_LightBucket4,  "LIGHT_COUNT_BUCKET 4" },
+        { ShaderFeature_LightBucket16, "LIGHT_COUNT_BUCKET 16" },
+    };
+
+    struct FeatureSampler
+    {
+        u32         feature;
+        const char* name;
+        GLint       textureUnit;
+    };
+
+    // Samplers that only exist in some variants, so the generic program has no unit to inherit
+    static const FeatureSampler FeatureSamplers[] = {
+        { ShaderFeature_NormalMap, "uNormalMap", 1 },
+    };
+
+    static bool IsSamplerType(GLenum type)
+    {
+        switch (type)
+        {
+        case GL_SAMPLER_2D:
+        case GL_SAMPLER_3D:
+        case GL_SAMPLER_CUBE:
+        case GL_SAMPLER_2D_SHADOW:
+        case GL_SAMPLER_2D_ARRAY:
+        case GL_SAMPLER_2D_MULTISAMPLE:
+            return true;
+        default:
+            return false;
+        }
+    }
+
+    static void ConfigureVariant(App* app, const Program& variant)
+    {
+        if (variant.handle == 0)
+            return;
+
+        const Program& generic = app->programs[variant.genericProgramIdx];
+        for (const ProgramUniform& uniform : variant.uniforms)
+        {
+            if (!IsSamplerType(uniform.type))
+                continue;
+
+            const GLint genericLocation = GetUniformLocation(generic, uniform.name.c_str());
+            if (genericLocation == -1)
+                continue;
+
+            GLint textureUnit = 0;
+            glGetUniformiv(generic.handle, genericLocation, &textureUnit);
+            glProgramUniform1i(variant.handle, uniform.location, textureUnit);
+        }
+
+        for (const FeatureSampler& sampler : FeatureSamplers)
+            if (variant.features & sampler.feature)
+                SetProgramSampler(variant, sampler.name, sampler.textureUnit);
+    }
+
+    static bool HasAttribute(const SubMesh& submesh, u8 location)
+    {
+        for (const VertexBufferAttribute& attribute : submesh.vertexBufferLayout.attributes)
+            if (attribute.location == location)
+                return true;
+        return false;
+    }
+
+    void BuildDefines(u32 features, char* defines, u32 definesSize)
+    {
+        defines[0] = '\0';
+        if (features == SHADER_FEATURES_GENERIC)
+            return;
+
+        u32 length = snprintf(defines, definesSize, "#define SHADER_PERMUTATION\n");
+        for (const FeatureDefine& featureDefine : FeatureDefines)
+            if ((features & featureDefine.feature) && length < definesSize)
+                length += snprintf(defines + length, definesSize - length, "#define %s\n", featureDefine.define);
+    }
+
+    u32 MaterialFeatures(bool hasAlbedoTexture, bool hasNormalMap)
+    {
+        u32 features = 0;
+        if (hasAlbedoTexture)
+            features |= ShaderFeature_AlbedoTexture;
+        if (hasNormalMap)
+            features |= ShaderFeature_NormalMap;
+        return features;
+    }
+
+    u32 LightFeatures(App* app)
+    {
+        const u32 lightCount = glm::min((u32)app->lights.size(), (u32)GLOBAL_PARAMS_MAX_LIGHTS);
+        return lightCount <= 4 ? ShaderFeature_LightBucket4 : ShaderFeature_LightBucket16;
+    }
+
+    u32 DrawFeatures(const Material& material, const SubMesh& submesh)
+    {
+        u32 features = material.shaderFeatures;
+        if (!HasAttribute(submesh, 3))
+            features &= ~ShaderFeature_NormalMap;
+        return features;
+    }
+
+    u32 Get(App* app, u32 programIdx, u32 features)
+    {
+        ShaderPermutationState& state = app->permutations;
+        if (!state.isEnabled)
+            return programIdx;
+
+        const u64 variantKey = HashBytes(&features, sizeof(features), HashBytes(&programIdx, sizeof(programIdx)));
+        u32 variantIdx = Registry::Find(state.variants, variantKey);
+
+        if (variantIdx == UINT32_MAX)
+        {
+            // Copied, loading the variant may grow app->programs
+            const Program generic = app->programs[programIdx];
+            variantIdx = LoadProgram(app, generic.filepath.c_str(), generic.programName.c_str(), generic.isCompute, features);
+            app->programs[variantIdx].genericProgramIdx = programIdx;
+            Registry::Insert(state.variants, variantKey, variantIdx);
+            state.variantCount++;
+
+            // Already linked when it came from the binary cache
+            ConfigureVariant(app, app->programs[variantIdx]);
+        }
+
+        return app->programs[variantIdx].handle != 0 ? variantIdx : programIdx;
+    }
+
+    void ConfigureVariants(App* app)
+    {
+        for (const Program& program : app->programs)
+            if (program.features != SHADER_FEATURES_GENERIC)
+                ConfigureVariant(app, program);
+    }
+
+    void DrawGui(App* app)
+    {
+        ShaderPermutationState& state = app->permutations;
+        ImGui::Checkbox("Compile-time permutations", &state.isEnabled);
+        ImGui::Text("Variants: %u  Programs: %u", state.variantCount, (u32)app->programs.size());
+
+        for (const Program& program : app->programs)
+        {
+            if (program.features == SHADER_FEATURES_GENERIC)
+                continue;
+
+            ImGui::BulletText("%s 0x%x%s", program.programName.c_str(), program.features, program.handle == 0 ? "  (compiling)" : "");
+        }
+    }
+}
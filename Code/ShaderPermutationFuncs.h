@@ -0,0 +1,55 @@
+#ifndef SHADER_PERMUTATION_FUNC
+#define SHADER_PERMUTATION_FUNC
+
+#include "Globals.h"
+#include "ResourceRegistry.h"
+
+struct App;
+
+#define SHADER_FEATURES_GENERIC UINT32_MAX // No permutation defines, the shader branches on uniforms at runtime
+#define SHADER_FEATURE_DEFINES_SIZE 256
+
+// Compile-time keys of a program variant, each one injected as a define before the source.
+// Every variant also gets SHADER_PERMUTATION, so features left out compile to their disabled path.
+enum ShaderFeature
+{
+    ShaderFeature_AlbedoTexture = 1 << 0, // HAS_ALBEDO_TEX
+    ShaderFeature_NormalMap     = 1 << 1, // HAS_NORMAL_MAP, needs tangents at location 3
+    ShaderFeature_LightBucket4  = 1 << 2, // LIGHT_COUNT_BUCKET 4
+    ShaderFeature_LightBucket16 = 1 << 3, // LIGHT_COUNT_BUCKET 16
+
+    ShaderFeature_MaterialMask = ShaderFeature_AlbedoTexture | ShaderFeature_NormalMap
+};
+
+struct ShaderPermutationState
+{
+    bool      isEnabled;
+    HashTable variants; // (generic program index, features) -> variant program index
+    u32       variantCount;
+};
+
+namespace ShaderPermutation
+{
+    // The #define lines of a feature set, empty for SHADER_FEATURES_GENERIC
+    void BuildDefines(u32 features, char* defines, u32 definesSize);
+
+    // Features a material selects, from the textures it has
+    u32 MaterialFeatures(bool hasAlbedoTexture, bool hasNormalMap);
+
+    // Light loop bound for the lights uploaded in GlobalParams this frame
+    u32 LightFeatures(App* app);
+
+    // Material features of a submesh draw, dropping the ones its vertex layout cannot feed
+    u32 DrawFeatures(const Material& material, const SubMesh& submesh);
+
+    // Index of the variant of a generic program. The variant is compiled on first request,
+    // and the generic program is returned until it links.
+    u32 Get(App* app, u32 programIdx, u32 features);
+
+    // Sampler units of every variant, inherited from its generic program
+    void ConfigureVariants(App* app);
+
+    void DrawGui(App* app);
+}
+
+#endif // !SHADER_PERMUTATION_FUNC
@@ -0,0 +1,159 @@
+#include "engine.h"
+#include "TextureStreamingFuncs.h"
+
+namespace TextureStreamer
+{
+    // Each job decodes the oldest pending texture, so textures finish roughly in request order
+    static void DecodeJob(void* data, u32, u32)
+    {
+        TextureStreamingQueue* queue = (TextureStreamingQueue*)data;
+
+        TextureDecodeJob job;
+        {
+            std::lock_guard<std::mutex> lock(queue->mutex);
+            job = std::move(queue->pendingJobs.front());
+            queue->pendingJobs.pop_front();
+        }
+
+        job.image = ModelLoader::LoadImage(job.filepath.c_str());
+
+        {
+            std::lock_guard<std::mutex> lock(queue->mutex);
+            queue->decodedJobs.push_back(std::move(job));
+        }
+    }
+
+    void Init(App* app)
+    {
+        TextureStreamingQueue& queue = app->textureQueue;
+        queue.isRunning = true;
+        queue.inFlightCount = 0;
+        queue.decodeCounter.pending = 0;
+        queue.uploadBudgetMs = TEXTURE_UPLOAD_BUDGET_MS;
+
+        glGenBuffers(1, &queue.uploadPbo);
+    }
+
+    void Shutdown(App* app)
+    {
+        TextureStreamingQueue& queue = app->textureQueue;
+        JobSystem::Wait(app, &queue.decodeCounter);
+        queue.isRunning = false;
+
+        for (TextureDecodeJob& job : queue.decodedJobs)
+            if (job.image.pixels)
+                ModelLoader::FreeImage(job.image);
+        queue.decodedJobs.clear();
+        queue.pendingJobs.clear();
+
+        for (TextureMipJob& mipJob : queue.mipJobs)
+            glDeleteSync(mipJob.uploadFence);
+        queue.mipJobs.clear();
+
+        glDeleteBuffers(1, &queue.uploadPbo);
+        queue.uploadPbo = 0;
+    }
+
+    void RequestDecode(App* app, u32 textureIdx)
+    {
+        TextureStreamingQueue& queue = app->textureQueue;
+        ASSERT(queue.isRunning, "The texture streamer must be initialized first");
+
+        TextureDecodeJob job = {};
+        job.textureIdx = textureIdx;
+        job.filepath = app->textures[textureIdx].filepath;
+
+        // The disk read starts now and overlaps the wait for a worker
+        PrefetchFile(job.filepath.c_str());
+
+        {
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            queue.pendingJobs.push_back(std::move(job));
+        }
+        queue.inFlightCount++;
+
+        queue.decodeCounter.pending.fetch_add(1, std::memory_order_relaxed);
+        JobSystem::Run(app, DecodeJob, &queue, 0, 1, &queue.decodeCounter);
+    }
+
+    void ProcessUploads(App* app)
+    {
+        TextureStreamingQueue& queue = app->textureQueue;
+        const f64 startTime = glfwGetTime();
+
+        // Fences signal in submission order, so the first one still pending ends the scan
+        while (!queue.mipJobs.empty())
+        {
+            TextureMipJob& mipJob = queue.mipJobs.front();
+            if (glClientWaitSync(mipJob.uploadFence, 0, 0) == GL_TIMEOUT_EXPIRED)
+                break;
+
+            glDeleteSync(mipJob.uploadFence);
+
+            Texture& texture = app->textures[mipJob.textureIdx];
+            glBindTexture(GL_TEXTURE_2D, texture.handle);
+            glGenerateMipmap(GL_TEXTURE_2D);
+            glBindTexture(GL_TEXTURE_2D, 0);
+            texture.state = TextureState_Resident;
+
+            queue.inFlightCount--;
+            queue.mipJobs.pop_front();
+        }
+
+        // At least one texture is uploaded per frame so loading always progresses
+        for (bool firstUpload = true; firstUpload || (glfwGetTime() - startTime) * 1000.0 < queue.uploadBudgetMs; firstUpload = false)
+        {
+            TextureDecodeJob job;
+            {
+                std::lock_guard<std::mutex> lock(queue.mutex);
+                if (queue.decodedJobs.empty())
+                    break;
+
+                job = std::move(queue.decodedJobs.front());
+                queue.decodedJobs.pop_front();
+            }
+
+            Texture& texture = app->textures[job.textureIdx];
+            if (!job.image.pixels)
+            {
+                texture.state = TextureState_Failed;
+                queue.inFlightCount--;
+                continue;
+            }
+
+            // Copy the texels into an orphaned PBO so glTexImage2D sources them asynchronously
+            const u32 imageSize = job.image.stride * job.image.size.y;
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, queue.uploadPbo);
+            glBufferData(GL_PIXEL_UNPACK_BUFFER, imageSize, NULL, GL_STREAM_DRAW);
+            void* pboData = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, imageSize, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+            memcpy(pboData, job.image.pixels, imageSize);
+            glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+
+            // With a PBO bound the pixel pointer is an offset into it. Building the mips now would wait for the
+            // transfer, so the texture keeps its placeholder until the fence says the base level is in place.
+            Image pboImage = job.image;
+            pboImage.pixels = NULL;
+            texture.handle = ModelLoader::CreateTexture2DFromImage(pboImage, false);
+
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+            TextureMipJob mipJob = {};
+            mipJob.textureIdx = job.textureIdx;
+            mipJob.uploadFence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+            queue.mipJobs.push_back(mipJob);
+
+            ModelLoader::FreeImage(job.image);
+        }
+    }
+
+    GLuint GetResidentHandle(const App* app, u32 textureIdx)
+    {
+        const Texture& texture = app->textures[textureIdx];
+        switch (texture.state)
+        {
+        case TextureState_Resident: return texture.handle;
+        case TextureState_Loading:  return app->textures[app->whiteTexIdx].handle;
+        default:                    return app->textures[app->magentaTexIdx].handle;
+        }
+    }
+}
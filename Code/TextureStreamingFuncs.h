@@ -0,0 +1,61 @@
+#ifndef TEXTURE_STREAMING_FUNC
+#define TEXTURE_STREAMING_FUNC
+
+#include "Globals.h"
+#include "JobSystemFuncs.h"
+#include <deque>
+#include <mutex>
+
+struct App;
+
+#define TEXTURE_UPLOAD_BUDGET_MS 2.0
+
+struct TextureDecodeJob
+{
+    u32         textureIdx;
+    std::string filepath;
+    Image       image;
+};
+
+// Uploaded from the PBO, its mips are built once the GPU has consumed the transfer
+struct TextureMipJob
+{
+    u32    textureIdx;
+    GLsync uploadFence;
+};
+
+// Decoding runs on the job system workers, one job per requested texture
+struct TextureStreamingQueue
+{
+    std::mutex                   mutex;
+    std::deque<TextureDecodeJob> pendingJobs; // Waiting for a worker to decode them
+    std::deque<TextureDecodeJob> decodedJobs; // Waiting for the main thread to upload them
+    JobCounter                   decodeCounter; // Decode jobs queued or running
+    std::deque<TextureMipJob>    mipJobs;       // Main thread only, in upload order
+    bool                         isRunning;
+
+    u32    inFlightCount; // Requested textures that are not resident yet
+    GLuint uploadPbo;
+    f64    uploadBudgetMs;
+};
+
+namespace TextureStreamer
+{
+    // Call after JobSystem::Init
+    void Init(App* app);
+
+    // Waits for the decode jobs in flight, call before JobSystem::Shutdown
+    void Shutdown(App* app);
+
+    // Queues the decoding of a texture already registered in app->textures
+    void RequestDecode(App* app, u32 textureIdx);
+
+    // Builds the mips of the textures whose upload has completed, then uploads decoded images to the GPU
+    // until the per-frame budget is spent. A texture becomes resident once its mips are built. Main thread only.
+    void ProcessUploads(App* app);
+
+    // Handle to bind for a texture, or a placeholder while it is loading (white) or if it failed (magenta)
+    GLuint GetResidentHandle(const App* app, u32 textureIdx);
+}
+
+#endif // !TEXTURE_STREAMING_FUNC
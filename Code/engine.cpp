@@ -11,97 +11,62 @@
 #include <stb_image_write.h>
 #include "Globals.h"
 
-#define MIPMAP_BASE_LEVEL 0
-#define MIPMAP_MAX_LEVEL 4
+void ReflectProgramUniforms(Program& program)
+{
+	GLint uniformCount = 0;
+	glGetProgramInterfaceiv(program.handle, GL_UNIFORM, GL_ACTIVE_RESOURCES, &uniformCount);
+
+	for (GLint i = 0; i < uniformCount; ++i)
+	{
+		const GLenum properties[] = { GL_TYPE, GL_LOCATION, GL_BLOCK_INDEX };
+		GLint values[ARRAY_COUNT(properties)] = {};
+		glGetProgramResourceiv(program.handle, GL_UNIFORM, i, ARRAY_COUNT(properties), properties, ARRAY_COUNT(values), NULL, values);
+
+		// Members of uniform blocks have no location of their own
+		if (values[2] != -1)
+			continue;
+
+		GLchar name[256];
+		glGetProgramResourceName(program.handle, GL_UNIFORM, i, ARRAY_COUNT(name), NULL, name);
+		program.uniforms.push_back(ProgramUniform{ name, values[1], (GLenum)values[0] });
+	}
+
+	GLint blockCount = 0;
+	glGetProgramInterfaceiv(program.handle, GL_UNIFORM_BLOCK, GL_ACTIVE_RESOURCES, &blockCount);
+
+	for (GLint i = 0; i < blockCount; ++i)
+	{
+		const GLenum properties[] = { GL_BUFFER_BINDING, GL_BUFFER_DATA_SIZE };
+		GLint values[ARRAY_COUNT(properties)] = {};
+		glGetProgramResourceiv(program.handle, GL_UNIFORM_BLOCK, i, ARRAY_COUNT(properties), properties, ARRAY_COUNT(values), NULL, values);
 
-GLuint CreateProgramFromSource(String programSource, const char* shaderName)
+		GLchar name[256];
+		glGetProgramResourceName(program.handle, GL_UNIFORM_BLOCK, i, ARRAY_COUNT(name), NULL, name);
+		program.uniformBlocks.push_back(ProgramUniformBlock{ name, (GLuint)i, values[0], values[1] });
+	}
+}
+
+GLint GetUniformLocation(const Program& program, const char* name)
 {
-	GLchar  infoLogBuffer[1024] = {};
-	GLsizei infoLogBufferSize = sizeof(infoLogBuffer);
-	GLsizei infoLogSize;
-	GLint   success;
-
-	char versionString[] = "#version 430\n";
-	char shaderNameDefine[128];
-	sprintf(shaderNameDefine, "#define %s\n", shaderName);
-	char vertexShaderDefine[] = "#define VERTEX\n";
-	char fragmentShaderDefine[] = "#define FRAGMENT\n";
-
-	const GLchar* vertexShaderSource[] = {
-		versionString,
-		shaderNameDefine,
-		vertexShaderDefine,
-		programSource.str
-	};
-	const GLint vertexShaderLengths[] = {
-		(GLint)strlen(versionString),
-		(GLint)strlen(shaderNameDefine),
-		(GLint)strlen(vertexShaderDefine),
-		(GLint)programSource.len
-	};
-	const GLchar* fragmentShaderSource[] = {
-		versionString,
-		shaderNameDefine,
-		fragmentShaderDefine,
-		programSource.str
-	};
-	const GLint fragmentShaderLengths[] = {
-		(GLint)strlen(versionString),
-		(GLint)strlen(shaderNameDefine),
-		(GLint)strlen(fragmentShaderDefine),
-		(GLint)programSource.len
-	};
-
-	GLuint vshader = glCreateShader(GL_VERTEX_SHADER);
-	glShaderSource(vshader, ARRAY_COUNT(vertexShaderSource), vertexShaderSource, vertexShaderLengths);
-	glCompileShader(vshader);
-	glGetShaderiv(vshader, GL_COMPILE_STATUS, &success);
-	if (!success)
-	{
-		glGetShaderInfoLog(vshader, infoLogBufferSize, &infoLogSize, infoLogBuffer);
-		ELOG("glCompileShader() failed with vertex shader %s\nReported message:\n%s\n", shaderName, infoLogBuffer);
-	}
-
-	GLuint fshader = glCreateShader(GL_FRAGMENT_SHADER);
-	glShaderSource(fshader, ARRAY_COUNT(fragmentShaderSource), fragmentShaderSource, fragmentShaderLengths);
-	glCompileShader(fshader);
-	glGetShaderiv(fshader, GL_COMPILE_STATUS, &success);
-	if (!success)
-	{
-		glGetShaderInfoLog(fshader, infoLogBufferSize, &infoLogSize, infoLogBuffer);
-		ELOG("glCompileShader() failed with fragment shader %s\nReported message:\n%s\n", shaderName, infoLogBuffer);
-	}
-
-	GLuint programHandle = glCreateProgram();
-	glAttachShader(programHandle, vshader);
-	glAttachShader(programHandle, fshader);
-	glLinkProgram(programHandle);
-	glGetProgramiv(programHandle, GL_LINK_STATUS, &success);
-	if (!success)
-	{
-		glGetProgramInfoLog(programHandle, infoLogBufferSize, &infoLogSize, infoLogBuffer);
-		ELOG("glLinkProgram() failed with program %s\nReported message:\n%s\n", shaderName, infoLogBuffer);
-	}
-
-	glUseProgram(0);
-
-	glDetachShader(programHandle, vshader);
-	glDetachShader(programHandle, fshader);
-	glDeleteShader(vshader);
-	glDeleteShader(fshader);
-
-	return programHandle;
+	for (const ProgramUniform& uniform : program.uniforms)
+		if (uniform.name == name)
+			return uniform.location;
+
+	return -1;
 }
 
-u32 LoadProgram(App* app, const char* filepath, const char* programName)
+void SetProgramSampler(const Program& program, const char* name, GLint textureUnit)
 {
-	String programSource = ReadTextFile(filepath);
+	GLint location = GetUniformLocation(program, name);
+	if (location != -1)
+		glProgramUniform1i(program.handle, location, textureUnit);
+}
 
-	Program program = {};
-	program.handle = CreateProgramFromSource(programSource, programName);
-	program.filepath = filepath;
-	program.programName = programName;
-	program.lastWriteTimestamp = GetFileLastWriteTimestamp(filepath);
+void ReflectProgram(Program& program)
+{
+	program.shaderLayout.attributes.clear();
+	program.uniforms.clear();
+	program.uniformBlocks.clear();
 
 	GLint attributeCount = 0;
 	glGetProgramiv(program.handle, GL_ACTIVE_ATTRIBUTES, &attributeCount);
@@ -123,9 +88,48 @@ u32 LoadProgram(App* app, const char* filepath, const char* programName)
 		program.shaderLayout.attributes.push_back(VertexShaderAttribute{ location, (u8)size });
 	}
 
+	ReflectProgramUniforms(program);
+	program.inverseViewProjectionLocation = GetUniformLocation(program, "uInverseViewProjection");
+}
+
+u32 LoadProgram(App* app, const char* filepath, const char* programName, bool isCompute, u32 features)
+{
+	const u32 pathHandle = Registry::InternPath(app->registry.paths, filepath);
+	const u64 programKey = Registry::ProgramKey(pathHandle, programName, features);
+	u32 existingProgramIdx = Registry::Find(app->registry.programs, programKey);
+	if (existingProgramIdx != UINT32_MAX)
+	{
+		// The key is a hash, the hit must be the same source, program and permutation
+		const Program& existingProgram = app->programs[existingProgramIdx];
+		if (existingProgram.programName == programName && existingProgram.features == features &&
+			Registry::InternPath(app->registry.paths, existingProgram.filepath.c_str()) == pathHandle)
+			return existingProgramIdx;
+
+		ELOG("Program key collision between %s and %s", existingProgram.programName.c_str(), programName);
+	}
+
+	String programSource = ReadTextFile(filepath);
+
+	Program program = {};
+	program.filepath = filepath;
+	program.programName = programName;
+	program.isCompute = isCompute;
+	program.features = features;
+	program.genericProgramIdx = UINT32_MAX;
+	program.inverseViewProjectionLocation = -1;
+	program.lastWriteTimestamp = GetFileLastWriteTimestamp(filepath);
+
 	app->programs.push_back(program);
 
-	return app->programs.size() - 1;
+	// On a collision the program is loaded but not registered, the key belongs to the other one
+	u32 programIdx = app->programs.size() - 1;
+	if (existingProgramIdx == UINT32_MAX)
+		Registry::Insert(app->registry.programs, programKey, programIdx);
+
+	// Either taken from the binary cache right away or compiled in the background until ShaderCompiler::FinishPending
+	ShaderCompiler::Load(app, programIdx, programSource);
+
+	return programIdx;
 }
 
 GLuint FindVAO(Mesh& mesh, u32 submeshIndex, const Program& program)
@@ -153,6 +157,10 @@ GLuint FindVAO(Mesh& mesh, u32 submeshIndex, const Program& program)
 		auto& ShaderLayout = program.shaderLayout.attributes;
 		for (auto ShaderIt = ShaderLayout.cbegin(); ShaderIt != ShaderLayout.cend(); ++ShaderIt)
 		{
+			// Per-draw constants, not sourced from the vertex buffer
+			if (ShaderIt->location == VERTEX_DEQUANT_SCALE_LOCATION || ShaderIt->location == VERTEX_DEQUANT_BIAS_LOCATION)
+				continue;
+
 			bool attributeWasLinked = false;
 			auto SubmeshLayout = Submesh.vertexBufferLayout.attributes;
 			for (auto SubmeshIt = SubmeshLayout.cbegin(); SubmeshIt != SubmeshLayout.cend(); ++SubmeshIt)
@@ -164,7 +172,7 @@ GLuint FindVAO(Mesh& mesh, u32 submeshIndex, const Program& program)
 					const u32 offset = SubmeshIt->offset + Submesh.vertexOffset;
 					const u32 stride = Submesh.vertexBufferLayout.stride;
 
-					glVertexAttribPointer(index, ncomp, GL_FLOAT, GL_FALSE, stride, (void*)(u64)(offset));
+					glVertexAttribPointer(index, ncomp, SubmeshIt->type, SubmeshIt->normalized ? GL_TRUE : GL_FALSE, stride, (void*)(u64)(offset));
 					glEnableVertexAttribArray(index);
 
 					attributeWasLinked = true;
@@ -195,6 +203,50 @@ glm::mat4 TransformPositionScale(const vec3& pos, const vec3& scaleFactors)
 	return transform;
 }
 
+// Sampler units never change, so they are assigned once per program instead of every draw.
+// Runs again whenever a program is reloaded.
+void ConfigurePrograms(App* app)
+{
+	SetProgramSampler(app->programs[app->renderToBackBufferShader], "uTexture", 0);
+	SetProgramSampler(app->programs[app->renderToFrameBufferShader], "uTexture", 0);
+	SetProgramSampler(app->programs[app->renderToBackBufferIndirectShader], "uTexture", 0);
+	SetProgramSampler(app->programs[app->renderToFrameBufferIndirectShader], "uTexture", 0);
+	SetProgramSampler(app->programs[app->renderToBackBufferInstancedShader], "uTexture", 0);
+	SetProgramSampler(app->programs[app->renderToFrameBufferInstancedShader], "uTexture", 0);
+	SetProgramSampler(app->programs[app->renderToFrameBufferPackedShader], "uTexture", 0);
+	SetProgramSampler(app->programs[app->renderToFrameBufferIndirectPackedShader], "uTexture", 0);
+	SetProgramSampler(app->programs[app->renderToFrameBufferInstancedPackedShader], "uTexture", 0);
+
+	const Program& FBToBB = app->programs[app->framebufferToQuadShader];
+	SetProgramSampler(FBToBB, "uAlbedo", 0);
+	SetProgramSampler(FBToBB, "uNormals", 1);
+	SetProgramSampler(FBToBB, "uPosition", 2);
+	SetProgramSampler(FBToBB, "uViewDir", 3);
+
+	const Program& FBToBBPacked = app->programs[app->framebufferToQuadPackedShader];
+	SetProgramSampler(FBToBBPacked, "uAlbedo", 0);
+	SetProgramSampler(FBToBBPacked, "uNormals", 1);
+	SetProgramSampler(FBToBBPacked, "uSurface", 2);
+	SetProgramSampler(FBToBBPacked, "uDepth", 3);
+
+	const Program& FBToBBClustered = app->programs[app->framebufferToQuadClusteredShader];
+	SetProgramSampler(FBToBBClustered, "uAlbedo", 0);
+	SetProgramSampler(FBToBBClustered, "uNormals", 1);
+	SetProgramSampler(FBToBBClustered, "uPosition", 2);
+	SetProgramSampler(FBToBBClustered, "uViewDir", 3);
+
+	const Program& FBToBBPackedClustered = app->programs[app->framebufferToQuadPackedClusteredShader];
+	SetProgramSampler(FBToBBPackedClustered, "uAlbedo", 0);
+	SetProgramSampler(FBToBBPackedClustered, "uNormals", 1);
+	SetProgramSampler(FBToBBPackedClustered, "uSurface", 2);
+	SetProgramSampler(FBToBBPackedClustered, "uDepth", 3);
+
+	Bloom::ConfigurePrograms(app);
+
+	// After the generic programs, variants inherit their sampler units
+	ShaderPermutation::ConfigureVariants(app);
+}
+
 void Init(App* app)
 {
 	// TODO: Initialize your resources here!
@@ -229,47 +281,76 @@ void Init(App* app)
 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
 
 	// Load shaders
+	JobSystem::Init(app);
+	ShaderCompiler::Init(app);
 	app->renderToBackBufferShader = LoadProgram(app, "Shaders/RENDER_TO_BB.glsl", "RENDER_TO_BB");
 	app->renderToFrameBufferShader = LoadProgram(app, "Shaders/RENDER_TO_FB.glsl", "RENDER_TO_FB");
 	app->framebufferToQuadShader = LoadProgram(app, "Shaders/FB_TO_BB.glsl", "FB_TO_BB");
-	app->gridRenderShader = LoadProgram(app, "Shader/PRGrid.glsl", "GRID_SHADER");
+	app->gridRenderShader = LoadProgram(app, "Shaders/PRGrid.glsl", "GRID_SHADER");
+	app->renderToBackBufferIndirectShader = LoadProgram(app, "Shaders/RENDER_TO_BB.glsl", "RENDER_TO_BB_INDIRECT");
+	app->renderToFrameBufferIndirectShader = LoadProgram(app, "Shaders/RENDER_TO_FB.glsl", "RENDER_TO_FB_INDIRECT");
+	app->renderToBackBufferInstancedShader = LoadProgram(app, "Shaders/RENDER_TO_BB.glsl", "RENDER_TO_BB_INSTANCED");
+	app->renderToFrameBufferInstancedShader = LoadProgram(app, "Shaders/RENDER_TO_FB.glsl", "RENDER_TO_FB_INSTANCED");
+	app->renderToFrameBufferPackedShader = LoadProgram(app, "Shaders/RENDER_TO_FB.glsl", "RENDER_TO_FB_PACKED");
+	app->renderToFrameBufferIndirectPackedShader = LoadProgram(app, "Shaders/RENDER_TO_FB.glsl", "RENDER_TO_FB_INDIRECT_PACKED");
+	app->renderToFrameBufferInstancedPackedShader = LoadProgram(app, "Shaders/RENDER_TO_FB.glsl", "RENDER_TO_FB_INSTANCED_PACKED");
+	app->framebufferToQuadPackedShader = LoadProgram(app, "Shaders/FB_TO_BB.glsl", "FB_TO_BB_PACKED");
+	app->framebufferToQuadClusteredShader = LoadProgram(app, "Shaders/FB_TO_BB.glsl", "FB_TO_BB_CLUSTERED");
+	app->framebufferToQuadPackedClusteredShader = LoadProgram(app, "Shaders/FB_TO_BB.glsl", "FB_TO_BB_PACKED_CLUSTERED");
+	app->clusterLightsShader = LoadProgram(app, "Shaders/CLUSTER_LIGHTS.glsl", "CLUSTER_LIGHTS", true);
 
 	// Load bloom shaders
-	app->blitBrightestPixelsShader = LoadProgram(app, "Shader/PASS_BLIT_BRIGHT.glsl", "PASS_BLIT_BRIGHT");
-	app->blurShader = LoadProgram(app, "Shader/BLUR.glsl", "BLUR");
-	app->bloomShader = LoadProgram(app, "Shader/BLOOM.glsl", "BLOOM");
+	app->blitBrightestPixelsShader = LoadProgram(app, "Shaders/PASS_BLIT_BRIGHT.glsl", "PASS_BLIT_BRIGHT");
+	app->blurShader = LoadProgram(app, "Shaders/BLUR.glsl", "BLUR");
+	app->blurComputeShader = LoadProgram(app, "Shaders/BLUR.glsl", "BLUR_COMPUTE", true);
+	app->bloomShader = LoadProgram(app, "Shaders/BLOOM.glsl", "BLOOM");
+
+	// All programs are linked past this point
+	ShaderCompiler::FinishPending(app, true);
+	ConfigurePrograms(app);
+
+	Bloom::Init(app);
 
-	const Program& texturedMeshProgram = app->programs[app->renderToBackBufferShader];
-	app->texturedMeshProgram_uTexture = glGetUniformLocation(texturedMeshProgram.handle, "uTexture");
+	Profiler::Init(app);
+
+	// Placeholder textures are loaded synchronously since streamed textures are bound to them while loading
+	TextureStreamer::Init(app);
+	app->diceTexIdx = ModelLoader::LoadTexture2D(app, "dice.png", false);
+	app->whiteTexIdx = ModelLoader::LoadTexture2D(app, "color_white.png", false);
+	app->blackTexIdx = ModelLoader::LoadTexture2D(app, "color_black.png", false);
+	app->normalTexIdx = ModelLoader::LoadTexture2D(app, "color_normal.png", false);
+	app->magentaTexIdx = ModelLoader::LoadTexture2D(app, "color_magenta.png", false);
 
 	// Load models
+	app->quantizeVertices = true;
 	u32 ModelIndex = ModelLoader::LoadModel(app, "Models/Substitute/ob0226_00.obj");
 	u32 GroundModelIndex = ModelLoader::LoadModel(app, "Models/Ground.obj");
 
+	IndirectRenderer::BuildArenas(app);
+
 	glEnable(GL_DEPTH_TEST);
 
 	glGetIntegerv(GL_MAX_UNIFORM_BLOCK_SIZE, &app->maxUniformBufferSize);
 	glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &app->uniformBlockAligment);
+	InstancedRenderer::Init(app);
+	ClusteredLighting::Init(app);
 
-	app->localUniformBuffer = BufferManager::CreateConstantBuffer(app->maxUniformBufferSize);
+	if (!BufferManager::LoadBufferStorage())
+		ELOG("GL_ARB_buffer_storage not supported, per-frame uniforms use unsynchronized mapping");
+	app->uniformRing = BufferManager::CreateRingBuffer(app->maxUniformBufferSize, GL_UNIFORM_BUFFER);
 
-	app->entities.push_back({ TransformPositionScale(vec3(-10.0, 0.0, -2.0), vec3(1.0, 1.0, 1.0)), ModelIndex, 0, 0 });
-	app->entities.push_back({ TransformPositionScale(vec3(-0.0, 0.0, -2.0), vec3(1.0, 1.0, 1.0)), ModelIndex, 0, 0 });
-	app->entities.push_back({ TransformPositionScale(vec3(-5.0, 0.0, -2.0), vec3(1.0, 1.0, 1.0)), ModelIndex, 0, 0 });
+	app->entities.push_back({ TransformPositionScale(vec3(-10.0, 0.0, -2.0), vec3(1.0, 1.0, 1.0)), ModelIndex, 0, 0, 0 });
+	app->entities.push_back({ TransformPositionScale(vec3(-0.0, 0.0, -2.0), vec3(1.0, 1.0, 1.0)), ModelIndex, 0, 0, 0 });
+	app->entities.push_back({ TransformPositionScale(vec3(-5.0, 0.0, -2.0), vec3(1.0, 1.0, 1.0)), ModelIndex, 0, 0, 0 });
 
-	app->entities.push_back({ TransformPositionScale(vec3(0.0, 0.0, 0.0), vec3(10.0, 1.0, 10.0)), GroundModelIndex, 0, 0 });
+	app->entities.push_back({ TransformPositionScale(vec3(0.0, 0.0, 0.0), vec3(10.0, 1.0, 10.0)), GroundModelIndex, 0, 0, 0 });
 
-	app->lights.push_back({ LightType::LightType_Directional, vec3(1.0, 1.0, 1.0),vec3(1.0, -1.0, 1.0),vec3(0, 0, 0) });
-	app->lights.push_back({ LightType::LighthType_point, vec3(0.0, 1.0, 0.0),vec3(1.0, 1.0, 1.0),vec3(0, 0, 0) });
+	app->lights.push_back({ LightType::LightType_Directional, vec3(1.0, 1.0, 1.0),vec3(1.0, -1.0, 1.0),vec3(0, 0, 0), 0.0f });
+	app->lights.push_back({ LightType::LighthType_point, vec3(0.0, 1.0, 0.0),vec3(1.0, 1.0, 1.0),vec3(0, 0, 0), 20.0f });
+	app->clusteredLighting.isEnabled = true;
 
-	app->ConfigureFrameBuffer(app->deferredFrameBuffer);
-
-	// config frame buffer
-	app->ConfigureFrameBuffer(app->bloom.fbBloom1);
-	app->ConfigureFrameBuffer(app->bloom.fbBloom2);
-	app->ConfigureFrameBuffer(app->bloom.fbBloom3);
-	app->ConfigureFrameBuffer(app->bloom.fbBloom4);
-	app->ConfigureFrameBuffer(app->bloom.fbBloom5);
+	// Render targets come from the pool each frame, sized to the display
+	app->gbufferLayout = GBufferLayout_Packed;
 
 	// Init camera
 	app->camera.pos = glm::vec3(0.0f, 5.0f, 15.0f);
@@ -277,20 +358,58 @@ void Init(App* app)
 	app->camera.up = glm::vec3(0.0f, 1.0f, 0.0f);
 
 	app->mode = Mode::Mode_Deferred;
+	app->culling.isEnabled = true;
+	app->culling.method = CullingMethod_Bvh;
+	app->culling.pickedEntity = UINT32_MAX;
+	app->permutations.isEnabled = true;
+	app->renderQueue.order = RenderQueueOrder_State;
+	app->glState.isEnabled = true;
+	GLState::Invalidate(app);
+
+	FramePipeline::Init(app);
 }
 
 void Gui(App* app)
 {
 	ImGui::Begin("Info");
 	ImGui::Text("FPS: %f", 1.0f / app->deltaTime);
+	ImGui::Text("Uniform ring: %u page(s)%s", (u32)app->uniformRing.pages.size(), app->uniformRing.isPersistent ? " persistent" : "");
+	if (app->textureQueue.inFlightCount > 0)
+		ImGui::Text("Streaming textures: %u", app->textureQueue.inFlightCount);
+	ImGui::Text("Visible entities: %u / %u", (u32)app->culling.visibleEntities.size(), (u32)app->entities.size());
 	ImGui::Text("%s", app->openglDebugInfo.c_str());
 
 	//ImGui::ShowDemoWindow();
 
+	if (ImGui::CollapsingHeader("Profiler"))
+		Profiler::DrawGui(app);
+	if (ImGui::CollapsingHeader("Memory"))
+		Arena::DrawGui();
+	if (ImGui::CollapsingHeader("Asset archive"))
+		Pak::DrawGui();
+	if (ImGui::CollapsingHeader("Render targets"))
+		RenderTargetPool::DrawGui(app);
+	if (ImGui::CollapsingHeader("Shaders"))
+	{
+		ShaderCompiler::DrawGui(app);
+		ShaderPermutation::DrawGui(app);
+	}
+	if (ImGui::CollapsingHeader("Jobs"))
+	{
+		FramePipeline::DrawGui(app);
+		JobSystem::DrawGui(app);
+	}
+	if (ImGui::CollapsingHeader("Render queue"))
+		RenderQueue::DrawGui(app);
+	if (ImGui::CollapsingHeader("Frame graph"))
+		FrameGraph::DrawGui(app);
+	if (ImGui::CollapsingHeader("Bloom"))
+		Bloom::DrawGui(app);
 	if (ImGui::CollapsingHeader("Camera"))
 	{
-		ImGui::SliderFloat("movement speed", &app->camera.moveSpeed, 0.0, 100.0);
-		ImGui::SliderFloat("rotation sensitive", &app->camera.rotationSensitive, 0.0, 1.0);
+		// The simulation step owns the camera, app->camera is its copy for the frame being drawn
+		ImGui::SliderFloat("movement speed", &app->pipeline.camera.moveSpeed, 0.0, 100.0);
+		ImGui::SliderFloat("rotation sensitive", &app->pipeline.camera.rotationSensitive, 0.0, 1.0);
 	}
 	if (ImGui::CollapsingHeader("Lights"))
 	{
@@ -299,13 +418,33 @@ void Gui(App* app)
 
 		if (app->lights.size() > 1)
 			ImGui::ColorEdit3("Point light color", (float*)&app->lights[1].color);
+
+		ImGui::Checkbox("Clustered lighting", &app->clusteredLighting.isEnabled);
+		ImGui::Text("Lights: %u (forward and unclustered deferred shade the first %u)", (u32)app->lights.size(), GLOBAL_PARAMS_MAX_LIGHTS);
+
+		if (ImGui::Button("Spawn 100 point lights"))
+		{
+			// xorshift, so the same presses give the same scene
+			static u32 seed = 2463534242u;
+			auto Random01 = []() { seed ^= seed << 13; seed ^= seed >> 17; seed ^= seed << 5; return (seed & 0xFFFFFF) / (f32)0xFFFFFF; };
+
+			for (u32 i = 0; i < 100; ++i)
+			{
+				const vec3 position(Random01() * 30.0f - 15.0f, Random01() * 4.0f + 0.5f, Random01() * 30.0f - 15.0f);
+				const vec3 color(Random01(), Random01(), Random01());
+				app->lights.push_back({ LightType::LighthType_point, color, vec3(0.0f, -1.0f, 0.0f), position, 3.0f + Random01() * 5.0f });
+			}
+		}
+		ImGui::SameLine();
+		if (ImGui::Button("Clear spawned lights") && app->lights.size() > 2)
+			app->lights.resize(2);
 		//ImGui::SliderFloat("movement speed", &app->camera.moveSpeed, 0.0, 100.0);
 		//ImGui::SliderFloat("rotation sensitive", &app->camera.rotationSensitive, 0.0, 1.0);
 	}
 
 	ImGui::Spacing();
 
-	const char* RenderModes[] = { "FORWARD", "DEFERRED" };
+	const char* RenderModes[] = { "FORWARD", "DEFERRED", "BLOOM" };
 	if (ImGui::BeginCombo("Render Mode", RenderModes[app->mode]))
 	{
 		for (int i = 0; i < ARRAY_COUNT(RenderModes); ++i)
@@ -320,7 +459,74 @@ void Gui(App* app)
 		ImGui::EndCombo();
 	}
 
-	if (app->mode == Mode::Mode_Deferred)
+	const char* RenderPaths[] = { "DIRECT", "MULTI DRAW INDIRECT", "INSTANCED" };
+	if (ImGui::BeginCombo("Render Path", RenderPaths[app->renderPath]))
+	{
+		for (u32 i = 0; i < ARRAY_COUNT(RenderPaths); ++i)
+		{
+			bool isSelected = (i == app->renderPath);
+			if (ImGui::Selectable(RenderPaths[i], isSelected))
+			{
+				app->renderPath = static_cast<RenderPath>(i);
+			}
+		}
+
+		ImGui::EndCombo();
+	}
+
+	if (app->mode != Mode::Mode_Forward)
+	{
+		const char* GBufferLayouts[] = { "FULL", "PACKED" };
+		if (ImGui::BeginCombo("G-Buffer Layout", GBufferLayouts[app->gbufferLayout]))
+		{
+			for (u32 i = 0; i < ARRAY_COUNT(GBufferLayouts); ++i)
+			{
+				bool isSelected = (i == app->gbufferLayout);
+				if (ImGui::Selectable(GBufferLayouts[i], isSelected))
+				{
+					app->gbufferLayout = static_cast<GBufferLayout>(i);
+				}
+			}
+
+			ImGui::EndCombo();
+		}
+	}
+
+	ImGui::Checkbox("Frustum culling", &app->culling.isEnabled);
+
+	const char* CullingMethods[] = { "SIMD BRUTE FORCE", "BVH" };
+	if (ImGui::BeginCombo("Culling Method", CullingMethods[app->culling.method]))
+	{
+		for (u32 i = 0; i < ARRAY_COUNT(CullingMethods); ++i)
+		{
+			bool isSelected = (i == app->culling.method);
+			if (ImGui::Selectable(CullingMethods[i], isSelected))
+			{
+				app->culling.method = static_cast<CullingMethod>(i);
+			}
+		}
+
+		ImGui::EndCombo();
+	}
+
+	ImGui::Text("Culling: %.3f ms", app->culling.cullTimeMs);
+	if (app->culling.pickedEntity != UINT32_MAX)
+	{
+		ImGui::Text("Picked entity: %u", app->culling.pickedEntity);
+
+		// No simulation step is in flight while the Gui runs, so the entity can be moved here
+		Entity& entity = app->entities[app->culling.pickedEntity];
+		vec3 position = vec3(entity.worldMatrix[3]);
+		if (ImGui::DragFloat3("Picked entity position", &position.x, 0.1f))
+		{
+			entity.worldMatrix[3] = vec4(position, 1.0f);
+			Culling::MarkEntityMoved(app, app->culling.pickedEntity);
+		}
+	}
+	if (ImGui::Button("Run culling benchmark"))
+		Culling::RunBenchmark(app);
+
+	if (app->mode != Mode::Mode_Forward)
 	{
 		for (int i = 0; i < app->deferredFrameBuffer.colorAttachments.size(); i++)
 		{
@@ -332,400 +538,422 @@ void Gui(App* app)
 	ImGui::End();
 }
 
+void Shutdown(App* app)
+{
+	ShaderCompiler::Shutdown(app);
+	RenderTargetPool::Shutdown(app);
+	Profiler::Shutdown(app);
+	TextureStreamer::Shutdown(app);
+	JobSystem::Shutdown(app);
+}
+
 void Update(App* app)
 {
-	// You can handle app->input keyboard/mouse here
-	UpdateCamera(app);
+	PROFILE_SCOPE(app, "Update");
+
+	// Camera, picking and culling run in the simulation step, app->input keyboard/mouse is latched for it here
+	FramePipeline::Update(app);
+
+	TextureStreamer::ProcessUploads(app);
+
+	ShaderCompiler::Update(app);
 }
 
-void UpdateCamera(App* app)
+void UpdateCamera(Camera& camera, Input& input, f32 deltaTime)
 {
-	float moveSpeed = app->camera.moveSpeed * app->deltaTime;
+	float moveSpeed = camera.moveSpeed * deltaTime;
 
 	// camera movement
-	if (app->input.keys[Key::K_W] == ButtonState::BUTTON_PRESSED)
+	if (input.keys[Key::K_W] == ButtonState::BUTTON_PRESSED)
 	{
-		app->camera.pos += app->camera.front * moveSpeed;
+		camera.pos += camera.front * moveSpeed;
 	}
-	if (app->input.keys[Key::K_S] == ButtonState::BUTTON_PRESSED)
+	if (input.keys[Key::K_S] == ButtonState::BUTTON_PRESSED)
 	{
-		app->camera.pos -= app->camera.front * moveSpeed;
+		camera.pos -= camera.front * moveSpeed;
 	}
-	if (app->input.keys[Key::K_A] == ButtonState::BUTTON_PRESSED)
+	if (input.keys[Key::K_A] == ButtonState::BUTTON_PRESSED)
 	{
-		app->camera.pos -= glm::normalize(glm::cross(app->camera.front, app->camera.up)) * moveSpeed;
+		camera.pos -= glm::normalize(glm::cross(camera.front, camera.up)) * moveSpeed;
 	}
-	if (app->input.keys[Key::K_D] == ButtonState::BUTTON_PRESSED)
+	if (input.keys[Key::K_D] == ButtonState::BUTTON_PRESSED)
 	{
-		app->camera.pos += glm::normalize(glm::cross(app->camera.front, app->camera.up)) * moveSpeed;
+		camera.pos += glm::normalize(glm::cross(camera.front, camera.up)) * moveSpeed;
 	}
 
 	// camera rotation
-	if (app->input.mouseButtons[MouseButton::RIGHT] == ButtonState::BUTTON_PRESS)
+	if (input.mouseButtons[MouseButton::RIGHT] == ButtonState::BUTTON_PRESS)
 	{
-		app->input.mouseLastPos = app->input.mousePos;
+		input.mouseLastPos = input.mousePos;
 	}
-	else if (app->input.mouseButtons[MouseButton::RIGHT] == ButtonState::BUTTON_PRESSED)
+	else if (input.mouseButtons[MouseButton::RIGHT] == ButtonState::BUTTON_PRESSED)
 	{
-		float xoffset = app->input.mousePos.x - app->input.mouseLastPos.x;
-		float yoffset = app->input.mouseLastPos.y - app->input.mousePos.y;
+		float xoffset = input.mousePos.x - input.mouseLastPos.x;
+		float yoffset = input.mouseLastPos.y - input.mousePos.y;
 
-		app->input.mouseLastPos = app->input.mousePos;
+		input.mouseLastPos = input.mousePos;
 
-		xoffset *= app->camera.rotationSensitive;
-		yoffset *= app->camera.rotationSensitive;
+		xoffset *= camera.rotationSensitive;
+		yoffset *= camera.rotationSensitive;
 
-		app->camera.yaw += xoffset;
-		app->camera.pitch += yoffset;
+		camera.yaw += xoffset;
+		camera.pitch += yoffset;
 
-		app->camera.pitch = app->camera.pitch > 89.0 ? 89.0 : app->camera.pitch < -89.0 ? -89.0 : app->camera.pitch;
+		camera.pitch = camera.pitch > 89.0 ? 89.0 : camera.pitch < -89.0 ? -89.0 : camera.pitch;
 
 		glm::vec3 direction;
-		direction.x = cos(glm::radians(app->camera.yaw)) * cos(glm::radians(app->camera.pitch));
-		direction.y = sin(glm::radians(app->camera.pitch));
-		direction.z = sin(glm::radians(app->camera.yaw)) * cos(glm::radians(app->camera.pitch));
-		app->camera.front = glm::normalize(direction);
+		direction.x = cos(glm::radians(camera.yaw)) * cos(glm::radians(camera.pitch));
+		direction.y = sin(glm::radians(camera.pitch));
+		direction.z = sin(glm::radians(camera.yaw)) * cos(glm::radians(camera.pitch));
+		camera.front = glm::normalize(direction);
 	}
 }
 
-void InitBloomEffect(App* app)
+void RenderSceneGeometry(App* app, GLuint directProgramIdx, GLuint indirectProgramIdx, GLuint instancedProgramIdx, u32 passFeatures)
 {
-	// Vertical
-	if (app->bloom.rtBright != 0)
-		glDeleteTextures(1, &app->bloom.rtBright);
-	
-	glGenTextures(1, &app->bloom.rtBright);
-	glBindTexture(GL_TEXTURE_2D, app->bloom.rtBright);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, MIPMAP_BASE_LEVEL);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, MIPMAP_MAX_LEVEL);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, app->displaySize.x / 2, app->displaySize.y / 2, 0, GL_RGBA, GL_FLOAT, nullptr);
-	glTexImage2D(GL_TEXTURE_2D, 1, GL_RGBA16F, app->displaySize.x / 4, app->displaySize.y / 4, 0, GL_RGBA, GL_FLOAT, nullptr);
-	glTexImage2D(GL_TEXTURE_2D, 2, GL_RGBA16F, app->displaySize.x / 8, app->displaySize.y / 8, 0, GL_RGBA, GL_FLOAT, nullptr);
-	glTexImage2D(GL_TEXTURE_2D, 3, GL_RGBA16F, app->displaySize.x / 16, app->displaySize.y / 16, 0, GL_RGBA, GL_FLOAT, nullptr);
-	glTexImage2D(GL_TEXTURE_2D, 4, GL_RGBA16F, app->displaySize.x / 32, app->displaySize.y / 32, 0, GL_RGBA, GL_FLOAT, nullptr);
-	glGenerateMipmap(GL_TEXTURE_2D);
-
-	// Horizontal
-	if (app->bloom.rtBloomH != 0)
-		glDeleteTextures(1, &app->bloom.rtBloomH);
-
-	glGenTextures(1, &app->bloom.rtBloomH);
-	glBindTexture(GL_TEXTURE_2D, app->bloom.rtBloomH);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, MIPMAP_BASE_LEVEL);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, MIPMAP_MAX_LEVEL);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, app->displaySize.x / 2, app->displaySize.y / 2, 0, GL_RGBA, GL_FLOAT, nullptr);
-	glTexImage2D(GL_TEXTURE_2D, 1, GL_RGBA16F, app->displaySize.x / 4, app->displaySize.y / 4, 0, GL_RGBA, GL_FLOAT, nullptr);
-	glTexImage2D(GL_TEXTURE_2D, 2, GL_RGBA16F, app->displaySize.x / 8, app->displaySize.y / 8, 0, GL_RGBA, GL_FLOAT, nullptr);
-	glTexImage2D(GL_TEXTURE_2D, 3, GL_RGBA16F, app->displaySize.x / 16, app->displaySize.y / 16, 0, GL_RGBA, GL_FLOAT, nullptr);
-	glTexImage2D(GL_TEXTURE_2D, 4, GL_RGBA16F, app->displaySize.x / 32, app->displaySize.y / 32, 0, GL_RGBA, GL_FLOAT, nullptr);
-	glGenerateMipmap(GL_TEXTURE_2D);
+	PROFILE_SCOPE(app, "RenderGeometry");
+
+	if (app->renderPath == RenderPath_Indirect)
+	{
+		// One multi-draw covers every material, so it keeps the generic program and its runtime branches
+		const Program& indirectProgram = app->programs[indirectProgramIdx];
+		GLState::UseProgram(app, indirectProgram.handle);
+		IndirectRenderer::RenderGeometry(app);
+	}
+	else if (app->renderPath == RenderPath_Instanced)
+	{
+		InstancedRenderer::RenderGeometry(app, instancedProgramIdx, passFeatures);
+	}
+	else
+	{
+		app->RenderGeometry(directProgramIdx, passFeatures);
+	}
 }
 
-void PassBlitBrightPixels(App* app)
+static void ExecuteForwardPass(App* app, FrameGraphState&, const FrameGraphPass&)
 {
-	float threshold = 1.0;
-
-	glBindFramebuffer(GL_FRAMEBUFFER, app->bloom.fbBloom1.fbHandle);
-	glDrawBuffer(GL_COLOR_ATTACHMENT0);
-	glViewport(0, 0, app->displaySize.x, app->displaySize.y);
-	glBindFramebuffer(GL_FRAMEBUFFER, 0);
-
-	const Program& blitBrightestProgram = app->programs[app->blitBrightestPixelsShader];
-	glUseProgram(blitBrightestProgram.handle);
-
-	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(GL_TEXTURE_2D, app->bloom.fbBloom1.colorAttachments[0]);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-	glUniform1f(glGetUniformLocation(blitBrightestProgram.handle, "threshold"), threshold);
-	glUniform1i(glGetUniformLocation(blitBrightestProgram.handle, "colorTexture"), 0);
+	RenderSceneGeometry(app, app->renderToBackBufferShader, app->renderToBackBufferIndirectShader, app->renderToBackBufferInstancedShader, ShaderPermutation::LightFeatures(app));
 
-	app->RenderGeometry(blitBrightestProgram);
-
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-	glUseProgram(0);
+	// try to do bloom here
 }
 
-void Render(App* app)
+static void ExecuteGBufferPass(App* app, FrameGraphState& graph, const FrameGraphPass& pass)
 {
-	switch (app->mode)
-	{
-	case Mode_Forward:
-	{
-		app->UpdateEntityBuffer();
+	if (app->gbufferLayout == GBufferLayout_Packed)
+		RenderSceneGeometry(app, app->renderToFrameBufferPackedShader, app->renderToFrameBufferIndirectPackedShader, app->renderToFrameBufferInstancedPackedShader, 0);
+	else
+		RenderSceneGeometry(app, app->renderToFrameBufferShader, app->renderToFrameBufferIndirectShader, app->renderToFrameBufferInstancedShader, 0);
 
-		glViewport(0, 0, app->displaySize.x, app->displaySize.y);
-		glBindFramebuffer(GL_FRAMEBUFFER, 0);
-		glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
-		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+	// Render Grid To CA
+	/*
+	GLuint drawBuffers[] = { GL_COLOR_ATTACHMENT4 };
+	glDrawBuffers(1, drawBuffers);
 
-		const Program& forwardProgram = app->programs[app->renderToBackBufferShader];
-		glUseProgram(forwardProgram.handle);
-		app->RenderGeometry(forwardProgram);
+	glEnable(GL_DEPTH_TEST);
+	glEnable(GL_BLEND);
+	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
-		// try to do bloom here
-	}
-	break;
+	GLuint gridHandle = app->programs[app->gridRenderShader].handle;
 
-	case Mode_Deferred:
-	{
-		app->UpdateEntityBuffer();
+	glUseProgram(gridHandle);
 
-		// Render to FB ColorAtt.
-		glViewport(0, 0, app->displaySize.x, app->displaySize.y);
-		glBindFramebuffer(GL_FRAMEBUFFER, app->deferredFrameBuffer.fbHandle);
-		glClearColor(0.1f, 0.1f, 0.1f, 1.0f);
-		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+	vec4 tbrl = app->camera.getTopBottomLeftRight();
 
-		//glDrawBuffers(app->deferredFrameBuffer.colorAttachments.size(), app->deferredFrameBuffer.colorAttachments.data());
+	glUniform1f(glGetUniformLocation(gridHandle, "top"), tbrl.x);
+	glUniform1f(glGetUniformLocation(gridHandle, "bottom"), tbrl.y);
+	glUniform1f(glGetUniformLocation(gridHandle, "right"), tbrl.z);
+	glUniform1f(glGetUniformLocation(gridHandle, "left"), tbrl.w);
+	glUniform1f(glGetUniformLocation(gridHandle, "znear"), app->camera.znear);
 
-		//glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
-		//glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+	glm::mat4 translationMatrix = glm::translate(glm::mat4(1.0f), app->camera.pos);
+	glm::mat4 yawMatrix = glm::rotate(glm::mat4(1.0), glm::radians(app->camera.yaw), glm::vec3(0.0, 1.0, 0.0));
+	glm::mat4 pitchMatrix = glm::rotate(glm::mat4(1.0f), glm::radians(app->camera.pitch), glm::vec3(1.0, 0.0, 0.0));
+	glm::mat4 rotationMatrix = yawMatrix * pitchMatrix;
+	glm::mat4 cameraWorldMatrix = translationMatrix * rotationMatrix;
 
-		const Program& deferredProgram = app->programs[app->renderToFrameBufferShader];
-		glUseProgram(deferredProgram.handle);
-		app->RenderGeometry(deferredProgram);
+	glUniformMatrix4fv(glGetUniformLocation(gridHandle, "worldMatrix"), 1, GL_FALSE, &cameraWorldMatrix[0][0]);
 
-		// Render Grid To CA
-		/*
-		GLuint drawBuffers[] = { GL_COLOR_ATTACHMENT4 };
-		glDrawBuffers(1, drawBuffers);
+	glBindVertexArray(app->vao);
+	glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_SHORT, 0);
+	*/
+
+	GLState::BindVertexArray(app, 0);
+	GLState::UseProgram(app, 0);
+	glDisable(GL_BLEND);
+
+	// Kept for the G-buffer previews in the Gui
+	FrameBuffer& gbuffer = app->deferredFrameBuffer;
+	gbuffer.colorAttachments.clear();
+	for (u32 i = 0; i < pass.colorWriteCount; ++i)
+		gbuffer.colorAttachments.push_back(FrameGraph::GetTexture(graph, pass.colorWrites[i]));
+	gbuffer.depthHandle = FrameGraph::GetTexture(graph, pass.depthWrite);
+}
 
-		glEnable(GL_DEPTH_TEST);
-		glEnable(GL_BLEND);
-		glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+static void ExecuteLightCullingPass(App* app, FrameGraphState&, const FrameGraphPass&)
+{
+	ClusteredLighting::CullLights(app);
+}
 
-		GLuint gridHandle = app->programs[app->gridRenderShader].handle;
+static void ExecuteLightingPass(App* app, FrameGraphState& graph, const FrameGraphPass& pass)
+{
+	const bool isPacked = app->gbufferLayout == GBufferLayout_Packed;
+	const bool isClustered = app->clusteredLighting.isEnabled;
 
-		glUseProgram(gridHandle);
+	// Unclustered lighting loops over GlobalParams with a bound known at compile time
+	GLuint lightingShader = isPacked ? app->framebufferToQuadPackedShader : app->framebufferToQuadShader;
+	if (isClustered)
+		lightingShader = isPacked ? app->framebufferToQuadPackedClusteredShader : app->framebufferToQuadClusteredShader;
+	else
+		lightingShader = ShaderPermutation::Get(app, lightingShader, ShaderPermutation::LightFeatures(app));
 
-		vec4 tbrl = app->camera.getTopBottomLeftRight();
+	const Program& FBToBB = app->programs[lightingShader];
+	GLState::UseProgram(app, FBToBB.handle);
 
-		glUniform1f(glGetUniformLocation(gridHandle, "top"), tbrl.x);
-		glUniform1f(glGetUniformLocation(gridHandle, "bottom"), tbrl.y);
-		glUniform1f(glGetUniformLocation(gridHandle, "right"), tbrl.z);
-		glUniform1f(glGetUniformLocation(gridHandle, "left"), tbrl.w);
-		glUniform1f(glGetUniformLocation(gridHandle, "znear"), app->camera.znear);
+	// Render Quad
+	GLState::BindBufferRange(app, GL_UNIFORM_BUFFER, BINDING(0), app->globalParamsBuffer, app->globalParamsOffset, app->globalParamsSize);
+	if (isClustered)
+		ClusteredLighting::BindForShading(app);
 
-		glm::mat4 translationMatrix = glm::translate(glm::mat4(1.0f), app->camera.pos);
-		glm::mat4 yawMatrix = glm::rotate(glm::mat4(1.0), glm::radians(app->camera.yaw), glm::vec3(0.0, 1.0, 0.0));
-		glm::mat4 pitchMatrix = glm::rotate(glm::mat4(1.0f), glm::radians(app->camera.pitch), glm::vec3(1.0, 0.0, 0.0));
-		glm::mat4 rotationMatrix = yawMatrix * pitchMatrix;
-		glm::mat4 cameraWorldMatrix = translationMatrix * rotationMatrix;
+	// The G-buffer targets were declared as reads in sampler unit order
+	for (u32 i = 0; i < pass.reads.size(); ++i)
+		GLState::BindTexture(app, i, GL_TEXTURE_2D, FrameGraph::GetTexture(graph, pass.reads[i]));
 
-		glUniformMatrix4fv(glGetUniformLocation(gridHandle, "worldMatrix"), 1, GL_FALSE, &cameraWorldMatrix[0][0]);
+	if (isPacked)
+	{
+		// Position and view direction come from depth
+		const glm::mat4 inverseViewProjection = glm::inverse(app->camera.projectionMatrix * app->camera.viewMatrix);
+		// Cached on each program when it is reflected, each permutation may place it elsewhere
+		glUniformMatrix4fv(FBToBB.inverseViewProjectionLocation, 1, GL_FALSE, &inverseViewProjection[0][0]);
+	}
 
-		glBindVertexArray(app->vao);
-		glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_SHORT, 0);
-		*/
+	GLState::BindVertexArray(app, app->vao);
+	glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_SHORT, 0);
 
-		glBindVertexArray(0);
-		glUseProgram(0);
+	// Release source
+	GLState::BindVertexArray(app, 0);
+	GLState::UseProgram(app, 0);
+}
 
-		glBindFramebuffer(GL_FRAMEBUFFER, 0);
-		glDisable(GL_BLEND);
+void BuildForwardGraph(App* app, FrameGraphState& graph)
+{
+	const FrameGraphResource backBuffer = FrameGraph::ImportBackBuffer(app, graph);
 
-		// Render to BB from ColorAtt.
-		glClearColor(0.1f, 0.1f, 0.1f, 1.0f);
-		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+	const u32 forwardPass = FrameGraph::AddPass(graph, "Forward pass", ExecuteForwardPass);
+	FrameGraph::WriteColor(graph, forwardPass, backBuffer);
+	FrameGraph::SetClear(graph, forwardPass, GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT, vec4(0.0f, 0.0f, 0.0f, 1.0f));
+}
 
-		glViewport(0, 0, app->displaySize.x, app->displaySize.y);
+void BuildDeferredGraph(App* app, FrameGraphState& graph, FrameGraphResource output)
+{
+	// G-buffer, in the output order of RENDER_TO_FB
+	std::vector<FrameGraphResource> gbuffer;
+	if (app->gbufferLayout == GBufferLayout_Packed)
+	{
+		gbuffer.push_back(FrameGraph::CreateTarget(graph, "Albedo", RenderTargetPool::DisplayTarget(app, GL_RGBA8)));
+		gbuffer.push_back(FrameGraph::CreateTarget(graph, "Normal (octahedral)", RenderTargetPool::DisplayTarget(app, GL_RG16)));
+		gbuffer.push_back(FrameGraph::CreateTarget(graph, "Surface", RenderTargetPool::DisplayTarget(app, GL_RGBA8)));
+	}
+	else
+	{
+		gbuffer.push_back(FrameGraph::CreateTarget(graph, "Albedo", RenderTargetPool::DisplayTarget(app, GL_RGBA8)));
+		gbuffer.push_back(FrameGraph::CreateTarget(graph, "Normal", RenderTargetPool::DisplayTarget(app, GL_RGBA16F)));
+		gbuffer.push_back(FrameGraph::CreateTarget(graph, "Position", RenderTargetPool::DisplayTarget(app, GL_RGBA16F)));
+		gbuffer.push_back(FrameGraph::CreateTarget(graph, "View direction", RenderTargetPool::DisplayTarget(app, GL_RGBA16F)));
+	}
+	const FrameGraphResource depth = FrameGraph::CreateTarget(graph, "Depth", RenderTargetPool::DisplayTarget(app, GL_DEPTH_COMPONENT24));
 
-		const Program& FBToBB = app->programs[app->framebufferToQuadShader];
-		glUseProgram(FBToBB.handle);
+	const u32 gbufferPass = FrameGraph::AddPass(graph, "G-buffer pass", ExecuteGBufferPass);
+	for (FrameGraphResource target : gbuffer)
+		FrameGraph::WriteColor(graph, gbufferPass, target);
+	FrameGraph::WriteDepth(graph, gbufferPass, depth);
+	FrameGraph::SetClear(graph, gbufferPass, GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT, vec4(0.1f, 0.1f, 0.1f, 1.0f));
 
-		// Render Quad
-		glBindBufferRange(GL_UNIFORM_BUFFER, BINDING(0), app->localUniformBuffer.handle, app->globalParamsOffset, app->globalParamsSize);
+	// Writes the cluster buffers, which the graph does not track
+	if (app->clusteredLighting.isEnabled)
+	{
+		const u32 lightCullingPass = FrameGraph::AddPass(graph, "Light culling", ExecuteLightCullingPass);
+		FrameGraph::SetSideEffects(graph, lightCullingPass);
+	}
 
-		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_2D, app->deferredFrameBuffer.colorAttachments[0]);
-		glUniform1i(glGetUniformLocation(FBToBB.handle, "uAlbedo"), 0);
+	// Render to BB from ColorAtt.
+	const u32 lightingPass = FrameGraph::AddPass(graph, "Lighting pass", ExecuteLightingPass);
+	FrameGraph::Read(graph, lightingPass, gbuffer[0]);
+	FrameGraph::Read(graph, lightingPass, gbuffer[1]);
+	FrameGraph::Read(graph, lightingPass, gbuffer[2]);
+	FrameGraph::Read(graph, lightingPass, app->gbufferLayout == GBufferLayout_Packed ? depth : gbuffer[3]);
+	FrameGraph::WriteColor(graph, lightingPass, output);
+	FrameGraph::SetClear(graph, lightingPass, GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT, vec4(0.1f, 0.1f, 0.1f, 1.0f));
+}
 
-		glActiveTexture(GL_TEXTURE1);
-		glBindTexture(GL_TEXTURE_2D, app->deferredFrameBuffer.colorAttachments[1]);
-		glUniform1i(glGetUniformLocation(FBToBB.handle, "uNormals"), 1);
+void Render(App* app)
+{
+	RenderTargetPool::BeginFrame(app);
 
-		glActiveTexture(GL_TEXTURE2);
-		glBindTexture(GL_TEXTURE_2D, app->deferredFrameBuffer.colorAttachments[2]);
-		glUniform1i(glGetUniformLocation(FBToBB.handle, "uPosition"), 2);
+	// After the pool deletes its unused objects, their names may come back for new ones
+	GLState::BeginFrame(app);
+	JobSystem::BeginFrame(app);
 
-		glActiveTexture(GL_TEXTURE3);
-		glBindTexture(GL_TEXTURE_2D, app->deferredFrameBuffer.colorAttachments[3]);
-		glUniform1i(glGetUniformLocation(FBToBB.handle, "uViewDir"), 3);
+	// The next frame is simulated on a worker while this one is submitted
+	FramePipeline::BeginStep(app);
 
-		glBindVertexArray(app->vao);
-		glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_SHORT, 0);
+	FrameGraphState& graph = app->frameGraph;
+	FrameGraph::Reset(graph);
 
-		// Release source
-		glBindVertexArray(0);
-		glUseProgram(0);
-		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	switch (app->mode)
+	{
+	case Mode_Forward:
+	{
+		app->UpdateEntityBuffer();
+		BuildForwardGraph(app, graph);
 	}
 	break;
 
-	case Mode_Bloom:
+	case Mode_Deferred:
 	{
-		const vec2 horizontal(1.0, 0.0);
-		const vec2 vertical(0.0, 1.0);
-
-		const float w = app->displaySize.x;
-		const float h = app->displaySize.y;
+		app->UpdateEntityBuffer();
+		BuildDeferredGraph(app, graph, FrameGraph::ImportBackBuffer(app, graph));
+	}
+	break;
 
-		float threshold = 1.0;	
+	case Mode_Bloom:
+	{
+		app->UpdateEntityBuffer();
 
+		// Deferred lighting into an HDR target, then bloom composited into the back buffer
+		const FrameGraphResource sceneColor = FrameGraph::CreateTarget(graph, "Scene color", RenderTargetPool::DisplayTarget(app, GL_RGBA16F));
+		BuildDeferredGraph(app, graph, sceneColor);
+		Bloom::AddPasses(app, graph, sceneColor, FrameGraph::ImportBackBuffer(app, graph));
 	}
 	break;
 
 	default:;
 	}
+
+	FrameGraph::Compile(graph);
+	FrameGraph::Execute(app, graph);
+
+	FramePipeline::EndStep(app);
+
+	// The GPU reads this frame's uniforms until every draw above completes
+	BufferManager::FenceRingFrame(app->uniformRing);
 }
 
 void App::UpdateEntityBuffer()
 {
-	// camera
-	camera.aspecRatio = (float)displaySize.x / (float)displaySize.y;
-	camera.fovYRad = glm::radians(60.0f);
-	glm::mat4 projection = glm::perspective(camera.fovYRad, camera.aspecRatio, camera.znear, camera.zfar);
-	glm::mat4 view = glm::lookAt(camera.pos, camera.pos + camera.front, camera.up);
-
-	BufferManager::MapBuffer(localUniformBuffer, GL_WRITE_ONLY);
-
-	//globalParamsOffset - localUniformBuffer.head;
-	PushVec3(localUniformBuffer, camera.pos);
-	PushUInt(localUniformBuffer, lights.size());
+	PROFILE_SCOPE(this, "UpdateEntityBuffer");
+
+	// The camera, the visible entities and their matrices were computed by the simulation step
+	const RenderSnapshot& snapshot = FramePipeline::GetRenderSnapshot(this);
+
+	if (materialBufferCount != materials.size())
+		UpdateMaterialBuffer();
+
+	BufferManager::BeginRingFrame(uniformRing);
+
+	// Camera position and light counts, then 4 vec4 per light. The shaders declare 16 lights, the clustered path reads the rest from its own buffer.
+	const u32 globalLightCount = glm::min((u32)lights.size(), (u32)GLOBAL_PARAMS_MAX_LIGHTS);
+	const u32 globalParamsMaxSize = 2 * sizeof(vec4) + globalLightCount * 4 * sizeof(vec4);
+	Buffer& globalBuffer = BufferManager::ReserveRingBlock(uniformRing, globalParamsMaxSize, uniformBlockAligment);
+	BufferManager::AlignHead(globalBuffer, uniformBlockAligment);
+	globalParamsBuffer = globalBuffer.handle;
+	globalParamsOffset = globalBuffer.head;
+
+	// Directional lights go first, so the permutations loop over each type without branching on it
+	u32 globalLights[GLOBAL_PARAMS_MAX_LIGHTS];
+	u32 globalLightIdx = 0;
+	for (u32 i = 0; i < lights.size() && globalLightIdx < globalLightCount; ++i)
+		if (lights[i].type == LightType_Directional)
+			globalLights[globalLightIdx++] = i;
+	const u32 directionalLightCount = globalLightIdx;
+	for (u32 i = 0; i < lights.size() && globalLightIdx < globalLightCount; ++i)
+		if (lights[i].type != LightType_Directional)
+			globalLights[globalLightIdx++] = i;
+
+	PushVec3(globalBuffer, camera.pos);
+	PushUInt(globalBuffer, globalLightCount);
+	PushUInt(globalBuffer, directionalLightCount);
 
 	// Lights
-	for (int i = 0; i < lights.size(); ++i)
+	for (u32 i = 0; i < globalLightCount; ++i)
 	{
-		BufferManager::AlignHead(localUniformBuffer, sizeof(vec4));
+		BufferManager::AlignHead(globalBuffer, sizeof(vec4));
 
-		Light& light = lights[i];
-		PushUInt(localUniformBuffer, light.type);
-		PushVec3(localUniformBuffer, light.color);
-		PushVec3(localUniformBuffer, light.direction);
-		PushVec3(localUniformBuffer, light.position);
+		Light& light = lights[globalLights[i]];
+		PushUInt(globalBuffer, light.type);
+		PushVec3(globalBuffer, light.color);
+		PushVec3(globalBuffer, light.direction);
+		PushVec3(globalBuffer, light.position);
 	}
-	globalParamsSize = localUniformBuffer.head - globalParamsOffset;
+	globalParamsSize = globalBuffer.head - globalParamsOffset;
 
-	u32 iteration = 0;
+	if (clusteredLighting.isEnabled)
+		ClusteredLighting::UpdateLights(this);
 
-	for (auto it = entities.begin(); it != entities.end(); ++it)
+	// Instanced draws read the matrices of all the copies of a model from one block instead
+	if (renderPath == RenderPath_Instanced)
+		InstancedRenderer::UpdateInstanceBuffers(this);
+	else
 	{
-		glm::mat4 world = it->worldMatrix;
-		glm::mat4 WVP = projection * view * world;
-
-		Buffer& localBuffer = localUniformBuffer;
-		BufferManager::AlignHead(localBuffer, uniformBlockAligment);
-		it->localParamOffset = localBuffer.head;
-		PushMat4(localBuffer, world);
-		PushMat4(localBuffer, WVP);
-		it->localParamSize = localBuffer.head - it->localParamOffset;
-		++iteration;
+		for (u32 i = 0; i < culling.visibleEntities.size(); ++i)
+		{
+			Entity* it = &entities[culling.visibleEntities[i]];
+
+			Buffer& localBuffer = BufferManager::ReserveRingBlock(uniformRing, 2 * sizeof(glm::mat4), uniformBlockAligment);
+			BufferManager::AlignHead(localBuffer, uniformBlockAligment);
+			it->localParamBuffer = localBuffer.handle;
+			it->localParamOffset = localBuffer.head;
+			PushMat4(localBuffer, snapshot.entityMatrices[2 * i]);
+			PushMat4(localBuffer, snapshot.entityMatrices[2 * i + 1]);
+			it->localParamSize = localBuffer.head - it->localParamOffset;
+		}
 	}
 
-	BufferManager::UnmapBuffer(localUniformBuffer);
+	if (renderPath == RenderPath_Indirect)
+		IndirectRenderer::UpdateDrawBuffers(this);
+
+	BufferManager::EndRingWrites(uniformRing);
 }
 
-void App::ConfigureFrameBuffer(FrameBuffer& aConfigFB)
+void App::UpdateMaterialBuffer()
 {
-	aConfigFB.colorAttachments.push_back(CreateTexture());
-	aConfigFB.colorAttachments.push_back(CreateTexture(true));
-	aConfigFB.colorAttachments.push_back(CreateTexture(true));
-	aConfigFB.colorAttachments.push_back(CreateTexture(true));
-
-	aConfigFB.colorAttachments.push_back(CreateTexture(true)); // oMetallic
-	aConfigFB.colorAttachments.push_back(CreateTexture(true)); // oRoughness
-	aConfigFB.colorAttachments.push_back(CreateTexture(true)); // oAo
-	aConfigFB.colorAttachments.push_back(CreateTexture(true)); // oEmissive
-
-	glGenTextures(1, &aConfigFB.depthHandle);
-	glBindTexture(GL_TEXTURE_2D, aConfigFB.depthHandle);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, displaySize.x, displaySize.y, 0, GL_DEPTH_COMPONENT, GL_UNSIGNED_BYTE, NULL);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-	glBindTexture(GL_TEXTURE_2D, 0);
+	// Every material gets its own aligned std140 MaterialParams block, bound per draw with glBindBufferRange
+	const u32 materialBlockSize = BufferManager::Align(2 * sizeof(vec4), uniformBlockAligment);
+	const u32 requiredSize = materials.size() * materialBlockSize;
 
-	glGenFramebuffers(1, &aConfigFB.fbHandle);
-	glBindFramebuffer(GL_FRAMEBUFFER, aConfigFB.fbHandle);
-
-	std::vector<GLuint> drawBuffers;
-	for (size_t i = 0; i < aConfigFB.colorAttachments.size(); ++i)
+	if (materialUniformBuffer.handle == 0 || (u32)materialUniformBuffer.size < requiredSize)
 	{
-		GLuint position = GL_COLOR_ATTACHMENT0 + i;
-		glFramebufferTexture(GL_FRAMEBUFFER, position, aConfigFB.colorAttachments[i], 0);
-		drawBuffers.push_back(position);
+		if (materialUniformBuffer.handle != 0)
+			glDeleteBuffers(1, &materialUniformBuffer.handle);
+		materialUniformBuffer = BufferManager::CreateConstantBuffer(requiredSize > 0 ? requiredSize : materialBlockSize);
 	}
 
-	glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, aConfigFB.depthHandle, 0);
-	glDrawBuffers(drawBuffers.size(), drawBuffers.data());
+	BufferManager::MapBuffer(materialUniformBuffer, GL_WRITE_ONLY);
 
-	GLenum framebufferStatus = glCheckFramebufferStatus(GL_FRAMEBUFFER);
-	if (framebufferStatus != GL_FRAMEBUFFER_COMPLETE)
+	for (Material& material : materials)
 	{
-		int i = 0;
+		BufferManager::AlignHead(materialUniformBuffer, uniformBlockAligment);
+		material.localParamOffset = materialUniformBuffer.head;
+		PushVec3(materialUniformBuffer, material.albedo);
+		PushUInt(materialUniformBuffer, material.useTexture);
+		PushVec3(materialUniformBuffer, material.emissive);
+		PushFloat(materialUniformBuffer, material.smoothness);
+		material.localParamSize = materialUniformBuffer.head - material.localParamOffset;
 	}
-	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+	BufferManager::UnmapBuffer(materialUniformBuffer);
+
+	materialBufferCount = materials.size();
 }
 
-void App::RenderGeometry(const Program& aBindedProgram)
+void App::RenderGeometry(u32 programIdx, u32 passFeatures)
 {
-	glBindBufferRange(GL_UNIFORM_BUFFER, BINDING(0), localUniformBuffer.handle, globalParamsOffset, globalParamsSize);
+	GLState::BindBufferRange(this, GL_UNIFORM_BUFFER, BINDING(0), globalParamsBuffer, globalParamsOffset, globalParamsSize);
 
-	for (auto it = entities.begin(); it != entities.end(); ++it)
 	{
-		glBindBufferRange(GL_UNIFORM_BUFFER, BINDING(1), localUniformBuffer.handle, it->localParamOffset, it->localParamSize);
-
-		Model& model = models[it->modelIndex];
-		Mesh& mesh = meshes[model.meshIdx];
-
-		for (u32 i = 0; i < mesh.submeshes.size(); ++i)
-		{
-			GLuint vao = FindVAO(mesh, i, aBindedProgram);
-			glBindVertexArray(vao);
-
-			u32 subMeshmaterialIdx = model.materialIdx[i];
-			Material& subMeshMaterial = materials[subMeshmaterialIdx];
-
-			glActiveTexture(GL_TEXTURE0);
-			glBindTexture(GL_TEXTURE_2D, textures[subMeshMaterial.albedoTextureIdx].handle);
-			glUniform1i(texturedMeshProgram_uTexture, 0);
-
-			glUniform3fv(glGetUniformLocation(aBindedProgram.handle, "uAlbedo"), 1, glm::value_ptr(subMeshMaterial.albedo));
-			glUniform1i(glGetUniformLocation(aBindedProgram.handle, "useTexture"), subMeshMaterial.useTexture);
-
-			SubMesh& submesh = mesh.submeshes[i];
-			glDrawElements(GL_TRIANGLES, submesh.indices.size(), GL_UNSIGNED_INT, (void*)(u64)submesh.indexOffset);
-		}
+		PROFILE_SCOPE(this, "RenderQueueSort");
+		RenderQueue::Build(this, programIdx, passFeatures);
+		RenderQueue::Sort(this);
 	}
-}
 
-const GLuint App::CreateTexture(const bool isFloating)
-{
-	GLuint textureHandle;
-
-	GLenum internalFormat = isFloating ? GL_RGBA16F : GL_RGBA8;
-	GLenum format = GL_RGBA;
-	GLenum dataType = isFloating ? GL_FLOAT : GL_UNSIGNED_BYTE;
-
-	glGenTextures(1, &textureHandle);
-	glBindTexture(GL_TEXTURE_2D, textureHandle);
-	glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, displaySize.x, displaySize.y, 0, format, dataType, NULL);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_R, GL_CLAMP);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP);
-	glBindTexture(GL_TEXTURE_2D, 0);
-
-	return textureHandle;
+	RenderQueue::Submit(this);
 }
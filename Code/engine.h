@@ -4,8 +4,26 @@
 #pragma once
 
 #include "platform.h"
+#include "ArenaFuncs.h"
+#include "PakFuncs.h"
 #include "BufferSupFuncs.h"
 #include "ModelLoadingFuncs.h"
+#include "TextureStreamingFuncs.h"
+#include "ResourceRegistry.h"
+#include "IndirectRenderFuncs.h"
+#include "CullingFuncs.h"
+#include "InstancedRenderFuncs.h"
+#include "ProfilerFuncs.h"
+#include "ClusteredLightingFuncs.h"
+#include "RenderTargetPoolFuncs.h"
+#include "FrameGraphFuncs.h"
+#include "BloomFuncs.h"
+#include "ShaderCompilerFuncs.h"
+#include "ShaderPermutationFuncs.h"
+#include "RenderQueueFuncs.h"
+#include "GLStateFuncs.h"
+#include "JobSystemFuncs.h"
+#include "FramePipelineFuncs.h"
 #include "Globals.h"
 
 const VertexV3V2 vertices[] = {
@@ -21,31 +39,22 @@ const u16 indices[] =
     0,2,3
 };
 
-struct Bloom 
-{
-    GLuint rtBright; // For blitting brightest pixels and vertical blur
-    GLuint rtBloomH; // For first pass horizontal blur
-    FrameBuffer fbBloom1;
-    FrameBuffer fbBloom2;
-    FrameBuffer fbBloom3;
-    FrameBuffer fbBloom4;
-    FrameBuffer fbBloom5;
-};
-
 struct App
 {
     void UpdateEntityBuffer();
 
-    void ConfigureFrameBuffer(FrameBuffer& aConfig);
+    // Draws with the variant of the generic program matching each material plus passFeatures
+    void RenderGeometry(u32 programIdx, u32 passFeatures);
 
-    void RenderGeometry(const Program& aBindedProgram);
-
-    const GLuint CreateTexture(const bool isFloating = false);
+    void UpdateMaterialBuffer();
 
     // Loop
     f32  deltaTime;
     bool isRunning;
 
+    JobSystemState     jobs;
+    FramePipelineState pipeline;
+
     // Input
     Input input;
 
@@ -57,22 +66,44 @@ struct App
 
     std::vector<Texture>    textures;
     std::vector<Material>   materials;
+    std::vector<MaterialDesc> materialDescs; // What each material was created from, checked on registry hits
     std::vector<Mesh>       meshes;
     std::vector<Model>      models;
+    bool                    quantizeVertices; // Imported meshes use the compact vertex layout
     std::vector<Program>    programs;
+    ShaderCompilerState     shaderCompiler;
+    ShaderPermutationState  permutations;
+    RenderQueueState        renderQueue;
+    GLStateCache            glState;
+
+    ResourceRegistry registry;
 
     // program indices
     GLuint renderToBackBufferShader;
     GLuint renderToFrameBufferShader;
     GLuint framebufferToQuadShader;
     GLuint gridRenderShader;
+    // for the indirect render path
+    GLuint renderToBackBufferIndirectShader;
+    GLuint renderToFrameBufferIndirectShader;
+    // for the instanced render path
+    GLuint renderToBackBufferInstancedShader;
+    GLuint renderToFrameBufferInstancedShader;
+    // for the packed G-buffer layout
+    GLuint renderToFrameBufferPackedShader;
+    GLuint renderToFrameBufferIndirectPackedShader;
+    GLuint renderToFrameBufferInstancedPackedShader;
+    GLuint framebufferToQuadPackedShader;
+    // for clustered lighting
+    GLuint clusterLightsShader;
+    GLuint framebufferToQuadClusteredShader;
+    GLuint framebufferToQuadPackedClusteredShader;
     // for bloom
     GLuint blitBrightestPixelsShader;
     GLuint blurShader;
     GLuint bloomShader;
+    GLuint blurComputeShader;
 
-    GLuint texturedMeshProgram_uTexture;
-    
     // texture indices
     u32 diceTexIdx;
     u32 whiteTexIdx;
@@ -80,8 +111,18 @@ struct App
     u32 normalTexIdx;
     u32 magentaTexIdx;
 
+    TextureStreamingQueue textureQueue;
+
     // Mode
     Mode mode;
+    RenderPath renderPath;
+
+    IndirectRenderState indirect;
+    InstancedRenderState instanced;
+    CullingState culling;
+    ClusteredLightingState clusteredLighting;
+
+    ProfilerState profiler;
 
     // Embedded geometry (in-editor simple meshes such as
     // a screen filling quad, a cube, a sphere...)
@@ -98,30 +139,58 @@ struct App
 
     GLint maxUniformBufferSize;
     GLint uniformBlockAligment;
-    Buffer localUniformBuffer;
+    RingBuffer uniformRing;
+    Buffer materialUniformBuffer;
+    u32 materialBufferCount;
     std::vector<Entity> entities;
     std::vector<Light> lights;
 
+    GLuint globalParamsBuffer;
     GLuint globalParamsOffset;
     GLuint globalParamsSize;
 
     FrameBuffer deferredFrameBuffer;
+    GBufferLayout gbufferLayout;
+    RenderTargetPoolState renderTargets;
+    FrameGraphState frameGraph;
 
-    Bloom bloom;
+    BloomState bloom;
 
     Camera camera;
 };
 
+// Loads a program once per file, name and permutation features
+u32 LoadProgram(App* app, const char* filepath, const char* programName, bool isCompute = false, u32 features = SHADER_FEATURES_GENERIC);
+
+// Vertex attributes and uniforms of a linked program
+void ReflectProgram(Program& program);
+
+// Assigns sampler units and caches uniform locations, again after any program is reloaded
+void ConfigurePrograms(App* app);
+
+GLint GetUniformLocation(const Program& program, const char* name);
+
+void SetProgramSampler(const Program& program, const char* name, GLint textureUnit);
+
+GLuint FindVAO(Mesh& mesh, u32 submeshIndex, const Program& program);
+
 void Init(App* app);
 
 void Gui(App* app);
 
+void Shutdown(App* app);
+
 void Update(App* app);
 
 void Render(App* app);
 
-void UpdateCamera(App* app);
+// Moves the camera from the input, on the simulation step
+void UpdateCamera(Camera& camera, Input& input, f32 deltaTime);
+
+void BuildForwardGraph(App* app, FrameGraphState& graph);
 
-void InitBloomEffect(App* app);
+// The lighting pass writes output, the back buffer or a target for post effects
+void BuildDeferredGraph(App* app, FrameGraphState& graph, FrameGraphResource output);
 
-void PassBlitBrightPixels(App* app);
\ No newline at end of file
+// The direct and instanced paths draw with permutations of their program, passFeatures selects the ones of the pass
+void RenderSceneGeometry(App* app, GLuint directProgramIdx, GLuint indirectProgramIdx, GLuint instancedProgramIdx, u32 passFeatures);
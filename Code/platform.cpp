@@ -12,6 +12,8 @@
 #else
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
 #include <unistd.h>
 #endif
 
@@ -25,9 +27,8 @@
 #define WINDOW_WIDTH  800
 #define WINDOW_HEIGHT 600
 
-#define GLOBAL_FRAME_ARENA_SIZE MB(16)
-u8* GlobalFrameArenaMemory = NULL;
-u32 GlobalFrameArenaHead = 0;
+#define GLOBAL_FRAME_ARENA_RESERVE GB(1) // Address space only, pages are committed as the frames need them
+MemoryArena GlobalFrameArena = {};
 
 void OnGlfwError(int errorCode, const char *errorMessage)
 {
@@ -112,8 +113,30 @@ void OnGlfwCloseWindow(GLFWwindow* window)
     app->isRunning = false;
 }
 
-int main()
+int main(int argc, char** argv)
 {
+    // Offline packer: Engine --pack [archive] [--compress] packs the working directory and exits
+    if (argc > 1 && strcmp(argv[1], "--pack") == 0)
+    {
+        const char* pakPath = PAK_DEFAULT_PATH;
+        bool compress = false;
+        for (int i = 2; i < argc; ++i)
+        {
+            if (strcmp(argv[i], "--compress") == 0)
+                compress = true;
+            else
+                pakPath = argv[i];
+        }
+
+        return Pak::Build(".", pakPath, compress) ? 0 : -1;
+    }
+
+    // Engine --loose-overrides lets newer loose files override the archive in release builds too
+    bool allowLooseOverrides = PAK_DEFAULT_LOOSE_OVERRIDES;
+    for (int i = 1; i < argc; ++i)
+        if (strcmp(argv[i], "--loose-overrides") == 0)
+            allowLooseOverrides = true;
+
     App app         = {};
     app.deltaTime   = 1.0f/60.0f;
     app.displaySize = ivec2(WINDOW_WIDTH, WINDOW_HEIGHT);
@@ -195,12 +218,17 @@ int main()
 
     f64 lastFrameTime = glfwGetTime();
 
-    GlobalFrameArenaMemory = (u8*)malloc(GLOBAL_FRAME_ARENA_SIZE);
+    Arena::Create(GlobalFrameArena, "Frame", GLOBAL_FRAME_ARENA_RESERVE);
+
+    // Loose files are used when there is no archive
+    Pak::Mount(PAK_DEFAULT_PATH, allowLooseOverrides);
 
     Init(&app);
 
     while (app.isRunning)
     {
+        Profiler::BeginFrame(&app);
+
         // Tell GLFW to call platform callbacks
         glfwPollEvents();
 
@@ -208,7 +236,10 @@ int main()
         ImGui_ImplOpenGL3_NewFrame();
         ImGui_ImplGlfw_NewFrame();
         ImGui::NewFrame();
-        Gui(&app);
+        {
+            PROFILE_SCOPE(&app, "Gui");
+            Gui(&app);
+        }
         ImGui::Render();
 
         // Clear input state if required by ImGui
@@ -240,7 +271,10 @@ int main()
         Render(&app);
 
         // ImGui Render
-        ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
+        {
+            PROFILE_GPU_SCOPE(&app, "ImGui");
+            ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
+        }
         if (io.ConfigFlags & ImGuiConfigFlags_ViewportsEnable) {
             GLFWwindow* backup_current_context = glfwGetCurrentContext();
             ImGui::UpdatePlatformWindows();
@@ -257,10 +291,13 @@ int main()
         lastFrameTime = currentFrameTime;
 
         // Reset frame allocator
-        GlobalFrameArenaHead = 0;
+        Arena::Reset(GlobalFrameArena);
     }
 
-    free(GlobalFrameArenaMemory);
+    Shutdown(&app);
+
+    Pak::Unmount();
+    Arena::Release(GlobalFrameArena);
 
     ImGui_ImplOpenGL3_Shutdown();
     ImGui_ImplGlfw_Shutdown();
@@ -281,34 +318,18 @@ u32 Strlen(const char* string)
 
 void* PushSize(u32 byteCount)
 {
-    ASSERT(GlobalFrameArenaHead + byteCount <= GLOBAL_FRAME_ARENA_SIZE,
-           "Trying to allocate more temp memory than available");
-
-    u8* curPtr = GlobalFrameArenaMemory + GlobalFrameArenaHead;
-    GlobalFrameArenaHead += byteCount;
-    return curPtr;
+    return Arena::Push(GlobalFrameArena, byteCount, 1);
 }
 
 void* PushBytes(const void* bytes, u32 byteCount)
 {
-    ASSERT(GlobalFrameArenaHead + byteCount <= GLOBAL_FRAME_ARENA_SIZE,
-            "Trying to allocate more temp memory than available");
-
-    u8* srcPtr = (u8*)bytes;
-    u8* curPtr = GlobalFrameArenaMemory + GlobalFrameArenaHead;
-    u8* dstPtr = GlobalFrameArenaMemory + GlobalFrameArenaHead;
-    GlobalFrameArenaHead += byteCount;
-    while (byteCount--) *dstPtr++ = *srcPtr++;
-    return curPtr;
+    return Arena::PushCopy(GlobalFrameArena, bytes, byteCount);
 }
 
 u8* PushChar(u8 c)
 {
-    ASSERT(GlobalFrameArenaHead + 1 <= GLOBAL_FRAME_ARENA_SIZE,
-            "Trying to allocate more temp memory than available");
-    u8* ptr = GlobalFrameArenaMemory + GlobalFrameArenaHead;
-    GlobalFrameArenaHead++;
-    *ptr = c;
+    u8* ptr = (u8*)Arena::Push(GlobalFrameArena, 1, 1);
+    if (ptr) *ptr = c;
     return ptr;
 }
 
@@ -351,17 +372,38 @@ String ReadTextFile(const char* filepath)
 {
     String fileText = {};
 
+    // Archive entries are never rewritten under the mapping, copy them from it
+    FileView view = {};
+    if (Pak::MapEntry(filepath, view))
+    {
+        fileText.str = (char*)PushSize(view.size + 1);
+        if (fileText.str)
+        {
+            fileText.len = (u32)view.size;
+            memcpy(fileText.str, view.data, view.size);
+            fileText.str[fileText.len] = '\0';
+        }
+
+        UnmapFile(view);
+        return fileText;
+    }
+
+    // Not mapped: the shader watcher may read a file an editor is rewriting, which a mapping turns into a
+    // SIGBUS while fread only comes back short
     FILE* file = fopen(filepath, "rb");
 
     if (file)
     {
         fseek(file, 0, SEEK_END);
-        fileText.len = ftell(file);
+        const long fileSize = ftell(file);
         fseek(file, 0, SEEK_SET);
 
-        fileText.str = (char*)PushSize(fileText.len + 1);
-        fread(fileText.str, sizeof(char), fileText.len, file);
-        fileText.str[fileText.len] = '\0';
+        fileText.str = fileSize >= 0 ? (char*)PushSize((u32)fileSize + 1) : NULL;
+        if (fileText.str)
+        {
+            fileText.len = fread(fileText.str, sizeof(char), fileSize, file);
+            fileText.str[fileText.len] = '\0';
+        }
 
         fclose(file);
     }
@@ -373,7 +415,150 @@ String ReadTextFile(const char* filepath)
     return fileText;
 }
 
+bool MapFile(const char* filepath, FileView& view)
+{
+    view = {};
+
+    if (Pak::MapEntry(filepath, view))
+        return true;
+
+#ifdef _WIN32
+    HANDLE file = CreateFileA(filepath, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE)
+        return false;
+
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(file, &fileSize))
+    {
+        CloseHandle(file);
+        return false;
+    }
+
+    if (fileSize.QuadPart == 0)
+    {
+        CloseHandle(file);
+        return true;
+    }
+
+    // The view keeps the mapping and the file open, their handles are not needed past this point
+    HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    CloseHandle(file);
+    if (!mapping)
+        return false;
+
+    void* data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    CloseHandle(mapping);
+    if (!data)
+        return false;
+#else
+    const int file = open(filepath, O_RDONLY);
+    if (file == -1)
+        return false;
+
+    struct stat fileStat;
+    if (fstat(file, &fileStat) != 0)
+    {
+        close(file);
+        return false;
+    }
+
+    const u64 fileSize = (u64)fileStat.st_size;
+    if (fileSize == 0)
+    {
+        close(file);
+        return true;
+    }
+
+    // The mapping keeps its own reference to the file
+    void* data = mmap(NULL, fileSize, PROT_READ, MAP_PRIVATE, file, 0);
+    close(file);
+    if (data == MAP_FAILED)
+        return false;
+#endif
+
+    view.data = (const u8*)data;
+#ifdef _WIN32
+    view.size = (u64)fileSize.QuadPart;
+#else
+    view.size = fileSize;
+#endif
+    return true;
+}
+
+void UnmapFile(FileView& view)
+{
+    if (view.data && view.source == FileViewSource_Mapping)
+    {
+#ifdef _WIN32
+        UnmapViewOfFile(view.data);
+#else
+        munmap((void*)view.data, view.size);
+#endif
+    }
+    else if (view.source == FileViewSource_Decompressed)
+    {
+        free((void*)view.data);
+    }
+
+    view = {};
+}
+
+void AdviseFileView(const FileView& view, FileAccessHint hint, u64 offset, u64 size)
+{
+    if (!view.data || view.source == FileViewSource_Decompressed || offset >= view.size)
+        return;
+
+    if (size == 0 || offset + size > view.size)
+        size = view.size - offset;
+
+#ifdef _WIN32
+    // Windows picks its read ahead from the access pattern, only the prefetch request has an API (8.0+)
+    typedef struct { PVOID VirtualAddress; SIZE_T NumberOfBytes; } PrefetchRange;
+    typedef BOOL (WINAPI *PrefetchVirtualMemoryProc)(HANDLE process, ULONG_PTR entryCount, PrefetchRange* entries, ULONG flags);
+    static PrefetchVirtualMemoryProc PrefetchVirtualMemory = (PrefetchVirtualMemoryProc)GetProcAddress(GetModuleHandleA("kernel32.dll"), "PrefetchVirtualMemory");
+
+    if (hint == FileAccess_WillNeed && PrefetchVirtualMemory)
+    {
+        PrefetchRange range = { (PVOID)(view.data + offset), (SIZE_T)size };
+        PrefetchVirtualMemory(GetCurrentProcess(), 1, &range, 0);
+    }
+#else
+    // madvise works on whole pages
+    const u64 pageSize = (u64)sysconf(_SC_PAGESIZE);
+    const u64 pageOffset = offset & ~(pageSize - 1);
+    const int advice = hint == FileAccess_Sequential ? MADV_SEQUENTIAL : hint == FileAccess_Random ? MADV_RANDOM : MADV_WILLNEED;
+    madvise((void*)(view.data + pageOffset), size + (offset - pageOffset), advice);
+#endif
+}
+
+void PrefetchFile(const char* filepath)
+{
+    if (Pak::PrefetchEntry(filepath))
+        return;
+
+#ifdef _WIN32
+    // No hint by path on Windows, AdviseFileView(FileAccess_WillNeed) prefetches once the file is mapped
+    (void)filepath;
+#else
+    const int file = open(filepath, O_RDONLY);
+    if (file == -1)
+        return;
+
+    posix_fadvise(file, 0, 0, POSIX_FADV_WILLNEED);
+    close(file);
+#endif
+}
+
 u64 GetFileLastWriteTimestamp(const char* filepath)
+{
+    u64 timestamp = 0;
+    if (Pak::GetEntryTimestamp(filepath, timestamp))
+        return timestamp;
+
+    return GetLooseFileLastWriteTimestamp(filepath);
+}
+
+u64 GetLooseFileLastWriteTimestamp(const char* filepath)
 {
 #ifdef _WIN32
     union Filetime2u64 {
@@ -397,6 +582,18 @@ u64 GetFileLastWriteTimestamp(const char* filepath)
     return 0;
 }
 
+u64 HashBytes(const void* data, u32 byteCount, u64 seed)
+{
+    const u8* bytes = (const u8*)data;
+    u64 hash = seed;
+    while (byteCount--)
+    {
+        hash ^= *bytes++;
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
 void LogString(const char* str)
 {
 #ifdef _WIN32
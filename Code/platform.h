@@ -15,6 +15,7 @@
 
 #pragma warning(disable : 4267) // conversion from X to Y, possible loss of data
 
+// The string functions allocate from the frame arena, reset every frame. Main thread only.
 String MakeString(const char *cstr);
 
 String MakePath(String dir, String filename);
@@ -27,12 +28,69 @@ String GetDirectoryPart(String path);
  */
 String ReadTextFile(const char *filepath);
 
+enum FileViewSource
+{
+    FileViewSource_Mapping,     // Mapped from a loose file
+    FileViewSource_Archive,     // Points into the mapping of the mounted archive
+    FileViewSource_Decompressed // Heap copy of a compressed archive entry
+};
+
+/**
+ * Read-only view of a whole file mapped in memory. The data stays valid until the
+ * view is unmapped, and it is not null terminated.
+ */
+struct FileView
+{
+    const u8*      data;
+    u64            size;
+    FileViewSource source;
+};
+
+enum FileAccessHint
+{
+    FileAccess_Sequential, // Read once from start to end, the OS can read ahead aggressively
+    FileAccess_Random,     // Read in no particular order, read ahead would be wasted
+    FileAccess_WillNeed    // Start reading the range into memory in the background now
+};
+
+/**
+ * Maps a file for reading, from the mounted archive if it holds the file. Returns
+ * false if it cannot be opened, an empty file gives an empty view. Thread safe.
+ */
+bool MapFile(const char *filepath, FileView& view);
+
+void UnmapFile(FileView& view);
+
+/**
+ * Tells the OS how a range of a mapped file will be read. A size of 0 covers the
+ * range up to the end of the file.
+ */
+void AdviseFileView(const FileView& view, FileAccessHint hint, u64 offset = 0, u64 size = 0);
+
+/**
+ * Asks the OS to start loading a file in the background, before it is opened or
+ * mapped, so the later read finds it in the page cache.
+ */
+void PrefetchFile(const char *filepath);
+
 /**
  * It retrieves a timestamp indicating the last time the file was modified.
  * Can be useful in order to check for file modifications to implement hot reloads.
  */
 u64 GetFileLastWriteTimestamp(const char *filepath);
 
+/**
+ * Same as GetFileLastWriteTimestamp, ignoring the mounted archive. Returns 0 when
+ * there is no loose file.
+ */
+u64 GetLooseFileLastWriteTimestamp(const char *filepath);
+
+/**
+ * Computes a 64-bit FNV-1a hash of a block of memory. The seed allows chaining
+ * several blocks into a single hash (pass the previous result as the seed).
+ */
+u64 HashBytes(const void* data, u32 byteCount, u64 seed = 14695981039346656037ull);
+
 /**
  * It logs a string to whichever outputs are configured in the platform layer.
  * By default, the string is printed in the output console of VisualStudio.
@@ -16,21 +16,23 @@ void main()
 #elif defined(FRAGMENT) ///////////////////////////////////////////////
 
 in vec2 vTexCoord;
-uniform sampler2D colorMap;
+uniform sampler2D uScene;
+uniform sampler2D colorMap; // Blurred bright pixels, one level per blur size
 uniform int maxLod;
+uniform float uIntensity;
 layout(location = 0) out vec4 oColor;
 
 void main()
 {
-    oColor = vec4(0.0);
+    vec3 bloom = vec3(0.0);
 
     for(int lod = 0; lod < maxLod; ++lod)
     {
-        oColor += textureLod(colorMap, vTexCoord, float(lod));
+        bloom += textureLod(colorMap, vTexCoord, float(lod)).rgb;
     }
 
-	oColor.a = 1.0;
+	oColor = vec4(texture(uScene, vTexCoord).rgb + bloom * uIntensity, 1.0);
 }
 
 #endif
-#endif
\ No newline at end of file
+#endif
@@ -1,4 +1,8 @@
-#ifdef BLUR
+// Separable Gaussian blur of one mip level. Weights come from Bloom::UpdateKernel.
+#if defined(BLUR) || defined(BLUR_COMPUTE)
+
+#define KERNEL_RADIUS 12                    // BLOOM_KERNEL_RADIUS
+#define LINEAR_TAPS (KERNEL_RADIUS / 2 + 1) // BLOOM_LINEAR_TAPS
 
 #if defined(VERTEX) ///////////////////////////////////////////////////
 
@@ -18,38 +22,72 @@ void main()
 uniform sampler2D colorMap;
 uniform vec2 direction;
 uniform int inputLod;
+uniform float uOffsets[LINEAR_TAPS]; // Texels from the center, between two discrete taps
+uniform float uWeights[LINEAR_TAPS];
 
 in vec2 vTexCoord;
 layout(location = 0) out vec4 oColor;
 
 void main()
 {
-    vec2 texSize = textureSize(colorMap, inputLod);
-    vec2 texelSize = 1.0/texSize;
-    vec2 margin1 = texelSize * 0.5;
-    vec2 margin2 = vec2(1.0) - margin1;
-
-	oColor = vec4(0.0);
-
-    vec2 directionFragCoord = gl_FragCoord.xy * direction;
-    int coord = int(directionFragCoord.x + eyeDirWorldSpace.y);
-    vec2 directionTexSize = texSize * direction;
-    int size = int(directionTexSize.x + directionTexSize.y);
-    int kernelRadius = 24;
-    int kernelBegin = -min(kernelRadius, coord);
-    int kernelEnd = min(kernelRadius, size - coord);
-    float weight = 0.0;
-    for(int i = kernelBegin; i <= kernelEnd; ++i)
-    {
-        float currentWeight = smoothstep(float(kernelRadius), 0.0, float(abs(i)));
-        vec2 finalTexCoords = texCoords + i * direction * texelSize;
-        finalTexCoords = clamp(finalTexCoords, margin1, margin2);
-        oColor += textureLod(colorMap, finalTexCoord, inputLod) * currentWeight;
-        weight += currentWeight;
-    }
-
-    oColor /= weight;
+	vec2 texelSize = 1.0 / vec2(textureSize(colorMap, inputLod));
+
+	// Bilinear fetches between texel pairs, so 2 * KERNEL_RADIUS + 1 taps take LINEAR_TAPS * 2 - 1 fetches
+	vec3 color = textureLod(colorMap, vTexCoord, inputLod).rgb * uWeights[0];
+	for (int i = 1; i < LINEAR_TAPS; ++i)
+	{
+		vec2 offset = direction * texelSize * uOffsets[i];
+		color += textureLod(colorMap, vTexCoord + offset, inputLod).rgb * uWeights[i];
+		color += textureLod(colorMap, vTexCoord - offset, inputLod).rgb * uWeights[i];
+	}
+
+	oColor = vec4(color, 1.0);
 }
 
+#elif defined(COMPUTE) ////////////////////////////////////////////////
+
+#define TILE_SIZE 128 // BLOOM_COMPUTE_TILE
+
+layout(local_size_x = TILE_SIZE) in;
+
+uniform sampler2D colorMap;
+uniform int inputLod;
+uniform ivec2 uDirection;
+uniform float uKernel[KERNEL_RADIUS + 1];
+
+layout(binding = 0, rgba16f) writeonly uniform image2D uOutput;
+
+// A tile of the row (or column) plus the texels the kernel reaches past both ends
+shared vec3 sTile[TILE_SIZE + 2 * KERNEL_RADIUS];
+
+void main()
+{
+	ivec2 size = textureSize(colorMap, inputLod);
+	ivec2 across = ivec2(1) - uDirection;
+	int lineLength = size.x * uDirection.x + size.y * uDirection.y;
+	int line = int(gl_WorkGroupID.y);
+	int tileStart = int(gl_WorkGroupID.x) * TILE_SIZE;
+	int local = int(gl_LocalInvocationID.x);
+
+	for (int i = local; i < TILE_SIZE + 2 * KERNEL_RADIUS; i += TILE_SIZE)
+	{
+		int along = clamp(tileStart + i - KERNEL_RADIUS, 0, lineLength - 1);
+		sTile[i] = texelFetch(colorMap, uDirection * along + across * line, inputLod).rgb;
+	}
+
+	barrier();
+
+	int along = tileStart + local;
+	if (along >= lineLength)
+		return;
+
+	int center = local + KERNEL_RADIUS;
+	vec3 color = sTile[center] * uKernel[0];
+	for (int i = 1; i <= KERNEL_RADIUS; ++i)
+		color += (sTile[center - i] + sTile[center + i]) * uKernel[i];
+
+	imageStore(uOutput, uDirection * along + across * line, vec4(color, 1.0));
+}
+
+#endif
 #endif
-#endif
\ No newline at end of file
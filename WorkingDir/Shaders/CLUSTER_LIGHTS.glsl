@@ -0,0 +1,131 @@
+#ifdef CLUSTER_LIGHTS
+
+#if defined(COMPUTE) //////////////////////////////////////////////////
+
+#define LOCAL_SIZE 64
+#define MAX_CLUSTER_LIGHTS 256
+
+layout(local_size_x = LOCAL_SIZE) in;
+
+struct ClusterLight
+{
+	vec4 positionRadius;
+	vec4 colorType;
+	vec4 direction;
+};
+
+layout(binding = 3, std140) uniform ClusterParams
+{
+	mat4 uClusterView;
+	mat4 uClusterInverseProjection;
+	uvec4 uClusterGrid;   // tiles x, tiles y, slices
+	uvec4 uClusterLights; // first point light, light count, max indices
+	vec4 uClusterDepth;   // near, far, slice scale, slice bias
+	vec4 uClusterScreen;  // display size
+};
+
+layout(binding = 3, std430) readonly buffer ClusterLights
+{
+	ClusterLight lights[];
+};
+
+layout(binding = 4, std430) writeonly buffer ClusterGrid
+{
+	uvec2 clusters[]; // offset, count
+};
+
+layout(binding = 5, std430) writeonly buffer ClusterLightIndices
+{
+	uint lightIndices[];
+};
+
+layout(binding = 6, std430) buffer ClusterIndexCounter
+{
+	uint indexCount;
+};
+
+shared vec3 sClusterMin;
+shared vec3 sClusterMax;
+shared uint sLightCount;
+shared uint sLightList[MAX_CLUSTER_LIGHTS];
+shared uint sIndexOffset;
+
+vec3 ScreenToView(vec2 ndc)
+{
+	vec4 view = uClusterInverseProjection * vec4(ndc, -1.0, 1.0);
+	return view.xyz / view.w;
+}
+
+// Point where the ray from the eye through p crosses the plane z = depth
+vec3 OnDepthPlane(vec3 p, float depth)
+{
+	return p * (depth / p.z);
+}
+
+void main()
+{
+	uvec3 clusterId = gl_WorkGroupID;
+	uint clusterIdx = clusterId.x + uClusterGrid.x * (clusterId.y + uClusterGrid.y * clusterId.z);
+
+	if (gl_LocalInvocationIndex == 0)
+	{
+		// Tile corners on the near plane, pushed to the slice depths (exponential, view space looks down -z)
+		vec2 tileSize = 2.0 / vec2(uClusterGrid.xy);
+		vec3 minPoint = ScreenToView(vec2(clusterId.xy) * tileSize - 1.0);
+		vec3 maxPoint = ScreenToView(vec2(clusterId.xy + 1) * tileSize - 1.0);
+
+		float sliceNear = -uClusterDepth.x * pow(uClusterDepth.y / uClusterDepth.x, float(clusterId.z) / float(uClusterGrid.z));
+		float sliceFar = -uClusterDepth.x * pow(uClusterDepth.y / uClusterDepth.x, float(clusterId.z + 1) / float(uClusterGrid.z));
+
+		vec3 minNear = OnDepthPlane(minPoint, sliceNear);
+		vec3 minFar = OnDepthPlane(minPoint, sliceFar);
+		vec3 maxNear = OnDepthPlane(maxPoint, sliceNear);
+		vec3 maxFar = OnDepthPlane(maxPoint, sliceFar);
+
+		sClusterMin = min(min(minNear, minFar), min(maxNear, maxFar));
+		sClusterMax = max(max(minNear, minFar), max(maxNear, maxFar));
+		sLightCount = 0;
+	}
+
+	barrier();
+
+	// Sphere against the cluster AABB, every thread takes a stride of the point lights
+	for (uint i = uClusterLights.x + gl_LocalInvocationIndex; i < uClusterLights.y; i += LOCAL_SIZE)
+	{
+		vec4 positionRadius = lights[i].positionRadius;
+		vec3 center = (uClusterView * vec4(positionRadius.xyz, 1.0)).xyz;
+		vec3 closest = clamp(center, sClusterMin, sClusterMax);
+		vec3 delta = closest - center;
+
+		if (dot(delta, delta) <= positionRadius.w * positionRadius.w)
+		{
+			uint slot = atomicAdd(sLightCount, 1);
+			if (slot < MAX_CLUSTER_LIGHTS)
+				sLightList[slot] = i;
+		}
+	}
+
+	barrier();
+
+	if (gl_LocalInvocationIndex == 0)
+	{
+		uint count = min(sLightCount, MAX_CLUSTER_LIGHTS);
+		uint offset = atomicAdd(indexCount, count);
+
+		// The index list is full: drop the cluster's lights rather than write out of bounds
+		if (offset + count > uClusterLights.z)
+			count = offset < uClusterLights.z ? uClusterLights.z - offset : 0;
+
+		sIndexOffset = offset;
+		sLightCount = count;
+		clusters[clusterIdx] = uvec2(offset, count);
+	}
+
+	barrier();
+
+	for (uint i = gl_LocalInvocationIndex; i < sLightCount; i += LOCAL_SIZE)
+		lightIndices[sIndexOffset + i] = sLightList[i];
+}
+
+#endif
+#endif
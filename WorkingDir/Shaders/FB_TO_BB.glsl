@@ -1,4 +1,13 @@
-#ifdef FB_TO_BB
+// Clustered variants shade every light binned by CLUSTER_LIGHTS.glsl instead of the 16 in GlobalParams
+#if defined(FB_TO_BB_CLUSTERED)
+#define FB_TO_BB
+#define LIGHTS_CLUSTERED
+#elif defined(FB_TO_BB_PACKED_CLUSTERED)
+#define FB_TO_BB_PACKED
+#define LIGHTS_CLUSTERED
+#endif
+
+#if defined(FB_TO_BB) || defined(FB_TO_BB_PACKED)
 
 #if defined(VERTEX) ///////////////////////////////////////////////////
 
@@ -27,25 +36,98 @@ layout(binding = 0, std140) uniform GlobalParams
 {
 	vec3 uCameraPosition;
 	uint uLightCount;
+	uint uDirectionalLightCount; // Directional lights come first in uLight
 	Light uLight[16];
 };
 
+#ifdef LIGHTS_CLUSTERED
+struct ClusterLight
+{
+	vec4 positionRadius;
+	vec4 colorType;
+	vec4 direction;
+};
+
+layout(binding = 3, std140) uniform ClusterParams
+{
+	mat4 uClusterView;
+	mat4 uClusterInverseProjection;
+	uvec4 uClusterGrid;   // tiles x, tiles y, slices
+	uvec4 uClusterLights; // first point light, light count, max indices
+	vec4 uClusterDepth;   // near, far, slice scale, slice bias
+	vec4 uClusterScreen;  // display size
+};
+
+layout(binding = 3, std430) readonly buffer ClusterLights
+{
+	ClusterLight lights[];
+};
+
+layout(binding = 4, std430) readonly buffer ClusterGrid
+{
+	uvec2 clusters[]; // offset, count
+};
+
+layout(binding = 5, std430) readonly buffer ClusterLightIndices
+{
+	uint lightIndices[];
+};
+#endif
+
 in vec2 vTexCoord;
 
 uniform sampler2D uAlbedo;
 uniform sampler2D uNormals;
+
+#ifdef FB_TO_BB_PACKED
+uniform sampler2D uSurface;
+uniform sampler2D uDepth;
+uniform mat4 uInverseViewProjection;
+
+vec3 DecodeOctahedral(vec2 f)
+{
+	f = f * 2.0 - 1.0;
+	vec3 n = vec3(f.x, f.y, 1.0 - abs(f.x) - abs(f.y));
+	float t = clamp(-n.z, 0.0, 1.0);
+	n.x += n.x >= 0.0 ? -t : t;
+	n.y += n.y >= 0.0 ? -t : t;
+	return normalize(n);
+}
+#else
 uniform sampler2D uPosition;
 uniform sampler2D uViewDir;
+#endif
 
 layout(location = 0) out vec4 oColor;
 
+vec3 vNormal;
+vec3 vPosition;
+vec3 vViewDir;
+float vAmbientOcclusion;
+
+void ReadGBuffer()
+{
+#ifdef FB_TO_BB_PACKED
+	vNormal = DecodeOctahedral(texture(uNormals, vTexCoord).xy);
+	vAmbientOcclusion = texture(uSurface, vTexCoord).b;
+
+	float depth = texture(uDepth, vTexCoord).r;
+	vec4 worldPosition = uInverseViewProjection * vec4(vec3(vTexCoord, depth) * 2.0 - 1.0, 1.0);
+	vPosition = worldPosition.xyz / worldPosition.w;
+	vViewDir = uCameraPosition - vPosition;
+#else
+	vNormal = texture(uNormals, vTexCoord).xyz;
+	vPosition = texture(uPosition, vTexCoord).xyz;
+	vViewDir = texture(uViewDir, vTexCoord).xyz;
+	vAmbientOcclusion = 1.0;
+#endif
+}
+
 void CalculateBlitVars(in Light light, out vec3 ambient, out vec3 diffuse, out vec3 specular)
 {
-	vec3 vNormal = texture(uNormals, vTexCoord).xyz;
-	vec3 vViewDir = texture(uViewDir, vTexCoord).xyz;
 	vec3 lightDir = normalize(light.direction);
 
-	float ambientStrenght = 0.2f;
+	float ambientStrenght = 0.2f * vAmbientOcclusion;
 	ambient = ambientStrenght * light.color;
 
 	float diff = max(dot(vNormal, lightDir), 0.0f);
@@ -58,48 +140,130 @@ void CalculateBlitVars(in Light light, out vec3 ambient, out vec3 diffuse, out v
 	specular = specularStrength * spec * light.color;
 }
 
+#ifdef LIGHTS_CLUSTERED
+Light ToLight(ClusterLight clusterLight)
+{
+	Light light;
+	light.type = uint(clusterLight.colorType.w);
+	light.color = clusterLight.colorType.rgb;
+	light.direction = clusterLight.direction.xyz;
+	light.position = clusterLight.positionRadius.xyz;
+	return light;
+}
+
+uint FindCluster()
+{
+	float viewDepth = max(-(uClusterView * vec4(vPosition, 1.0)).z, uClusterDepth.x);
+	uint slice = uint(max(log(viewDepth) * uClusterDepth.z - uClusterDepth.w, 0.0));
+	slice = min(slice, uClusterGrid.z - 1);
+
+	uvec2 tile = min(uvec2(vTexCoord * vec2(uClusterGrid.xy)), uClusterGrid.xy - 1);
+	return tile.x + uClusterGrid.x * (tile.y + uClusterGrid.y * slice);
+}
+
 void main()
 {
+	ReadGBuffer();
+
 	vec4 textureColor = texture(uAlbedo, vTexCoord);
-	vec4 finalColor = vec4(0.0f);
+	vec3 lightResult = vec3(0.0f);
 
-	for(int i = 0; i< uLightCount; ++i)
+	vec3 ambient = vec3(0.0f);
+	vec3 diffuse = vec3(0.0f);
+	vec3 specular = vec3(0.0f);
+
+	// Directional lights affect every cluster and are not binned
+	for(uint i = 0; i < uClusterLights.x; ++i)
 	{
-		vec3 lightResult = vec3(0.0f);
+		CalculateBlitVars(ToLight(lights[i]), ambient, diffuse, specular);
+		lightResult += ambient + diffuse + specular;
+	}
+
+	uvec2 cluster = clusters[FindCluster()];
+	for(uint i = 0; i < cluster.y; ++i)
+	{
+		ClusterLight clusterLight = lights[lightIndices[cluster.x + i]];
+		Light light = ToLight(clusterLight);
+
+		vec3 toLight = light.position - vPosition;
+		float distance = length(toLight);
+		light.direction = toLight / max(distance, 0.0001f);
+
+		// Same falloff as the unclustered path, windowed to reach zero at the radius the light was binned with
+		float attenuation = 1.0f / (1.0f + 0.09f * distance + 0.032f * distance * distance);
+		float window = clamp(1.0f - pow(distance / clusterLight.positionRadius.w, 4.0f), 0.0f, 1.0f);
+		attenuation *= window * window;
+
+		CalculateBlitVars(light, ambient, diffuse, specular);
+		lightResult += (ambient + diffuse + specular) * attenuation;
+	}
+
+	oColor = vec4(lightResult, 1.0f) * textureColor;
+}
+#else
+vec3 PointLightResult(Light light)
+{
+	vec3 ambient = vec3(0.0f);
+	vec3 diffuse = vec3(0.0f);
+	vec3 specular = vec3(0.0f);
+
+	float constant = 1.0f;
+	float linear = 0.09f;
+	float quadratic = 0.032f;
+	float distance = length(light.position - vPosition);
+	float attenuation = 1.0f / (constant + linear * distance + quadratic * pow(distance, 2));
 
-		vec3 ambient = vec3(0.0f);
-		vec3 diffuse = vec3(0.0f);
-		vec3 specular = vec3(0.0f);
+	CalculateBlitVars(light, ambient, diffuse, specular);
+
+	return (ambient * attenuation) + (diffuse * attenuation) + (specular * attenuation);
+}
+
+vec3 DirectionalLightResult(Light light)
+{
+	vec3 ambient = vec3(0.0f);
+	vec3 diffuse = vec3(0.0f);
+	vec3 specular = vec3(0.0f);
 
+	CalculateBlitVars(light, ambient, diffuse, specular);
+
+	return ambient + diffuse + specular;
+}
+
+void main()
+{
+	ReadGBuffer();
+
+	vec4 textureColor = texture(uAlbedo, vTexCoord);
+	vec3 lightResult = vec3(0.0f);
+
+#ifdef LIGHT_COUNT_BUCKET
+	// Directional lights come first, and the compile-time bound lets the compiler unroll both loops
+	for(uint i = 0; i < LIGHT_COUNT_BUCKET; ++i)
+	{
+		if(i >= uDirectionalLightCount)
+			break;
+		lightResult += DirectionalLightResult(uLight[i]);
+	}
+
+	for(uint i = uDirectionalLightCount; i < LIGHT_COUNT_BUCKET; ++i)
+	{
+		if(i >= uLightCount)
+			break;
+		lightResult += PointLightResult(uLight[i]);
+	}
+#else
+	for(int i = 0; i< uLightCount; ++i)
+	{
 		if(uLight[i].type == 0) // directional light
-		{
-			Light light = uLight[i];
-
-			CalculateBlitVars(light, ambient, diffuse, specular);
-
-			lightResult = ambient + diffuse + specular;
-			finalColor += vec4(lightResult, 1.0f) * textureColor;
-		}
-		else // point light, Todo podria ser una funcion
-		{
-			Light light = uLight[i];
-
-			float constant = 1.0f;
-			float linear = 0.09f;
-			float quadratic = 0.032f;
-			float distance = length(light.position - texture(uPosition, vTexCoord).xyz);
-			float attenuation = 1.0f / (constant + linear * distance + quadratic * pow(distance, 2));
-
-			CalculateBlitVars(light, ambient, diffuse, specular);
-
-			lightResult = (ambient * attenuation) + (diffuse * attenuation) + (specular * attenuation);
-		
-			finalColor += vec4(lightResult, 1.0) * textureColor;
-		}
+			lightResult += DirectionalLightResult(uLight[i]);
+		else // point light
+			lightResult += PointLightResult(uLight[i]);
 	}
+#endif
 
-	oColor = finalColor;
+	oColor = vec4(lightResult, 1.0f) * textureColor;
 }
+#endif
 
 #endif
 #endif
\ No newline at end of file
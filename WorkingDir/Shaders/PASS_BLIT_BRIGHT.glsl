@@ -17,18 +17,31 @@ void main()
 
 in vec2 vTexCoord;
 uniform sampler2D uTexture;
+uniform float threshold;
 layout(location = 0) out vec4 oColor;
 
-void main()
+vec3 BrightTexel(ivec2 texelCoord)
 {
     vec3 luminances = vec3(0.2126, 0.7152, 0.0722);
-    vec4 texel = texture2D(uTexture, vTexCoord);
-    float luminance = dot(luminances, texel.rgb);
+    vec3 texel = texelFetch(uTexture, texelCoord, 0).rgb;
+    float luminance = dot(luminances, texel);
     luminance = max(0.0, luminance - threshold);
-    texel.rgb *= sign(luminance);
-    texel.a = 1.0;
+    return texel * sign(luminance);
+}
+
+void main()
+{
+    // The output is half resolution and the scene target is point sampled, so each pixel averages
+    // its whole 2x2 block. A single fetch would drop 3 texels out of 4 and small highlights flicker.
+    ivec2 maxCoord = textureSize(uTexture, 0) - 1;
+    ivec2 base = ivec2(gl_FragCoord.xy) * 2;
+
+    vec3 color = BrightTexel(min(base, maxCoord));
+    color += BrightTexel(min(base + ivec2(1, 0), maxCoord));
+    color += BrightTexel(min(base + ivec2(0, 1), maxCoord));
+    color += BrightTexel(min(base + ivec2(1, 1), maxCoord));
 
-	oColor = texel;
+	oColor = vec4(color * 0.25, 1.0);
 }
 
 #endif
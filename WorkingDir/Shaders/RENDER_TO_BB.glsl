@@ -1,10 +1,17 @@
-#ifdef RENDER_TO_BB
+#if defined(RENDER_TO_BB) || defined(RENDER_TO_BB_INDIRECT) || defined(RENDER_TO_BB_INSTANCED)
 
 #if defined(VERTEX) ///////////////////////////////////////////////////
 
 layout(location = 0) in vec3 aPosition;
 layout(location = 1) in vec3 aNormal;
 layout(location = 2) in vec2 aTexCoord;
+#ifdef HAS_NORMAL_MAP
+layout(location = 3) in vec4 aTangent; // w is the handedness of the bitangent
+#endif
+
+// Per-draw constants, positions are stored relative to the submesh bounds when quantized
+layout(location = 6) in vec3 aPositionScale;
+layout(location = 7) in vec3 aPositionBias;
 
 struct Light
 {
@@ -18,28 +25,79 @@ layout(binding = 0, std140) uniform GlobalParams
 {
 	vec3 uCameraPosition;
 	uint uLightCount;
+	uint uDirectionalLightCount; // Directional lights come first in uLight
 	Light uLight[16];
 };
 
+#ifdef RENDER_TO_BB_INDIRECT
+layout(location = 5) in uint aDrawId;
+
+struct DrawParams
+{
+	mat4 worldMatrix;
+	mat4 worldViewProjectionMatrix;
+	uint materialIdx;
+};
+
+layout(binding = 0, std430) readonly buffer DrawParamsBuffer
+{
+	DrawParams uDraws[];
+};
+
+flat out uint vMaterialIdx;
+#elif defined(RENDER_TO_BB_INSTANCED)
+struct InstanceParams
+{
+	mat4 worldMatrix;
+	mat4 worldViewProjectionMatrix;
+};
+
+// The instances of the current draw, starting at the bound range
+layout(binding = 2, std430) readonly buffer InstancesBuffer
+{
+	InstanceParams uInstances[];
+};
+#else
 layout(binding = 1, std140) uniform localParams
 {
 	mat4 uWorldMatrix;
 	mat4 uWorldViewProjectionMatrix;
 };
+#endif
 
 out vec2 vTexCoord;
 out vec3 vPosition;
 out vec3 vNormal;
 out vec3 vViewDir;
+#ifdef HAS_NORMAL_MAP
+out vec3 vTangent;
+out vec3 vBitangent;
+#endif
 
 void main()
 {
+#ifdef RENDER_TO_BB_INDIRECT
+	mat4 uWorldMatrix = uDraws[aDrawId].worldMatrix;
+	mat4 uWorldViewProjectionMatrix = uDraws[aDrawId].worldViewProjectionMatrix;
+	vMaterialIdx = uDraws[aDrawId].materialIdx;
+#elif defined(RENDER_TO_BB_INSTANCED)
+	mat4 uWorldMatrix = uInstances[gl_InstanceID].worldMatrix;
+	mat4 uWorldViewProjectionMatrix = uInstances[gl_InstanceID].worldViewProjectionMatrix;
+#endif
+
+	vec3 position = aPosition * aPositionScale + aPositionBias;
+
 	vTexCoord = aTexCoord;
-	vPosition = vec3(uWorldMatrix * vec4(aPosition, 1.0));
+	vPosition = vec3(uWorldMatrix * vec4(position, 1.0));
 	vNormal = vec3(uWorldMatrix * vec4(aNormal, 0.0));
+#ifdef HAS_NORMAL_MAP
+	vec3 bitangent = cross(aNormal, aTangent.xyz) * aTangent.w;
+	vTangent = vec3(uWorldMatrix * vec4(aTangent.xyz, 0.0));
+	vBitangent = vec3(uWorldMatrix * vec4(bitangent, 0.0));
+#endif
 	vViewDir = uCameraPosition - vPosition;
 
-	gl_Position = uWorldViewProjectionMatrix * vec4(aPosition, 1.0);
+	gl_Position = uWorldViewProjectionMatrix * vec4(position, 1.0);
 }
 
 #elif defined(FRAGMENT) ///////////////////////////////////////////////
@@ -56,6 +114,7 @@ layout(binding = 0, std140) uniform GlobalParams
 {
 	vec3 uCameraPosition;
 	uint uLightCount;
+	uint uDirectionalLightCount; // Directional lights come first in uLight
 	Light uLight[16];
 };
 
@@ -63,12 +122,53 @@ in vec2 vTexCoord;
 in vec3 vPosition;
 in vec3 vNormal;
 in vec3 vViewDir;
+#ifdef HAS_NORMAL_MAP
+in vec3 vTangent;
+in vec3 vBitangent;
+
+uniform sampler2D uNormalMap;
+#endif
 
 uniform sampler2D uTexture;
-uniform vec3 uAlbedo;
-uniform int useTexture;
+
+#ifdef RENDER_TO_BB_INDIRECT
+struct MaterialParams
+{
+	vec4 albedo;
+	vec4 emissive;
+	float smoothness;
+	int useTexture;
+};
+
+layout(binding = 1, std430) readonly buffer MaterialsBuffer
+{
+	MaterialParams uMaterials[];
+};
+
+flat in uint vMaterialIdx;
+#else
+layout(binding = 2, std140) uniform MaterialParams
+{
+	vec3 uAlbedo;
+	int useTexture;
+	vec3 uEmissive;
+	float uSmoothness;
+};
+#endif
 layout(location = 0) out vec4 oColor;
 
+vec3 normal;
+
+vec3 SurfaceNormal()
+{
+#ifdef HAS_NORMAL_MAP
+	mat3 tangentToWorld = mat3(normalize(vTangent), normalize(vBitangent), normalize(vNormal));
+	return normalize(tangentToWorld * (texture(uNormalMap, vTexCoord).xyz * 2.0 - 1.0));
+#else
+	return vNormal;
+#endif
+}
+
 void CalculateBlitVars(in Light light, out vec3 ambient, out vec3 diffuse, out vec3 specular)
 {
 	vec3 lightDir = normalize(light.direction);
@@ -76,61 +176,94 @@ void CalculateBlitVars(in Light light, out vec3 ambient, out vec3 diffuse, out v
 	float ambientStrenght = 0.2f;
 	ambient = ambientStrenght * light.color;
 
-	float diff = max(dot(vNormal, lightDir), 0.0f);
+	float diff = max(dot(normal, lightDir), 0.0f);
 	diffuse = diff * light.color;
 
 	float specularStrength = 0.1f;
-	vec3 reflectDir = reflect(-lightDir, vNormal);
+	vec3 reflectDir = reflect(-lightDir, normal);
 	vec3 normalViewDir = normalize(vViewDir);
 	float spec = pow(max(dot(normalViewDir, reflectDir), 0.0f), 32);
 	specular = specularStrength * spec * light.color;
 }
 
+vec3 PointLightResult(Light light)
+{
+	vec3 ambient = vec3(0.0f);
+	vec3 diffuse = vec3(0.0f);
+	vec3 specular = vec3(0.0f);
+
+	float constant = 1.0f;
+	float linear = 0.09f;
+	float quadratic = 0.032f;
+	float distance = length(light.position - vPosition);
+	float attenuation = 1.0f / (constant + linear * distance + quadratic * pow(distance, 2));
+
+	CalculateBlitVars(light, ambient, diffuse, specular);
+
+	return (ambient * attenuation) + (diffuse * attenuation) + (specular * attenuation);
+}
+
+vec3 DirectionalLightResult(Light light)
+{
+	vec3 ambient = vec3(0.0f);
+	vec3 diffuse = vec3(0.0f);
+	vec3 specular = vec3(0.0f);
+
+	CalculateBlitVars(light, ambient, diffuse, specular);
+
+	return ambient + diffuse + specular;
+}
+
 void main()
 {
+#ifdef RENDER_TO_BB_INDIRECT
+	vec3 uAlbedo = uMaterials[vMaterialIdx].albedo.rgb;
+	int useTexture = uMaterials[vMaterialIdx].useTexture;
+#endif
+
+	normal = SurfaceNormal();
+
+#if defined(HAS_ALBEDO_TEX)
+	vec4 textureColor = texture(uTexture, vTexCoord);
+#elif defined(SHADER_PERMUTATION)
+	vec4 textureColor = vec4(uAlbedo, 1.0);
+#else
 	vec4 textureColor = vec4(uAlbedo, 1.0);
 
 	if(useTexture == 1)
 	{
 		textureColor = texture(uTexture, vTexCoord);
 	}
+#endif
 
-	vec4 finalColor = vec4(0.0f);
+	vec3 lightResult = vec3(0.0f);
 
-	for(int i = 0; i < uLightCount; ++i)
+#ifdef LIGHT_COUNT_BUCKET
+	// Directional lights come first, and the compile-time bound lets the compiler unroll both loops
+	for(uint i = 0; i < LIGHT_COUNT_BUCKET; ++i)
 	{
-		vec3 lightResult = vec3(0.0f);
-
-		vec3 ambient = vec3(0.0f);
-		vec3 diffuse = vec3(0.0f);
-		vec3 specular = vec3(0.0f);
+		if(i >= uDirectionalLightCount)
+			break;
+		lightResult += DirectionalLightResult(uLight[i]);
+	}
 
+	for(uint i = uDirectionalLightCount; i < LIGHT_COUNT_BUCKET; ++i)
+	{
+		if(i >= uLightCount)
+			break;
+		lightResult += PointLightResult(uLight[i]);
+	}
+#else
+	for(int i = 0; i < uLightCount; ++i)
+	{
 		if(uLight[i].type == 0) // directional light
-		{
-			Light light = uLight[i];
-
-			CalculateBlitVars(light, ambient, diffuse, specular);
-
-			lightResult = ambient + diffuse + specular;
-			finalColor += vec4(lightResult, 1.0f) * textureColor;
-		}
+			lightResult += DirectionalLightResult(uLight[i]);
 		else // point light
-		{
-			Light light = uLight[i];
-			float constant = 1.0f;
-			float linear = 0.09f;
-			float quadratic = 0.032f;
-			float distance = length(light.position - vPosition);
-			float attenuation = 1.0f / (constant + linear * distance + quadratic * pow(distance, 2));
-
-			CalculateBlitVars(light, ambient, diffuse, specular);
-
-			lightResult = (ambient * attenuation) + (diffuse * attenuation) + (specular * attenuation);
-			finalColor += vec4(lightResult, 1.0) * textureColor;
-		}
+			lightResult += PointLightResult(uLight[i]);
 	}
+#endif
 
-	oColor = finalColor;
+	oColor = vec4(lightResult, 1.0f) * textureColor;
 }
 
 #endif
@@ -1,10 +1,29 @@
-#ifdef RENDER_TO_FB
+// Packed G-buffer variants share the geometry path of their base variant
+#if defined(RENDER_TO_FB_PACKED) || defined(RENDER_TO_FB_INDIRECT_PACKED) || defined(RENDER_TO_FB_INSTANCED_PACKED)
+#define GBUFFER_PACKED
+#endif
+#if defined(RENDER_TO_FB_PACKED)
+#define RENDER_TO_FB
+#elif defined(RENDER_TO_FB_INDIRECT_PACKED)
+#define RENDER_TO_FB_INDIRECT
+#elif defined(RENDER_TO_FB_INSTANCED_PACKED)
+#define RENDER_TO_FB_INSTANCED
+#endif
+
+#if defined(RENDER_TO_FB) || defined(RENDER_TO_FB_INDIRECT) || defined(RENDER_TO_FB_INSTANCED)
 
 #if defined(VERTEX) ///////////////////////////////////////////////////
 
 layout(location = 0) in vec3 aPosition;
 layout(location = 1) in vec3 aNormal;
 layout(location = 2) in vec2 aTexCoord;
+#ifdef HAS_NORMAL_MAP
+layout(location = 3) in vec4 aTangent; // w is the handedness of the bitangent
+#endif
+
+// Per-draw constants, positions are stored relative to the submesh bounds when quantized
+layout(location = 6) in vec3 aPositionScale;
+layout(location = 7) in vec3 aPositionBias;
 
 struct Light
 {
@@ -18,28 +37,79 @@ layout(binding = 0, std140) uniform GlobalParams
 {
 	vec3 uCameraPosition;
 	uint uLightCount;
+	uint uDirectionalLightCount; // Directional lights come first in uLight
 	Light uLight[16];
 };
 
+#ifdef RENDER_TO_FB_INDIRECT
+layout(location = 5) in uint aDrawId;
+
+struct DrawParams
+{
+	mat4 worldMatrix;
+	mat4 worldViewProjectionMatrix;
+	uint materialIdx;
+};
+
+layout(binding = 0, std430) readonly buffer DrawParamsBuffer
+{
+	DrawParams uDraws[];
+};
+
+flat out uint vMaterialIdx;
+#elif defined(RENDER_TO_FB_INSTANCED)
+struct InstanceParams
+{
+	mat4 worldMatrix;
+	mat4 worldViewProjectionMatrix;
+};
+
+// The instances of the current draw, starting at the bound range
+layout(binding = 2, std430) readonly buffer InstancesBuffer
+{
+	InstanceParams uInstances[];
+};
+#else
 layout(binding = 1, std140) uniform localParams
 {
 	mat4 uWorldMatrix;
 	mat4 uWorldViewProjectionMatrix;
 };
+#endif
 
 out vec2 vTexCoord;
 out vec3 vPosition;
 out vec3 vNormal;
 out vec3 vViewDir;
+#ifdef HAS_NORMAL_MAP
+out vec3 vTangent;
+out vec3 vBitangent;
+#endif
 
 void main()
 {
+#ifdef RENDER_TO_FB_INDIRECT
+	mat4 uWorldMatrix = uDraws[aDrawId].worldMatrix;
+	mat4 uWorldViewProjectionMatrix = uDraws[aDrawId].worldViewProjectionMatrix;
+	vMaterialIdx = uDraws[aDrawId].materialIdx;
+#elif defined(RENDER_TO_FB_INSTANCED)
+	mat4 uWorldMatrix = uInstances[gl_InstanceID].worldMatrix;
+	mat4 uWorldViewProjectionMatrix = uInstances[gl_InstanceID].worldViewProjectionMatrix;
+#endif
+
+	vec3 position = aPosition * aPositionScale + aPositionBias;
+
 	vTexCoord = aTexCoord;
-	vPosition = vec3(uWorldMatrix * vec4(aPosition, 1.0));
+	vPosition = vec3(uWorldMatrix * vec4(position, 1.0));
 	vNormal = vec3(uWorldMatrix * vec4(aNormal, 0.0));
+#ifdef HAS_NORMAL_MAP
+	vec3 bitangent = cross(aNormal, aTangent.xyz) * aTangent.w;
+	vTangent = vec3(uWorldMatrix * vec4(aTangent.xyz, 0.0));
+	vBitangent = vec3(uWorldMatrix * vec4(bitangent, 0.0));
+#endif
 	vViewDir = uCameraPosition - vPosition;
 
-	gl_Position = uWorldViewProjectionMatrix * vec4(aPosition, 1.0);
+	gl_Position = uWorldViewProjectionMatrix * vec4(position, 1.0);
 };
 
 #elif defined(FRAGMENT) ///////////////////////////////////////////////
@@ -56,6 +126,7 @@ layout(binding = 0, std140) uniform GlobalParams
 {
 	vec3 uCameraPosition;
 	uint uLightCount;
+	uint uDirectionalLightCount; // Directional lights come first in uLight
 	Light uLight[16];
 };
 
@@ -63,28 +134,105 @@ in vec2 vTexCoord;
 in vec3 vPosition;
 in vec3 vNormal;
 in vec3 vViewDir;
+#ifdef HAS_NORMAL_MAP
+in vec3 vTangent;
+in vec3 vBitangent;
+
+uniform sampler2D uNormalMap;
+#endif
 
 uniform sampler2D uTexture;
-uniform vec3 uAlbedo;
-uniform int useTexture;
 
+#ifdef RENDER_TO_FB_INDIRECT
+struct MaterialParams
+{
+	vec4 albedo;
+	vec4 emissive;
+	float smoothness;
+	int useTexture;
+};
+
+layout(binding = 1, std430) readonly buffer MaterialsBuffer
+{
+	MaterialParams uMaterials[];
+};
+
+flat in uint vMaterialIdx;
+#else
+layout(binding = 2, std140) uniform MaterialParams
+{
+	vec3 uAlbedo;
+	int useTexture;
+	vec3 uEmissive;
+	float uSmoothness;
+};
+#endif
+
+#ifdef GBUFFER_PACKED
+layout(location = 0) out vec4 oAlbedo;
+layout(location = 1) out vec2 oNormal;  // Octahedral, remapped to [0, 1]
+layout(location = 2) out vec4 oSurface; // Metallic, roughness, ambient occlusion
+
+vec2 OctWrap(vec2 v)
+{
+	return (1.0 - abs(v.yx)) * vec2(v.x >= 0.0 ? 1.0 : -1.0, v.y >= 0.0 ? 1.0 : -1.0);
+}
+
+vec2 EncodeOctahedral(vec3 n)
+{
+	n /= abs(n.x) + abs(n.y) + abs(n.z);
+	n.xy = n.z >= 0.0 ? n.xy : OctWrap(n.xy);
+	return n.xy * 0.5 + 0.5;
+}
+#else
 layout(location = 0) out vec4 oAlbedo;
 layout(location = 1) out vec4 oNormal;
 layout(location = 2) out vec4 oPosition;
 layout(location = 3) out vec4 oViewDir;
+#endif
+
+vec3 SurfaceNormal()
+{
+#ifdef HAS_NORMAL_MAP
+	mat3 tangentToWorld = mat3(normalize(vTangent), normalize(vBitangent), normalize(vNormal));
+	return normalize(tangentToWorld * (texture(uNormalMap, vTexCoord).xyz * 2.0 - 1.0));
+#else
+	return vNormal;
+#endif
+}
 
 void main()
 {
+#ifdef RENDER_TO_FB_INDIRECT
+	vec3 uAlbedo = uMaterials[vMaterialIdx].albedo.rgb;
+	int useTexture = uMaterials[vMaterialIdx].useTexture;
+	float uSmoothness = uMaterials[vMaterialIdx].smoothness;
+#endif
+
+#if defined(HAS_ALBEDO_TEX)
+	oAlbedo = texture(uTexture, vTexCoord);
+#elif defined(SHADER_PERMUTATION)
+	oAlbedo = vec4(uAlbedo, 1.0);
+#else
 	oAlbedo = vec4(uAlbedo, 1.0);
 
 	if(useTexture == 1)
 	{
 		oAlbedo = texture(uTexture, vTexCoord);
 	}
+#endif
+
+	vec3 normal = SurfaceNormal();
 
-	oNormal = vec4(vNormal, 1.0);
+#ifdef GBUFFER_PACKED
+	// Position and view direction are reconstructed from depth in FB_TO_BB_PACKED
+	oNormal = EncodeOctahedral(normalize(normal));
+	oSurface = vec4(0.0, 1.0 - uSmoothness, 1.0, 1.0);
+#else
+	oNormal = vec4(normal, 1.0);
 	oPosition = vec4(vPosition, 1.0);
 	oViewDir = vec4(vViewDir, 1.0);
+#endif
 }
 
 #endif